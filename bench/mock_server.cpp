@@ -0,0 +1,340 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        bench/mock_server.cpp
+// Purpose:     Local stand-in for the download archive, for offline benchmarks
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "mock_server.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    bool SendAll(int socket, const char *data, size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t sent = send(socket, data, size, MSG_NOSIGNAL);
+            if (sent <= 0)
+            {
+                return false;
+            }
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    //%41 -> A. Anything else is passed through.
+    std::string UrlDecode(const std::string &s)
+    {
+        std::string out;
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            if (s[i] == '%' && i + 2 < s.size() && isxdigit((unsigned char)s[i + 1]) && isxdigit((unsigned char)s[i + 2]))
+            {
+                out += (char)std::stoi(s.substr(i + 1, 2), nullptr, 16);
+                i += 2;
+            }
+            else
+            {
+                out += s[i];
+            }
+        }
+        return out;
+    }
+
+    std::string Header(const std::string &request, const std::string &name)
+    {
+        std::istringstream lines(request);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            if (line.size() > name.size() && line[name.size()] == ':' && strncasecmp(line.c_str(), name.c_str(), name.size()) == 0)
+            {
+                std::string value = line.substr(name.size() + 1);
+                value.erase(0, value.find_first_not_of(" \t"));
+                value.erase(value.find_last_not_of(" \t\r") + 1);
+                return value;
+            }
+        }
+        return "";
+    }
+
+    std::string StatusOnly(int status, const std::string &text, bool keepAlive)
+    {
+        return "HTTP/1.1 " + std::to_string(status) + " " + text + "\r\nContent-Length: 0\r\nConnection: " + (keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+    }
+}
+
+MockServer::MockServer(const mockServerConfig &config) : config(config), rng(config.seed)
+{
+    listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0)
+    {
+        throw std::runtime_error("Mock server: socket failed: " + std::string(strerror(errno)));
+    }
+    int yes = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(config.port);
+    socklen_t length = sizeof(address);
+    if (bind(listenSocket, (sockaddr *)&address, sizeof(address)) < 0 || listen(listenSocket, 64) < 0 || getsockname(listenSocket, (sockaddr *)&address, &length) < 0)
+    {
+        std::string error = strerror(errno);
+        close(listenSocket);
+        throw std::runtime_error("Mock server: could not listen on port " + std::to_string(config.port) + ": " + error);
+    }
+    port = ntohs(address.sin_port);
+    acceptThread = std::thread(&MockServer::AcceptLoop, this);
+}
+
+MockServer::~MockServer()
+{
+    Stop();
+}
+
+std::string MockServer::Url() const
+{
+    return "http://127.0.0.1:" + std::to_string(port) + "/";
+}
+
+void MockServer::Stop()
+{
+    if (stopping.exchange(true))
+    {
+        return;
+    }
+    // shutdown() wakes the blocked accept() and recv() calls.
+    shutdown(listenSocket, SHUT_RDWR);
+    acceptThread.join();
+    close(listenSocket);
+    std::vector<std::thread> running;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int client : clients)
+        {
+            shutdown(client, SHUT_RDWR);
+        }
+        running.swap(workers);
+    }
+    for (std::thread &worker : running)
+    {
+        worker.join();
+    }
+}
+
+bool MockServer::Roll(int percent)
+{
+    if (percent <= 0)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    return (int)(rng() % 100) < percent;
+}
+
+void MockServer::AcceptLoop()
+{
+    while (!stopping)
+    {
+        int client = accept(listenSocket, nullptr, nullptr);
+        if (client < 0)
+        {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping)
+        {
+            close(client);
+            break;
+        }
+        clients.push_back(client);
+        workers.emplace_back(&MockServer::Serve, this, client);
+    }
+}
+
+void MockServer::Serve(int client)
+{
+    std::string buffer;
+    std::vector<char> chunk(64 * 1024);
+    bool keepAlive = true;
+    while (keepAlive && !stopping)
+    {
+        // Read one request head. Bodies are never expected, only GET and HEAD are served.
+        size_t end;
+        while ((end = buffer.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t received = recv(client, chunk.data(), chunk.size(), 0);
+            if (received <= 0)
+            {
+                keepAlive = false;
+                break;
+            }
+            buffer.append(chunk.data(), received);
+        }
+        if (!keepAlive)
+        {
+            break;
+        }
+        std::string request = buffer.substr(0, end + 2);
+        buffer.erase(0, end + 4);
+        stats.requests++;
+
+        std::istringstream requestLine(request);
+        std::string method, target, version;
+        requestLine >> method >> target >> version;
+        keepAlive = version == "HTTP/1.1" ? strcasecmp(Header(request, "Connection").c_str(), "close") != 0 : strcasecmp(Header(request, "Connection").c_str(), "keep-alive") == 0;
+
+        if (config.latencyMs > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(config.latencyMs));
+        }
+        if (method != "GET" && method != "HEAD")
+        {
+            std::string response = StatusOnly(405, "Method Not Allowed", false);
+            SendAll(client, response.data(), response.size());
+            break;
+        }
+        if (Roll(config.failPercent))
+        {
+            stats.failed++;
+            std::string response = StatusOnly(503, "Service Unavailable", keepAlive);
+            keepAlive = SendAll(client, response.data(), response.size()) && keepAlive;
+            continue;
+        }
+
+        std::string path = UrlDecode(target.substr(0, target.find('?')));
+        std::filesystem::path file;
+        if (path.find("..") == std::string::npos)
+        {
+            for (const std::string &root : config.roots)
+            {
+                std::error_code ec;
+                if (std::filesystem::is_regular_file(root + path, ec))
+                {
+                    file = root + path;
+                    break;
+                }
+            }
+        }
+        if (file.empty())
+        {
+            std::string response = StatusOnly(404, "Not Found", keepAlive);
+            keepAlive = SendAll(client, response.data(), response.size()) && keepAlive;
+            continue;
+        }
+
+        // Single ranges only: bytes=a-b, bytes=a- and bytes=-n. The ETag is the size and modified time, so a file replaced mid-download gets a new one.
+        int64_t size = (int64_t)std::filesystem::file_size(file);
+        int64_t first = 0, last = size - 1;
+        bool partial = false;
+        std::error_code ec;
+        std::string etag = "\"" + std::to_string(size) + "-" + std::to_string(std::filesystem::last_write_time(file, ec).time_since_epoch().count()) + "\"";
+        std::string match = Header(request, "If-Match");
+        if (!match.empty() && match != etag && match != "*")
+        {
+            std::string response = StatusOnly(412, "Precondition Failed", keepAlive);
+            keepAlive = SendAll(client, response.data(), response.size()) && keepAlive;
+            continue;
+        }
+        std::string range = Header(request, "Range");
+        std::string ifRange = Header(request, "If-Range");
+        if (range.rfind("bytes=", 0) == 0 && (ifRange.empty() || ifRange == etag) && range.find(',') == std::string::npos)
+        {
+            std::string spec = range.substr(6);
+            size_t dash = spec.find('-');
+            try
+            {
+                if (dash == 0)
+                {
+                    first = std::max<int64_t>(0, size - std::stoll(spec.substr(1)));
+                }
+                else
+                {
+                    first = std::stoll(spec.substr(0, dash));
+                    if (dash + 1 < spec.size())
+                    {
+                        last = std::min(last, (int64_t)std::stoll(spec.substr(dash + 1)));
+                    }
+                }
+                partial = true;
+            }
+            catch (std::exception &)
+            {
+                partial = false;
+                first = 0;
+            }
+            if (partial && (first > last || first >= size))
+            {
+                std::string response = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" + std::to_string(size) + "\r\nContent-Length: 0\r\n\r\n";
+                keepAlive = SendAll(client, response.data(), response.size()) && keepAlive;
+                continue;
+            }
+        }
+        int64_t length = last - first + 1;
+        std::string head = std::string("HTTP/1.1 ") + (partial ? "206 Partial Content" : "200 OK") + "\r\nContent-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\nETag: " + etag + "\r\nContent-Length: " + std::to_string(length) + "\r\n";
+        if (partial)
+        {
+            head += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(size) + "\r\n";
+        }
+        head += std::string("Connection: ") + (keepAlive ? "keep-alive" : "close") + "\r\n\r\n";
+        if (!SendAll(client, head.data(), head.size()))
+        {
+            break;
+        }
+        if (method == "HEAD")
+        {
+            continue;
+        }
+
+        // Stream the body, sleeping as needed to stay under the bandwidth cap.
+        int64_t stopAt = Roll(config.dropPercent) ? length / 2 : length;
+        std::ifstream in(file, std::ios::binary);
+        in.seekg(first);
+        int64_t sent = 0;
+        auto start = std::chrono::steady_clock::now();
+        size_t step = config.bandwidth > 0 ? (size_t)std::clamp<int64_t>(config.bandwidth / 20, 1024, chunk.size()) : chunk.size();
+        while (sent < stopAt && !stopping)
+        {
+            size_t n = (size_t)std::min<int64_t>(step, stopAt - sent);
+            in.read(chunk.data(), n);
+            if ((size_t)in.gcount() != n || !SendAll(client, chunk.data(), n))
+            {
+                keepAlive = false;
+                break;
+            }
+            sent += n;
+            stats.bytes += n;
+            if (config.bandwidth > 0)
+            {
+                auto due = start + std::chrono::microseconds(sent * 1000000 / config.bandwidth);
+                std::this_thread::sleep_until(due);
+            }
+        }
+        if (stopAt < length)
+        {
+            stats.dropped++;
+            keepAlive = false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    clients.erase(std::remove(clients.begin(), clients.end(), client), clients.end());
+    close(client);
+}
@@ -0,0 +1,69 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        bench/mock_server.h
+// Purpose:     Local stand-in for the download archive, for offline benchmarks
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct mockServerConfig
+{
+    std::vector<std::string> roots; //Folders served at "/". The first one with the file wins, so a ROM and a CHD folder can share the URL space like the archive does.
+    int port = 0; //0 picks a free port.
+    int latencyMs = 0; //Delay before each response.
+    int64_t bandwidth = 0; //Bytes per second per connection. 0 is unlimited.
+    int failPercent = 0; //Requests answered with a 503.
+    int dropPercent = 0; //Responses cut off half way through the body.
+    unsigned seed = 1; //Same seed, same failures.
+};
+
+struct mockServerStats
+{
+    std::atomic<int64_t> requests{0};
+    std::atomic<int64_t> bytes{0}; //Body bytes sent.
+    std::atomic<int64_t> failed{0}; //503s injected.
+    std::atomic<int64_t> dropped{0}; //Connections cut injected.
+};
+
+/*
+*A small HTTP/1.1 server for GET and HEAD with keep-alive and single Range requests. One thread per connection.
+*POSIX sockets only, so it is not built on Windows.
+*/
+class MockServer
+{
+public:
+    /*Start listening on 127.0.0.1. Throws if the socket can't be opened.*/
+    explicit MockServer(const mockServerConfig &config);
+    ~MockServer();
+
+    /*http://127.0.0.1:port/*/
+    std::string Url() const;
+    int Port() const { return port; }
+    const mockServerStats &Stats() const { return stats; }
+
+    /*Stop accepting, cut open connections and join every thread. Called by the destructor.*/
+    void Stop();
+
+private:
+    void AcceptLoop();
+    void Serve(int client);
+    bool Roll(int percent);
+
+    mockServerConfig config;
+    mockServerStats stats;
+    int listenSocket = -1;
+    int port = 0;
+    std::atomic<bool> stopping{false};
+    std::thread acceptThread;
+    std::mutex mutex; //Guards clients, workers and rng.
+    std::vector<int> clients;
+    std::vector<std::thread> workers;
+    std::mt19937 rng;
+};
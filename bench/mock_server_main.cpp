@@ -0,0 +1,109 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        bench/mock_server_main.cpp
+// Purpose:     romper_mock_server. Serves a ROM/CHD tree over HTTP so an online profile can be pointed at it.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "mock_server.h"
+
+#include <csignal>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <unistd.h>
+
+namespace
+{
+    volatile std::sig_atomic_t interrupted = 0;
+}
+
+int main(int argc, char **argv)
+{
+    const std::string usage =
+        "Usage: romper_mock_server --root DIR [--root DIR...] [options]\n"
+        "  --port N             Port on 127.0.0.1 (default: any free port).\n"
+        "  --latency-ms N       Delay before each response.\n"
+        "  --bandwidth-kbps N   Per connection cap in KB/s.\n"
+        "  --fail-percent N     Answer this share of requests with a 503.\n"
+        "  --drop-percent N     Cut this share of responses off half way.\n"
+        "  --seed N             Seed for the injected failures.\n"
+        "Set an online profile's Download URL to the printed URL.\n";
+    mockServerConfig config;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (i + 1 >= argc)
+            {
+                std::cerr << usage;
+                return 2;
+            }
+            std::string value = argv[++i];
+            if (arg == "--root")
+            {
+                config.roots.push_back(value);
+            }
+            else if (arg == "--port")
+            {
+                config.port = std::stoi(value);
+            }
+            else if (arg == "--latency-ms")
+            {
+                config.latencyMs = std::stoi(value);
+            }
+            else if (arg == "--bandwidth-kbps")
+            {
+                config.bandwidth = std::stoll(value) * 1024;
+            }
+            else if (arg == "--fail-percent")
+            {
+                config.failPercent = std::stoi(value);
+            }
+            else if (arg == "--drop-percent")
+            {
+                config.dropPercent = std::stoi(value);
+            }
+            else if (arg == "--seed")
+            {
+                config.seed = std::stoul(value);
+            }
+            else
+            {
+                std::cerr << usage;
+                return 2;
+            }
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Bad number: " << e.what() << "\n" << usage;
+        return 2;
+    }
+    if (config.roots.empty())
+    {
+        std::cerr << usage;
+        return 2;
+    }
+
+    try
+    {
+        MockServer server(config);
+        std::signal(SIGINT, [](int) { interrupted = 1; });
+        std::signal(SIGTERM, [](int) { interrupted = 1; });
+        std::cout << server.Url() << std::endl;
+        while (!interrupted)
+        {
+            pause();
+        }
+        server.Stop();
+        std::cerr << "requests " << server.Stats().requests << ", bytes " << server.Stats().bytes << ", failed " << server.Stats().failed << ", dropped " << server.Stats().dropped << std::endl;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,586 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        bench/romper_bench.cpp
+// Purpose:     Benchmarks for the romper core against a synthetic catalog
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "synthetic.h"
+#ifndef _WIN32
+#include "mock_server.h"
+#endif
+#include "core/budget.h"
+#include "core/cache.h"
+#include "core/catalog.h"
+#include "core/checksum.h"
+#include "core/fatimage.h"
+#include "core/pack.h"
+#include "core/plan.h"
+#include "core/profiles.h"
+#include "core/run.h"
+#include "core/util.h"
+#include "core/verify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <wx/app.h>
+#include <wx/init.h>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace
+{
+    using benchClock = std::chrono::steady_clock;
+
+    double MsSince(benchClock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(benchClock::now() - start).count();
+    }
+
+    /*Downloads go through wxWebRequestSync, which needs wxBase initialized.*/
+    class BenchApp : public wxAppConsole
+    {
+    public:
+        virtual bool OnInit() { return true; }
+    };
+
+    //One JSON object per result, written out at the end.
+    std::vector<std::string> results;
+
+    /*Run fn iterations times and record min/median/p95/mean in milliseconds.*/
+    void Measure(const std::string &name, int iterations, const std::function<void()> &fn)
+    {
+        std::vector<double> samples;
+        fn(); //Warm up the page cache and SQLite's statement cache.
+        for (int i = 0; i < iterations; i++)
+        {
+            benchClock::time_point start = benchClock::now();
+            fn();
+            samples.push_back(MsSince(start));
+        }
+        std::sort(samples.begin(), samples.end());
+        double total = 0;
+        for (double s : samples)
+        {
+            total += s;
+        }
+        std::ostringstream out;
+        out << "{\"name\":" << JsonString(name) << ",\"unit\":\"ms\",\"iterations\":" << iterations
+            << ",\"min\":" << samples.front() << ",\"median\":" << samples[samples.size() / 2]
+            << ",\"p95\":" << samples[std::min(samples.size() - 1, samples.size() * 95 / 100)]
+            << ",\"mean\":" << total / samples.size() << "}";
+        results.push_back(out.str());
+        std::cerr << name << ": median " << samples[samples.size() / 2] << " ms" << std::endl;
+    }
+
+    /*Run files on each job count and record files/s and MB/s. target is emptied before each pass.*/
+    void MeasureTransfer(const std::string &name, const std::vector<runFile> &files, uintmax_t bytes, bool online, const std::vector<int> &jobCounts, const profile &p, const std::string &target,
+                         const gameChecksums &checksums = gameChecksums(), const downloadCache &cache = downloadCache())
+    {
+        for (int jobs : jobCounts)
+        {
+            std::filesystem::remove_all(target);
+            std::filesystem::create_directories(p.romTarget);
+            std::filesystem::create_directories(p.chdTarget);
+            std::atomic<bool> abort(false);
+            benchClock::time_point start = benchClock::now();
+            runResult result = RunFiles(files, online, jobs, abort, [](size_t, const runFile &, const std::string &) {}, checksums, cache);
+            double seconds = MsSince(start) / 1000;
+            std::string fullName = name + ".jobs_" + std::to_string(jobs);
+            int retries = 0;
+            for (const fileStats &stats : result.files)
+            {
+                retries += stats.retries;
+            }
+            std::ostringstream out;
+            out << "{\"name\":" << JsonString(fullName) << ",\"unit\":\"s\",\"seconds\":" << seconds << ",\"files\":" << files.size()
+                << ",\"failed\":" << result.failed << ",\"retries\":" << retries << ",\"bytes\":" << bytes << ",\"files_per_s\":" << files.size() / seconds
+                << ",\"mb_per_s\":" << bytes / 1048576.0 / seconds << "}";
+            results.push_back(out.str());
+            std::cerr << fullName << ": " << bytes / 1048576.0 / seconds << " MB/s, " << result.failed << " failed" << std::endl;
+        }
+        std::filesystem::remove_all(target);
+    }
+
+    /*The rows BuildGrid would show: one search page plus the profile's selection.*/
+    int GridPage(SQLite::Database &gameDB, SQLite::Database &profileDB, const std::string &profileName, const searchFilter &filter, int page)
+    {
+        std::vector<std::string> selected = SelectedGames(profileDB, profileName);
+        std::unordered_set<std::string> selectedSet(selected.begin(), selected.end());
+        int totalGames = 0;
+        std::vector<gameRow> rows = SearchGames(gameDB, filter, "Name", "ASC", 100, page, totalGames);
+        int checked = 0;
+        for (const gameRow &row : rows)
+        {
+            checked += selectedSet.count(row.name);
+        }
+        return checked;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const std::string usage =
+        "Usage: romper_bench [options]" NEWLINE
+        "  --dir DIR          Where the synthetic data is written (default romper_bench_data)." NEWLINE
+        "  --out FILE         Write the JSON results to FILE instead of stdout." NEWLINE
+        "  --games N          Games in the catalog (50000)." NEWLINE
+        "  --profiles N       Profiles (200)." NEWLINE
+        "  --selection N      Games selected in the benchmarked profile (20000)." NEWLINE
+        "  --roms N           ROM zips in the source tree (2000)." NEWLINE
+        "  --chds N           CHDs in the source tree (20)." NEWLINE
+        "  --chd-mb N         Size of each CHD in MB (16)." NEWLINE
+        "  --iterations N     Samples per latency benchmark (20)." NEWLINE
+        "  --jobs LIST        Comma separated job counts for the copy benchmark (1,2,4,8)." NEWLINE
+        "  --reuse            Keep existing synthetic data in DIR instead of regenerating it." NEWLINE
+        "  --download         Also download the source tree from a local mock server, on each job count. Not on Windows." NEWLINE
+        "  --latency-ms N     Mock server: delay before each response (0)." NEWLINE
+        "  --bandwidth-kbps N Mock server: per connection cap in KB/s (0, unlimited)." NEWLINE
+        "  --fail-percent N   Mock server: share of requests answered with a 503 (0)." NEWLINE;
+
+    std::map<std::string, std::string> options = {{"--dir", "romper_bench_data"}, {"--iterations", "20"}, {"--jobs", "1,2,4,8"}};
+    syntheticConfig config;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--reuse" || arg == "--download" || arg == "--help")
+        {
+            options[arg] = "1";
+        }
+        else if (arg.rfind("--", 0) == 0 && i + 1 < argc)
+        {
+            options[arg] = argv[++i];
+        }
+        else
+        {
+            std::cerr << usage;
+            return 2;
+        }
+    }
+    if (options.count("--help"))
+    {
+        std::cout << usage;
+        return 0;
+    }
+
+    std::vector<int> jobCounts;
+    int iterations = 1;
+    try
+    {
+        std::map<std::string, int *> ints = {{"--games", &config.games}, {"--profiles", &config.profiles}, {"--selection", &config.selection},
+                                             {"--roms", &config.roms}, {"--chds", &config.chds}, {"--chd-mb", &config.chdMB}};
+        for (auto &[name, value] : ints)
+        {
+            if (options.count(name))
+            {
+                *value = std::stoi(options[name]);
+            }
+        }
+        std::stringstream jobs(options["--jobs"]);
+        std::string job;
+        while (std::getline(jobs, job, ','))
+        {
+            jobCounts.push_back(std::max(1, std::stoi(job)));
+        }
+        iterations = std::max(1, std::stoi(options["--iterations"]));
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Bad number: " << e.what() << NEWLINE << usage;
+        return 2;
+    }
+    std::unique_ptr<wxInitializer> initializer;
+    if (options.count("--download"))
+    {
+        wxAppConsole::SetInstance(new BenchApp);
+        initializer = std::make_unique<wxInitializer>(argc, argv);
+        if (!initializer->IsOk())
+        {
+            std::cerr << "Could not initialize wxWidgets." << std::endl;
+            return 3;
+        }
+    }
+    std::string dir = std::filesystem::absolute(options["--dir"]).string();
+
+    try
+    {
+        benchClock::time_point start = benchClock::now();
+        syntheticData data;
+        if (options.count("--reuse") && std::filesystem::exists(dir + "/romper.romper"))
+        {
+            data.gameDBFile = dir + "/romper.romper";
+            data.profileDBFile = dir + "/profiles.romper";
+            data.romSource = dir + "/roms";
+            data.chdSource = dir + "/chd";
+            SQLite::Database profileDB(data.profileDBFile, SQLite::OPEN_READWRITE);
+            UpgradeProfileSchema(profileDB);
+            for (auto &[name, p] : LoadProfiles(profileDB))
+            {
+                data.profileNames.push_back(name);
+            }
+            std::sort(data.profileNames.begin(), data.profileNames.end(), [](const std::string &a, const std::string &b)
+                      { return a.size() != b.size() ? a.size() < b.size() : a < b; });
+        }
+        else
+        {
+            data = GenerateCatalog(dir, config);
+            GenerateSourceTree(dir, config, data);
+        }
+        std::cerr << "Synthetic data ready in " << MsSince(start) << " ms" << std::endl;
+        const std::string profileName = data.profileNames.at(0);
+
+        // Startup: what MyFrame does before the first grid is on screen.
+        Measure("startup", iterations, [&]()
+                {
+                    SQLite::Database gameDB(data.gameDBFile);
+                    SQLite::Database profileDB(data.profileDBFile, SQLite::OPEN_READWRITE);
+                    LoadProfiles(profileDB);
+                    CatalogValues(gameDB, "Rank");
+                    CatalogValues(gameDB, "Genre");
+                    GridPage(gameDB, profileDB, profileName, searchFilter(), 1); });
+
+        // The same with the startup cache MyFrame uses. The warm up run fills the cache.
+        std::string stamp = CatalogStamp(data.gameDBFile);
+        Measure("startup.cached", iterations, [&]()
+                {
+                    SQLite::Database gameDB(data.gameDBFile);
+                    SQLite::Database profileDB(data.profileDBFile, SQLite::OPEN_READWRITE);
+                    LoadProfiles(profileDB);
+                    CachedCatalogValues(gameDB, profileDB, stamp, "Rank");
+                    CachedCatalogValues(gameDB, profileDB, stamp, "Genre");
+                    std::vector<std::string> selected = SelectedGames(profileDB, profileName);
+                    std::unordered_set<std::string> selectedSet(selected.begin(), selected.end());
+                    int totalGames = 0;
+                    CachedSearchGames(gameDB, profileDB, stamp, searchFilter(), "Name", "ASC", 100, 1, totalGames); });
+
+        SQLite::Database gameDB(data.gameDBFile);
+        SQLite::Database profileDB(data.profileDBFile, SQLite::OPEN_READWRITE);
+
+        // Search latency per filter shape, first page as the grid shows it.
+        searchFilter all;
+        all.screenless = true;
+        searchFilter description;
+        description.value = "Dragon";
+        searchFilter name;
+        name.field = "Name";
+        name.value = "g01";
+        searchFilter excluded;
+        excluded.excludedRanks = {"", "0-20"};
+        excluded.excludedGenres = {"Casino", "Quiz", "Electromechanical", ""};
+        searchFilter combined = excluded;
+        combined.value = "Super";
+        searchFilter none;
+        none.value = "zzz";
+        std::map<std::string, searchFilter> shapes = {{"all", all}, {"description_prefix", description}, {"name_prefix", name},
+                                                      {"excluded_ranks_genres", excluded}, {"combined", combined}, {"no_match", none}};
+        for (auto &[shape, filter] : shapes)
+        {
+            Measure("search." + shape, iterations, [&]()
+                    { int totalGames; SearchGames(gameDB, filter, "Name", "ASC", 100, 1, totalGames); });
+        }
+
+        // Page flips: the whole grid refresh, early and deep into the results.
+        for (int page : {1, 2, 50, std::max(1, config.games / 100 / 2), std::max(1, config.games / 100)})
+        {
+            Measure("page_flip.page_" + std::to_string(page), iterations, [&]()
+                    { GridPage(gameDB, profileDB, profileName, all, page); });
+        }
+
+        // Bulk select: the header click on a grid page, selecting then deselecting.
+        for (int count : {100, 1000, 10000})
+        {
+            std::vector<std::string> games;
+            int totalGames;
+            for (const gameRow &row : SearchGames(gameDB, all, "Name", "DESC", count, 1, totalGames))
+            {
+                games.push_back(row.name);
+            }
+            Measure("bulk_select." + std::to_string(count), iterations, [&]()
+                    {
+                        SetGamesSelected(profileDB, profileName, games, true);
+                        SetGamesSelected(profileDB, profileName, games, false); });
+        }
+
+        // Run planning for the big profile.
+        std::map<std::string, profile> profiles = LoadProfiles(profileDB);
+        profile p = profiles.at(profileName);
+        Measure("plan_run", iterations, [&]()
+                { PlanRun(p, LoadProfileGames(profileDB, gameDB, profileName)); });
+
+        // Parent, BIOS and device closure: loading the graph once per game DB, then walking it for the big profile.
+        std::vector<gameMap> games = LoadProfileGames(profileDB, gameDB, profileName);
+        Measure("dependency_graph", iterations, [&]()
+                { LoadDependencyGraph(gameDB); });
+        dependencyGraph graph = LoadDependencyGraph(gameDB);
+        Measure("dependency_closure", iterations, [&]()
+                { DependencyClosure(graph, games); });
+
+        // Fitting the whole catalog into a card. The synthetic sources hold few sets, so every game gets a made up size, half the catalog's bytes fitting.
+        std::vector<budgetGame> candidates = BudgetCandidates(gameDB, all);
+        setSizes sizes;
+        int64_t catalogBytes = 0;
+        for (const budgetGame &game : candidates)
+        {
+            size_t hash = std::hash<std::string>()(game.name);
+            catalogBytes += sizes.zips[game.name] = 16384 + hash % (4 << 20);
+            if (!game.disk.empty())
+            {
+                catalogBytes += sizes.disks[game.name + "/" + game.disk] = (64 << 20) + hash % (512 << 20);
+            }
+        }
+        Measure("budget_sizes", iterations, [&]()
+                { LoadSetSizes(profileDB, gameDB, p, candidates, graph); });
+        for (budgetRule rule : {BUDGET_BEST_FIRST, BUDGET_MOST_POINTS})
+        {
+            Measure(rule == BUDGET_BEST_FIRST ? "budget_select.rank" : "budget_select.points", iterations, [&]()
+                    { SelectWithinBudget(candidates, sizes, graph, catalogBytes / 2, rule, FatClusterBytes(catalogBytes / 2)); });
+        }
+
+        // Copy throughput: every file in the source tree, once per job count.
+        std::vector<runFile> planned = PlanRun(p, games);
+        std::vector<size_t> present;
+        std::vector<runFile> files;
+        uintmax_t bytes = 0;
+        for (size_t i = 0; i < planned.size(); i++)
+        {
+            if (std::filesystem::exists(planned[i].source))
+            {
+                present.push_back(i);
+                files.push_back(planned[i]);
+                bytes += std::filesystem::file_size(planned[i].source);
+            }
+        }
+        // The dry run before a run: every file of the big profile stat'ed, with its checksums at hand, on the most jobs.
+        gameChecksums checksums = LoadChecksums(gameDB, games);
+        Measure("plan_transfers", iterations, [&]()
+                { PlanTransfers(profileDB, p, planned, checksums, jobCounts.back()); });
+
+        // copy is the default backend (io_uring where the kernel has it), copy_portable the std::filesystem one.
+        // Both hold spinning disks and cards to one file at a time. copy_unpaced lets every device take all the jobs.
+        MeasureTransfer("copy", files, bytes, false, jobCounts, p, dir + "/out");
+#ifndef _WIN32
+        setenv("ROMPER_COPY", "portable", 1);
+        MeasureTransfer("copy_portable", files, bytes, false, jobCounts, p, dir + "/out");
+        unsetenv("ROMPER_COPY");
+        setenv("ROMPER_DEVICE_JOBS", "1024", 1);
+        MeasureTransfer("copy_unpaced", files, bytes, false, jobCounts, p, dir + "/out");
+        unsetenv("ROMPER_DEVICE_JOBS");
+#endif
+
+        // Four profiles of one library: a run each, then one fan-out run that reads each source once and links it into the other three.
+        {
+            const int FANOUT_PROFILES = 4;
+            std::vector<std::vector<runFile>> profileFiles;
+            for (int k = 0; k < FANOUT_PROFILES; k++)
+            {
+                profile copy = p;
+                copy.romTarget = dir + "/out/" + std::to_string(k) + "/roms";
+                copy.chdTarget = dir + "/out/" + std::to_string(k) + "/chd";
+                std::vector<runFile> all = PlanRun(copy, games);
+                profileFiles.emplace_back();
+                for (size_t i : present)
+                {
+                    profileFiles.back().push_back(all[i]);
+                }
+            }
+            int jobs = jobCounts.back();
+            for (const std::string name : {"copy_profiles_separate", "copy_profiles_fanout"})
+            {
+                std::filesystem::remove_all(dir + "/out");
+                for (int k = 0; k < FANOUT_PROFILES; k++)
+                {
+                    std::filesystem::create_directories(dir + "/out/" + std::to_string(k) + "/roms");
+                    std::filesystem::create_directories(dir + "/out/" + std::to_string(k) + "/chd");
+                }
+                std::atomic<bool> abort(false);
+                benchClock::time_point start = benchClock::now();
+                int failed = 0;
+                if (name == "copy_profiles_fanout")
+                {
+                    failed = RunFiles(FanOutFiles(profileFiles).files, false, jobs, abort, nullptr).failed;
+                }
+                else
+                {
+                    for (const std::vector<runFile> &planned : profileFiles)
+                    {
+                        failed += RunFiles(planned, false, jobs, abort, nullptr).failed;
+                    }
+                }
+                double seconds = MsSince(start) / 1000;
+                std::string fullName = name + ".jobs_" + std::to_string(jobs);
+                std::ostringstream out;
+                out << "{\"name\":" << JsonString(fullName) << ",\"unit\":\"s\",\"seconds\":" << seconds << ",\"profiles\":" << FANOUT_PROFILES << ",\"files\":" << files.size() * FANOUT_PROFILES
+                    << ",\"failed\":" << failed << ",\"bytes\":" << bytes * FANOUT_PROFILES << ",\"mb_per_s\":" << bytes * FANOUT_PROFILES / 1048576.0 / seconds << "}";
+                results.push_back(out.str());
+                std::cerr << fullName << ": " << bytes * FANOUT_PROFILES / 1048576.0 / seconds << " MB/s, " << failed << " failed" << std::endl;
+            }
+            std::filesystem::remove_all(dir + "/out");
+        }
+
+        // The same files written into a FAT32 card image in one sequential pass, against copy above.
+        {
+            std::atomic<bool> abort(false);
+            imageResult result;
+            std::string error = BuildFatImage(dir + "/card.img", ImageFiles(p, files), 0, "BENCH", abort, result);
+            std::ostringstream out;
+            out << "{\"name\":\"card_image\",\"unit\":\"s\",\"seconds\":" << result.seconds << ",\"files\":" << result.files << ",\"left_out\":" << result.errors.size()
+                << ",\"bytes\":" << result.dataBytes << ",\"image_bytes\":" << result.bytes << ",\"mb_per_s\":" << result.dataBytes / 1048576.0 / result.seconds << "}";
+            results.push_back(out.str());
+            std::cerr << "card_image: " << result.dataBytes / 1048576.0 / result.seconds << " MB/s" << (error.empty() ? "" : ", " + error) << std::endl;
+            std::filesystem::remove(dir + "/card.img");
+        }
+
+        // Verify throughput over the source zips and CHDs: zip directories and CHD headers, then decompressing and hashing or reading everything.
+        std::map<std::string, std::vector<runFile>> sets;
+        std::map<std::string, uintmax_t> setBytes;
+        for (const runFile &file : files)
+        {
+            sets[file.type].push_back(runFile{file.game, file.type, file.source, file.source});
+            setBytes[file.type] += std::filesystem::file_size(file.source);
+        }
+        for (const auto &[type, set] : sets)
+        {
+            for (bool deep : {false, true})
+            {
+                for (int jobs : jobCounts)
+                {
+                    std::atomic<bool> abort(false);
+                    verifyResult result = VerifyFiles(set, checksums, deep, jobs, abort, nullptr);
+                    // verify.jobs_N and verify_deep.jobs_N are the zips, as they were before CHDs were checked.
+                    std::string fullName = std::string(deep ? "verify_deep" : "verify") + (type == "rom" ? "" : "_" + type) + ".jobs_" + std::to_string(jobs);
+                    std::ostringstream out;
+                    out << "{\"name\":" << JsonString(fullName) << ",\"unit\":\"s\",\"seconds\":" << result.seconds << ",\"files\":" << set.size()
+                        << ",\"bad\":" << result.bad << ",\"unchecked\":" << result.unchecked << ",\"bytes\":" << setBytes[type] << ",\"files_per_s\":" << set.size() / result.seconds
+                        << ",\"mb_per_s\":" << setBytes[type] / 1048576.0 / result.seconds << "}";
+                    results.push_back(out.str());
+                    std::cerr << fullName << ": " << set.size() / result.seconds << " files/s, " << setBytes[type] / 1048576.0 / result.seconds << " MB/s, " << result.bad << " bad" << std::endl;
+                }
+            }
+        }
+
+        // Rebuild throughput: the same zips, as if each game were a clone whose ROMs are all in its parent's zip of a merged set.
+        std::vector<runFile> rebuilds;
+        for (const runFile &file : sets["rom"])
+        {
+            rebuilds.push_back(runFile{file.game, "rom", dir + "/merged/" + file.game + ".zip", p.romTarget + "/" + file.game + ".zip", {file.source}});
+        }
+        MeasureTransfer("rebuild", rebuilds, setBytes["rom"], false, jobCounts, p, dir + "/out", checksums);
+
+        // Packing rom zips into 7z sets is CPU bound, so it should scale with jobs. A sample of the zips keeps it short.
+        // Then from a cache filled by one pass: what each later run or profile with the same sets costs.
+        {
+            const size_t PACK_SETS = 500;
+            std::vector<runFile> packs;
+            uintmax_t packBytes = 0;
+            for (size_t i = 0; i < sets["rom"].size() && i < PACK_SETS; i++)
+            {
+                const runFile &file = sets["rom"][i];
+                packs.push_back(runFile{file.game, "rom", file.source, p.romTarget + "/" + file.game + ".zip"});
+                packBytes += std::filesystem::file_size(file.source);
+            }
+            PackFiles(packs);
+            MeasureTransfer("pack_7z", packs, packBytes, false, jobCounts, p, dir + "/out", checksums);
+            downloadCache cache{dir + "/pack_cache", UINT64_MAX};
+            std::filesystem::remove_all(cache.folder);
+            MeasureTransfer("pack_7z_fill_cache", packs, packBytes, false, {jobCounts.back()}, p, dir + "/out", checksums, cache);
+            MeasureTransfer("pack_7z_cached", packs, packBytes, false, jobCounts, p, dir + "/out", checksums, cache);
+            std::filesystem::remove_all(cache.folder);
+        }
+
+        // Auditing the whole source folder from the zip directories alone.
+        for (int jobs : jobCounts)
+        {
+            std::atomic<bool> abort(false);
+            folderAudit audit = AuditFolder(gameDB, data.romSource, jobs, abort, nullptr);
+            std::string fullName = "audit.jobs_" + std::to_string(jobs);
+            std::ostringstream out;
+            out << "{\"name\":" << JsonString(fullName) << ",\"unit\":\"s\",\"seconds\":" << audit.seconds << ",\"zips\":" << audit.games.size()
+                << ",\"good\":" << audit.counts[AUDIT_GOOD] << ",\"zips_per_s\":" << audit.games.size() / audit.seconds << "}";
+            results.push_back(out.str());
+            std::cerr << fullName << ": " << audit.games.size() / audit.seconds << " zips/s, " << audit.counts[AUDIT_GOOD] << " good" << std::endl;
+        }
+
+        // The checksum kernels on their own, over 64MB in memory.
+        std::string block(64 << 20, '\x5a');
+        Measure("checksum.crc32", iterations, [&]()
+                { Crc32(0, block.data(), block.size()); });
+        Measure("checksum.sha1", iterations, [&]()
+                {
+            Sha1 sha1;
+            sha1.Update(block.data(), block.size());
+            sha1.HexDigest(); });
+        results.push_back("{\"name\":\"checksum.kernels\",\"kernels\":" + JsonString(ChecksumKernels()) + "}");
+
+#ifndef _WIN32
+        // Download throughput: the same files through DownloadFile, served by the mock server.
+        if (options.count("--download"))
+        {
+            mockServerConfig serverConfig;
+            serverConfig.roots = {p.romSource, p.chdSource};
+            serverConfig.latencyMs = options.count("--latency-ms") ? std::stoi(options["--latency-ms"]) : 0;
+            serverConfig.bandwidth = options.count("--bandwidth-kbps") ? std::stoll(options["--bandwidth-kbps"]) * 1024 : 0;
+            serverConfig.failPercent = options.count("--fail-percent") ? std::stoi(options["--fail-percent"]) : 0;
+            MockServer server(serverConfig);
+            profile online = p;
+            online.online = 1;
+            online.baseUrl = server.Url();
+            std::vector<runFile> onlinePlanned = PlanRun(online, games);
+            std::vector<runFile> downloads;
+            for (size_t i : present)
+            {
+                downloads.push_back(onlinePlanned[i]);
+            }
+            MeasureTransfer("download", downloads, bytes, true, jobCounts, online, dir + "/out");
+            // Again through a download cache, filled by one pass first: what each further profile with the same games costs.
+            downloadCache cache{dir + "/download_cache", UINT64_MAX};
+            std::filesystem::remove_all(cache.folder);
+            MeasureTransfer("download_fill_cache", downloads, bytes, true, {jobCounts.back()}, online, dir + "/out", checksums, cache);
+            MeasureTransfer("download_cached", downloads, bytes, true, jobCounts, online, dir + "/out", checksums, cache);
+            std::filesystem::remove_all(cache.folder);
+            server.Stop();
+            std::ostringstream out;
+            out << "{\"name\":\"download.server\",\"latency_ms\":" << serverConfig.latencyMs << ",\"bandwidth\":" << serverConfig.bandwidth
+                << ",\"fail_percent\":" << serverConfig.failPercent << ",\"requests\":" << server.Stats().requests << ",\"bytes\":" << server.Stats().bytes
+                << ",\"failed\":" << server.Stats().failed << "}";
+            results.push_back(out.str());
+        }
+#endif
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Benchmark error: " << e.what() << std::endl;
+        return 3;
+    }
+
+    std::ostringstream json;
+    json << "{\"version\":" << JsonString(VERSION) << ",\"config\":{\"games\":" << config.games << ",\"profiles\":" << config.profiles
+         << ",\"selection\":" << config.selection << ",\"roms\":" << config.roms << ",\"chds\":" << config.chds
+         << ",\"chd_mb\":" << config.chdMB << ",\"iterations\":" << iterations << "},\"results\":[";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        json << (i ? "," : "") << results[i];
+    }
+    json << "]}" << std::endl;
+    if (options.count("--out"))
+    {
+        std::ofstream out(options["--out"]);
+        out << json.str();
+    }
+    else
+    {
+        std::cout << json.str();
+    }
+    return 0;
+}
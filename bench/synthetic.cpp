@@ -0,0 +1,284 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        bench/synthetic.cpp
+// Purpose:     Synthetic game DB, profile DB and ROM/CHD tree for benchmarks
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "synthetic.h"
+#include "core/catalog.h"
+#include "core/checksum.h"
+#include "core/profiles.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace
+{
+    const char *GENRES[] = {"Shooter", "Fighter", "Platform", "Puzzle", "Sports", "Racing", "Maze", "Beat'em Up", "Casino", "Quiz",
+                            "Driving", "Climbing", "Ball & Paddle", "Tabletop", "Multiplay", "Rhythm", "Simulation", "Misc", "Electromechanical", ""};
+    const char *RANKS[] = {"", "0-20", "20-40", "40-60", "60-80", "80-100"};
+    const char *WORDS[] = {"Super", "Street", "Dragon", "Galaxy", "Ninja", "Turbo", "Space", "Final", "Metal", "Star",
+                           "Power", "Mega", "Ultra", "Hyper", "Battle", "Crystal", "Shadow", "Thunder", "Golden", "Pac"};
+
+    std::string GameName(int i)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "g%06d", i);
+        return buf;
+    }
+
+    void PutBe(unsigned char *p, uint64_t v, int bytes)
+    {
+        for (int i = bytes - 1; i >= 0; i--, v >>= 8)
+        {
+            p[i] = (unsigned char)(v & 0xFF);
+        }
+    }
+
+    /*
+    *Write an uncompressed v5 CHD of pseudo random bytes with no metadata, and return the SHA1 MAME would list for it.
+    *Layout: the 124 byte header, the map, then the hunks from the next hunk boundary on.
+    */
+    std::string WriteRandomChd(const std::string &path, size_t bytes, std::mt19937 &rng)
+    {
+        const uint32_t hunkBytes = 4096;
+        uint64_t hunks = (bytes + hunkBytes - 1) / hunkBytes;
+        uint64_t firstHunk = (124 + hunks * 4 + hunkBytes - 1) / hunkBytes;
+        std::vector<unsigned char> head((size_t)(firstHunk * hunkBytes));
+        for (uint64_t i = 0; i < hunks; i++)
+        {
+            PutBe(&head[124 + i * 4], firstHunk + i, 4);
+        }
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write((const char *)head.data(), head.size());
+        Sha1 raw;
+        std::vector<char> buffer(1 << 20);
+        for (size_t left = bytes; left > 0;)
+        {
+            size_t n = std::min(left, buffer.size());
+            for (size_t i = 0; i < n; i += 4)
+            {
+                uint32_t r = rng();
+                std::memcpy(&buffer[i], &r, std::min<size_t>(4, n - i));
+            }
+            raw.Update(buffer.data(), n);
+            out.write(buffer.data(), n);
+            left -= n;
+        }
+        // Pad the last hunk.
+        std::vector<char> zeros((size_t)(hunks * hunkBytes - bytes));
+        out.write(zeros.data(), zeros.size());
+
+        std::memcpy(&head[0], "MComprHD", 8);
+        PutBe(&head[8], 124, 4);
+        PutBe(&head[12], 5, 4);
+        PutBe(&head[32], bytes, 8);
+        PutBe(&head[40], 124, 8); //Map offset.
+        PutBe(&head[56], hunkBytes, 4);
+        PutBe(&head[60], 512, 4);
+        raw.Digest(&head[64]);
+        // With no metadata, the overall SHA1 is the SHA1 of the raw SHA1.
+        Sha1 overall;
+        overall.Update(&head[64], 20);
+        overall.Digest(&head[84]);
+        out.seekp(0);
+        out.write((const char *)head.data(), 124);
+        return Sha1Hex(&head[84]);
+    }
+
+    void Put16(std::string &out, uint16_t v)
+    {
+        out.push_back((char)(v & 0xFF));
+        out.push_back((char)(v >> 8));
+    }
+
+    void Put32(std::string &out, uint32_t v)
+    {
+        Put16(out, (uint16_t)(v & 0xFFFF));
+        Put16(out, (uint16_t)(v >> 16));
+    }
+
+    /*Write a zip holding one stored (uncompressed) member of pseudo random bytes, and return the member's checksums.*/
+    romChecksum WriteRandomZip(const std::string &path, const std::string &member, size_t bytes, std::mt19937 &rng)
+    {
+        std::string data(bytes, '\0');
+        for (size_t i = 0; i < bytes; i += 4)
+        {
+            uint32_t r = rng();
+            std::memcpy(&data[i], &r, std::min<size_t>(4, bytes - i));
+        }
+        Sha1 sha1;
+        sha1.Update(data.data(), data.size());
+        romChecksum rom{member, bytes, Crc32(0, data.data(), data.size()), sha1.HexDigest()};
+
+        std::string local;
+        Put32(local, 0x04034b50);
+        Put16(local, 10); //Version needed.
+        Put16(local, 0); //Flags.
+        Put16(local, 0); //Stored.
+        Put32(local, 0); //DOS time and date.
+        Put32(local, rom.crc);
+        Put32(local, (uint32_t)bytes);
+        Put32(local, (uint32_t)bytes);
+        Put16(local, (uint16_t)member.size());
+        Put16(local, 0);
+        local += member;
+
+        std::string central;
+        Put32(central, 0x02014b50);
+        Put16(central, 20); //Version made by.
+        central.append(local, 4, 26); //Same fields as the local header from version needed on.
+        Put16(central, 0); //Comment length.
+        Put16(central, 0); //Disk.
+        Put16(central, 0); //Internal attributes.
+        Put32(central, 0); //External attributes.
+        Put32(central, 0); //Local header offset.
+        central += member;
+
+        std::string end;
+        Put32(end, 0x06054b50);
+        Put32(end, 0); //This disk and the directory's disk.
+        Put16(end, 1);
+        Put16(end, 1);
+        Put32(end, (uint32_t)central.size());
+        Put32(end, (uint32_t)(local.size() + bytes));
+        Put16(end, 0);
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << local << data << central << end;
+        return rom;
+    }
+}
+
+syntheticData GenerateCatalog(const std::string &dir, const syntheticConfig &config)
+{
+    std::filesystem::create_directories(dir);
+    syntheticData data;
+    data.gameDBFile = dir + "/romper.romper";
+    data.profileDBFile = dir + "/profiles.romper";
+    std::filesystem::remove(data.gameDBFile);
+    std::filesystem::remove(data.profileDBFile);
+    std::mt19937 rng(config.seed);
+
+    SQLite::Database gameDB(data.gameDBFile, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+    gameDB.exec("CREATE TABLE games (Name TEXT, Genre TEXT, Cat TEXT, Developer TEXT, Publisher TEXT, Year TEXT, Series TEXT, Description TEXT, ROMof TEXT, Disk TEXT, Rank TEXT, Screenless INTEGER);");
+    {
+        SQLite::Transaction transaction(gameDB);
+        SQLite::Statement insert(gameDB, "INSERT INTO games VALUES (?,?,?,?,?,?,?,?,?,?,?,?);");
+        for (int i = 0; i < config.games; i++)
+        {
+            // About a third are clones of an earlier game, 3% have a disk, 5% are screenless.
+            std::string romOf = (i > 10 && rng() % 3 == 0) ? GameName(rng() % i) : "";
+            std::string disk = (rng() % 100 < 3) ? "disk" + std::to_string(i) : "";
+            std::string description = std::string(WORDS[rng() % 20]) + " " + WORDS[rng() % 20] + " " + std::to_string(i % 97);
+            std::string developer = "Dev" + std::to_string(rng() % 300);
+            insert.bind(1, GameName(i));
+            insert.bind(2, GENRES[rng() % 20]);
+            insert.bind(3, "Cat" + std::to_string(rng() % 50));
+            insert.bind(4, developer);
+            insert.bind(5, developer);
+            insert.bind(6, std::to_string(1975 + rng() % 45));
+            insert.bind(7, rng() % 4 == 0 ? std::string(WORDS[rng() % 20]) : "");
+            insert.bind(8, description);
+            insert.bind(9, romOf);
+            insert.bind(10, disk);
+            insert.bind(11, RANKS[rng() % 6]);
+            insert.bind(12, rng() % 100 < 5 ? 1 : 0);
+            insert.exec();
+            insert.reset();
+        }
+        transaction.commit();
+    }
+
+    SQLite::Database profileDB(data.profileDBFile, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+    CreateProfileSchema(profileDB);
+    {
+        SQLite::Transaction transaction(profileDB);
+        SQLite::Statement insertGame(profileDB, "INSERT OR IGNORE INTO games (profile,game) VALUES (?,?);");
+        for (int p = 0; p < config.profiles; p++)
+        {
+            std::string name = "Profile " + std::to_string(p);
+            data.profileNames.push_back(name);
+            CreateProfile(profileDB, profile{name, 0, dir + "/roms", dir + "/chd", dir + "/out/roms", dir + "/out/chd"});
+            int selection = p == 0 ? config.selection : config.selection / 10;
+            for (int i = 0; i < selection && config.games > 0; i++)
+            {
+                insertGame.bind(1, name);
+                insertGame.bind(2, GameName(p == 0 ? i % config.games : rng() % config.games));
+                insertGame.exec();
+                insertGame.reset();
+            }
+        }
+        transaction.commit();
+    }
+    return data;
+}
+
+void GenerateSourceTree(const std::string &dir, const syntheticConfig &config, syntheticData &data)
+{
+    data.romSource = dir + "/roms";
+    data.chdSource = dir + "/chd";
+    std::filesystem::create_directories(data.romSource);
+    std::filesystem::create_directories(data.chdSource);
+    std::mt19937 rng(config.seed + 1);
+
+    SQLite::Database gameDB(data.gameDBFile, SQLite::OPEN_READWRITE);
+    std::vector<std::pair<std::string, romChecksum>> roms;
+    std::vector<std::pair<std::string, diskChecksum>> disks;
+    SQLite::Statement query(gameDB, "SELECT Name, Disk FROM games ORDER BY Name;");
+    while (query.executeStep() && ((int)data.romGames.size() < config.roms || (int)data.chdGames.size() < config.chds))
+    {
+        std::string name = query.getColumn(0).getString();
+        std::string disk = query.getColumn(1).getString();
+        if (disk == "" && (int)data.romGames.size() < config.roms)
+        {
+            size_t kb = config.minRomKB + rng() % (config.maxRomKB - config.minRomKB + 1);
+            roms.push_back({name, WriteRandomZip(data.romSource + "/" + name + ".zip", name + ".bin", kb * 1024, rng)});
+            data.romGames.push_back(name);
+        }
+        else if (disk != "" && (int)data.chdGames.size() < config.chds)
+        {
+            std::filesystem::create_directories(data.chdSource + "/" + name);
+            disks.push_back({name, diskChecksum{disk, WriteRandomChd(data.chdSource + "/" + name + "/" + disk + ".chd", (size_t)config.chdMB << 20, rng)}});
+            data.chdGames.push_back(name);
+        }
+    }
+    query.reset();
+
+    // The checksums a real game DB has for each zip and CHD, so runs and the verify benchmark have something to check.
+    SQLite::Transaction transaction(gameDB);
+    gameDB.exec("DROP TABLE IF EXISTS roms;");
+    gameDB.exec("CREATE TABLE roms (Game TEXT, Name TEXT, Size INTEGER, CRC TEXT, SHA1 TEXT);");
+    SQLite::Statement insertRom(gameDB, "INSERT INTO roms (Game,Name,Size,CRC,SHA1) VALUES (?,?,?,?,?);");
+    for (const auto &rom : roms)
+    {
+        insertRom.bind(1, rom.first);
+        insertRom.bind(2, rom.second.name);
+        insertRom.bind(3, (int64_t)rom.second.size);
+        insertRom.bind(4, Crc32Hex(rom.second.crc));
+        insertRom.bind(5, rom.second.sha1);
+        insertRom.exec();
+        insertRom.reset();
+    }
+    gameDB.exec("CREATE INDEX idxromsgame ON roms (Game);");
+    gameDB.exec("DROP TABLE IF EXISTS disks;");
+    gameDB.exec("CREATE TABLE disks (Game TEXT, Name TEXT, SHA1 TEXT);");
+    SQLite::Statement insertDisk(gameDB, "INSERT INTO disks (Game,Name,SHA1) VALUES (?,?,?);");
+    for (const auto &disk : disks)
+    {
+        insertDisk.bind(1, disk.first);
+        insertDisk.bind(2, disk.second.name);
+        insertDisk.bind(3, disk.second.sha1);
+        insertDisk.exec();
+        insertDisk.reset();
+    }
+    gameDB.exec("CREATE INDEX idxdisksgame ON disks (Game);");
+    transaction.commit();
+}
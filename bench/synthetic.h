@@ -0,0 +1,39 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        bench/synthetic.h
+// Purpose:     Synthetic game DB, profile DB and ROM/CHD tree for benchmarks
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct syntheticConfig
+{
+    int games = 50000; //Rows in the games table.
+    int profiles = 200; //Profiles in the profile DB.
+    int selection = 20000; //Games selected in the first profile. The others get a tenth of that.
+    int roms = 2000; //ROM zips written to the source tree. They are the first games that have no disk.
+    int chds = 20; //CHDs written to the source tree.
+    int minRomKB = 10; //ROM zip sizes are uniform between min and max.
+    int maxRomKB = 200;
+    int chdMB = 16; //Size of each CHD.
+    unsigned seed = 1; //Same seed, same data.
+};
+
+struct syntheticData
+{
+    std::string gameDBFile; //romper.romper
+    std::string profileDBFile; //profiles.romper
+    std::string romSource; //Folder of <name>.zip
+    std::string chdSource; //Folder of <name>/<disk>.chd
+    std::vector<std::string> profileNames; //profileNames[0] is the big one.
+    std::vector<std::string> romGames; //Games that have a zip in romSource.
+    std::vector<std::string> chdGames; //Games that have a CHD in chdSource.
+};
+
+/*Write a game DB and profile DB into dir. Fast, since everything is inserted in one transaction per DB.*/
+syntheticData GenerateCatalog(const std::string &dir, const syntheticConfig &config);
+
+/*Write the ROM/CHD source tree for data into dir. Files are filled with pseudo random bytes.*/
+void GenerateSourceTree(const std::string &dir, const syntheticConfig &config, syntheticData &data);
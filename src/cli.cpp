@@ -0,0 +1,839 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        cli.cpp
+// Purpose:     Romper headless command line mode
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "cli.h"
+#include "core/budget.h"
+#include "core/catalog.h"
+#include "core/checksum.h"
+#include "core/fatimage.h"
+#include "core/history.h"
+#include "core/inventory.h"
+#include "core/pack.h"
+#include "core/plan.h"
+#include "core/profiles.h"
+#include "core/run.h"
+#include "core/throttle.h"
+#include "core/trace.h"
+#include "core/util.h"
+#include "core/verify.h"
+#include "core/watcher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <wx/app.h>
+#include <wx/init.h>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+/*Headless mode only needs wxBase (for wxWebRequestSync), so it runs as a console app.*/
+class RomperCliApp : public wxAppConsole
+{
+public:
+    virtual bool OnInit() { return true; }
+};
+
+//Set by Ctrl+C so a headless run stops after the files in flight.
+std::atomic<bool> cliAbort(false);
+//Set by SIGUSR1 and cleared by SIGUSR2 to pause and resume a headless run.
+std::atomic<bool> cliPause(false);
+
+bool IsCliInvocation(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::string(argv[i]).rfind("--", 0) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+namespace
+{
+    /*Parse text as a whole number from low to high. False if it isn't one, has anything after it or is out of range, so "8x" and "-1" are refused.*/
+    bool ParseWholeNumber(const std::string &text, long long low, long long high, long long &value)
+    {
+        char *end = nullptr;
+        errno = 0;
+        value = std::strtoll(text.c_str(), &end, 10);
+        return !text.empty() && *end == '\0' && errno != ERANGE && value >= low && value <= high;
+    }
+}
+
+int RunCli(int argc, char **argv)
+{
+    enum //Exit codes. Scripts rely on these, so only ever append.
+    {
+        CLI_OK = 0,
+        CLI_RUN_ERRORS, //The run finished, but some files failed.
+        CLI_USAGE, //Bad arguments.
+        CLI_DB_ERROR, //Profile not found, or a DB could not be read or written.
+        CLI_ABORTED, //Interrupted before the run finished.
+    };
+    const std::string usage =
+        "Usage: romper [options]" NEWLINE
+        "  --list-profiles                    List profiles." NEWLINE
+        "  --profile NAME --sync [--jobs N]   Copy or download the profile's games, N files at a time." NEWLINE
+        "                                     Parent, BIOS and device sets the games need are included." NEWLINE
+        "                                     Targets already up to date are skipped. Stops first if the files won't fit." NEWLINE
+        "  --profile A --profile B ... --sync" NEWLINE
+        "                                     Sync several profiles of the same kind in one run. Each source file is read once," NEWLINE
+        "                                     written to the first target that needs it and linked (or copied) from there to the rest." NEWLINE
+        "  --profile NAME --sync [--rate SCHEDULE]" NEWLINE
+        "                                     Cap the run's throughput. SCHEDULE is comma separated KB/s, each for a time of day or all day," NEWLINE
+        "                                     the first that matches wins, e.g. 08:00-18:00=2048,512. Overrides ROMPER_RATE." NEWLINE
+        "                                     Send SIGUSR1 to pause the run (files in flight keep what they have) and SIGUSR2 to resume it." NEWLINE
+        "  --profile NAME --sync --dry-run [--jobs N]" NEWLINE
+        "                                     Only plan the sync: files new and unchanged, bytes, free space and time left." NEWLINE
+        "  --profile NAME --image FILE [--image-mb N]" NEWLINE
+        "                                     Write the profile's rom zips and CHDs straight into a FAT32 image of at least N MB, in the" NEWLINE
+        "                                     targets' folder layout, ready to dd or flash to a card. Local profiles only." NEWLINE
+        "  --profile NAME --sync --pack 7z    Write the rom zips as 7z sets, which MAME loads the same way, packed N at a time. Local profiles only." NEWLINE
+        "                                     Each set is packed once into the cache (ROMPER_CACHE_MB) and linked from there. --verify --pack 7z checks them." NEWLINE
+        "  --profile NAME --export            List the profile's selected games." NEWLINE
+        "  --profile NAME --scan [--jobs N] [--full]" NEWLINE
+        "                                     Scan the profile's source folders on N threads. --sync then skips files the scan didn't find." NEWLINE
+        "                                     --full lists every folder again instead of only the changed ones." NEWLINE
+        "  --profile NAME --verify [--deep] [--jobs N]" NEWLINE
+        "                                     Check the target rom zips and CHDs against the game DB's checksums." NEWLINE
+        "                                     --deep also decompresses and hashes the zips and reads the CHDs through." NEWLINE
+        "  --profile NAME --audit [--jobs N]  Audit every zip in the profile's rom folder (the source, or the target when downloading)" NEWLINE
+        "                                     from the zip directories: Good, Extra files, Bad CRC, Missing ROM, Unreadable or Unknown." NEWLINE
+        "  --profile NAME --watch             Keep the scanned inventory current until interrupted, printing each change." NEWLINE
+        "  --search TEXT [--by FIELD] [--limit N] [--screenless] [--ranks LIST] [--genres LIST] [--profile NAME [--have]]" NEWLINE
+        "                                     Search games. FIELD is Name, Description (default), Developer or Series." NEWLINE
+        "                                     --ranks and --genres keep only those, comma separated, \"blank\" for none." NEWLINE
+        "                                     --have keeps only games the last --scan found." NEWLINE
+        "  --profile NAME --budget-mb N --into NEW [--budget-by rank|points] [--search TEXT ...]" NEWLINE
+        "                                     Make NEW select the best ranked games matching the search options whose files, with the sets" NEWLINE
+        "                                     they need, fit in N MB of FAT32 clusters. NEW is created with NAME's folders if it doesn't exist." NEWLINE
+        "                                     rank (default) takes games best rank first, points the most rank points per MB. Local profiles only." NEWLINE
+        "  --update-game-db FILE [--remap]    Apply a newer game DB as a delta. --remap moves renamed games in profiles." NEWLINE
+        "  --history [--profile NAME] [--limit N]" NEWLINE
+        "                                     List past runs, newest first, with their throughput." NEWLINE
+        "  --history-run ID                   List the files of one run with their size, time and MB/s." NEWLINE
+        "  --trace FILE                       Write a Chrome trace (open it in Perfetto). ROMPER_TRACE=FILE does the same." NEWLINE
+        "  ROMPER_COPY=portable               Copy local files one at a time instead of in io_uring batches (Linux)." NEWLINE
+        "  ROMPER_DEVICE_JOBS=N               Allow N files at a time on every drive. By default spinning disks and cards get 1." NEWLINE
+        "  ROMPER_CACHE_MB=N                  Cap the download cache shared by online profiles at N MB (51200). 0 turns it off." NEWLINE
+        "Output is one JSON object per line. Exit status: 0 ok, 1 run had errors, 2 usage, 3 DB or profile error, 4 aborted." NEWLINE;
+
+    // --name value, or "1" for flags.
+    std::map<std::string, std::string> options;
+    std::vector<std::string> profileNames; //Every --profile given. Only --sync takes more than one.
+    const std::vector<std::string> flags = {"--sync", "--export", "--list-profiles", "--remap", "--screenless", "--history", "--scan", "--full", "--have", "--watch", "--verify", "--deep", "--audit", "--dry-run", "--help"};
+    const std::vector<std::string> valued = {"--profile", "--jobs", "--search", "--by", "--limit", "--update-game-db", "--trace", "--history-run", "--rate", "--image", "--image-mb", "--pack", "--budget-mb", "--into", "--budget-by", "--ranks", "--genres"};
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (in_array(arg, flags))
+        {
+            options[arg] = "1";
+        }
+        else if (in_array(arg, valued) && i + 1 < argc)
+        {
+            options[arg] = argv[++i];
+            if (arg == "--profile")
+            {
+                profileNames.push_back(options[arg]);
+            }
+        }
+        else
+        {
+            std::cerr << "Unknown or incomplete option: " << arg << NEWLINE << usage;
+            return CLI_USAGE;
+        }
+    }
+    if (options.count("--help"))
+    {
+        std::cout << usage;
+        return CLI_OK;
+    }
+    if (options.count("--trace"))
+    {
+        StartTrace(options["--trace"]);
+    }
+    else
+    {
+        StartTraceFromEnvironment();
+    }
+    long long jobs = 1;
+    long long limit = 100;
+    long long historyRun = 0;
+    if (!ParseWholeNumber(options.count("--jobs") ? options["--jobs"] : "1", 1, 1024, jobs))
+    {
+        std::cerr << "--jobs must be a whole number from 1 to 1024." << NEWLINE;
+        return CLI_USAGE;
+    }
+    if (!ParseWholeNumber(options.count("--limit") ? options["--limit"] : "100", 1, INT_MAX, limit))
+    {
+        std::cerr << "--limit must be a whole number of at least 1." << NEWLINE;
+        return CLI_USAGE;
+    }
+    if (options.count("--history-run") && !ParseWholeNumber(options["--history-run"], 1, LLONG_MAX, historyRun))
+    {
+        std::cerr << "--history-run must be a run ID from --history." << NEWLINE;
+        return CLI_USAGE;
+    }
+    std::string profileName = profileNames.empty() ? "" : profileNames.front();
+    if (profileNames.size() > 1 && !options.count("--sync"))
+    {
+        std::cerr << "Only --sync takes more than one --profile." << NEWLINE;
+        return CLI_USAGE;
+    }
+    // --rate overrides ROMPER_RATE, so a bad ROMPER_RATE only matters without it.
+    std::vector<rateWindow> schedule;
+    std::string rateError = options.count("--rate") ? ParseRateSchedule(options["--rate"], schedule) : Throttle::ScheduleFromEnvironment(schedule);
+    if (!rateError.empty())
+    {
+        std::cerr << (options.count("--rate") ? "--rate: " : "ROMPER_RATE: ") << rateError << NEWLINE;
+        return CLI_USAGE;
+    }
+    if (options.count("--pack") && options["--pack"] != "7z")
+    {
+        std::cerr << "--pack only takes 7z." << NEWLINE;
+        return CLI_USAGE;
+    }
+    if (options.count("--budget-by") && options["--budget-by"] != "rank" && options["--budget-by"] != "points")
+    {
+        std::cerr << "--budget-by must be rank or points." << NEWLINE;
+        return CLI_USAGE;
+    }
+    if (options.count("--budget-mb") && (profileName == "" || !options.count("--into")))
+    {
+        std::cerr << "--budget-mb needs --profile and --into." << NEWLINE << usage;
+        return CLI_USAGE;
+    }
+    // Whole MB up to 2 TB, FAT32's limit, so the bytes can't overflow and "32G" isn't taken as 32.
+    int64_t budget = 0;
+    if (options.count("--budget-mb"))
+    {
+        long long megabytes = 0;
+        if (!ParseWholeNumber(options["--budget-mb"], 1, 2097151, megabytes))
+        {
+            std::cerr << "--budget-mb must be a whole number of MB from 1 to 2097151." << NEWLINE;
+            return CLI_USAGE;
+        }
+        budget = (int64_t)megabytes << 20;
+        options["--into"] = trim(options["--into"]);
+        if (options["--into"].empty())
+        {
+            std::cerr << "--into needs a profile name." << NEWLINE;
+            return CLI_USAGE;
+        }
+    }
+    if ((options.count("--sync") || options.count("--export") || options.count("--scan") || options.count("--watch") || options.count("--image") || options.count("--verify") || options.count("--audit")) && profileName == "")
+    {
+        std::cerr << "--sync, --export, --scan, --watch, --image, --verify and --audit need --profile." << NEWLINE << usage;
+        return CLI_USAGE;
+    }
+
+    wxAppConsole::SetInstance(new RomperCliApp);
+    wxInitializer initializer(argc, argv);
+    if (!initializer.IsOk())
+    {
+        std::cerr << "Could not initialize wxWidgets." << NEWLINE;
+        return CLI_DB_ERROR;
+    }
+    std::signal(SIGINT, [](int)
+                { cliAbort = true; });
+#ifndef _WIN32
+    std::signal(SIGUSR1, [](int)
+                { cliPause = true; });
+    std::signal(SIGUSR2, [](int)
+                { cliPause = false; });
+#endif
+
+    std::string profileDBError;
+    std::string profileDBFile = getProfileDatabasePath(profileDBError);
+    if (profileDBFile == "")
+    {
+        std::cerr << "Create Profile DB Error: " << profileDBError << NEWLINE;
+        return CLI_DB_ERROR;
+    }
+    std::string gameDBFile = getGameDatabasePath();
+    try
+    {
+        SQLite::Database profileDB(profileDBFile, SQLite::OPEN_READWRITE);
+        if (options.count("--update-game-db"))
+        {
+            catalogDelta delta = ApplyCatalogDelta(gameDBFile, options["--update-game-db"], profileDB, options.count("--remap") > 0);
+            for (const std::string &entry : delta.affectedEntries)
+            {
+                std::cout << "{\"event\":\"affected\",\"entry\":" << JsonString(entry) << "}" << std::endl;
+            }
+            std::cout << "{\"event\":\"updated\",\"inserted\":" << delta.inserted << ",\"updated\":" << delta.updated << ",\"removed\":" << delta.removed
+                      << ",\"renamed\":" << delta.renamed.size() << ",\"remapped\":" << delta.remapped << ",\"checksums_changed\":" << delta.checksumsChanged << ",\"devices_changed\":" << delta.devicesChanged << "}" << std::endl;
+            return CLI_OK;
+        }
+
+        SQLite::Database gameDB(gameDBFile);
+        std::map<std::string, profile> profiles = LoadProfiles(profileDB);
+        for (const std::string &name : profileNames)
+        {
+            if (profiles.count(name) == 0)
+            {
+                std::cerr << "No profile named: " << name << NEWLINE;
+                return CLI_DB_ERROR;
+            }
+        }
+
+        if (options.count("--list-profiles"))
+        {
+            for (const auto &p : profiles)
+            {
+                std::cout << "{\"name\":" << JsonString(p.second.name) << ",\"online\":" << p.second.online << ",\"romTarget\":" << JsonString(p.second.romTarget)
+                          << ",\"chdTarget\":" << JsonString(p.second.chdTarget) << ",\"baseUrl\":" << JsonString(p.second.baseUrl) << "}" << std::endl;
+            }
+            return CLI_OK;
+        }
+
+        if (options.count("--history"))
+        {
+            for (const runRecord &run : LoadRuns(profileDB, profileName, limit))
+            {
+                std::cout << "{\"id\":" << run.id << ",\"profile\":" << JsonString(run.profile) << ",\"started\":" << run.started << ",\"finished\":" << run.finished
+                          << ",\"online\":" << run.online << ",\"jobs\":" << run.jobs << ",\"strategy\":" << JsonString(run.strategy) << ",\"files\":" << run.files
+                          << ",\"ok\":" << run.ok << ",\"failed\":" << run.failed << ",\"skipped\":" << run.skipped << ",\"retries\":" << run.retries
+                          << ",\"bytes\":" << run.bytes << ",\"mb_per_s\":" << RunMegabytesPerSecond(run) << ",\"aborted\":" << (run.aborted ? "true" : "false") << "}" << std::endl;
+            }
+            return CLI_OK;
+        }
+
+        if (options.count("--history-run"))
+        {
+            for (const runFileRecord &file : LoadRunFiles(profileDB, historyRun))
+            {
+                std::cout << "{\"game\":" << JsonString(file.game) << ",\"type\":" << JsonString(file.type) << ",\"source\":" << JsonString(file.source)
+                          << ",\"target\":" << JsonString(file.target) << ",\"bytes\":" << file.bytes << ",\"seconds\":" << file.seconds
+                          << ",\"mb_per_s\":" << (file.seconds > 0 ? file.bytes / 1048576.0 / file.seconds : 0) << ",\"retries\":" << file.retries
+                          << ",\"skipped\":" << (file.skipped ? "true" : "false") << ",\"error\":" << JsonString(file.error) << "}" << std::endl;
+            }
+            return CLI_OK;
+        }
+
+        // The search options, as --search and --budget-mb use them. Returns "" if they're valid, else what's wrong.
+        auto filterFromOptions = [&](searchFilter &filter) -> std::string
+        {
+            filter.field = options.count("--by") ? options["--by"] : "Description";
+            filter.value = options.count("--search") ? options["--search"] : "";
+            filter.screenless = options.count("--screenless") > 0;
+            if (!in_array(filter.field, {"Name", "Description", "Developer", "Series"}))
+            {
+                return "--by must be Name, Description, Developer or Series.";
+            }
+            // --ranks and --genres list what to keep. The filter wants what to leave out.
+            for (bool ranks : {true, false})
+            {
+                std::string option = ranks ? "--ranks" : "--genres";
+                if (!options.count(option))
+                {
+                    continue;
+                }
+                std::vector<std::string> values = CatalogValues(gameDB, ranks ? "Rank" : "Genre");
+                std::vector<std::string> kept;
+                std::string list = options[option] + ",";
+                for (size_t from = 0, comma; (comma = list.find(',', from)) != std::string::npos; from = comma + 1)
+                {
+                    std::string value = trim(list.substr(from, comma - from));
+                    if (value != "blank" && !in_array(value, values))
+                    {
+                        // A typo would otherwise leave out every game of the kind it meant.
+                        return option + ": the game DB has no " + (ranks ? "rank " : "genre ") + JsonString(value) + ".";
+                    }
+                    kept.push_back(value == "blank" ? "" : value);
+                }
+                for (const std::string &value : values)
+                {
+                    if (!in_array(value, kept))
+                    {
+                        (ranks ? filter.excludedRanks : filter.excludedGenres).push_back(value);
+                    }
+                }
+            }
+            if (options.count("--have"))
+            {
+                if (profileName == "")
+                {
+                    return "--have needs --profile.";
+                }
+                const profile &p = profiles[profileName];
+                SetHaveTable(gameDB, GamesPresent(gameDB, p, LoadInventory(profileDB, p)));
+                filter.onlyHave = true;
+            }
+            return "";
+        };
+
+        if (options.count("--budget-mb"))
+        {
+            const profile &p = profiles[profileName];
+            if (p.online == 1)
+            {
+                std::cerr << "This profile downloads its files. Budgets are worked out from the sizes of local source files." << NEWLINE;
+                return CLI_DB_ERROR;
+            }
+            searchFilter filter;
+            std::string error = filterFromOptions(filter);
+            if (!error.empty())
+            {
+                std::cerr << error << NEWLINE;
+                return CLI_USAGE;
+            }
+            budgetRule rule = options["--budget-by"] == "points" ? BUDGET_MOST_POINTS : BUDGET_BEST_FIRST;
+            std::vector<budgetGame> candidates = BudgetCandidates(gameDB, filter);
+            dependencyGraph graph = LoadDependencyGraph(gameDB);
+            budgetSelection selection = SelectWithinBudget(candidates, LoadSetSizes(profileDB, gameDB, p, candidates, graph), graph, budget, rule, FatClusterBytes(budget));
+            profile target = profiles.count(options["--into"]) ? profiles[options["--into"]] : p;
+            target.name = options["--into"];
+            ReplaceProfileGames(profileDB, target, selection.games);
+            std::cout << "{\"event\":\"budgeted\",\"profile\":" << JsonString(target.name) << ",\"games\":" << selection.games.size() << ",\"candidates\":" << selection.candidates
+                      << ",\"unsized\":" << selection.unsized << ",\"dependencies\":" << selection.dependencies << ",\"bytes\":" << selection.bytes
+                      << ",\"dependency_bytes\":" << selection.dependencyBytes << ",\"budget\":" << budget << ",\"points\":" << selection.points
+                      << ",\"seconds\":" << selection.seconds << "}" << std::endl;
+            return CLI_OK;
+        }
+
+        if (options.count("--search"))
+        {
+            searchFilter filter;
+            std::string error = filterFromOptions(filter);
+            if (!error.empty())
+            {
+                std::cerr << error << NEWLINE;
+                return CLI_USAGE;
+            }
+            std::vector<std::string> selected = SelectedGames(profileDB, profileName);
+            std::unordered_set<std::string> checkedGames(selected.begin(), selected.end());
+            TraceSpan span("search", "search");
+            bool needBind = false;
+            std::string where = SearchWhere(filter, needBind);
+            SQLite::Statement sq(gameDB, "SELECT Name, Description, Developer, Series, Cat, Genre, Rank FROM games " + where + " ORDER BY Description LIMIT " + std::to_string(limit) + ";");
+            if (needBind)
+            {
+                sq.bind(1, trim(filter.value + "%"));
+            }
+            while (sq.executeStep())
+            {
+                std::string name = sq.getColumn(0).getString();
+                std::cout << "{\"name\":" << JsonString(name) << ",\"description\":" << JsonString(sq.getColumn(1).getString()) << ",\"developer\":" << JsonString(sq.getColumn(2).getString())
+                          << ",\"series\":" << JsonString(sq.getColumn(3).getString()) << ",\"cat\":" << JsonString(sq.getColumn(4).getString()) << ",\"genre\":" << JsonString(sq.getColumn(5).getString())
+                          << ",\"rank\":" << JsonString(sq.getColumn(6).getString()) << ",\"selected\":" << (checkedGames.count(name) ? "true" : "false") << "}" << std::endl;
+            }
+            return CLI_OK;
+        }
+
+        if (options.count("--export"))
+        {
+            for (const gameMap &game : LoadProfileGames(profileDB, gameDB, profileName))
+            {
+                std::cout << "{\"name\":" << JsonString(game.name) << ",\"disk\":" << JsonString(game.disk) << "}" << std::endl;
+            }
+            return CLI_OK;
+        }
+
+        if (options.count("--scan"))
+        {
+            const profile &p = profiles[profileName];
+            if (p.online == 1)
+            {
+                std::cerr << "This profile downloads its files. There are no source folders to scan." << NEWLINE;
+                return CLI_DB_ERROR;
+            }
+            bool failed = false;
+            for (const std::string &root : {p.romSource, p.chdSource})
+            {
+                if (root.empty())
+                {
+                    continue;
+                }
+                scanStats stats = ScanSource(profileDB, root, jobs, options.count("--full") > 0, cliAbort);
+                std::cout << "{\"event\":\"scanned\",\"root\":" << JsonString(root) << ",\"dirs\":" << stats.dirs << ",\"dirs_listed\":" << stats.dirsListed
+                          << ",\"files\":" << stats.files << ",\"added\":" << stats.added << ",\"removed\":" << stats.removed << ",\"changed\":" << stats.changed
+                          << ",\"seconds\":" << stats.seconds;
+                if (!stats.error.empty())
+                {
+                    failed = true;
+                    std::cout << ",\"error\":" << JsonString(stats.error);
+                }
+                std::cout << "}" << std::endl;
+            }
+            if (cliAbort)
+            {
+                return CLI_ABORTED;
+            }
+            return failed ? CLI_RUN_ERRORS : CLI_OK;
+        }
+
+        if (options.count("--verify"))
+        {
+            const profile &p = profiles[profileName];
+            std::vector<gameMap> games = LoadProfileGames(profileDB, gameDB, profileName);
+            std::vector<gameMap> required = DependencyClosure(LoadDependencyGraph(gameDB), games);
+            games.insert(games.end(), required.begin(), required.end());
+            gameChecksums checksums = LoadChecksums(gameDB, games);
+            std::vector<runFile> files = PlanRun(p, games);
+            if (options.count("--pack") && p.online != 1)
+            {
+                PackFiles(files);
+            }
+            verifyResult result = VerifyFiles(files, checksums, options.count("--deep") > 0, jobs, cliAbort, [&](size_t index, const runFile &file, const std::string &error)
+                                              {
+                std::cout << "{\"event\":\"verified\",\"game\":" << JsonString(file.game) << ",\"type\":" << JsonString(file.type) << ",\"target\":" << JsonString(file.target)
+                          << ",\"status\":" << (!error.empty() ? "\"error\"" : file.upToDate ? "\"skipped\"" : "\"ok\"");
+                if (!error.empty())
+                {
+                    std::cout << ",\"error\":" << JsonString(error);
+                }
+                std::cout << "}" << std::endl; });
+            std::cout << "{\"event\":\"done\",\"good\":" << result.good << ",\"bad\":" << result.bad << ",\"unchecked\":" << result.unchecked << ",\"readable\":" << result.readable
+                      << ",\"bytes\":" << result.bytes << ",\"seconds\":" << result.seconds << ",\"kernels\":" << JsonString(ChecksumKernels()) << "}" << std::endl;
+            if (cliAbort)
+            {
+                return CLI_ABORTED;
+            }
+            return result.bad > 0 ? CLI_RUN_ERRORS : CLI_OK;
+        }
+
+        if (options.count("--audit"))
+        {
+            const profile &p = profiles[profileName];
+            std::string folder = p.online == 1 ? p.romTarget : p.romSource;
+            if (!dir_exists(folder))
+            {
+                std::cerr << "The profile's rom folder is invalid: " << folder << NEWLINE;
+                return CLI_DB_ERROR;
+            }
+            folderAudit audit = AuditFolder(gameDB, folder, jobs, cliAbort, nullptr);
+            std::vector<std::string> names;
+            for (const auto &game : audit.games)
+            {
+                names.push_back(game.first);
+            }
+            std::sort(names.begin(), names.end());
+            for (const std::string &name : names)
+            {
+                const zipAudit &game = audit.games[name];
+                std::cout << "{\"event\":\"audited\",\"game\":" << JsonString(name) << ",\"status\":" << JsonString(AuditLabel(game.status));
+                if (!game.detail.empty())
+                {
+                    std::cout << ",\"detail\":" << JsonString(game.detail);
+                }
+                std::cout << "}" << std::endl;
+            }
+            std::cout << "{\"event\":\"done\",\"folder\":" << JsonString(folder) << ",\"zips\":" << audit.games.size();
+            for (int status = 0; status < AUDIT_STATUSES; status++)
+            {
+                // "Bad CRC" -> "bad_crc", like the other keys.
+                std::string key = AuditLabel((zipAuditStatus)status);
+                std::transform(key.begin(), key.end(), key.begin(), [](char c)
+                               { return c == ' ' ? '_' : (char)std::tolower((unsigned char)c); });
+                std::cout << "," << JsonString(key) << ":" << audit.counts[status];
+            }
+            std::cout << ",\"seconds\":" << audit.seconds << "}" << std::endl;
+            if (cliAbort)
+            {
+                return CLI_ABORTED;
+            }
+            return audit.counts[AUDIT_BAD_CRC] + audit.counts[AUDIT_MISSING_ROM] + audit.counts[AUDIT_UNREADABLE] > 0 ? CLI_RUN_ERRORS : CLI_OK;
+        }
+
+        if (options.count("--watch"))
+        {
+            const profile &p = profiles[profileName];
+            if (!LoadInventory(profileDB, p).scanned)
+            {
+                std::cerr << "Run --scan on this profile first." << NEWLINE;
+                return CLI_DB_ERROR;
+            }
+            // Batches are queued by the watcher thread and written to the profile DB on this one.
+            std::mutex batchMutex;
+            std::vector<std::pair<std::string, std::vector<std::string>>> batches;
+            std::vector<std::string> roots;
+            for (const std::string &root : {p.romSource, p.chdSource})
+            {
+                if (!root.empty())
+                {
+                    roots.push_back(root);
+                }
+            }
+            SourceWatcher watcher(roots, [&](const std::string &root, const std::vector<std::string> &relativePaths)
+                                  {
+                std::lock_guard<std::mutex> lock(batchMutex);
+                batches.push_back({root, relativePaths}); });
+            std::cout << "{\"event\":\"watching\",\"profile\":" << JsonString(profileName) << "}" << std::endl;
+            while (!cliAbort)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                std::vector<std::pair<std::string, std::vector<std::string>>> ready;
+                {
+                    std::lock_guard<std::mutex> lock(batchMutex);
+                    ready.swap(batches);
+                }
+                for (const auto &batch : ready)
+                {
+                    for (const inventoryChange &change : UpdateInventoryFiles(profileDB, batch.first, batch.second))
+                    {
+                        std::cout << "{\"event\":\"changed\",\"root\":" << JsonString(batch.first) << ",\"path\":" << JsonString(change.relativePath)
+                                  << ",\"game\":" << JsonString(GameOfPath(p, batch.first, change.relativePath)) << ",\"present\":" << (change.present ? "true" : "false") << "}" << std::endl;
+                    }
+                }
+            }
+            watcher.Stop();
+            return CLI_OK;
+        }
+
+        if (options.count("--image"))
+        {
+            const profile &p = profiles[profileName];
+            if (p.online == 1)
+            {
+                std::cerr << "Images are built from local sources. Sync the profile, then image a local profile of its targets." << NEWLINE;
+                return CLI_USAGE;
+            }
+            if (!dir_exists(p.romSource))
+            {
+                std::cerr << "The profile's source folders are invalid. Edit the profile and try again." << NEWLINE;
+                return CLI_DB_ERROR;
+            }
+            // Up to 2 TB, FAT32's limit, so "-1" can't wrap around and the bytes can't overflow.
+            long long minimumMB = 0;
+            if (options.count("--image-mb") && !ParseWholeNumber(options["--image-mb"], 1, 2097151, minimumMB))
+            {
+                std::cerr << "--image-mb must be a whole number of MB from 1 to 2097151." << NEWLINE;
+                return CLI_USAGE;
+            }
+            uint64_t minimumBytes = (uint64_t)minimumMB << 20;
+            std::vector<gameMap> games = LoadProfileGames(profileDB, gameDB, profileName);
+            dependencyGraph dependencies = LoadDependencyGraph(gameDB);
+            std::vector<gameMap> required = DependencyClosure(dependencies, games);
+            games.insert(games.end(), required.begin(), required.end());
+            std::vector<runFile> files = PlanRun(p, games, dependencies);
+            std::vector<runFile> absent = DropAbsentFiles(files, LoadInventory(profileDB, p));
+            std::cout << "{\"event\":\"start\",\"profile\":" << JsonString(profileName) << ",\"image\":" << JsonString(options["--image"]) << ",\"files\":" << files.size()
+                      << ",\"absent\":" << absent.size() << "}" << std::endl;
+            imageResult result;
+            int percent = -1;
+            std::string error = BuildFatImage(options["--image"], ImageFiles(p, files), minimumBytes, profileName, cliAbort, result, [&](uint64_t done, uint64_t total)
+                                              {
+                int now = total > 0 ? (int)(done * 100 / total) : 100;
+                if (now != percent)
+                {
+                    percent = now;
+                    std::cout << "{\"event\":\"progress\",\"bytes\":" << done << ",\"total\":" << total << "}" << std::endl;
+                } });
+            for (const std::string &left : result.errors)
+            {
+                std::cout << "{\"event\":\"left_out\",\"error\":" << JsonString(left) << "}" << std::endl;
+            }
+            if (!error.empty())
+            {
+                std::cerr << error << NEWLINE;
+                return cliAbort ? CLI_ABORTED : CLI_RUN_ERRORS;
+            }
+            std::cout << "{\"event\":\"done\",\"image\":" << JsonString(options["--image"]) << ",\"bytes\":" << result.bytes << ",\"data_bytes\":" << result.dataBytes
+                      << ",\"cluster_bytes\":" << result.clusterBytes << ",\"files\":" << result.files << ",\"folders\":" << result.folders << ",\"left_out\":" << result.errors.size()
+                      << ",\"seconds\":" << result.seconds << "}" << std::endl;
+            return result.errors.empty() && absent.empty() ? CLI_OK : CLI_RUN_ERRORS;
+        }
+
+        if (options.count("--sync"))
+        {
+            bool online = profiles[profileName].online == 1;
+            for (const std::string &name : profileNames)
+            {
+                const profile &p = profiles[name];
+                if (!dir_exists(p.romTarget) || !dir_exists(p.chdTarget) || (p.online != 1 && !dir_exists(p.romSource)))
+                {
+                    std::cerr << "The source or target folders of " << name << " are invalid. Edit the profile and try again." << NEWLINE;
+                    return CLI_DB_ERROR;
+                }
+                if ((p.online == 1) != online)
+                {
+                    std::cerr << "Profiles synced together must all download, or all copy." << NEWLINE;
+                    return CLI_USAGE;
+                }
+                if (p.online == 1 && options.count("--pack"))
+                {
+                    std::cerr << "--pack only packs local profiles. " << name << " downloads." << NEWLINE;
+                    return CLI_USAGE;
+                }
+            }
+            dependencyGraph dependencies = LoadDependencyGraph(gameDB);
+            downloadCache cache;
+            std::string cacheError = DefaultDownloadCache(profileDBFile, cache);
+            if (!cacheError.empty())
+            {
+                std::cerr << "ROMPER_CACHE_MB: " << cacheError << NEWLINE;
+                return CLI_USAGE;
+            }
+            std::vector<std::vector<runFile>> profileFiles;
+            std::vector<runPlan> plans;
+            std::vector<std::vector<gameMap>> profileGames;
+            std::vector<gameMap> allGames;
+            std::vector<size_t> absentCount;
+            for (const std::string &name : profileNames)
+            {
+                const profile &p = profiles[name];
+                std::vector<gameMap> games = LoadProfileGames(profileDB, gameDB, name);
+                std::vector<gameMap> required = DependencyClosure(dependencies, games);
+                size_t selected = games.size();
+                games.insert(games.end(), required.begin(), required.end());
+                std::vector<runFile> files = PlanRun(p, games, dependencies);
+                if (options.count("--pack"))
+                {
+                    PackFiles(files);
+                }
+                std::vector<runFile> absent = DropAbsentFiles(files, LoadInventory(profileDB, p));
+                std::cout << "{\"event\":\"start\",\"profile\":" << JsonString(name) << ",\"online\":" << p.online << ",\"games\":" << selected << ",\"required\":" << required.size()
+                          << ",\"files\":" << files.size() << ",\"absent\":" << absent.size() << ",\"jobs\":" << jobs << "}" << std::endl;
+                for (const runFile &file : absent)
+                {
+                    std::cout << "{\"event\":\"absent\",\"game\":" << JsonString(file.game) << ",\"type\":" << JsonString(file.type) << ",\"source\":" << JsonString(file.source) << "}" << std::endl;
+                }
+                profileFiles.push_back(files);
+                absentCount.push_back(absent.size());
+                allGames.insert(allGames.end(), games.begin(), games.end());
+            }
+            gameChecksums checksums = LoadChecksums(gameDB, allGames);
+            for (size_t k = 0; k < profileNames.size(); k++)
+            {
+                plans.push_back(PlanTransfers(profileDB, profiles[profileNames[k]], profileFiles[k], checksums, jobs, cache));
+            }
+            // Several profiles run as one: each source read once and fanned out to every target that needs it.
+            fanOut merged;
+            runPlan plan = plans.front();
+            std::vector<runFile> files = profileFiles.front();
+            if (profileNames.size() > 1)
+            {
+                merged = FanOutFiles(profileFiles);
+                plan = CombinePlans(plans, merged);
+                files = merged.files;
+                size_t targets = 0;
+                for (const std::vector<runFile> &planned : profileFiles)
+                {
+                    targets += planned.size();
+                }
+                std::cout << "{\"event\":\"fanout\",\"profiles\":" << profileNames.size() << ",\"targets\":" << targets << ",\"files\":" << files.size() << "}" << std::endl;
+            }
+            for (const std::string &source : plan.missing)
+            {
+                std::cout << "{\"event\":\"missing\",\"source\":" << JsonString(source) << "}" << std::endl;
+            }
+            auto groups = [](const std::map<std::string, planGroup> &byType)
+            {
+                std::string json = "{";
+                for (const auto &group : byType)
+                {
+                    json += (json.size() > 1 ? "," : "") + JsonString(group.first) + ":{\"files\":" + std::to_string(group.second.files) +
+                            ",\"bytes\":" + std::to_string(group.second.bytes) + ",\"unknown_size\":" + std::to_string(group.second.unknownSize) + "}";
+                }
+                return json + "}";
+            };
+            std::cout << "{\"event\":\"plan\",\"transfer\":" << groups(plan.transfer) << ",\"unchanged\":" << groups(plan.unchanged) << ",\"missing\":" << plan.missing.size()
+                      << ",\"bytes\":" << plan.estimatedBytes << ",\"bytes_per_second\":" << (int64_t)plan.bytesPerSecond << ",\"eta_seconds\":" << (int64_t)plan.estimatedSeconds
+                      << ",\"fits\":" << (plan.Fits() ? "true" : "false") << ",\"seconds\":" << plan.seconds << ",\"space\":[";
+            for (size_t i = 0; i < plan.space.size(); i++)
+            {
+                std::cout << (i ? "," : "") << "{\"folder\":" << JsonString(plan.space[i].folder) << ",\"needed\":" << plan.space[i].needed
+                          << ",\"estimated\":" << plan.space[i].estimated << ",\"available\":" << plan.space[i].available << "}";
+            }
+            std::cout << "]}" << std::endl;
+            if (options.count("--dry-run"))
+            {
+                return plan.Fits() ? CLI_OK : CLI_RUN_ERRORS;
+            }
+            if (!plan.Fits())
+            {
+                std::cerr << "Not enough free space for the run. Nothing was written." << NEWLINE;
+                return CLI_RUN_ERRORS;
+            }
+            size_t completed = 0;
+            runRecord run;
+            run.started = EpochMs();
+            run.online = online ? 1 : 0;
+            run.jobs = jobs;
+            // Signal handlers can't take the throttle's lock, so this thread passes pause and resume on.
+            Throttle throttle(schedule);
+            std::mutex outputMutex;
+            std::atomic<bool> runDone(false);
+            std::thread pauser([&]()
+                               {
+                bool paused = false;
+                while (!runDone)
+                {
+                    if (cliPause != paused)
+                    {
+                        paused = cliPause;
+                        paused ? throttle.Pause() : throttle.Resume();
+                        std::lock_guard<std::mutex> lock(outputMutex);
+                        std::cout << "{\"event\":" << (paused ? "\"paused\"" : "\"resumed\"") << "}" << std::endl;
+                    }
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                } });
+            runResult result = RunFiles(files, online, jobs, cliAbort, [&](size_t index, const runFile &file, const std::string &error)
+                                        {
+                std::lock_guard<std::mutex> lock(outputMutex);
+                completed++;
+                std::cout << "{\"event\":\"file\",\"done\":" << completed << ",\"total\":" << files.size() << ",\"game\":" << JsonString(file.game)
+                          << ",\"type\":" << JsonString(file.type) << ",\"status\":" << (!error.empty() ? "\"error\"" : file.upToDate ? "\"skipped\"" : "\"ok\"");
+                if (!file.alsoTo.empty())
+                {
+                    std::cout << ",\"targets\":" << file.alsoTo.size() + 1;
+                }
+                if (!error.empty())
+                {
+                    std::cout << ",\"error\":" << JsonString(error);
+                }
+                std::cout << "}" << std::endl; }, checksums, cache, &throttle);
+            runDone = true;
+            pauser.join();
+            run.finished = EpochMs();
+            run.aborted = cliAbort ? 1 : 0;
+            // Each profile gets its own run in the history, as if it had been synced alone.
+            std::vector<runResult> results = profileNames.size() > 1 ? SplitFanOut(merged, profileFiles, result) : std::vector<runResult>{result};
+            bool errors = false;
+            for (size_t k = 0; k < profileNames.size(); k++)
+            {
+                run.profile = profileNames[k];
+                int64_t runId = RecordRun(profileDB, run, profileFiles[k], results[k]);
+                std::cout << "{\"event\":\"done\",\"run\":" << runId;
+                if (profileNames.size() > 1)
+                {
+                    std::cout << ",\"profile\":" << JsonString(profileNames[k]);
+                }
+                std::cout << ",\"ok\":" << results[k].ok << ",\"failed\":" << results[k].failed << ",\"skipped\":" << results[k].skipped << ",\"rebuilt\":" << results[k].rebuilt << ",\"cached\":" << results[k].cached << ",\"packed\":" << results[k].packed
+                          << ",\"cache_removed\":" << results[k].trim.files << ",\"cache_bytes\":" << results[k].trim.kept << ",\"absent\":" << absentCount[k] << ",\"aborted\":" << (cliAbort ? "true" : "false") << "}" << std::endl;
+                errors = errors || results[k].failed > 0 || absentCount[k] > 0;
+            }
+            if (cliAbort)
+            {
+                return CLI_ABORTED;
+            }
+            return errors ? CLI_RUN_ERRORS : CLI_OK;
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Romper error: " << e.what() << NEWLINE;
+        return CLI_DB_ERROR;
+    }
+    std::cerr << usage;
+    return CLI_USAGE;
+}
@@ -0,0 +1,12 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        cli.h
+// Purpose:     Romper headless command line mode
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+/*True if the command line asks for headless mode. Headless options all start with "--".*/
+bool IsCliInvocation(int argc, char **argv);
+
+/*Headless entry point. Runs without creating any window. Returns the process exit code.*/
+int RunCli(int argc, char **argv);
@@ -0,0 +1,390 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/budget.cpp
+// Purpose:     Picks the best ranked games that fit in a card's capacity
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/budget.h"
+#include "core/rebuild.h"
+#include "core/trace.h"
+#include "core/util.h"
+#include "core/verify.h"
+
+#include <chrono>
+#include <filesystem>
+#include <queue>
+#include <unordered_set>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace
+{
+    struct candidateState
+    {
+        int set = 0; //The game's own zip.
+        std::vector<int> sets; //Its own zip and every set it needs.
+        int64_t cost = 0; //Bytes picking it adds now: its CHD and whatever of sets isn't paid for yet.
+        int points = 0;
+        int version = 0; //Bumped whenever cost drops, so older heap entries are skipped.
+        bool picked = false;
+    };
+
+    struct heapEntry
+    {
+        int candidate;
+        int version;
+        int64_t cost;
+        int points;
+    };
+
+    //Whether a is a worse pick than b, so the heap's top is the best.
+    bool WorsePick(const heapEntry &a, const heapEntry &b, budgetRule rule)
+    {
+        if (rule == BUDGET_MOST_POINTS)
+        {
+            // points/cost compared without dividing, so games that cost nothing come first. Points are small, so this can't overflow.
+            int64_t left = (int64_t)a.points * b.cost, right = (int64_t)b.points * a.cost;
+            if (left != right)
+            {
+                return left < right;
+            }
+        }
+        if (a.points != b.points)
+        {
+            return a.points < b.points;
+        }
+        if (a.cost != b.cost)
+        {
+            return a.cost > b.cost;
+        }
+        return a.candidate > b.candidate;
+    }
+
+    bool IsZip(const std::filesystem::path &path)
+    {
+        return path.extension() == ".zip";
+    }
+
+    /*The sizes of the files in a local profile's source folders: from the last scan if they were scanned, else by listing them.*/
+    setSizes SourceSizes(SQLite::Database &profileDB, const profile &p)
+    {
+        TraceSpan span("SourceSizes", "inventory");
+        setSizes sizes;
+        bool scanned = true;
+        for (const std::string &root : {p.romSource, p.chdSource})
+        {
+            SQLite::Statement query(profileDB, "SELECT 1 FROM inventory_dirs WHERE root=? AND dir='';");
+            query.bind(1, root);
+            scanned = scanned && (root.empty() || query.executeStep());
+        }
+        span.Arg("scanned", (int64_t)scanned);
+        if (scanned)
+        {
+            if (!p.romSource.empty())
+            {
+                SQLite::Statement query(profileDB, "SELECT name, size FROM inventory WHERE root=? AND dir='';");
+                query.bind(1, p.romSource);
+                while (query.executeStep())
+                {
+                    std::filesystem::path name = query.getColumn(0).getString();
+                    if (IsZip(name))
+                    {
+                        sizes.zips[name.stem().string()] = query.getColumn(1).getInt64();
+                    }
+                }
+            }
+            if (!p.chdSource.empty())
+            {
+                SQLite::Statement query(profileDB, "SELECT dir, name, size FROM inventory WHERE root=? AND dir!='' AND instr(dir,'/')=0;");
+                query.bind(1, p.chdSource);
+                while (query.executeStep())
+                {
+                    std::filesystem::path name = query.getColumn(1).getString();
+                    if (name.extension() == ".chd")
+                    {
+                        sizes.disks[query.getColumn(0).getString() + "/" + name.stem().string()] = query.getColumn(2).getInt64();
+                    }
+                }
+            }
+            return sizes;
+        }
+        std::error_code ec;
+        if (!p.romSource.empty())
+        {
+            for (const auto &entry : std::filesystem::directory_iterator(p.romSource, ec))
+            {
+                if (entry.is_regular_file(ec) && IsZip(entry.path()))
+                {
+                    sizes.zips[entry.path().stem().string()] = (int64_t)entry.file_size(ec);
+                }
+            }
+        }
+        if (!p.chdSource.empty())
+        {
+            for (const auto &folder : std::filesystem::directory_iterator(p.chdSource, ec))
+            {
+                if (!folder.is_directory(ec))
+                {
+                    continue;
+                }
+                for (const auto &entry : std::filesystem::directory_iterator(folder.path(), ec))
+                {
+                    if (entry.is_regular_file(ec) && entry.path().extension() == ".chd")
+                    {
+                        sizes.disks[folder.path().filename().string() + "/" + entry.path().stem().string()] = (int64_t)entry.file_size(ec);
+                    }
+                }
+            }
+        }
+        return sizes;
+    }
+
+    /*
+    *Size the zips a run would rebuild as their rebuilt sets, as PlanFile does: a split clone's own zip is smaller than its set, and a merged clone has none.
+    *Any of candidates' sets with ROMs in the game DB whose source isn't a good non-merged zip counts. One that can't be rebuilt is left unsized.
+    */
+    void SizeRebuiltZips(setSizes &sizes, SQLite::Database &gameDB, const profile &p, const std::vector<budgetGame> &candidates, const dependencyGraph &graph)
+    {
+        TraceSpan span("SizeRebuiltZips", "rebuild");
+        std::vector<gameMap> games;
+        games.reserve(candidates.size());
+        for (const budgetGame &game : candidates)
+        {
+            games.push_back(gameMap{game.name, game.disk});
+        }
+        std::vector<gameMap> needed = DependencyClosure(graph, games);
+        games.insert(games.end(), needed.begin(), needed.end());
+        std::vector<std::string> names;
+        names.reserve(games.size());
+        for (const gameMap &game : games)
+        {
+            names.push_back(game.name);
+        }
+        romChecksums roms = LoadRomChecksums(gameDB, names);
+        int64_t rebuilt = 0;
+        for (const gameMap &game : games)
+        {
+            auto found = roms.find(game.name);
+            if (found == roms.end())
+            {
+                continue;
+            }
+            // A missing source is audited as unreadable, and a merged parent as having extra files.
+            std::string source = p.romSource + "/" + game.name + ".zip";
+            if (AuditZip(source, found->second).status == AUDIT_GOOD)
+            {
+                continue;
+            }
+            std::vector<std::string> sources{source};
+            for (const gameMap &set : DependencyClosure(graph, {game}))
+            {
+                sources.push_back(p.romSource + "/" + set.name + ".zip");
+            }
+            int64_t bytes = RebuiltZipBytes(found->second, sources);
+            if (bytes < 0)
+            {
+                sizes.zips.erase(game.name);
+                continue;
+            }
+            sizes.zips[game.name] = bytes;
+            rebuilt++;
+        }
+        span.Arg("rebuilt", rebuilt);
+    }
+}
+
+int RankPoints(const std::string &rank)
+{
+    try
+    {
+        size_t dash = rank.find('-');
+        if (dash == std::string::npos)
+        {
+            return std::stoi(rank);
+        }
+        return (std::stoi(rank.substr(0, dash)) + std::stoi(rank.substr(dash + 1))) / 2;
+    }
+    catch (std::exception &)
+    {
+        return 0;
+    }
+}
+
+std::vector<budgetGame> BudgetCandidates(SQLite::Database &gameDB, const searchFilter &filter)
+{
+    TraceSpan span("BudgetCandidates", "gamedb");
+    bool needBind = false;
+    std::string where = SearchWhere(filter, needBind);
+    SQLite::Statement query(gameDB, "SELECT Name, Disk, Rank FROM games " + where + " ORDER BY Name;");
+    if (needBind)
+    {
+        query.bind(1, trim(filter.value + "%"));
+    }
+    std::vector<budgetGame> games;
+    while (query.executeStep())
+    {
+        games.push_back(budgetGame{query.getColumn(0).getString(), query.getColumn(1).getString(), query.getColumn(2).getString()});
+    }
+    span.Arg("games", (int64_t)games.size());
+    return games;
+}
+
+setSizes LoadSetSizes(SQLite::Database &profileDB, SQLite::Database &gameDB, const profile &p, const std::vector<budgetGame> &candidates, const dependencyGraph &graph)
+{
+    TraceSpan span("LoadSetSizes", "budget");
+    if (p.online == 1)
+    {
+        return setSizes();
+    }
+    setSizes sizes = SourceSizes(profileDB, p);
+    SizeRebuiltZips(sizes, gameDB, p, candidates, graph);
+    return sizes;
+}
+
+budgetSelection SelectWithinBudget(const std::vector<budgetGame> &candidates, const setSizes &sizes, const dependencyGraph &graph, int64_t budget, budgetRule rule, uint32_t clusterBytes)
+{
+    TraceSpan span("SelectWithinBudget", "budget");
+    auto start = std::chrono::steady_clock::now();
+    budgetSelection selection;
+    selection.candidates = (int)candidates.size();
+    auto rounded = [&](int64_t bytes)
+    {
+        return clusterBytes == 0 ? bytes : (bytes + clusterBytes - 1) / clusterBytes * clusterBytes;
+    };
+
+    // Sets are numbered as they're met, with who would pay for each, so paying for one only touches the games that share it.
+    std::unordered_map<std::string, int> setIds;
+    std::vector<int64_t> setBytes; //-1 if the set's zip isn't in the sources.
+    std::vector<std::vector<int>> setUsers;
+    setIds.reserve(candidates.size() * 2);
+    auto setId = [&](const std::string &name)
+    {
+        auto inserted = setIds.emplace(name, (int)setBytes.size());
+        if (inserted.second)
+        {
+            auto zip = sizes.zips.find(name);
+            setBytes.push_back(zip == sizes.zips.end() ? -1 : rounded(zip->second));
+            setUsers.emplace_back();
+        }
+        return inserted.first->second;
+    };
+
+    std::vector<candidateState> states(candidates.size());
+    std::vector<heapEntry> entries;
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> pending;
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const budgetGame &game = candidates[i];
+        candidateState &state = states[i];
+        state.points = RankPoints(game.rank);
+        state.set = setId(game.name);
+        state.sets.push_back(state.set);
+        // The same walk as DependencyClosure, for one game.
+        seen = {game.name};
+        pending = {game.name};
+        while (!pending.empty())
+        {
+            auto needs = graph.needs.find(pending.back());
+            pending.pop_back();
+            if (needs == graph.needs.end())
+            {
+                continue;
+            }
+            for (const std::string &set : needs->second)
+            {
+                if (!set.empty() && seen.insert(set).second)
+                {
+                    state.sets.push_back(setId(set));
+                    pending.push_back(set);
+                }
+            }
+        }
+        bool sized = true;
+        if (!game.disk.empty())
+        {
+            auto disk = sizes.disks.find(game.name + "/" + game.disk);
+            sized = disk != sizes.disks.end();
+            state.cost = sized ? rounded(disk->second) : 0;
+        }
+        for (int set : state.sets)
+        {
+            sized = sized && setBytes[set] >= 0;
+            state.cost += setBytes[set];
+        }
+        if (!sized)
+        {
+            selection.unsized++;
+            continue;
+        }
+        for (int set : state.sets)
+        {
+            setUsers[set].push_back((int)i);
+        }
+        entries.push_back(heapEntry{(int)i, 0, state.cost, state.points});
+    }
+
+    auto worse = [rule](const heapEntry &a, const heapEntry &b)
+    {
+        return WorsePick(a, b, rule);
+    };
+    std::priority_queue<heapEntry, std::vector<heapEntry>, decltype(worse)> heap(worse, std::move(entries));
+    std::vector<bool> paid(setBytes.size(), false);
+    int64_t left = budget;
+    while (!heap.empty())
+    {
+        heapEntry top = heap.top();
+        heap.pop();
+        candidateState &state = states[top.candidate];
+        // A game too big now is dropped, but comes back with a new entry if a later pick pays for part of it.
+        if (state.picked || top.version != state.version || state.cost > left)
+        {
+            continue;
+        }
+        state.picked = true;
+        left -= state.cost;
+        selection.games.push_back(candidates[top.candidate].name);
+        selection.points += state.points;
+        for (int set : state.sets)
+        {
+            if (paid[set])
+            {
+                continue;
+            }
+            paid[set] = true;
+            for (int user : setUsers[set])
+            {
+                candidateState &other = states[user];
+                if (other.picked)
+                {
+                    continue;
+                }
+                other.cost -= setBytes[set];
+                other.version++;
+                heap.push(heapEntry{user, other.version, other.cost, other.points});
+            }
+        }
+    }
+
+    selection.bytes = budget - left;
+    std::vector<bool> picked(setBytes.size(), false);
+    for (const candidateState &state : states)
+    {
+        if (state.picked)
+        {
+            picked[state.set] = true;
+        }
+    }
+    for (size_t set = 0; set < paid.size(); set++)
+    {
+        if (paid[set] && !picked[set])
+        {
+            selection.dependencies++;
+            selection.dependencyBytes += setBytes[set];
+        }
+    }
+    selection.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    span.Arg("candidates", (int64_t)selection.candidates);
+    span.Arg("picked", (int64_t)selection.games.size());
+    return selection;
+}
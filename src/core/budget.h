@@ -0,0 +1,73 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/budget.h
+// Purpose:     Picks the best ranked games that fit in a card's capacity
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+#include "core/profiles.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SQLite
+{
+    class Database;
+}
+
+enum budgetRule
+{
+    BUDGET_BEST_FIRST, //Games by rank, best first. Within a rank the cheapest go first, so as many as possible fit.
+    BUDGET_MOST_POINTS, //Games by rank points per byte, so the card holds as many points as possible. Favours small good games over big great ones.
+};
+
+/*A game that may go in, from the game DB.*/
+struct budgetGame
+{
+    std::string name;
+    std::string disk; //CHD name. Blank if none.
+    std::string rank;
+};
+
+/*The bytes of a profile's source files.*/
+struct setSizes
+{
+    std::unordered_map<std::string, int64_t> zips; //Set name -> its rom zip's bytes.
+    std::unordered_map<std::string, int64_t> disks; //"game/disk" -> the CHD's bytes.
+};
+
+/*What SelectWithinBudget picked.*/
+struct budgetSelection
+{
+    std::vector<std::string> games; //In the order they were picked.
+    int64_t bytes = 0; //Everything a sync of games writes: their zips and CHDs and the sets they need, rounded up to clusters.
+    int64_t dependencyBytes = 0; //Of bytes, the parent, BIOS and device sets that aren't picked themselves.
+    int dependencies = 0; //Those sets.
+    int64_t points = 0; //RankPoints of games, summed.
+    int candidates = 0; //Games that matched the filter.
+    int unsized = 0; //Of candidates, games left out because a file they need isn't in the sources, or can't be rebuilt from them.
+    double seconds = 0;
+};
+
+/*The points a game's rank is worth: the middle of a range like "80-100", so 90. Blank or unknown ranks are worth 0, so they only fill what room is left.*/
+int RankPoints(const std::string &rank);
+
+/*The games matching filter, in name order.*/
+std::vector<budgetGame> BudgetCandidates(SQLite::Database &gameDB, const searchFilter &filter);
+
+/*
+*The sizes of a local profile's rom zips and CHDs: from the last scan if its source folders were scanned, else by listing them.
+*The zips of candidates and the sets they need that a run would rebuild from a split or merged set (see RebuildRoms) are sized as rebuilt,
+*so a merged clone has a size too. Online profiles have no sources, so they get no sizes.
+*/
+setSizes LoadSetSizes(SQLite::Database &profileDB, SQLite::Database &gameDB, const profile &p, const std::vector<budgetGame> &candidates, const dependencyGraph &graph);
+
+/*
+*Pick the candidates that fit in budget bytes, by rule. A game costs its zip, its CHD and the parent, BIOS and device zips it needs
+*that nothing picked so far paid for, so games sharing a BIOS get cheaper once one of them is in. Greedy over a heap, so 40000 games take milliseconds.
+*If clusterBytes isn't 0 every file is rounded up to it, as it is on the card. See FatClusterBytes.
+*/
+budgetSelection SelectWithinBudget(const std::vector<budgetGame> &candidates, const setSizes &sizes, const dependencyGraph &graph, int64_t budget, budgetRule rule, uint32_t clusterBytes);
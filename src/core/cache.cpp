@@ -0,0 +1,170 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/cache.cpp
+// Purpose:     Startup cache. Catalog facets and first pages, kept in profiles.romper.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/cache.h"
+#include "core/trace.h"
+
+#include <filesystem>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace
+{
+    //Values are stored as fields split by the ASCII unit separator, rows by the record separator. Neither shows up in game data.
+    const char FIELD = '\x1f';
+    const char RECORD = '\x1e';
+
+    std::vector<std::vector<std::string>> Split(const std::string &value)
+    {
+        std::vector<std::vector<std::string>> records;
+        std::vector<std::string> fields;
+        std::string field;
+        for (char c : value)
+        {
+            if (c == FIELD || c == RECORD)
+            {
+                fields.push_back(field);
+                field.clear();
+                if (c == RECORD)
+                {
+                    records.push_back(fields);
+                    fields.clear();
+                }
+            }
+            else
+            {
+                field += c;
+            }
+        }
+        return records;
+    }
+
+    bool ReadCache(SQLite::Database &profileDB, const std::string &key, const std::string &stamp, std::string &value)
+    {
+        SQLite::Statement query(profileDB, "SELECT value FROM catalog_cache WHERE key=? AND stamp=?;");
+        query.bind(1, key);
+        query.bind(2, stamp);
+        if (!query.executeStep())
+        {
+            return false;
+        }
+        value = query.getColumn(0).getString();
+        return true;
+    }
+
+    //Best effort. A locked or read-only profile DB just means no cache.
+    void WriteCache(SQLite::Database &profileDB, const std::string &key, const std::string &stamp, const std::string &value)
+    {
+        TraceSpan span("WriteCache", "profiledb");
+        try
+        {
+            SQLite::Transaction transaction(profileDB);
+            SQLite::Statement clear(profileDB, "DELETE FROM catalog_cache WHERE stamp<>?;");
+            clear.bind(1, stamp);
+            clear.exec();
+            SQLite::Statement query(profileDB, "INSERT OR REPLACE INTO catalog_cache (key,stamp,value) VALUES (?,?,?);");
+            query.bind(1, key);
+            query.bind(2, stamp);
+            query.bind(3, value);
+            query.exec();
+            transaction.commit();
+        }
+        catch (std::exception &)
+        {
+        }
+    }
+}
+
+std::string CatalogStamp(const std::string &gameDBFile)
+{
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(gameDBFile, ec);
+    if (ec)
+    {
+        return "";
+    }
+    auto modified = std::filesystem::last_write_time(gameDBFile, ec).time_since_epoch().count();
+    return std::to_string(size) + ":" + std::to_string(modified);
+}
+
+std::vector<std::string> CachedCatalogValues(SQLite::Database &gameDB, SQLite::Database &profileDB, const std::string &stamp, const std::string &column)
+{
+    std::string key = "values:" + column;
+    std::string value;
+    if (stamp != "" && ReadCache(profileDB, key, stamp, value))
+    {
+        std::vector<std::string> values;
+        for (const std::vector<std::string> &record : Split(value))
+        {
+            values.push_back(record[0]);
+        }
+        return values;
+    }
+    std::vector<std::string> values = CatalogValues(gameDB, column);
+    if (stamp != "")
+    {
+        value.clear();
+        for (const std::string &v : values)
+        {
+            value += v + RECORD;
+        }
+        WriteCache(profileDB, key, stamp, value);
+    }
+    return values;
+}
+
+std::vector<gameRow> CachedSearchGames(SQLite::Database &gameDB, SQLite::Database &profileDB, const std::string &stamp, const searchFilter &filter,
+                                       const std::string &orderBy, const std::string &orderDirection, int limit, int page, int &totalGames)
+{
+    // The have filter depends on the last scan, not just the game DB, so it is never cached.
+    if (stamp == "" || page != 1 || filter.value != "" || filter.onlyHave)
+    {
+        return SearchGames(gameDB, filter, orderBy, orderDirection, limit, page, totalGames);
+    }
+
+    // Everything that changes the result is in the key. The search field doesn't matter without search text.
+    std::string key = "page1:" + orderBy + FIELD + orderDirection + FIELD + std::to_string(limit) + FIELD + (filter.screenless ? "1" : "0");
+    for (const std::string &rank : filter.excludedRanks)
+    {
+        key += FIELD + ("r" + rank);
+    }
+    for (const std::string &genre : filter.excludedGenres)
+    {
+        key += FIELD + ("g" + genre);
+    }
+
+    std::string value;
+    if (ReadCache(profileDB, key, stamp, value))
+    {
+        TraceSpan span("CachedSearchGames hit", "search");
+        std::vector<std::vector<std::string>> records = Split(value);
+        if (!records.empty() && records[0].size() == 1)
+        {
+            totalGames = std::stoi(records[0][0]);
+            std::vector<gameRow> rows;
+            rows.reserve(records.size() - 1);
+            for (size_t i = 1; i < records.size() && records[i].size() == 12; i++)
+            {
+                const std::vector<std::string> &f = records[i];
+                rows.push_back(gameRow{f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7], f[8], f[9], f[10], std::stoi(f[11])});
+            }
+            return rows;
+        }
+    }
+
+    std::vector<gameRow> rows = SearchGames(gameDB, filter, orderBy, orderDirection, limit, page, totalGames);
+    value = std::to_string(totalGames) + RECORD;
+    for (const gameRow &row : rows)
+    {
+        for (const std::string *field : {&row.name, &row.genre, &row.cat, &row.developer, &row.publisher, &row.year, &row.series, &row.description, &row.romOf, &row.disk, &row.rank})
+        {
+            value += *field + FIELD;
+        }
+        value += std::to_string(row.screenless) + RECORD;
+    }
+    WriteCache(profileDB, key, stamp, value);
+    return rows;
+}
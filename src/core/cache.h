@@ -0,0 +1,27 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/cache.h
+// Purpose:     Startup cache. Catalog facets and first pages, kept in profiles.romper.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+
+#include <string>
+#include <vector>
+
+/*
+*Identifies the game DB's contents by its size and modification time.
+*Cached entries are only used while this matches, so replacing or updating the game DB drops them.
+*/
+std::string CatalogStamp(const std::string &gameDBFile);
+
+/*CatalogValues, served from the profile DB while the game DB is unchanged. Saves a GROUP BY scan of games per menu at startup.*/
+std::vector<std::string> CachedCatalogValues(SQLite::Database &gameDB, SQLite::Database &profileDB, const std::string &stamp, const std::string &column);
+
+/*
+*SearchGames. Page 1 of a search with no search text is served from the profile DB while the game DB is unchanged.
+*That is the grid shown when a profile is picked, and the slowest query to run cold since it counts and sorts every game.
+*/
+std::vector<gameRow> CachedSearchGames(SQLite::Database &gameDB, SQLite::Database &profileDB, const std::string &stamp, const searchFilter &filter,
+                                       const std::string &orderBy, const std::string &orderDirection, int limit, int page, int &totalGames);
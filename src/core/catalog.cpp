@@ -0,0 +1,506 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/catalog.cpp
+// Purpose:     Game DB queries. The game DB is romper.romper, built from MAME data.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/catalog.h"
+#include "core/trace.h"
+#include "core/util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <functional>
+#include <stdexcept>
+#include <unordered_set>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+std::string SearchWhere(const searchFilter &filter, bool &needBind)
+{
+    needBind = false;
+    std::string where = "";
+    bool whereBool = false; // determine if the WHERE needs to be WHERE or AND. If TRUE, then AND. There's got to be a better way for this.
+    // If the search value is not empty, set the WHERE var and we'll need to bind it.
+    if (trim(filter.value) != "")
+    {
+        needBind = true; // We only bind on the searchValue because it's the only WHERE that's not programically assigned.
+        whereBool = true;
+        where = " WHERE games." + filter.field + " LIKE ? ";
+    }
+
+    // Screenless: if NOT screenless, then don't show screenless. Else, show all.
+    // Who cares about only screenless games?
+    if (!filter.screenless)
+    {
+        where += whereBool ? " AND games.Screenless=0 " : " WHERE games.Screenless=0 ";
+        whereBool = true;
+    }
+
+    // RANK and Genre
+    const std::pair<std::string, const std::vector<std::string> *> excluded[2] = {{"rank", &filter.excludedRanks}, {"genre", &filter.excludedGenres}};
+    for (const auto &column : excluded)
+    {
+        if (column.second->empty())
+        {
+            continue;
+        }
+        std::string tempSQL = (whereBool ? " AND games." : " WHERE games.") + column.first + " NOT IN (";
+        whereBool = true;
+        for (const std::string &v : *column.second)
+        {
+            tempSQL.append("\"" + v + "\",");
+        }
+        tempSQL.pop_back(); // remove last comma.
+        where.append(tempSQL.append(") "));
+    }
+
+    if (filter.onlyHave)
+    {
+        where += whereBool ? " AND games.Name IN (SELECT name FROM temp.have) " : " WHERE games.Name IN (SELECT name FROM temp.have) ";
+    }
+    return where;
+}
+
+std::vector<gameRow> SearchGames(SQLite::Database &gameDB, const searchFilter &filter, const std::string &orderBy, const std::string &orderDirection, int limit, int page, int &totalGames)
+{
+    TraceSpan span("SearchGames", "search");
+    TraceSpan compileSpan("compile", "search");
+    bool needBind = false;
+    std::string where = SearchWhere(filter, needBind);
+    std::string queryStr = "WITH All_Games AS (SELECT * FROM games "+where+"), Count_Games AS (SELECT COUNT(*) AS TotalGames FROM All_Games) SELECT c.TotalGames, g.Name, g.Genre, g.Cat, g.Developer, g.Publisher, g.Year, g.Series, g.Description, g.ROMof, g.Disk, g.Rank, g.Screenless FROM All_Games g CROSS JOIN Count_Games c ";
+
+    std::string sqlOrderBy;
+    if (orderBy == "")
+    {
+        sqlOrderBy = "g.Description";
+    }
+    else
+    {
+        sqlOrderBy = "g." + orderBy;
+    }
+
+    std::string sqlOrderDirection;
+    if (orderDirection != "ASC" && orderDirection != "DESC")
+    {
+        sqlOrderDirection = "ASC";
+    }
+    else
+    {
+        sqlOrderDirection = orderDirection;
+    }
+    int start = (limit * page) - limit;
+    SQLite::Statement query(gameDB, queryStr + " ORDER BY " + sqlOrderBy + " " + sqlOrderDirection + " LIMIT " + std::to_string(limit) + " OFFSET " + std::to_string(start) + ";");
+    if (needBind)
+    {
+        query.bind(1, trim(filter.value + "%"));
+    }
+    compileSpan.Finish();
+
+    TraceSpan stepSpan("step", "search");
+    std::vector<gameRow> rows;
+    rows.reserve(limit);
+    totalGames = 0;
+    while (query.executeStep())
+    {
+        totalGames = query.getColumn(0).getInt();
+        rows.push_back(gameRow{query.getColumn(1).getString(), query.getColumn(2).getString(), query.getColumn(3).getString(), query.getColumn(4).getString(),
+                               query.getColumn(5).getString(), query.getColumn(6).getString(), query.getColumn(7).getString(), query.getColumn(8).getString(),
+                               query.getColumn(9).getString(), query.getColumn(10).getString(), query.getColumn(11).getString(), query.getColumn(12).getInt()});
+    }
+    stepSpan.Arg("rows", (int64_t)rows.size());
+    span.Arg("totalGames", totalGames);
+    return rows;
+}
+
+void SetHaveTable(SQLite::Database &gameDB, const std::vector<std::string> &names)
+{
+    TraceSpan span("SetHaveTable", "search");
+    span.Arg("games", (int64_t)names.size());
+    // A TEMP table lives in the connection, not the file, so this works on the read-only game DB.
+    gameDB.exec("CREATE TEMP TABLE IF NOT EXISTS \"have\" (\"name\" TEXT NOT NULL PRIMARY KEY);");
+    SQLite::Transaction transaction(gameDB);
+    gameDB.exec("DELETE FROM temp.have;");
+    SQLite::Statement query(gameDB, "INSERT OR IGNORE INTO temp.have (name) VALUES (?);");
+    for (const std::string &name : names)
+    {
+        query.bind(1, name);
+        query.exec();
+        query.reset();
+    }
+    transaction.commit();
+}
+
+void UpdateHaveTable(SQLite::Database &gameDB, const std::vector<std::string> &have, const std::vector<std::string> &notHave)
+{
+    TraceSpan span("UpdateHaveTable", "search");
+    gameDB.exec("CREATE TEMP TABLE IF NOT EXISTS \"have\" (\"name\" TEXT NOT NULL PRIMARY KEY);");
+    SQLite::Transaction transaction(gameDB);
+    SQLite::Statement insert(gameDB, "INSERT OR IGNORE INTO temp.have (name) VALUES (?);");
+    for (const std::string &name : have)
+    {
+        insert.bind(1, name);
+        insert.exec();
+        insert.reset();
+    }
+    SQLite::Statement remove(gameDB, "DELETE FROM temp.have WHERE name=?;");
+    for (const std::string &name : notHave)
+    {
+        remove.bind(1, name);
+        remove.exec();
+        remove.reset();
+    }
+    transaction.commit();
+}
+
+std::vector<std::string> CatalogValues(SQLite::Database &gameDB, const std::string &column)
+{
+    TraceSpan span("CatalogValues", "search");
+    span.Arg("column", column);
+    std::vector<std::string> values;
+    SQLite::Statement query(gameDB, "SELECT " + column + " FROM games GROUP BY " + column + " ORDER BY " + column + ";");
+    while (query.executeStep())
+    {
+        values.push_back(query.getColumn(0).getString());
+    }
+    return values;
+}
+
+std::vector<gameMap> LoadGames(SQLite::Database &gameDB, const std::vector<std::string> &names)
+{
+    TraceSpan span("LoadGames", "search");
+    span.Arg("names", (int64_t)names.size());
+    // Look the games up in chunks so huge profiles stay under SQLite's bound variable limit.
+    std::vector<gameMap> games;
+    const size_t chunk = 500;
+    for (size_t start = 0; start < names.size(); start += chunk)
+    {
+        size_t count = std::min(chunk, names.size() - start);
+        std::string qmarks = "";
+        for (size_t i = 0; i < count; i++)
+        {
+            qmarks.append("?,");
+        }
+        qmarks.pop_back(); // remove last comma.
+        SQLite::Statement query(gameDB, "SELECT name,disk FROM games WHERE name IN (" + qmarks + ");");
+        for (size_t i = 0; i < count; i++)
+        {
+            query.bind((int)i + 1, names[start + i]);
+        }
+        while (query.executeStep())
+        {
+            games.push_back(gameMap{query.getColumn(0).getString(), query.getColumn(1).getString()});
+        }
+    }
+    return games;
+}
+
+namespace
+{
+    bool HasTable(SQLite::Database &gameDB, const std::string &table)
+    {
+        SQLite::Statement exists(gameDB, "SELECT 1 FROM sqlite_master WHERE type='table' AND name=?;");
+        exists.bind(1, table);
+        return exists.executeStep();
+    }
+
+    /*Run "SELECT ... WHERE Game IN (...)" over games in chunks and hand each row to onRow.*/
+    void ForGameRows(SQLite::Database &gameDB, const std::string &select, const std::vector<std::string> &games, const std::function<void(SQLite::Statement &)> &onRow)
+    {
+        // Same chunks as LoadGames, to stay under SQLite's bound variable limit.
+        const size_t chunk = 500;
+        for (size_t start = 0; start < games.size(); start += chunk)
+        {
+            size_t count = std::min(chunk, games.size() - start);
+            std::string qmarks = "";
+            for (size_t i = 0; i < count; i++)
+            {
+                qmarks.append("?,");
+            }
+            qmarks.pop_back(); // remove last comma.
+            SQLite::Statement query(gameDB, select + " WHERE Game IN (" + qmarks + ");");
+            for (size_t i = 0; i < count; i++)
+            {
+                query.bind((int)i + 1, games[start + i]);
+            }
+            while (query.executeStep())
+            {
+                onRow(query);
+            }
+        }
+    }
+
+    std::string LowerHex(std::string hex)
+    {
+        std::transform(hex.begin(), hex.end(), hex.begin(), ::tolower);
+        return hex;
+    }
+}
+
+romChecksums LoadRomChecksums(SQLite::Database &gameDB, const std::vector<std::string> &games)
+{
+    TraceSpan span("LoadRomChecksums", "gamedb");
+    romChecksums checksums;
+    if (!HasTable(gameDB, "roms"))
+    {
+        return checksums;
+    }
+    ForGameRows(gameDB, "SELECT Game, Name, Size, CRC, SHA1 FROM roms", games, [&](SQLite::Statement &query)
+                {
+        romChecksum rom;
+        rom.name = query.getColumn(1).getString();
+        rom.size = (uint64_t)query.getColumn(2).getInt64();
+        std::string crc = query.getColumn(3).getString();
+        rom.crc = (uint32_t)std::strtoul(crc.c_str(), nullptr, 16);
+        rom.nodump = crc.empty();
+        rom.sha1 = LowerHex(query.getColumn(4).getString());
+        checksums[query.getColumn(0).getString()].push_back(rom); });
+    return checksums;
+}
+
+diskChecksums LoadDiskChecksums(SQLite::Database &gameDB, const std::vector<std::string> &games)
+{
+    TraceSpan span("LoadDiskChecksums", "gamedb");
+    diskChecksums checksums;
+    if (!HasTable(gameDB, "disks"))
+    {
+        return checksums;
+    }
+    ForGameRows(gameDB, "SELECT Game, Name, SHA1 FROM disks", games, [&](SQLite::Statement &query)
+                { checksums[query.getColumn(0).getString()].push_back(diskChecksum{query.getColumn(1).getString(), LowerHex(query.getColumn(2).getString())}); });
+    return checksums;
+}
+
+gameChecksums LoadChecksums(SQLite::Database &gameDB, const std::vector<gameMap> &games)
+{
+    std::vector<std::string> names;
+    names.reserve(games.size());
+    for (const gameMap &game : games)
+    {
+        names.push_back(game.name);
+    }
+    return gameChecksums{LoadRomChecksums(gameDB, names), LoadDiskChecksums(gameDB, names)};
+}
+
+dependencyGraph LoadDependencyGraph(SQLite::Database &gameDB)
+{
+    TraceSpan span("LoadDependencyGraph", "gamedb");
+    dependencyGraph graph;
+    SQLite::Statement query(gameDB, "SELECT Name, ROMof FROM games WHERE ROMof != '';");
+    while (query.executeStep())
+    {
+        graph.needs[query.getColumn(0).getString()].push_back(query.getColumn(1).getString());
+    }
+    if (HasTable(gameDB, "devices"))
+    {
+        SQLite::Statement devices(gameDB, "SELECT Game, Device FROM devices;");
+        while (devices.executeStep())
+        {
+            graph.needs[devices.getColumn(0).getString()].push_back(devices.getColumn(1).getString());
+        }
+    }
+    graph.loaded = true;
+    span.Arg("games", (int64_t)graph.needs.size());
+    return graph;
+}
+
+std::vector<gameMap> DependencyClosure(const dependencyGraph &graph, const std::vector<gameMap> &games)
+{
+    TraceSpan span("DependencyClosure", "run");
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> pending;
+    seen.reserve(games.size() * 2);
+    for (const gameMap &game : games)
+    {
+        seen.insert(game.name);
+        pending.push_back(game.name);
+    }
+    std::vector<gameMap> required;
+    while (!pending.empty())
+    {
+        std::string game = std::move(pending.back());
+        pending.pop_back();
+        auto needs = graph.needs.find(game);
+        if (needs == graph.needs.end())
+        {
+            continue;
+        }
+        for (const std::string &set : needs->second)
+        {
+            // seen also stops a bad game DB whose ROMof loops back on itself.
+            if (!set.empty() && seen.insert(set).second)
+            {
+                required.push_back(gameMap{set, ""});
+                pending.push_back(set);
+            }
+        }
+    }
+    span.Arg("required", (int64_t)required.size());
+    return required;
+}
+
+namespace
+{
+    /*
+    *Bring main.table up to newcat.table, one game at a time: any game whose rows differ gets the new rows.
+    *Tables keyed by a Game column, like roms and disks. Returns the number of games changed. Leaves main alone if newcat has no such table.
+    */
+    int ApplyGameRowsDelta(SQLite::Database &db, const std::string &table)
+    {
+        auto columnsOf = [&](const std::string &schema)
+        {
+            std::vector<std::string> columns;
+            SQLite::Statement query(db, "SELECT name FROM pragma_table_info('" + table + "', '" + schema + "') ORDER BY cid;");
+            while (query.executeStep())
+            {
+                columns.push_back(query.getColumn(0).getString());
+            }
+            return columns;
+        };
+        std::vector<std::string> newColumns = columnsOf("newcat");
+        if (newColumns.empty())
+        {
+            return 0;
+        }
+        std::vector<std::string> columns = columnsOf("main");
+        if (columns != newColumns)
+        {
+            // New, or its layout changed. Take the new one whole.
+            db.exec("DROP TABLE IF EXISTS main.\"" + table + "\";");
+            db.exec("CREATE TABLE main.\"" + table + "\" AS SELECT * FROM newcat.\"" + table + "\";");
+            db.exec("CREATE INDEX main.\"idx" + table + "game\" ON \"" + table + "\" (\"Game\");");
+            SQLite::Statement count(db, "SELECT COUNT(DISTINCT Game) FROM main.\"" + table + "\";");
+            return count.executeStep() ? count.getColumn(0).getInt() : 0;
+        }
+        db.exec("DROP TABLE IF EXISTS temp.delta_rows;");
+        db.exec("CREATE TEMP TABLE delta_rows AS SELECT Game FROM (SELECT * FROM main.\"" + table + "\" EXCEPT SELECT * FROM newcat.\"" + table + "\");");
+        db.exec("INSERT INTO temp.delta_rows SELECT Game FROM (SELECT * FROM newcat.\"" + table + "\" EXCEPT SELECT * FROM main.\"" + table + "\");");
+        db.exec("DELETE FROM main.\"" + table + "\" WHERE Game IN (SELECT Game FROM temp.delta_rows);");
+        db.exec("INSERT INTO main.\"" + table + "\" SELECT * FROM newcat.\"" + table + "\" WHERE Game IN (SELECT Game FROM temp.delta_rows);");
+        SQLite::Statement count(db, "SELECT COUNT(DISTINCT Game) FROM temp.delta_rows;");
+        return count.executeStep() ? count.getColumn(0).getInt() : 0;
+    }
+}
+
+catalogDelta ApplyCatalogDelta(const std::string &gameDBFile, const std::string &newGameDBFile, SQLite::Database &profileDB, bool remapRenamed)
+{
+    TraceSpan span("ApplyCatalogDelta", "gamedb");
+    catalogDelta delta;
+    SQLite::Database db(gameDBFile, SQLite::OPEN_READWRITE);
+    SQLite::Statement attach(db, "ATTACH DATABASE ? AS newcat;");
+    attach.bind(1, newGameDBFile);
+    attach.exec();
+
+    // Both DBs must have the same games columns or a row by row diff makes no sense.
+    std::vector<std::string> columns;
+    std::vector<std::string> newColumns;
+    {
+        SQLite::Statement query(db, "SELECT name FROM pragma_table_info('games', 'main') ORDER BY cid;");
+        while (query.executeStep())
+        {
+            columns.push_back(query.getColumn(0).getString());
+        }
+        SQLite::Statement query2(db, "SELECT name FROM pragma_table_info('games', 'newcat') ORDER BY cid;");
+        while (query2.executeStep())
+        {
+            newColumns.push_back(query2.getColumn(0).getString());
+        }
+    }
+    if (columns.empty() || columns != newColumns)
+    {
+        throw std::runtime_error("The new game DB has different columns than the installed one. Replace romper.romper instead.");
+    }
+    std::string columnList = "";
+    std::string changed = "";
+    for (const std::string &c : columns)
+    {
+        columnList.append("\"" + c + "\",");
+        changed.append("n.\"" + c + "\" IS NOT o.\"" + c + "\" OR ");
+    }
+    columnList.pop_back();
+    changed.erase(changed.size() - 4); // remove last " OR "
+
+    db.exec("CREATE TEMP TABLE delta_removed AS SELECT Name FROM main.games WHERE Name NOT IN (SELECT Name FROM newcat.games);");
+    db.exec("CREATE TEMP TABLE delta_inserted AS SELECT Name FROM newcat.games WHERE Name NOT IN (SELECT Name FROM main.games);");
+    db.exec("CREATE TEMP TABLE delta_updated AS SELECT n.Name FROM newcat.games n JOIN main.games o ON o.Name = n.Name WHERE " + changed + ";");
+
+    // A rename is a removed game and an inserted game sharing a description that nothing else in the delta has.
+    {
+        std::map<std::string, int> oldCount;
+        std::map<std::string, int> newCount;
+        std::vector<std::pair<std::string, std::string>> pairs;
+        SQLite::Statement query(db, "SELECT o.Name, n.Name FROM main.games o JOIN newcat.games n ON n.Description = o.Description "
+                                    "WHERE o.Name IN (SELECT Name FROM temp.delta_removed) AND n.Name IN (SELECT Name FROM temp.delta_inserted);");
+        while (query.executeStep())
+        {
+            pairs.emplace_back(query.getColumn(0).getString(), query.getColumn(1).getString());
+            oldCount[pairs.back().first]++;
+            newCount[pairs.back().second]++;
+        }
+        for (const auto &p : pairs)
+        {
+            if (oldCount[p.first] == 1 && newCount[p.second] == 1)
+            {
+                delta.renamed[p.first] = p.second;
+            }
+        }
+    }
+
+    {
+        SQLite::Transaction transaction(db);
+        delta.removed = db.exec("DELETE FROM main.games WHERE Name IN (SELECT Name FROM temp.delta_removed);");
+        db.exec("DELETE FROM main.games WHERE Name IN (SELECT Name FROM temp.delta_updated);");
+        delta.inserted = db.exec("INSERT INTO main.games (" + columnList + ") SELECT " + columnList + " FROM newcat.games WHERE Name IN (SELECT Name FROM temp.delta_inserted);");
+        delta.updated = db.exec("INSERT INTO main.games (" + columnList + ") SELECT " + columnList + " FROM newcat.games WHERE Name IN (SELECT Name FROM temp.delta_updated);");
+        delta.checksumsChanged = ApplyGameRowsDelta(db, "roms") + ApplyGameRowsDelta(db, "disks");
+        delta.devicesChanged = ApplyGameRowsDelta(db, "devices");
+        transaction.commit();
+    }
+
+    // Report and optionally remap the profile games that point at removed games.
+    std::vector<std::string> removedGames;
+    {
+        SQLite::Statement query(db, "SELECT Name FROM temp.delta_removed;");
+        while (query.executeStep())
+        {
+            removedGames.push_back(query.getColumn(0).getString());
+        }
+    }
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement profileQuery(profileDB, "SELECT profile FROM games WHERE game = ? ORDER BY profile;");
+    SQLite::Statement remapQuery(profileDB, "UPDATE OR IGNORE games SET game = ? WHERE game = ?;");
+    SQLite::Statement cleanupQuery(profileDB, "DELETE FROM games WHERE game = ?;");
+    for (const std::string &game : removedGames)
+    {
+        auto rename = delta.renamed.find(game);
+        profileQuery.bind(1, game);
+        while (profileQuery.executeStep())
+        {
+            std::string entry = profileQuery.getColumn(0).getString() + ": " + game;
+            if (rename != delta.renamed.end())
+            {
+                entry.append(" renamed to " + rename->second);
+            }
+            else
+            {
+                entry.append(" removed");
+            }
+            delta.affectedEntries.push_back(entry);
+        }
+        profileQuery.reset();
+        if (remapRenamed && rename != delta.renamed.end())
+        {
+            remapQuery.bind(1, rename->second);
+            remapQuery.bind(2, game);
+            delta.remapped += remapQuery.exec();
+            remapQuery.reset();
+            // Profiles that already had the new name keep a stale row. Drop it.
+            cleanupQuery.bind(1, game);
+            cleanupQuery.exec();
+            cleanupQuery.reset();
+        }
+    }
+    transaction.commit();
+    return delta;
+}
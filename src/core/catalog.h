@@ -0,0 +1,149 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/catalog.h
+// Purpose:     Game DB queries. The game DB is romper.romper, built from MAME data.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace SQLite
+{
+    class Database;
+}
+
+struct gameMap
+{
+    std::string name; //name of the game
+    std::string disk; //name of the game's disk. If blank, no disk
+};
+
+struct gameRow //One row of the games table, as shown in the grid.
+{
+    std::string name;
+    std::string genre;
+    std::string cat;
+    std::string developer;
+    std::string publisher;
+    std::string year;
+    std::string series;
+    std::string description;
+    std::string romOf; //Parent or BIOS set. Blank if none.
+    std::string disk; //CHD name. Blank if none.
+    std::string rank;
+    int screenless;
+};
+
+/*One ROM of a game, from the game DB's optional roms table. MAME lists these for every set.*/
+struct romChecksum
+{
+    std::string name; //Name inside the zip.
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    std::string sha1; //40 lowercase hex digits. Blank if unknown.
+    bool nodump = false; //No CRC in the game DB: a ROM MAME knows no dump of. Sets don't have it, so it's never checked or rebuilt.
+};
+
+using romChecksums = std::unordered_map<std::string, std::vector<romChecksum>>; //Game name -> its ROMs.
+
+/*One CHD of a game, from the game DB's optional disks table.*/
+struct diskChecksum
+{
+    std::string name; //The CHD's name without .chd.
+    std::string sha1; //The SHA1 in the CHD's header, 40 lowercase hex digits.
+};
+
+using diskChecksums = std::unordered_map<std::string, std::vector<diskChecksum>>; //Game name -> its disks.
+
+/*What the game DB knows about some games' files, for checking them once written.*/
+struct gameChecksums
+{
+    romChecksums roms;
+    diskChecksums disks;
+};
+
+/*
+*What each game needs besides its own files to run: its ROMof parent or BIOS, and the devices in the game DB's optional devices table.
+*Loaded once per game DB so closing over a big profile is a walk in memory instead of a query per game.
+*/
+struct dependencyGraph
+{
+    std::unordered_map<std::string, std::vector<std::string>> needs; //Game -> the sets it needs. Games that need nothing aren't in it.
+    bool loaded = false; //False until LoadDependencyGraph has filled it.
+};
+
+/*What to search for. BuildGrid fills this from the search box and the Select menu, the CLI from its arguments.*/
+struct searchFilter
+{
+    std::string field = "Description"; //Name, Description, Developer or Series.
+    std::string value; //Matched as a prefix. Empty matches everything.
+    bool screenless = false; //If false, screenless games are left out.
+    std::vector<std::string> excludedRanks; //Ranks to leave out. "" is the blank rank.
+    std::vector<std::string> excludedGenres; //Genres to leave out. "" is the blank genre.
+    bool onlyHave = false; //If true, only games in temp.have. See SetHaveTable.
+};
+
+/*Build the WHERE clause for a search. If needBind is set, bind value + "%" to the only "?" in it.*/
+std::string SearchWhere(const searchFilter &filter, bool &needBind);
+
+/*
+*One page of search results ordered by orderBy (a games column) and orderDirection (ASC or DESC).
+*totalGames is set to the number of games matching the filter across all pages.
+*/
+std::vector<gameRow> SearchGames(SQLite::Database &gameDB, const searchFilter &filter, const std::string &orderBy, const std::string &orderDirection, int limit, int page, int &totalGames);
+
+/*Fill the connection's temp.have table with the games a searchFilter's onlyHave keeps.*/
+void SetHaveTable(SQLite::Database &gameDB, const std::vector<std::string> &names);
+
+/*Add have and remove notHave from temp.have, e.g. after a SourceWatcher saw files come and go.*/
+void UpdateHaveTable(SQLite::Database &gameDB, const std::vector<std::string> &have, const std::vector<std::string> &notHave);
+
+/*The distinct values of a games column, sorted. Used for the rank and genre menus.*/
+std::vector<std::string> CatalogValues(SQLite::Database &gameDB, const std::string &column);
+
+/*Look up games by name. Unknown names are skipped.*/
+std::vector<gameMap> LoadGames(SQLite::Database &gameDB, const std::vector<std::string> &names);
+
+/*
+*The ROMs of games from the roms table (Game, Name, Size, CRC, SHA1). CRC and SHA1 are hex, as in MAME's XML.
+*Game DBs from before checksums have no roms table. Then this is empty and nothing can be verified.
+*/
+romChecksums LoadRomChecksums(SQLite::Database &gameDB, const std::vector<std::string> &games);
+
+/*The disks of games from the disks table (Game, Name, SHA1). Empty for game DBs without one.*/
+diskChecksums LoadDiskChecksums(SQLite::Database &gameDB, const std::vector<std::string> &games);
+
+/*LoadRomChecksums and LoadDiskChecksums for a run's games.*/
+gameChecksums LoadChecksums(SQLite::Database &gameDB, const std::vector<gameMap> &games);
+
+/*Read every game's ROMof and, if the game DB has a devices table (Game, Device), the device sets with ROMs each game uses.*/
+dependencyGraph LoadDependencyGraph(SQLite::Database &gameDB);
+
+/*
+*The sets games need that aren't in games themselves: parents, BIOSes and devices, and whatever those need in turn. Each is listed once.
+*They are added as ROM zips only. A parent's CHD isn't needed by its clones, so it's only copied if the parent is selected.
+*/
+std::vector<gameMap> DependencyClosure(const dependencyGraph &graph, const std::vector<gameMap> &games);
+
+/*The result of applying a new game DB on top of the installed one.*/
+struct catalogDelta
+{
+    int inserted = 0; //Games only in the new game DB.
+    int updated = 0; //Games in both, but with at least one changed column.
+    int removed = 0; //Games no longer in the new game DB.
+    std::map<std::string, std::string> renamed; //Removed game -> inserted game with the same unique description.
+    std::vector<std::string> affectedEntries; //"profile: game" lines for profile games that were removed or renamed.
+    int remapped = 0; //Profile entries moved to the renamed game.
+    int checksumsChanged = 0; //Games whose rows in the checksum tables were added, changed or removed.
+    int devicesChanged = 0; //Games whose rows in the devices table were added, changed or removed.
+};
+
+/*
+*Diff newGameDBFile against the installed game DB and apply only the inserted, updated and removed rows.
+*If remapRenamed, profile entries of renamed games are moved to the new name. Throws on error.
+*/
+catalogDelta ApplyCatalogDelta(const std::string &gameDBFile, const std::string &newGameDBFile, SQLite::Database &profileDB, bool remapRenamed);
@@ -0,0 +1,413 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/chd.cpp
+// Purpose:     Reads MAME CHD headers and checks CHDs against the game DB's disk SHA1s
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/chd.h"
+#include "core/checksum.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    const size_t BLOCK_BYTES = 4 << 20; //Read size for full checks.
+
+    // Everything in a CHD is big endian.
+    uint32_t Be32(const unsigned char *p)
+    {
+        return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+    }
+
+    uint64_t Be64(const unsigned char *p)
+    {
+        return (uint64_t)Be32(p) << 32 | Be32(p + 4);
+    }
+
+    using filePtr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    bool ReadAt(FILE *file, uint64_t offset, void *buffer, size_t length)
+    {
+#ifdef _WIN32
+        if (_fseeki64(file, (int64_t)offset, SEEK_SET) != 0)
+#else
+        if (fseeko(file, (off_t)offset, SEEK_SET) != 0)
+#endif
+        {
+            return false;
+        }
+        return std::fread(buffer, 1, length, file) == length;
+    }
+
+    /*A SHA1 from a header, or "" if it is all zeros (no parent, or not computed).*/
+    std::string HeaderSha1(const unsigned char *p)
+    {
+        static const unsigned char zeros[20] = {};
+        return std::memcmp(p, zeros, 20) == 0 ? "" : Sha1Hex(p);
+    }
+
+    std::string TagName(uint32_t tag)
+    {
+        std::string name;
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            char c = (char)(tag >> shift);
+            if (c != 0)
+            {
+                name.push_back(c);
+            }
+        }
+        return name;
+    }
+
+    bool HexToDigest(const std::string &hex, unsigned char digest[20])
+    {
+        if (hex.size() != 40)
+        {
+            return false;
+        }
+        for (int i = 0; i < 20; i++)
+        {
+            digest[i] = (unsigned char)std::strtoul(hex.substr(2 * i, 2).c_str(), nullptr, 16);
+        }
+        return true;
+    }
+
+    /*
+    *The SHA1 MAME lists for a v4 or v5 CHD: the raw data's SHA1, then the tag and SHA1 of each checksummed metadata entry in sorted order.
+    *Returns "" on success, else the error.
+    */
+    std::string OverallSha1(FILE *file, const chdHeader &header, std::string &sha1)
+    {
+        const unsigned char CHECKSUM_FLAG = 0x01;
+        std::vector<std::array<unsigned char, 24>> hashes;
+        uint64_t offset = header.metaOffset;
+        // A corrupt chain could loop, and real CHDs have a handful of entries.
+        for (int entries = 0; offset != 0; entries++)
+        {
+            unsigned char entry[16];
+            if (entries > 65536 || offset + 16 > header.fileBytes || !ReadAt(file, offset, entry, sizeof(entry)))
+            {
+                return "Corrupt CHD metadata";
+            }
+            uint32_t length = Be32(entry + 4) & 0xFFFFFF;
+            if (offset + 16 + length > header.fileBytes)
+            {
+                return "CHD metadata is past the end of the file (truncated?)";
+            }
+            if (entry[4] & CHECKSUM_FLAG)
+            {
+                std::vector<unsigned char> data(length);
+                if (length > 0 && !ReadAt(file, offset + 16, data.data(), length))
+                {
+                    return "Could not read the CHD metadata";
+                }
+                std::array<unsigned char, 24> hash;
+                std::memcpy(hash.data(), entry, 4);
+                Sha1 dataSha1;
+                dataSha1.Update(data.data(), data.size());
+                dataSha1.Digest(hash.data() + 4);
+                hashes.push_back(hash);
+            }
+            offset = Be64(entry + 8);
+        }
+        std::sort(hashes.begin(), hashes.end());
+        unsigned char raw[20];
+        if (!HexToDigest(header.rawSha1, raw))
+        {
+            return "The CHD has no raw SHA1";
+        }
+        Sha1 overall;
+        overall.Update(raw, sizeof(raw));
+        for (const auto &hash : hashes)
+        {
+            overall.Update(hash.data(), hash.size());
+        }
+        sha1 = overall.HexDigest();
+        return "";
+    }
+
+    /*
+    *Call fill on a reader thread and consume on this one, so the disk never waits for the hasher or the other way round.
+    *Blocks are blockBytes each and four are in flight at most.
+    *fill puts up to capacity bytes in buffer and returns how many, 0 at the end. It sets error and returns 0 if a read fails.
+    */
+    std::string Pipeline(size_t blockBytes, const std::function<size_t(unsigned char *buffer, size_t capacity, std::string &error)> &fill, const std::function<void(const unsigned char *data, size_t length)> &consume)
+    {
+        const size_t blocks = 4;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::pair<std::vector<unsigned char>, size_t>> ready;
+        std::vector<std::vector<unsigned char>> spare(blocks, std::vector<unsigned char>(blockBytes));
+        bool finished = false;
+        std::string error;
+        std::thread reader([&]()
+                           {
+            while (true)
+            {
+                std::vector<unsigned char> buffer;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    changed.wait(lock, [&]() { return !spare.empty(); });
+                    buffer = std::move(spare.back());
+                    spare.pop_back();
+                }
+                std::string readError;
+                size_t length = fill(buffer.data(), buffer.size(), readError);
+                std::lock_guard<std::mutex> lock(mutex);
+                if (length == 0)
+                {
+                    error = readError;
+                    break;
+                }
+                ready.push_back({std::move(buffer), length});
+                changed.notify_all();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+            changed.notify_all(); });
+        while (true)
+        {
+            std::pair<std::vector<unsigned char>, size_t> block;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]() { return !ready.empty() || finished; });
+                if (ready.empty())
+                {
+                    break;
+                }
+                block = std::move(ready.front());
+                ready.pop_front();
+            }
+            consume(block.first.data(), block.second);
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push_back(std::move(block.first));
+            changed.notify_all();
+        }
+        reader.join();
+        return error;
+    }
+}
+
+std::string ReadChdHeader(const std::string &path, chdHeader &header)
+{
+    header = chdHeader();
+    filePtr file(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (!file)
+    {
+        return "Could not open " + path;
+    }
+    unsigned char h[124] = {};
+    size_t got = std::fread(h, 1, sizeof(h), file.get());
+    if (got < 16 || std::memcmp(h, "MComprHD", 8) != 0)
+    {
+        return "Not a CHD: " + path;
+    }
+#ifdef _WIN32
+    _fseeki64(file.get(), 0, SEEK_END);
+    header.fileBytes = (uint64_t)_ftelli64(file.get());
+#else
+    fseeko(file.get(), 0, SEEK_END);
+    header.fileBytes = (uint64_t)ftello(file.get());
+#endif
+    header.headerBytes = Be32(h + 8);
+    header.version = Be32(h + 12);
+    const uint32_t expectedBytes[] = {0, 0, 0, 120, 108, 124};
+    if (header.version < 3 || header.version > 5)
+    {
+        return "Unsupported CHD version " + std::to_string(header.version) + ": " + path;
+    }
+    if (header.headerBytes != expectedBytes[header.version] || got < header.headerBytes)
+    {
+        return "Corrupt CHD header: " + path;
+    }
+    if (header.version == 5)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if (Be32(h + 16 + 4 * i) != 0)
+            {
+                header.compressors.push_back(TagName(Be32(h + 16 + 4 * i)));
+            }
+        }
+        header.logicalBytes = Be64(h + 32);
+        header.mapOffset = Be64(h + 40);
+        header.metaOffset = Be64(h + 48);
+        header.hunkBytes = Be32(h + 56);
+        header.unitBytes = Be32(h + 60);
+        header.rawSha1 = HeaderSha1(h + 64);
+        header.sha1 = HeaderSha1(h + 84);
+        header.parentSha1 = HeaderSha1(h + 104);
+    }
+    else
+    {
+        // v3 and v4 have one compression type for the whole file.
+        const char *compression[] = {"", "zlib", "zlib+", "avhu"};
+        uint32_t type = Be32(h + 20);
+        if (type > 0)
+        {
+            header.compressors.push_back(type < 4 ? compression[type] : std::to_string(type));
+        }
+        header.logicalBytes = Be64(h + 28);
+        header.metaOffset = Be64(h + 36);
+        if (header.version == 4)
+        {
+            header.hunkBytes = Be32(h + 44);
+            header.sha1 = HeaderSha1(h + 48);
+            header.parentSha1 = HeaderSha1(h + 68);
+            header.rawSha1 = HeaderSha1(h + 88);
+        }
+        else
+        {
+            header.hunkBytes = Be32(h + 76);
+            header.sha1 = HeaderSha1(h + 80);
+            header.parentSha1 = HeaderSha1(h + 100);
+        }
+    }
+    if (header.hunkBytes == 0)
+    {
+        return "Corrupt CHD header: " + path;
+    }
+    return "";
+}
+
+std::string VerifyChd(const std::string &path, const std::string &expectedSha1, bool full, bool *hashed)
+{
+    TraceSpan span(full ? "VerifyChd full" : "VerifyChd", "verify");
+    if (hashed)
+    {
+        *hashed = full;
+    }
+    chdHeader header;
+    std::string error = ReadChdHeader(path, header);
+    if (!error.empty())
+    {
+        return error;
+    }
+    if (!expectedSha1.empty() && header.sha1 != expectedSha1)
+    {
+        return "Wrong CHD " + path + ": SHA1 " + header.sha1 + ", expected " + expectedSha1;
+    }
+    filePtr file(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (!file)
+    {
+        return "Could not open " + path;
+    }
+
+    // The map is written after the hunks, so a file cut short loses it.
+    uint64_t hunks = (header.logicalBytes + header.hunkBytes - 1) / header.hunkBytes;
+    uint64_t mapEnd = 0;
+    if (header.version == 5)
+    {
+        if (header.compressors.empty())
+        {
+            mapEnd = header.mapOffset + hunks * 4;
+        }
+        else
+        {
+            unsigned char map[16];
+            if (header.mapOffset + 16 > header.fileBytes || !ReadAt(file.get(), header.mapOffset, map, sizeof(map)))
+            {
+                return "CHD map is past the end of the file (truncated?): " + path;
+            }
+            mapEnd = header.mapOffset + 16 + Be32(map);
+        }
+    }
+    else
+    {
+        mapEnd = header.headerBytes + hunks * 16;
+    }
+    if (mapEnd > header.fileBytes)
+    {
+        return "CHD map is past the end of the file (truncated?): " + path;
+    }
+    if (header.version >= 4)
+    {
+        std::string sha1;
+        error = OverallSha1(file.get(), header, sha1);
+        if (!error.empty())
+        {
+            return error + ": " + path;
+        }
+        if (sha1 != header.sha1)
+        {
+            return "CHD metadata doesn't match its SHA1: " + path;
+        }
+    }
+    if (!full)
+    {
+        return "";
+    }
+
+    if (header.version == 5 && header.compressors.empty())
+    {
+        // Uncompressed: hunk i is at map[i] * hunkBytes, or all zeros if map[i] is 0. Hash them in order.
+        std::vector<unsigned char> map((size_t)hunks * 4);
+        if (!map.empty() && !ReadAt(file.get(), header.mapOffset, map.data(), map.size()))
+        {
+            return "Could not read the CHD map: " + path;
+        }
+        uint64_t hunk = 0;
+        Sha1 raw;
+        error = Pipeline(std::max<size_t>(BLOCK_BYTES, header.hunkBytes), [&](unsigned char *buffer, size_t capacity, std::string &readError) -> size_t
+                         {
+            size_t length = 0;
+            while (hunk < hunks && length + header.hunkBytes <= capacity)
+            {
+                uint64_t bytes = std::min<uint64_t>(header.hunkBytes, header.logicalBytes - hunk * header.hunkBytes);
+                uint64_t offset = (uint64_t)Be32(&map[(size_t)hunk * 4]) * header.hunkBytes;
+                if (offset == 0)
+                {
+                    std::memset(buffer + length, 0, (size_t)bytes);
+                }
+                else if (offset + bytes > header.fileBytes || !ReadAt(file.get(), offset, buffer + length, (size_t)bytes))
+                {
+                    readError = "Could not read hunk " + std::to_string(hunk) + " of " + path;
+                    return 0;
+                }
+                length += (size_t)bytes;
+                hunk++;
+            }
+            return length; },
+                         [&](const unsigned char *data, size_t length)
+                         { raw.Update(data, length); });
+        if (!error.empty())
+        {
+            return error;
+        }
+        if (raw.HexDigest() != header.rawSha1)
+        {
+            return "Bad data in " + path + ": the raw SHA1 doesn't match";
+        }
+        return "";
+    }
+
+    // Compressed hunks would need MAME's codecs to hash, so these are read end to end to make sure every byte is readable.
+    if (hashed)
+    {
+        *hashed = false;
+    }
+    uint64_t position = 0;
+    std::rewind(file.get());
+    return Pipeline(BLOCK_BYTES, [&](unsigned char *buffer, size_t capacity, std::string &readError) -> size_t
+                    {
+        size_t length = std::fread(buffer, 1, capacity, file.get());
+        position += length;
+        if (length == 0 && position < header.fileBytes)
+        {
+            readError = "Could not read " + path;
+        }
+        return length; },
+                    [](const unsigned char *, size_t) {});
+}
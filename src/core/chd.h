@@ -0,0 +1,41 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/chd.h
+// Purpose:     Reads MAME CHD headers and checks CHDs against the game DB's disk SHA1s
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*What a CHD's header says about it. Versions 3 to 5 are understood. MAME has written v5 since 0.146.*/
+struct chdHeader
+{
+    uint32_t version = 0;
+    uint32_t headerBytes = 0;
+    std::vector<std::string> compressors; //e.g. "lzma", "zlib", "huff", "flac", "cdlz". Empty if uncompressed.
+    uint64_t logicalBytes = 0; //Size of the disk image it holds.
+    uint32_t hunkBytes = 0; //Size of each hunk of the image.
+    uint32_t unitBytes = 0; //v5: sector size.
+    uint64_t mapOffset = 0; //v5: where the hunk map is.
+    uint64_t metaOffset = 0; //Where the first metadata entry is. 0 if none.
+    std::string sha1; //The SHA1 MAME lists for the disk: the raw data and metadata together.
+    std::string rawSha1; //v4 and up: the SHA1 of the raw data alone.
+    std::string parentSha1; //Blank unless this is a diff against a parent CHD.
+    uint64_t fileBytes = 0; //Size of the file.
+};
+
+/*Read the header of the CHD at path. Returns "" on success, else the error.*/
+std::string ReadChdHeader(const std::string &path, chdHeader &header);
+
+/*
+*Check a CHD against the SHA1 the game DB has for it.
+*The quick check reads the header, the metadata and the map's size: the SHA1 must match, the metadata must hash to it,
+*and the map (written last) must be whole, so a truncated copy fails in well under a millisecond.
+*If full, the whole file is also read, with a reader thread feeding a hasher thread. Uncompressed CHDs have their
+*raw data hashed and compared to the header. Compressed hunks aren't decoded, so those are only read end to end,
+*and hashed (if given) is set false to say so.
+*Returns "" if the CHD is good, else what is wrong with it.
+*/
+std::string VerifyChd(const std::string &path, const std::string &expectedSha1, bool full, bool *hashed = nullptr);
@@ -0,0 +1,399 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/checksum.cpp
+// Purpose:     CRC32 and SHA1, the checksums MAME lists for every ROM. Uses the CPU's instructions for them when it has them.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/checksum.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ROMPER_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define ROMPER_ARM_CRC
+#include <arm_acle.h>
+#endif
+
+namespace
+{
+    // Slicing by 8: eight tables so the portable CRC does 8 bytes per step.
+    struct crcTables
+    {
+        uint32_t t[8][256];
+        crcTables()
+        {
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++)
+                {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                for (int s = 1; s < 8; s++)
+                {
+                    t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+                }
+            }
+        }
+    };
+    const crcTables tables;
+
+    //crc is the raw register here, not the inverted value callers see.
+    uint32_t Crc32Table(uint32_t crc, const unsigned char *p, size_t length)
+    {
+        while (length >= 8)
+        {
+            uint32_t lo, hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            lo = __builtin_bswap32(lo);
+            hi = __builtin_bswap32(hi);
+#endif
+            lo ^= crc;
+            crc = tables.t[7][lo & 0xFF] ^ tables.t[6][(lo >> 8) & 0xFF] ^ tables.t[5][(lo >> 16) & 0xFF] ^ tables.t[4][lo >> 24] ^
+                  tables.t[3][hi & 0xFF] ^ tables.t[2][(hi >> 8) & 0xFF] ^ tables.t[1][(hi >> 16) & 0xFF] ^ tables.t[0][hi >> 24];
+            p += 8;
+            length -= 8;
+        }
+        while (length--)
+        {
+            crc = tables.t[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+#ifdef ROMPER_X86_KERNELS
+    /*
+    *Carry-less multiply folding (Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ").
+    *Folds 64 bytes per step, then reduces to 32 bits. length must be at least 64 and a multiple of 16.
+    *Note SSE4.2's crc32 instruction is CRC32C, a different polynomial, so it can't be used for zip CRCs.
+    */
+    __attribute__((target("pclmul,sse4.1"))) uint32_t Crc32Pclmul(uint32_t crc, const unsigned char *p, size_t length)
+    {
+        alignas(16) static const uint64_t k1k2[2] = {0x0154442bd4, 0x01c6e41596};
+        alignas(16) static const uint64_t k3k4[2] = {0x01751997d0, 0x00ccaa009e};
+        alignas(16) static const uint64_t k5k0[2] = {0x0163cd6124, 0x0000000000};
+        alignas(16) static const uint64_t poly[2] = {0x01db710641, 0x01f7011641};
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+        x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+        x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+        x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+        x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+        x0 = _mm_load_si128((const __m128i *)k1k2);
+        p += 64;
+        length -= 64;
+        while (length >= 64)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+            p += 64;
+            length -= 64;
+        }
+
+        // Fold the four lanes into one.
+        x0 = _mm_load_si128((const __m128i *)k3k4);
+        for (__m128i next : {x2, x3, x4})
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+        }
+        while (length >= 16)
+        {
+            x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)p)), x5);
+            p += 16;
+            length -= 16;
+        }
+
+        // 128 bits to 64.
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction to 32 bits.
+        x0 = _mm_load_si128((const __m128i *)poly);
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        return (uint32_t)_mm_extract_epi32(x1, 1);
+    }
+
+    /*SHA1 of whole 64 byte blocks with the SHA extensions.*/
+    __attribute__((target("sha,sse4.1"))) void Sha1BlocksShaNi(uint32_t state[5], const unsigned char *p, size_t blocks)
+    {
+        const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+        __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+        __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+        while (blocks--)
+        {
+            __m128i abcdSave = abcd;
+            __m128i e0Save = e0;
+            __m128i msg[4];
+            for (int i = 0; i < 4; i++)
+            {
+                msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16 * i)), mask);
+            }
+            __m128i abcdPrev = abcd;
+            // Twenty groups of four rounds. Groups 4 and up extend the message schedule in place.
+#pragma GCC unroll 20
+            for (int i = 0; i < 20; i++)
+            {
+                __m128i w;
+                if (i < 4)
+                {
+                    w = msg[i];
+                }
+                else
+                {
+                    w = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(msg[i % 4], msg[(i + 1) % 4]), msg[(i + 2) % 4]), msg[(i + 3) % 4]);
+                    msg[i % 4] = w;
+                }
+                __m128i e = i == 0 ? _mm_add_epi32(e0, w) : _mm_sha1nexte_epu32(abcdPrev, w);
+                abcdPrev = abcd;
+                switch (i / 5)
+                {
+                case 0:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+                    break;
+                case 1:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 1);
+                    break;
+                case 2:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 2);
+                    break;
+                default:
+                    abcd = _mm_sha1rnds4_epu32(abcd, e, 3);
+                    break;
+                }
+            }
+            e0 = _mm_sha1nexte_epu32(abcdPrev, e0Save);
+            abcd = _mm_add_epi32(abcd, abcdSave);
+            p += 64;
+        }
+        _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+        state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+    }
+
+    const bool hasPclmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    const bool hasShaNi = __builtin_cpu_supports("sha") && __builtin_cpu_supports("sse4.1");
+#endif
+
+#ifdef ROMPER_ARM_CRC
+    //ARMv8's crc32 instructions use the zip polynomial (crc32c* is the other one).
+    uint32_t Crc32Arm(uint32_t crc, const unsigned char *p, size_t length)
+    {
+        while (length >= 8)
+        {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            crc = __crc32d(crc, v);
+            p += 8;
+            length -= 8;
+        }
+        while (length--)
+        {
+            crc = __crc32b(crc, *p++);
+        }
+        return crc;
+    }
+#endif
+
+    uint32_t RotateLeft(uint32_t v, int n)
+    {
+        return (v << n) | (v >> (32 - n));
+    }
+
+    void Sha1BlocksPortable(uint32_t state[5], const unsigned char *p, size_t blocks)
+    {
+        while (blocks--)
+        {
+            uint32_t w[80];
+            for (int i = 0; i < 16; i++)
+            {
+                w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+            }
+            for (int i = 16; i < 80; i++)
+            {
+                w[i] = RotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+            // One loop per round function, so there is no branch inside the rounds.
+            auto round = [&](uint32_t f, uint32_t k, uint32_t w)
+            {
+                uint32_t t = RotateLeft(a, 5) + f + e + k + w;
+                e = d;
+                d = c;
+                c = RotateLeft(b, 30);
+                b = a;
+                a = t;
+            };
+            for (int i = 0; i < 20; i++)
+            {
+                round((b & c) | (~b & d), 0x5A827999, w[i]);
+            }
+            for (int i = 20; i < 40; i++)
+            {
+                round(b ^ c ^ d, 0x6ED9EBA1, w[i]);
+            }
+            for (int i = 40; i < 60; i++)
+            {
+                round((b & c) | (b & d) | (c & d), 0x8F1BBCDC, w[i]);
+            }
+            for (int i = 60; i < 80; i++)
+            {
+                round(b ^ c ^ d, 0xCA62C1D6, w[i]);
+            }
+            state[0] += a;
+            state[1] += b;
+            state[2] += c;
+            state[3] += d;
+            state[4] += e;
+            p += 64;
+        }
+    }
+
+    void Sha1Blocks(uint32_t state[5], const unsigned char *p, size_t blocks)
+    {
+#ifdef ROMPER_X86_KERNELS
+        if (hasShaNi)
+        {
+            Sha1BlocksShaNi(state, p, blocks);
+            return;
+        }
+#endif
+        Sha1BlocksPortable(state, p, blocks);
+    }
+}
+
+uint32_t Crc32(uint32_t crc, const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    crc = ~crc;
+#ifdef ROMPER_ARM_CRC
+    return ~Crc32Arm(crc, p, length);
+#endif
+#ifdef ROMPER_X86_KERNELS
+    if (hasPclmul && length >= 64)
+    {
+        size_t folded = length & ~(size_t)15;
+        crc = Crc32Pclmul(crc, p, folded);
+        p += folded;
+        length -= folded;
+    }
+#endif
+    return ~Crc32Table(crc, p, length);
+}
+
+Sha1::Sha1() : state{0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0}
+{
+}
+
+void Sha1::Update(const void *data, size_t size)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    length += size;
+    if (buffered > 0)
+    {
+        size_t take = std::min(size, sizeof(buffer) - buffered);
+        std::memcpy(buffer + buffered, p, take);
+        buffered += take;
+        p += take;
+        size -= take;
+        if (buffered < sizeof(buffer))
+        {
+            return;
+        }
+        Sha1Blocks(state, buffer, 1);
+        buffered = 0;
+    }
+    Sha1Blocks(state, p, size / 64);
+    p += size / 64 * 64;
+    size %= 64;
+    std::memcpy(buffer, p, size);
+    buffered = size;
+}
+
+void Sha1::Digest(unsigned char digest[20])
+{
+    uint64_t bits = length * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padLength = (buffered < 56 ? 56 : 120) - buffered;
+    for (int i = 0; i < 8; i++)
+    {
+        pad[padLength + i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    Update(pad, padLength + 8);
+    for (int i = 0; i < 20; i++)
+    {
+        digest[i] = (unsigned char)(state[i / 4] >> (24 - 8 * (i % 4)));
+    }
+}
+
+std::string Sha1::HexDigest()
+{
+    unsigned char digest[20];
+    Digest(digest);
+    return Sha1Hex(digest);
+}
+
+std::string Sha1Hex(const unsigned char digest[20])
+{
+    char hex[41];
+    for (int i = 0; i < 20; i++)
+    {
+        std::snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+    }
+    return std::string(hex, 40);
+}
+
+std::string ChecksumKernels()
+{
+    std::string crc = "table";
+    std::string sha = "portable";
+#ifdef ROMPER_ARM_CRC
+    crc = "armv8";
+#endif
+#ifdef ROMPER_X86_KERNELS
+    crc = hasPclmul ? "pclmul" : crc;
+    sha = hasShaNi ? "sha-ni" : sha;
+#endif
+    return "crc32 " + crc + ", sha1 " + sha;
+}
+
+std::string Crc32Hex(uint32_t crc)
+{
+    char hex[9];
+    std::snprintf(hex, sizeof(hex), "%08x", crc);
+    return hex;
+}
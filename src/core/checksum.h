@@ -0,0 +1,43 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/checksum.h
+// Purpose:     CRC32 and SHA1, the checksums MAME lists for every ROM. Uses the CPU's instructions for them when it has them.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/*
+*The zip/MAME CRC32 of data, continuing from crc. Start with 0.
+*Crc32(Crc32(0, a), b) is the CRC of a followed by b.
+*/
+uint32_t Crc32(uint32_t crc, const void *data, size_t length);
+
+/*SHA1, fed in pieces.*/
+class Sha1
+{
+public:
+    Sha1();
+    void Update(const void *data, size_t length);
+    /*The 20 byte digest. Call once, after the last Update.*/
+    void Digest(unsigned char digest[20]);
+    /*The digest as 40 lowercase hex digits, the way MAME writes it. Call once, after the last Update.*/
+    std::string HexDigest();
+
+private:
+    uint32_t state[5];
+    uint64_t length = 0; //Bytes fed so far.
+    unsigned char buffer[64];
+    size_t buffered = 0;
+};
+
+/*Which CRC32 and SHA1 implementations this CPU gets, e.g. "crc32 pclmul, sha1 sha-ni". Shown by the benchmark.*/
+std::string ChecksumKernels();
+
+/*A SHA1 digest as 40 lowercase hex digits.*/
+std::string Sha1Hex(const unsigned char digest[20]);
+
+/*A CRC32 as 8 lowercase hex digits, the way MAME writes it.*/
+std::string Crc32Hex(uint32_t crc);
@@ -0,0 +1,422 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/copy.cpp
+// Purpose:     Local copy engine for runs of local profiles
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    // Direct descriptors (open straight into the ring's file table) came with these headers. Older ones get the portable copy.
+    #ifdef IORING_FILE_INDEX_ALLOC
+        #define ROMPER_URING 1
+        #include <fcntl.h>
+        #include <sys/mman.h>
+        #include <sys/stat.h>
+        #include <sys/syscall.h>
+        #include <sys/uio.h>
+        #include <unistd.h>
+    #endif
+#endif
+
+#include "core/copy.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+
+#ifdef ROMPER_URING
+namespace
+{
+    // Files up to SLOT_BYTES go through the ring, SLOTS at a time. Bigger ones, mostly CHDs, are copied with copy_file_range.
+    const unsigned SLOTS = 16;
+    const size_t SLOT_BYTES = 256 << 10;
+    // Each file is a chain of six: open source, open target, read, write, close, close.
+    const unsigned CHAIN = 6;
+
+    /*
+    *A bare io_uring, set up with raw syscalls so there is no liburing to ship.
+    *Two file table entries and one SLOT_BYTES buffer per slot.
+    */
+    class CopyRing
+    {
+    public:
+        bool broken = false; //Set if io_uring_enter failed. The ring's state is then unknown, so it isn't used again.
+
+        bool Open()
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            fd = (int)syscall(__NR_io_uring_setup, SLOTS * CHAIN, &params);
+            if (fd < 0)
+            {
+                return false;
+            }
+            sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+            {
+                sqSize = cqSize = std::max(sqSize, cqSize);
+            }
+            sqRing = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqRing == MAP_FAILED)
+            {
+                sqRing = nullptr;
+                return false;
+            }
+            cqRing = sqRing;
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+            {
+                cqRing = mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (cqRing == MAP_FAILED)
+                {
+                    cqRing = nullptr;
+                    return false;
+                }
+            }
+            sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void *sqesMap = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (sqesMap == MAP_FAILED)
+            {
+                return false;
+            }
+            sqes = (io_uring_sqe *)sqesMap;
+            char *sq = (char *)sqRing;
+            char *cq = (char *)cqRing;
+            sqTail = (unsigned *)(sq + params.sq_off.tail);
+            tail = submitted = *sqTail;
+            sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+            sqEntries = params.sq_entries;
+            cqHead = (unsigned *)(cq + params.cq_off.head);
+            cqTail = (unsigned *)(cq + params.cq_off.tail);
+            cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+            cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+            // SQEs are always used in ring order, so the index array never changes.
+            unsigned *array = (unsigned *)(sq + params.sq_off.array);
+            for (unsigned i = 0; i < sqEntries; i++)
+            {
+                array[i] = i;
+            }
+
+            std::vector<int> table(SLOTS * 2, -1);
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, table.data(), (unsigned)table.size()) < 0)
+            {
+                return false;
+            }
+            buffers = (char *)std::aligned_alloc(4096, SLOTS * SLOT_BYTES);
+            if (!buffers)
+            {
+                return false;
+            }
+            // Registered buffers are pinned once instead of on every read and write. They count against the locked memory limit (often 8 MB),
+            // so with many threads some rings go without and use plain reads and writes.
+            iovec buffer{buffers, SLOTS * SLOT_BYTES};
+            fixedBuffers = syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, &buffer, 1) == 0;
+            return true;
+        }
+
+        ~CopyRing()
+        {
+            if (sqes)
+            {
+                munmap(sqes, sqesSize);
+            }
+            if (cqRing && cqRing != sqRing)
+            {
+                munmap(cqRing, cqSize);
+            }
+            if (sqRing)
+            {
+                munmap(sqRing, sqSize);
+            }
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            std::free(buffers);
+        }
+
+        /*Queue one file's chain in slot. The file's user_data is slot * CHAIN + step.*/
+        void Queue(unsigned slot, const std::string &source, const std::string &target, size_t size)
+        {
+            unsigned in = slot * 2;
+            unsigned out = in + 1;
+            char *buffer = buffers + slot * SLOT_BYTES;
+            io_uring_sqe *sqe = Next(slot, 0, IORING_OP_OPENAT, IOSQE_IO_LINK);
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)source.c_str();
+            // No O_CLOEXEC: a direct descriptor is never in the process's table, and the kernel refuses the flag with EINVAL.
+            sqe->open_flags = O_RDONLY;
+            sqe->file_index = in + 1;
+            sqe = Next(slot, 1, IORING_OP_OPENAT, IOSQE_IO_LINK);
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)target.c_str();
+            sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+            sqe->len = 0644;
+            sqe->file_index = out + 1;
+            // A short read or write breaks the chain, so a file that shrank since it was stat'ed fails here. One that grew is caught by CopyGameFiles.
+            sqe = Next(slot, 2, fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+            sqe->fd = (int)in;
+            sqe->addr = (uint64_t)(uintptr_t)buffer;
+            sqe->len = (unsigned)size;
+            sqe = Next(slot, 3, fixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, IOSQE_IO_LINK | IOSQE_FIXED_FILE);
+            sqe->fd = (int)out;
+            sqe->addr = (uint64_t)(uintptr_t)buffer;
+            sqe->len = (unsigned)size;
+            sqe = Next(slot, 4, IORING_OP_CLOSE, IOSQE_IO_LINK);
+            sqe->file_index = in + 1;
+            sqe = Next(slot, 5, IORING_OP_CLOSE, 0);
+            sqe->file_index = out + 1;
+        }
+
+        /*
+        *Empty slot's two file table entries. A chain that breaks before its closes leaves what it opened installed, and the next chain in the slot
+        *would open over it. False if the ring can't be trusted after, in which case it is marked broken.
+        */
+        bool Release(unsigned slot)
+        {
+            int table[2] = {-1, -1};
+            io_uring_files_update update{};
+            update.offset = slot * 2;
+            update.fds = (uint64_t)(uintptr_t)table;
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES_UPDATE, &update, 2) < 0)
+            {
+                broken = true;
+                return false;
+            }
+            return true;
+        }
+
+        /*Submit what is queued and wait for all of it. results[slot * CHAIN + step] gets each result. False if the ring itself failed.*/
+        bool Run(std::vector<int> &results)
+        {
+            unsigned queued = tail - submitted;
+            __atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+            unsigned done = 0;
+            unsigned toSubmit = queued;
+            while (done < queued)
+            {
+                int entered = (int)syscall(__NR_io_uring_enter, fd, toSubmit, queued - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (entered < 0 && errno != EINTR)
+                {
+                    broken = true;
+                    return false;
+                }
+                toSubmit -= entered > 0 ? std::min((unsigned)entered, toSubmit) : 0;
+                unsigned head = *cqHead;
+                unsigned ready = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+                for (; head != ready; head++, done++)
+                {
+                    const io_uring_cqe &cqe = cqes[head & cqMask];
+                    if (cqe.user_data < results.size())
+                    {
+                        results[cqe.user_data] = cqe.res;
+                    }
+                }
+                __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+            }
+            submitted = tail;
+            return true;
+        }
+
+    private:
+        io_uring_sqe *Next(unsigned slot, unsigned step, unsigned char opcode, unsigned char flags)
+        {
+            io_uring_sqe *sqe = &sqes[tail++ & sqMask];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = opcode;
+            sqe->flags = flags;
+            sqe->user_data = slot * CHAIN + step;
+            return sqe;
+        }
+
+        int fd = -1;
+        void *sqRing = nullptr;
+        void *cqRing = nullptr;
+        size_t sqSize = 0;
+        size_t cqSize = 0;
+        size_t sqesSize = 0;
+        io_uring_sqe *sqes = nullptr;
+        unsigned *sqTail = nullptr;
+        unsigned sqMask = 0;
+        unsigned sqEntries = 0;
+        unsigned tail = 0; //The SQ tail, published to the kernel by Run.
+        unsigned submitted = 0; //The SQ tail the kernel has been given.
+        unsigned *cqHead = nullptr;
+        unsigned *cqTail = nullptr;
+        unsigned cqMask = 0;
+        io_uring_cqe *cqes = nullptr;
+        char *buffers = nullptr;
+        bool fixedBuffers = false;
+    };
+
+    /*This thread's ring, opened on first use. nullptr if io_uring isn't available.*/
+    CopyRing *ThreadRing()
+    {
+        thread_local std::unique_ptr<CopyRing> ring;
+        thread_local bool tried = false;
+        if (!tried)
+        {
+            tried = true;
+            ring = std::make_unique<CopyRing>();
+            if (!ring->Open())
+            {
+                ring.reset();
+            }
+        }
+        return ring && !ring->broken ? ring.get() : nullptr;
+    }
+
+    /*Copy a big file in the kernel, as a reflink where the filesystem can. False if it couldn't, so the portable copy should.*/
+    bool CopyLarge(const std::string &source, const std::string &target)
+    {
+        TraceSpan span("copy_file_range", "run");
+        int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0)
+        {
+            return false;
+        }
+        int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out < 0)
+        {
+            close(in);
+            return false;
+        }
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+        bool copied = true;
+        while (true)
+        {
+            ssize_t n = copy_file_range(in, nullptr, out, nullptr, 1 << 30, 0);
+            if (n == 0)
+            {
+                break;
+            }
+            if (n < 0)
+            {
+                copied = false;
+                break;
+            }
+        }
+        copied = close(out) == 0 && copied;
+        close(in);
+        return copied;
+    }
+
+    bool UringAvailable()
+    {
+        static const bool available = []()
+        {
+            CopyRing ring;
+            return ring.Open();
+        }();
+        return available;
+    }
+}
+#endif
+
+copyBackend DefaultCopyBackend()
+{
+    const char *setting = std::getenv("ROMPER_COPY");
+    if (setting && std::string(setting) == "portable")
+    {
+        return COPY_PORTABLE;
+    }
+#ifdef ROMPER_URING
+    return UringAvailable() ? COPY_URING : COPY_PORTABLE;
+#else
+    return COPY_PORTABLE;
+#endif
+}
+
+const char *CopyBackendName(copyBackend backend)
+{
+    return backend == COPY_URING ? "uring" : "portable";
+}
+
+std::string CopyGameFile(const std::string &source, const std::string &target)
+{
+    std::error_code ec;
+    if (!std::filesystem::copy_file(source, target, std::filesystem::copy_options::overwrite_existing, ec))
+    {
+        return "Error copying file: " + std::filesystem::path(target).filename().string() + " " + ec.message();
+    }
+    return "";
+}
+
+std::vector<std::string> CopyGameFiles(const std::vector<std::pair<std::string, std::string>> &copies, copyBackend backend)
+{
+    std::vector<std::string> errors(copies.size());
+    std::vector<bool> copied(copies.size(), false);
+#ifdef ROMPER_URING
+    CopyRing *ring = backend == COPY_URING ? ThreadRing() : nullptr;
+    if (ring)
+    {
+        TraceSpan span("copy batch", "run");
+        span.Arg("files", (int64_t)copies.size());
+        std::vector<size_t> slotFile;
+        std::vector<struct stat> slotStat; //Each source as it was queued.
+        std::vector<int> results(SLOTS * CHAIN);
+        auto flush = [&]()
+        {
+            if (slotFile.empty())
+            {
+                return;
+            }
+            std::fill(results.begin(), results.end(), -ECANCELED);
+            bool ran = ring->Run(results);
+            for (unsigned slot = 0; ran && slot < slotFile.size(); slot++)
+            {
+                const int *r = &results[slot * CHAIN];
+                int size = (int)slotStat[slot].st_size;
+                // The read took the size stat'ed before queuing, so a source written to meanwhile would be copied cut short. Check it's still that file.
+                struct stat after;
+                bool unchanged = stat(copies[slotFile[slot]].first.c_str(), &after) == 0 && after.st_size == slotStat[slot].st_size &&
+                                 after.st_mtim.tv_sec == slotStat[slot].st_mtim.tv_sec && after.st_mtim.tv_nsec == slotStat[slot].st_mtim.tv_nsec;
+                copied[slotFile[slot]] = r[0] >= 0 && r[1] >= 0 && r[2] == size && r[3] == size && r[4] >= 0 && r[5] >= 0 && unchanged;
+                if ((r[4] < 0 || r[5] < 0) && !ring->Release(slot))
+                {
+                    break;
+                }
+            }
+            slotFile.clear();
+            slotStat.clear();
+        };
+        for (size_t i = 0; i < copies.size(); i++)
+        {
+            struct stat st;
+            if (stat(copies[i].first.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            {
+                continue;
+            }
+            if ((size_t)st.st_size > SLOT_BYTES)
+            {
+                copied[i] = CopyLarge(copies[i].first, copies[i].second);
+                continue;
+            }
+            if (ring->broken)
+            {
+                continue;
+            }
+            ring->Queue((unsigned)slotFile.size(), copies[i].first, copies[i].second, (size_t)st.st_size);
+            slotFile.push_back(i);
+            slotStat.push_back(st);
+            if (slotFile.size() == SLOTS)
+            {
+                flush();
+            }
+        }
+        flush();
+    }
+#endif
+    for (size_t i = 0; i < copies.size(); i++)
+    {
+        if (!copied[i])
+        {
+            errors[i] = CopyGameFile(copies[i].first, copies[i].second);
+        }
+    }
+    return errors;
+}
@@ -0,0 +1,35 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/copy.h
+// Purpose:     Local copy engine for runs of local profiles
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/*How local files are copied.*/
+enum copyBackend
+{
+    COPY_PORTABLE, //std::filesystem::copy_file, one file at a time.
+    COPY_URING, //Linux io_uring: small files in batches of linked open/read/write/close, big ones with copy_file_range.
+};
+
+/*
+*The backend ROMPER_COPY asks for ("portable" or "uring"), else io_uring if the kernel has it.
+*Asking for io_uring where it isn't available gets the portable copy.
+*/
+copyBackend DefaultCopyBackend();
+
+/*"portable" or "uring".*/
+const char *CopyBackendName(copyBackend backend);
+
+/*Copy source to target, overwriting it. Returns "" on success, else the error.*/
+std::string CopyGameFile(const std::string &source, const std::string &target);
+
+/*
+*Copy each (source, target) pair, overwriting targets. Returns one error per pair, "" for each that copied.
+*With COPY_URING, each calling thread has its own ring. A file the ring can't copy is copied again with CopyGameFile, which reports the error.
+*/
+std::vector<std::string> CopyGameFiles(const std::vector<std::pair<std::string, std::string>> &copies, copyBackend backend);
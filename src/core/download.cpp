@@ -0,0 +1,282 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/download.cpp
+// Purpose:     Download engine for runs of online profiles
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/download.h"
+#include "core/throttle.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+
+// Only wxBase's web request is used here. Nothing in romper_core touches the GUI.
+#include <wx/stream.h>
+#include <wx/webrequest.h>
+
+namespace
+{
+    // A throttled download comes in chunks of about two seconds at the rate of the moment.
+    // Unlimited ones use the biggest, which most ROM zips fit in whole, and still let a pause hold a CHD soon after it's asked for.
+    const uint64_t CHUNK_MIN = 256 << 10;
+    const uint64_t CHUNK_MAX = 16 << 20;
+
+    using filePtr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    /*Move the file wx spooled a response to into place. Returns "" on success, else the error.*/
+    std::string MoveIntoPlace(const std::string &dataFile, const std::string &target)
+    {
+        TraceSpan moveSpan("move into place", "download");
+        std::error_code ec;
+        std::filesystem::rename(dataFile, target, ec);
+        if (ec)
+        {
+            // The temp folder may be on another filesystem.
+            ec.clear();
+            std::filesystem::copy_file(dataFile, target, std::filesystem::copy_options::overwrite_existing, ec);
+            std::error_code removeEc;
+            std::filesystem::remove(dataFile, removeEc);
+            if (ec)
+            {
+                return "Could not write: " + target + " " + ec.message();
+            }
+        }
+        return "";
+    }
+
+    /*Append a chunk held in memory to out. Returns the bytes appended, or -1.*/
+    int64_t AppendChunk(const wxWebResponse &response, FILE *out)
+    {
+        wxInputStream *in = response.GetStream();
+        if (!in)
+        {
+            return -1;
+        }
+        int64_t appended = 0;
+        char buffer[1 << 16];
+        while (in->Read(buffer, sizeof(buffer)).LastRead() > 0)
+        {
+            size_t n = in->LastRead();
+            if (std::fwrite(buffer, 1, n, out) != n)
+            {
+                return -1;
+            }
+            appended += (int64_t)n;
+        }
+        return appended;
+    }
+
+    /*Whether an HTTP status is the server being busy or broken for now, rather than a no.*/
+    bool TransientStatus(int status)
+    {
+        return status == 408 || status == 425 || status == 429 || status >= 500;
+    }
+
+    /*The total size from a Content-Range header ("bytes 0-99/1234"), or -1.*/
+    int64_t RangeTotal(const std::string &contentRange)
+    {
+        size_t slash = contentRange.rfind('/');
+        if (contentRange.rfind("bytes ", 0) != 0 || slash == std::string::npos || slash + 1 >= contentRange.size() || contentRange[slash + 1] == '*')
+        {
+            return -1;
+        }
+        return std::strtoll(contentRange.c_str() + slash + 1, nullptr, 10);
+    }
+
+    /*The first byte of a Content-Range header ("bytes 0-99/1234"), or -1.*/
+    int64_t RangeStart(const std::string &contentRange)
+    {
+        if (contentRange.rfind("bytes ", 0) != 0 || contentRange.size() < 7 || !std::isdigit((unsigned char)contentRange[6]))
+        {
+            return -1;
+        }
+        char *end = nullptr;
+        long long start = std::strtoll(contentRange.c_str() + 6, &end, 10);
+        return *end == '-' ? start : -1;
+    }
+}
+
+std::string DownloadFile(const std::string &url, const std::string &target, Throttle *throttle, const std::atomic<bool> *abort, bool *transient)
+{
+    bool ignored;
+    bool &retry = transient ? *transient : ignored;
+    retry = false;
+    if (!throttle)
+    {
+        // Large CHDs don't fit in memory. Have wx spool to a temp file and move it into place.
+        wxWebRequestSync request = wxWebSessionSync::GetDefault().CreateRequest(url);
+        request.SetStorage(wxWebRequest::Storage_File);
+        TraceSpan requestSpan("request", "download");
+        auto result = request.Execute();
+        requestSpan.Finish();
+        if (result.state != wxWebRequest::State_Completed)
+        {
+            // Failed is the connection or a timeout. Unauthorized and Cancelled won't change by asking again.
+            retry = result.state == wxWebRequest::State_Failed;
+            return "Could not download: " + url + " " + result.error.ToStdString();
+        }
+        wxWebResponse response = request.GetResponse();
+        if (response.GetStatus() != 200)
+        {
+            retry = TransientStatus(response.GetStatus());
+            return "Could not download: " + url + " HTTP " + std::to_string(response.GetStatus());
+        }
+        return MoveIntoPlace(response.GetDataFile().ToStdString(), target);
+    }
+
+    std::atomic<bool> never(false);
+    const std::atomic<bool> &stop = abort ? *abort : never;
+    filePtr out(nullptr, std::fclose);
+    auto fail = [&](const std::string &error)
+    {
+        out.reset();
+        std::error_code ec;
+        std::filesystem::remove(target, ec);
+        return error;
+    };
+    int64_t offset = 0;
+    int64_t total = -1;
+    // What the first chunk came from: its strong ETag, else its Last-Modified. Later chunks must come from the same file, or the target would be two versions stitched together.
+    std::string etag;
+    std::string lastModified;
+    auto changed = [&]()
+    {
+        retry = true;
+        return fail("Changed on the server during the download: " + url);
+    };
+    while (total < 0 || offset < total)
+    {
+        if (!throttle->Wait(stop))
+        {
+            return fail("Stopped before the download finished: " + url);
+        }
+        uint64_t rate = throttle->Rate();
+        uint64_t chunk = rate == 0 ? CHUNK_MAX : std::clamp<uint64_t>(rate * 2, CHUNK_MIN, CHUNK_MAX);
+        wxWebRequestSync request = wxWebSessionSync::GetDefault().CreateRequest(url);
+        // The first chunk is spooled to a file, as a server that ignores Range sends the whole file, and starts the target.
+        // Later ones come from a server known to honour Range, so they are at most a chunk and go from memory straight to the target.
+        request.SetStorage(offset == 0 ? wxWebRequest::Storage_File : wxWebRequest::Storage_Memory);
+        request.SetHeader("Range", "bytes=" + std::to_string(offset) + "-" + std::to_string(offset + chunk - 1));
+        // If-Range sends the whole file if it changed, which is caught below. If-Match and If-Unmodified-Since have servers that know them say 412 instead, without the body.
+        if (!etag.empty())
+        {
+            request.SetHeader("If-Range", etag);
+            request.SetHeader("If-Match", etag);
+        }
+        else if (!lastModified.empty())
+        {
+            request.SetHeader("If-Range", lastModified);
+            request.SetHeader("If-Unmodified-Since", lastModified);
+        }
+        TraceSpan requestSpan("request", "download");
+        requestSpan.Arg("offset", offset);
+        auto result = request.Execute();
+        requestSpan.Finish();
+        if (result.state != wxWebRequest::State_Completed)
+        {
+            retry = result.state == wxWebRequest::State_Failed;
+            return fail("Could not download: " + url + " " + result.error.ToStdString());
+        }
+        wxWebResponse response = request.GetResponse();
+        std::string dataFile = offset == 0 ? response.GetDataFile().ToStdString() : "";
+        auto dropSpool = [&]()
+        {
+            std::error_code ec;
+            if (!dataFile.empty())
+            {
+                std::filesystem::remove(dataFile, ec);
+            }
+        };
+        if (response.GetStatus() == 416 && offset == 0)
+        {
+            // Nothing to range over: the file is empty.
+            dropSpool();
+            out.reset(std::fopen(target.c_str(), "wb"));
+            return out ? "" : fail("Could not write: " + target);
+        }
+        if (response.GetStatus() == 200 && offset > 0)
+        {
+            // If-Range found the file changed.
+            return changed();
+        }
+        if (response.GetStatus() == 412)
+        {
+            dropSpool();
+            return changed();
+        }
+        if (response.GetStatus() == 200)
+        {
+            // The server ignored the range and sent the whole file.
+            out.reset();
+            std::error_code ec;
+            throttle->Spend(std::filesystem::file_size(dataFile, ec));
+            return MoveIntoPlace(dataFile, target);
+        }
+        std::string contentRange = response.GetHeader("Content-Range").ToStdString();
+        int64_t rangeTotal = RangeTotal(contentRange);
+        if (response.GetStatus() != 206 || rangeTotal < 0)
+        {
+            dropSpool();
+            retry = TransientStatus(response.GetStatus());
+            return fail("Could not download: " + url + " HTTP " + std::to_string(response.GetStatus()));
+        }
+        if (RangeStart(contentRange) != offset)
+        {
+            // Appending another range would put its bytes in the wrong place.
+            dropSpool();
+            retry = true;
+            return fail("Got the wrong part of: " + url + " (" + contentRange + " for byte " + std::to_string(offset) + ")");
+        }
+        if (total >= 0 && rangeTotal != total)
+        {
+            return changed();
+        }
+        total = rangeTotal;
+        int64_t appended = 0;
+        if (offset == 0)
+        {
+            if (total <= (int64_t)chunk)
+            {
+                // All of it in one go, so there is nothing to put together.
+                throttle->Spend((uint64_t)total);
+                return MoveIntoPlace(dataFile, target);
+            }
+            // A weak ETag can't be used to ask for a range of the same file.
+            etag = response.GetHeader("ETag").ToStdString();
+            etag = etag.rfind("W/", 0) == 0 ? "" : etag;
+            lastModified = response.GetHeader("Last-Modified").ToStdString();
+            std::string error = MoveIntoPlace(dataFile, target);
+            if (!error.empty())
+            {
+                return fail(error);
+            }
+            std::error_code ec;
+            appended = (int64_t)std::filesystem::file_size(target, ec);
+            out.reset(std::fopen(target.c_str(), "ab"));
+            if (!out || ec)
+            {
+                return fail("Could not write: " + target);
+            }
+        }
+        else
+        {
+            appended = AppendChunk(response, out.get());
+        }
+        if (appended <= 0)
+        {
+            return fail("Could not write: " + target + ". Be sure there is enough space.");
+        }
+        throttle->Spend((uint64_t)appended);
+        offset += appended;
+    }
+    if (std::fflush(out.get()) != 0)
+    {
+        return fail("Could not write: " + target + ". Be sure there is enough space.");
+    }
+    return "";
+}
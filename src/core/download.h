@@ -0,0 +1,25 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/download.h
+// Purpose:     Download engine for runs of online profiles
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <string>
+
+class Throttle;
+
+//Where online profiles download from.
+const std::string DOWNLOAD_URL = "https://archive.org/download/mame-chds-roms-extras-complete/";
+
+/*
+*Download url to target. Blocks, so only call it off the UI thread. Returns "" on success, else the error.
+*Needs wxWidgets to be initialized, either by the GUI's wxApp or a wxInitializer.
+*With a throttle, the file comes in ranged chunks that each wait on it, so a rate limit or pause takes hold mid-file
+*and a paused file keeps what it has. abort is checked between chunks. Chunks after the first are asked for with If-Range on the first's ETag
+*(or Last-Modified), so a file replaced on the server mid-download fails as transient rather than being stitched together from two versions.
+*On failure, transient (if given) is set to whether trying again later may work: a dropped connection, a timeout or a busy server (408, 429, 5xx).
+*A missing file, a refused one or a local write error won't.
+*/
+std::string DownloadFile(const std::string &url, const std::string &target, Throttle *throttle = nullptr, const std::atomic<bool> *abort = nullptr, bool *transient = nullptr);
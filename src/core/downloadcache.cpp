@@ -0,0 +1,213 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/downloadcache.cpp
+// Purpose:     A download cache shared by every online profile
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+    #include <unistd.h>
+#endif
+#ifdef __APPLE__
+    #include <sys/clonefile.h>
+#endif
+
+#include "core/downloadcache.h"
+#include "core/checksum.h"
+#include "core/run.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <vector>
+
+std::string DefaultDownloadCache(const std::string &profileDBFile, downloadCache &cache)
+{
+    const unsigned long long DEFAULT_MB = 51200;
+    const unsigned long long MAX_MB = 16777216; //16 TB, far from overflowing once in bytes.
+    cache = downloadCache();
+    unsigned long long megabytes = DEFAULT_MB;
+    std::string error;
+    const char *setting = std::getenv("ROMPER_CACHE_MB");
+    if (setting && *setting)
+    {
+        // strtoull takes "-1" as a huge number, skips leading spaces, and reads "abc" as 0, which would turn the cache off.
+        std::string text = setting;
+        char *end = nullptr;
+        errno = 0;
+        megabytes = std::strtoull(text.c_str(), &end, 10);
+        if (!std::isdigit((unsigned char)text[0]) || *end != '\0' || errno == ERANGE || megabytes > MAX_MB)
+        {
+            error = "Expected MB from 0 to " + std::to_string(MAX_MB) + ", got: " + text;
+            megabytes = DEFAULT_MB;
+        }
+    }
+    if (megabytes > 0)
+    {
+        cache.folder = (std::filesystem::path(profileDBFile).parent_path() / "download_cache").string();
+        cache.maxBytes = (uint64_t)megabytes << 20;
+    }
+    return error;
+}
+
+std::string CacheKey(const runFile &file, const gameChecksums &checksums)
+{
+    std::string identity = file.type + "\n" + file.game + "\n" + std::filesystem::path(file.target).filename().string() + "\n";
+    bool known = false;
+    if (file.type == "chd")
+    {
+        auto disks = checksums.disks.find(file.game);
+        if (disks != checksums.disks.end())
+        {
+            std::string name = std::filesystem::path(file.target).stem().string();
+            for (const diskChecksum &disk : disks->second)
+            {
+                if (disk.name == name && !disk.sha1.empty())
+                {
+                    identity += disk.sha1 + "\n";
+                    known = true;
+                }
+            }
+        }
+    }
+    else
+    {
+        auto roms = checksums.roms.find(file.game);
+        if (roms != checksums.roms.end())
+        {
+            // Sorted, so the game DB's row order doesn't matter.
+            std::vector<std::string> lines;
+            for (const romChecksum &rom : roms->second)
+            {
+                lines.push_back(rom.name + " " + std::to_string(rom.size) + " " + Crc32Hex(rom.crc));
+            }
+            std::sort(lines.begin(), lines.end());
+            for (const std::string &line : lines)
+            {
+                identity += line + "\n";
+            }
+            known = !lines.empty();
+        }
+    }
+    if (!known)
+    {
+        identity += file.source + "\n";
+    }
+    Sha1 sha1;
+    sha1.Update(identity.data(), identity.size());
+    return sha1.HexDigest();
+}
+
+std::string CachePath(const downloadCache &cache, const std::string &key, const std::string &type)
+{
+    // 256 subfolders keep any one folder small.
+    return cache.folder + "/" + key.substr(0, 2) + "/" + key + (type == "chd" ? ".chd" : type == "7z" ? ".7z" : ".zip");
+}
+
+std::string FillFromCache(const std::string &cached, const std::string &target, std::string &method)
+{
+    TraceSpan span("fill from cache", "download");
+    std::error_code ec;
+    std::filesystem::remove(target, ec);
+    // A hard link costs no space and no time, as long as both are on one filesystem that has them.
+    ec.clear();
+    std::filesystem::create_hard_link(cached, target, ec);
+    if (!ec)
+    {
+        method = "link";
+        return "";
+    }
+#ifdef __linux__
+    // Btrfs and XFS can share the blocks between folders a hard link can't reach.
+    int in = open(cached.c_str(), O_RDONLY);
+    if (in >= 0)
+    {
+        int out = open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if (out >= 0)
+        {
+            close(out);
+        }
+        close(in);
+        if (cloned)
+        {
+            method = "reflink";
+            return "";
+        }
+        std::filesystem::remove(target, ec);
+    }
+#elif defined(__APPLE__)
+    if (clonefile(cached.c_str(), target.c_str(), 0) == 0)
+    {
+        method = "reflink";
+        return "";
+    }
+#endif
+    method = "copy";
+    ec.clear();
+    if (!std::filesystem::copy_file(cached, target, std::filesystem::copy_options::overwrite_existing, ec))
+    {
+        return "Error copying file: " + std::filesystem::path(target).filename().string() + " " + ec.message();
+    }
+    return "";
+}
+
+cacheTrim TrimDownloadCache(const downloadCache &cache)
+{
+    TraceSpan span("TrimDownloadCache", "download");
+    cacheTrim trim;
+    if (cache.folder.empty())
+    {
+        return trim;
+    }
+    struct cachedFile
+    {
+        std::filesystem::file_time_type used;
+        uint64_t bytes;
+        std::filesystem::path path;
+    };
+    std::vector<cachedFile> files;
+    std::error_code ec;
+    for (std::filesystem::recursive_directory_iterator it(cache.folder, ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code fileEc;
+        // Files a profile target still links to go when the target does. Removing them here would free nothing.
+        if (!it->is_regular_file(fileEc) || it->path().extension() == ".part" || it->hard_link_count(fileEc) > 1)
+        {
+            continue;
+        }
+        cachedFile file{it->last_write_time(fileEc), (uint64_t)it->file_size(fileEc), it->path()};
+        if (!fileEc)
+        {
+            files.push_back(file);
+            trim.kept += file.bytes;
+        }
+    }
+    if (trim.kept <= cache.maxBytes)
+    {
+        return trim;
+    }
+    // Hits touch the file's time, so the oldest are the least recently used.
+    std::sort(files.begin(), files.end(), [](const cachedFile &a, const cachedFile &b)
+              { return a.used < b.used; });
+    for (const cachedFile &file : files)
+    {
+        if (trim.kept <= cache.maxBytes)
+        {
+            break;
+        }
+        if (std::filesystem::remove(file.path, ec))
+        {
+            trim.files++;
+            trim.bytes += file.bytes;
+            trim.kept -= file.bytes;
+        }
+    }
+    span.Arg("removed", (int64_t)trim.files);
+    return trim;
+}
@@ -0,0 +1,55 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/downloadcache.h
+// Purpose:     A download cache shared by every online profile
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+
+#include <cstdint>
+#include <string>
+
+struct runFile;
+
+/*
+*Where downloads are kept so profiles that share games fetch them once.
+*Files are named after a key of what they are (see CacheKey), and profile targets are hard links, reflinks or copies of them.
+*/
+struct downloadCache
+{
+    std::string folder; //"" turns the cache off.
+    uint64_t maxBytes = 0; //Cap on the files only the cache holds. Files a target still links to cost nothing and aren't counted.
+};
+
+/*
+*Set cache to the one next to the profile DB, in download_cache.
+*ROMPER_CACHE_MB sets its cap (51200 by default, up to 16777216). 0 turns the cache off.
+*Returns "" on success, else what is wrong with ROMPER_CACHE_MB, in which case cache gets the default cap.
+*/
+std::string DefaultDownloadCache(const std::string &profileDBFile, downloadCache &cache);
+
+/*
+*40 hex digits naming a run file's content: its game, type and name, plus its ROMs' sizes and CRCs or its CHD's SHA1.
+*So a game DB with new ROMs for a game gets a new key. Without checksums the source URL stands in for them.
+*/
+std::string CacheKey(const runFile &file, const gameChecksums &checksums);
+
+/*Where the file with this key lives in the cache.*/
+std::string CachePath(const downloadCache &cache, const std::string &key, const std::string &type);
+
+/*
+*Put a cached file at target: a hard link if the filesystem allows it, else a reflink, else a copy.
+*method is set to "link", "reflink" or "copy". Returns "" on success, else the error.
+*/
+std::string FillFromCache(const std::string &cached, const std::string &target, std::string &method);
+
+struct cacheTrim
+{
+    int files = 0; //Files removed.
+    uint64_t bytes = 0; //Bytes freed.
+    uint64_t kept = 0; //Bytes of cache-only files left.
+};
+
+/*Remove the least recently used files that only the cache holds until they fit under maxBytes.*/
+cacheTrim TrimDownloadCache(const downloadCache &cache);
@@ -0,0 +1,673 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/fatimage.cpp
+// Purpose:     FAT32 card images of a profile's files, written front to back in one pass
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/fatimage.h"
+#include "core/trace.h"
+#include "core/util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <set>
+
+namespace
+{
+    const uint32_t SECTOR = 512;
+    const uint32_t RESERVED_MIN = 32; //Boot sector, FSInfo, their backups at 6 and 7, and room to spare.
+    const uint32_t ALIGN_SECTORS = 2048; //The data area starts on a 1 MB boundary, so clusters don't straddle a card's erase blocks.
+    const uint32_t MIN_CLUSTERS = 65525; //With fewer, the spec says it's FAT16 whatever the boot sector claims.
+    const uint32_t MAX_CLUSTERS = 0x0FFFFFF5 - 2;
+    const uint64_t MAX_FILE = 0xFFFFFFFFull;
+    const size_t MAX_ENTRIES = 65536; //32 byte entries a folder may have.
+    const uint32_t END_OF_CHAIN = 0x0FFFFFFF;
+    const size_t IO_BYTES = 1 << 20;
+
+    using filePtr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    void Put16(uint8_t *at, uint16_t value)
+    {
+        at[0] = value & 0xFF;
+        at[1] = value >> 8;
+    }
+
+    void Put32(uint8_t *at, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            at[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    bool ShortChar(char c)
+    {
+        return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || std::strchr("!#$%&'()-@^_`{}~", c) != nullptr;
+    }
+
+    /*Letters all one case: 1 lower, 2 upper or none, 0 mixed.*/
+    int Case(const std::string &text)
+    {
+        bool lower = false, upper = false;
+        for (char c : text)
+        {
+            lower = lower || (c >= 'a' && c <= 'z');
+            upper = upper || (c >= 'A' && c <= 'Z');
+        }
+        return lower && upper ? 0 : lower ? 1 : 2;
+    }
+
+    std::string Upper(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), [](char c)
+                       { return (char)std::toupper((unsigned char)c); });
+        return text;
+    }
+
+    /*A file or folder in a folder, with the directory entries it takes.*/
+    struct folderEntry
+    {
+        bool folder = false;
+        size_t index = 0; //Into the folders or the files.
+        char shortName[11]; //Space padded 8.3, without the dot.
+        uint8_t caseFlags = 0; //0x08 lower case name, 0x10 lower case extension, so an all lower case 8.3 name needs no long name.
+        std::u16string longName; //Empty when the short name says it all.
+    };
+
+    struct folderNode
+    {
+        std::string name;
+        size_t parent = 0;
+        std::vector<folderEntry> entries;
+        std::map<std::string, size_t> folders; //Subfolders by upper case name. FAT names don't differ by case alone.
+        std::set<std::string> names; //Upper case names of everything in it.
+        std::set<std::string> shortNames;
+        std::map<std::string, int> tails; //The next ~N to try per stem and extension, so a folder of long names isn't quadratic.
+        size_t slots = 0; //32 byte entries it takes.
+        uint32_t cluster = 0;
+        uint32_t clusters = 0;
+    };
+
+    struct fileNode
+    {
+        std::string source;
+        uint64_t size = 0;
+        uint32_t cluster = 0; //0 for an empty file.
+        uint32_t clusters = 0;
+    };
+
+    /*The 8.3 name for name in folder: name itself if it fits, else a unique NAME~N.EXT and a long name.*/
+    void NameEntry(folderNode &folder, const std::string &name, folderEntry &entry)
+    {
+        size_t dot = name.rfind('.');
+        std::string base = dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+        std::string extension = dot == std::string::npos || dot == 0 ? "" : name.substr(dot + 1);
+        std::string upperBase = Upper(base), upperExtension = Upper(extension);
+        bool fits = !base.empty() && base.size() <= 8 && extension.size() <= 3 && Case(base) != 0 && Case(extension) != 0 &&
+                    std::all_of(upperBase.begin(), upperBase.end(), ShortChar) && std::all_of(upperExtension.begin(), upperExtension.end(), ShortChar);
+        std::string shortName;
+        if (fits && folder.shortNames.count(upperBase + "." + upperExtension) == 0)
+        {
+            shortName = upperBase + "." + upperExtension;
+            entry.caseFlags = (Case(base) == 1 ? 0x08 : 0) | (Case(extension) == 1 ? 0x10 : 0);
+        }
+        else
+        {
+            auto sanitize = [](const std::string &text)
+            {
+                std::string out;
+                for (char c : Upper(text))
+                {
+                    if (c != ' ' && c != '.')
+                    {
+                        out += ShortChar(c) ? c : '_';
+                    }
+                }
+                return out;
+            };
+            std::string stem = sanitize(base);
+            std::string suffix = sanitize(extension).substr(0, 3);
+            int &n = folder.tails[stem.substr(0, 6) + "." + suffix];
+            while (true)
+            {
+                std::string tail = "~" + std::to_string(++n);
+                shortName = stem.substr(0, 8 - tail.size()) + tail + "." + suffix;
+                if (folder.shortNames.count(shortName) == 0)
+                {
+                    break;
+                }
+            }
+            entry.longName = Utf16(name);
+        }
+        folder.shortNames.insert(shortName);
+        std::memset(entry.shortName, ' ', 11);
+        size_t shortDot = shortName.find('.');
+        std::memcpy(entry.shortName, shortName.data(), shortDot);
+        std::memcpy(entry.shortName + 8, shortName.data() + shortDot + 1, shortName.size() - shortDot - 1);
+        // A first byte of 0xE5 means deleted. 0x05 stands for it.
+        if ((unsigned char)entry.shortName[0] == 0xE5)
+        {
+            entry.shortName[0] = 0x05;
+        }
+        folder.slots += 1 + (entry.longName.size() + 12) / 13;
+    }
+
+    uint8_t ShortNameChecksum(const char *shortName)
+    {
+        uint8_t sum = 0;
+        for (int i = 0; i < 11; i++)
+        {
+            sum = (uint8_t)(((sum & 1) ? 0x80 : 0) + (sum >> 1) + (uint8_t)shortName[i]);
+        }
+        return sum;
+    }
+
+    void ShortEntry(uint8_t *at, const char *name, uint8_t attributes, uint8_t caseFlags, uint32_t cluster, uint32_t size, uint16_t date, uint16_t time)
+    {
+        std::memcpy(at, name, 11);
+        at[11] = attributes;
+        at[12] = caseFlags;
+        Put16(at + 14, time);
+        Put16(at + 16, date);
+        Put16(at + 18, date);
+        Put16(at + 20, (uint16_t)(cluster >> 16));
+        Put16(at + 22, time);
+        Put16(at + 24, date);
+        Put16(at + 26, (uint16_t)(cluster & 0xFFFF));
+        Put32(at + 28, size);
+    }
+
+    /*Write count bytes of zeros.*/
+    bool WriteZeros(FILE *out, uint64_t count)
+    {
+        static const std::vector<uint8_t> zeros(IO_BYTES, 0);
+        while (count > 0)
+        {
+            size_t chunk = (size_t)std::min<uint64_t>(count, zeros.size());
+            if (std::fwrite(zeros.data(), 1, chunk, out) != chunk)
+            {
+                return false;
+            }
+            count -= chunk;
+        }
+        return true;
+    }
+}
+
+uint32_t FatClusterBytes(uint64_t volumeBytes)
+{
+    const uint64_t MB = 1 << 20;
+    if (volumeBytes <= 64 * MB)
+    {
+        return 512;
+    }
+    if (volumeBytes <= 128 * MB)
+    {
+        return 1024;
+    }
+    if (volumeBytes <= 256 * MB)
+    {
+        return 2048;
+    }
+    if (volumeBytes <= 8192 * MB)
+    {
+        return 4096;
+    }
+    if (volumeBytes <= 16384 * MB)
+    {
+        return 8192;
+    }
+    return volumeBytes <= 32768 * MB ? 16384 : 32768;
+}
+
+std::vector<imageFile> ImageFiles(const profile &p, const std::vector<runFile> &files)
+{
+    // The deepest folder holding both targets is the image's root. If that is a target itself (CHDs in the rom folder), the one above it is, so the folder keeps its name.
+    auto normal = [](const std::string &folder)
+    {
+        std::filesystem::path path = std::filesystem::path(folder).lexically_normal();
+        return path.has_filename() ? path : path.parent_path();
+    };
+    std::filesystem::path rom = normal(p.romTarget), chd = normal(p.chdTarget);
+    std::filesystem::path root;
+    for (auto r = rom.begin(), c = chd.begin(); r != rom.end() && c != chd.end() && *r == *c; ++r, ++c)
+    {
+        root /= *r;
+    }
+    if (root == rom || root == chd)
+    {
+        root = root.parent_path();
+    }
+    std::vector<imageFile> images;
+    for (const runFile &file : files)
+    {
+        images.push_back(imageFile{std::filesystem::path(file.target).lexically_normal().lexically_relative(root).generic_string(), file.source});
+    }
+    return images;
+}
+
+std::string BuildFatImage(const std::string &image, const std::vector<imageFile> &files, uint64_t minimumBytes, const std::string &label, std::atomic<bool> &abort, imageResult &result,
+                          const std::function<void(uint64_t done, uint64_t total)> &onProgress)
+{
+    TraceSpan span("BuildFatImage", "image");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    result = imageResult();
+
+    // Lay out the tree: folders, then the files in them with their names.
+    std::vector<folderNode> folders(1);
+    std::vector<fileNode> nodes;
+    for (const imageFile &file : files)
+    {
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(file.source, ec);
+        if (ec)
+        {
+            result.errors.push_back("Could not read: " + file.source + " " + ec.message());
+            continue;
+        }
+        if (size > MAX_FILE)
+        {
+            result.errors.push_back("4 GB or more, which FAT32 can't hold: " + file.source);
+            continue;
+        }
+        std::vector<std::string> parts;
+        for (const std::filesystem::path &part : std::filesystem::path(file.path))
+        {
+            if (!part.empty() && part != "." && part != ".." && part != "/")
+            {
+                parts.push_back(part.string());
+            }
+        }
+        if (parts.empty())
+        {
+            continue;
+        }
+        size_t folder = 0;
+        std::string error;
+        for (size_t k = 0; k + 1 < parts.size() && error.empty(); k++)
+        {
+            std::string key = Upper(parts[k]);
+            auto found = folders[folder].folders.find(key);
+            if (found != folders[folder].folders.end())
+            {
+                folder = found->second;
+                continue;
+            }
+            if (folders[folder].names.count(key) || folders[folder].slots + 1 + (parts[k].size() + 12) / 13 > MAX_ENTRIES - 2)
+            {
+                error = "No room for the folder of: " + file.path;
+                break;
+            }
+            folderNode child;
+            child.name = parts[k];
+            child.parent = folder;
+            folderEntry entry;
+            entry.folder = true;
+            entry.index = folders.size();
+            NameEntry(folders[folder], parts[k], entry);
+            folders[folder].entries.push_back(entry);
+            folders[folder].names.insert(key);
+            folders[folder].folders[key] = folders.size();
+            folders.push_back(child);
+            folder = folders.size() - 1;
+        }
+        std::string key = Upper(parts.back());
+        if (error.empty() && (folders[folder].names.count(key) || folders[folder].slots + 1 + (parts.back().size() + 12) / 13 > MAX_ENTRIES - 2))
+        {
+            error = "Another file has the same name, or its folder is full: " + file.path;
+        }
+        if (!error.empty())
+        {
+            result.errors.push_back(error);
+            continue;
+        }
+        folderEntry entry;
+        entry.index = nodes.size();
+        NameEntry(folders[folder], parts.back(), entry);
+        folders[folder].entries.push_back(entry);
+        folders[folder].names.insert(key);
+        nodes.push_back(fileNode{file.source, size});
+        result.dataBytes += size;
+    }
+    // The root has the volume label, every other folder "." and "..".
+    folders[0].slots += 1;
+    for (size_t f = 1; f < folders.size(); f++)
+    {
+        folders[f].slots += 2;
+    }
+
+    // The cluster size depends on the image's size, which depends on the cluster size. A few rounds settle it.
+    uint32_t clusterBytes = 4096;
+    uint64_t neededClusters = 0;
+    auto countClusters = [&](uint32_t bytes)
+    {
+        uint64_t count = 0;
+        for (const folderNode &folder : folders)
+        {
+            count += std::max<uint64_t>(1, (folder.slots * 32 + bytes - 1) / bytes);
+        }
+        for (const fileNode &node : nodes)
+        {
+            count += (node.size + bytes - 1) / bytes;
+        }
+        return count;
+    };
+    for (int round = 0; round < 8; round++)
+    {
+        neededClusters = countClusters(clusterBytes);
+        uint64_t estimate = std::max<uint64_t>(minimumBytes, neededClusters * clusterBytes + neededClusters * 8 + (uint64_t)(RESERVED_MIN + ALIGN_SECTORS) * SECTOR);
+        uint32_t wanted = FatClusterBytes(estimate);
+        if (wanted == clusterBytes)
+        {
+            break;
+        }
+        clusterBytes = wanted;
+    }
+    neededClusters = countClusters(clusterBytes);
+    uint32_t sectorsPerCluster = clusterBytes / SECTOR;
+
+    // Geometry: reserved sectors padded so the data area is aligned, two FATs, then the clusters.
+    uint64_t clusterCount = std::max<uint64_t>(neededClusters, MIN_CLUSTERS);
+    uint64_t fatSectors = 0, reserved = RESERVED_MIN;
+    auto fit = [&]()
+    {
+        fatSectors = ((clusterCount + 2) * 4 + SECTOR - 1) / SECTOR;
+        reserved = RESERVED_MIN + (ALIGN_SECTORS - (RESERVED_MIN + 2 * fatSectors) % ALIGN_SECTORS) % ALIGN_SECTORS;
+    };
+    fit();
+    if (minimumBytes / SECTOR > reserved + 2 * fatSectors + clusterCount * sectorsPerCluster)
+    {
+        // Fill the card: as many clusters as fit once their FATs are counted.
+        uint64_t totalSectors = minimumBytes / SECTOR;
+        for (int round = 0; round < 4; round++)
+        {
+            clusterCount = std::max<uint64_t>(clusterCount, (totalSectors - reserved - 2 * fatSectors) / sectorsPerCluster);
+            fit();
+            while (reserved + 2 * fatSectors + clusterCount * sectorsPerCluster > totalSectors && clusterCount > std::max<uint64_t>(neededClusters, MIN_CLUSTERS))
+            {
+                clusterCount--;
+                fit();
+            }
+        }
+    }
+    if (clusterCount > MAX_CLUSTERS)
+    {
+        return "Too big for FAT32: " + std::to_string(clusterCount) + " clusters.";
+    }
+    uint64_t totalSectors = reserved + 2 * fatSectors + clusterCount * sectorsPerCluster;
+    if (totalSectors > 0xFFFFFFFFull)
+    {
+        return "Too big for FAT32: more than 2 TB.";
+    }
+
+    // Clusters in the order they are written: the root at 2, the other folders, then the files.
+    uint32_t next = 2;
+    for (folderNode &folder : folders)
+    {
+        folder.cluster = next;
+        folder.clusters = (uint32_t)std::max<uint64_t>(1, (folder.slots * 32 + clusterBytes - 1) / clusterBytes);
+        next += folder.clusters;
+    }
+    for (fileNode &node : nodes)
+    {
+        node.clusters = (uint32_t)((node.size + clusterBytes - 1) / clusterBytes);
+        node.cluster = node.clusters > 0 ? next : 0;
+        next += node.clusters;
+    }
+    uint32_t usedClusters = next - 2;
+    std::vector<std::pair<uint32_t, uint32_t>> runs; //First cluster and count, in order.
+    for (const folderNode &folder : folders)
+    {
+        runs.push_back({folder.cluster, folder.clusters});
+    }
+    for (const fileNode &node : nodes)
+    {
+        if (node.clusters > 0)
+        {
+            runs.push_back({node.cluster, node.clusters});
+        }
+    }
+
+    std::time_t now = std::time(nullptr);
+    std::tm local;
+#ifdef _WIN32
+    localtime_s(&local, &now);
+#else
+    localtime_r(&now, &local);
+#endif
+    uint16_t date = (uint16_t)(((std::max(local.tm_year, 80) - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday);
+    uint16_t time = (uint16_t)((local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2));
+    char volumeLabel[11];
+    std::memset(volumeLabel, ' ', 11);
+    std::string labelText;
+    for (char c : Upper(label))
+    {
+        if (labelText.size() < 11 && (ShortChar(c) || c == ' '))
+        {
+            labelText += c;
+        }
+    }
+    std::memcpy(volumeLabel, labelText.empty() ? "NO NAME" : labelText.c_str(), labelText.empty() ? 7 : labelText.size());
+
+    filePtr out(std::fopen(image.c_str(), "wb"), std::fclose);
+    if (!out)
+    {
+        return "Could not write: " + image;
+    }
+    auto fail = [&](const std::string &error)
+    {
+        out.reset();
+        std::error_code ec;
+        std::filesystem::remove(image, ec);
+        return error;
+    };
+    span.Arg("clusters", (int64_t)clusterCount);
+    span.Arg("cluster bytes", (int64_t)clusterBytes);
+
+    // Boot sector, FSInfo and their backups.
+    {
+        TraceSpan metaSpan("boot and FATs", "image");
+        std::vector<uint8_t> head(reserved * SECTOR, 0);
+        uint8_t *boot = head.data();
+        const uint8_t jump[3] = {0xEB, 0x58, 0x90};
+        std::memcpy(boot, jump, 3);
+        std::memcpy(boot + 3, "ROMPER  ", 8);
+        Put16(boot + 11, SECTOR);
+        boot[13] = (uint8_t)sectorsPerCluster;
+        Put16(boot + 14, (uint16_t)reserved);
+        boot[16] = 2;
+        boot[21] = 0xF8;
+        Put16(boot + 24, 63);
+        Put16(boot + 26, 255);
+        Put32(boot + 32, (uint32_t)totalSectors);
+        Put32(boot + 36, (uint32_t)fatSectors);
+        Put32(boot + 44, 2);
+        Put16(boot + 48, 1);
+        Put16(boot + 50, 6);
+        boot[64] = 0x80;
+        boot[66] = 0x29;
+        Put32(boot + 67, ((uint32_t)date << 16) | time);
+        std::memcpy(boot + 71, volumeLabel, 11);
+        std::memcpy(boot + 82, "FAT32   ", 8);
+        boot[510] = 0x55;
+        boot[511] = 0xAA;
+        uint8_t *info = head.data() + SECTOR;
+        Put32(info, 0x41615252);
+        Put32(info + 484, 0x61417272);
+        Put32(info + 488, (uint32_t)(clusterCount - usedClusters));
+        Put32(info + 492, (uint32_t)std::min<uint64_t>(2 + usedClusters, clusterCount + 1));
+        Put32(info + 508, 0xAA550000);
+        std::memcpy(head.data() + 6 * SECTOR, head.data(), 2 * SECTOR);
+        if (std::fwrite(head.data(), 1, head.size(), out.get()) != head.size())
+        {
+            return fail("Could not write: " + image + ". Be sure there is enough space.");
+        }
+
+        // Both FATs, a chunk at a time. Every run of clusters is one chain.
+        std::vector<uint8_t> chunk(IO_BYTES);
+        uint64_t entries = fatSectors * SECTOR / 4;
+        for (int copy = 0; copy < 2; copy++)
+        {
+            size_t run = 0;
+            for (uint64_t first = 0; first < entries; first += chunk.size() / 4)
+            {
+                uint64_t count = std::min<uint64_t>(chunk.size() / 4, entries - first);
+                std::memset(chunk.data(), 0, count * 4);
+                for (uint64_t e = first; e < first + count; e++)
+                {
+                    uint32_t value = 0;
+                    if (e < 2)
+                    {
+                        value = e == 0 ? 0x0FFFFFF8 : END_OF_CHAIN;
+                    }
+                    else
+                    {
+                        while (run < runs.size() && e >= (uint64_t)runs[run].first + runs[run].second)
+                        {
+                            run++;
+                        }
+                        if (run < runs.size() && e >= runs[run].first)
+                        {
+                            value = e + 1 < (uint64_t)runs[run].first + runs[run].second ? (uint32_t)e + 1 : END_OF_CHAIN;
+                        }
+                        else if (run == runs.size())
+                        {
+                            break;
+                        }
+                    }
+                    Put32(chunk.data() + (e - first) * 4, value);
+                }
+                if (std::fwrite(chunk.data(), 1, count * 4, out.get()) != count * 4)
+                {
+                    return fail("Could not write: " + image + ". Be sure there is enough space.");
+                }
+            }
+        }
+    }
+
+    // Folders, in cluster order.
+    {
+        TraceSpan folderSpan("folders", "image");
+        for (size_t f = 0; f < folders.size(); f++)
+        {
+            const folderNode &folder = folders[f];
+            std::vector<uint8_t> bytes((size_t)folder.clusters * clusterBytes, 0);
+            uint8_t *at = bytes.data();
+            if (f == 0)
+            {
+                ShortEntry(at, volumeLabel, 0x08, 0, 0, 0, date, time);
+                at += 32;
+            }
+            else
+            {
+                // ".." is 0 when the parent is the root.
+                ShortEntry(at, ".          ", 0x10, 0, folder.cluster, 0, date, time);
+                ShortEntry(at + 32, "..         ", 0x10, 0, folder.parent == 0 ? 0 : folders[folder.parent].cluster, 0, date, time);
+                at += 64;
+            }
+            for (const folderEntry &entry : folder.entries)
+            {
+                // Long name pieces come last to first, just before the short entry.
+                size_t pieces = (entry.longName.size() + 12) / 13;
+                uint8_t checksum = ShortNameChecksum(entry.shortName);
+                for (size_t piece = pieces; piece-- > 0; at += 32)
+                {
+                    at[0] = (uint8_t)((piece + 1) | (piece + 1 == pieces ? 0x40 : 0));
+                    at[11] = 0x0F;
+                    at[13] = checksum;
+                    const int offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+                    for (size_t k = 0; k < 13; k++)
+                    {
+                        size_t position = piece * 13 + k;
+                        uint16_t unit = position < entry.longName.size() ? entry.longName[position] : position == entry.longName.size() ? 0x0000 : 0xFFFF;
+                        Put16(at + offsets[k], unit);
+                    }
+                }
+                if (entry.folder)
+                {
+                    ShortEntry(at, entry.shortName, 0x10, entry.caseFlags, folders[entry.index].cluster, 0, date, time);
+                }
+                else
+                {
+                    ShortEntry(at, entry.shortName, 0x20, entry.caseFlags, nodes[entry.index].cluster, (uint32_t)nodes[entry.index].size, date, time);
+                }
+                at += 32;
+            }
+            if (std::fwrite(bytes.data(), 1, bytes.size(), out.get()) != bytes.size())
+            {
+                return fail("Could not write: " + image + ". Be sure there is enough space.");
+            }
+        }
+        result.folders = (int)folders.size() - 1;
+    }
+
+    // Then every file's bytes, back to back.
+    TraceSpan dataSpan("files", "image");
+    std::vector<char> buffer(IO_BYTES);
+    uint64_t done = 0;
+    for (const fileNode &node : nodes)
+    {
+        if (abort)
+        {
+            return fail("Stopped before the image was finished: " + image);
+        }
+        filePtr in(std::fopen(node.source.c_str(), "rb"), std::fclose);
+        if (!in)
+        {
+            return fail("Could not read: " + node.source);
+        }
+        uint64_t left = node.size;
+        while (left > 0)
+        {
+            size_t want = (size_t)std::min<uint64_t>(left, buffer.size());
+            if (std::fread(buffer.data(), 1, want, in.get()) != want)
+            {
+                return fail("Could not read all of: " + node.source + ". It may have changed while the image was built.");
+            }
+            if (std::fwrite(buffer.data(), 1, want, out.get()) != want)
+            {
+                return fail("Could not write: " + image + ". Be sure there is enough space.");
+            }
+            left -= want;
+            if (abort)
+            {
+                return fail("Stopped before the image was finished: " + image);
+            }
+        }
+        if (!WriteZeros(out.get(), (uint64_t)node.clusters * clusterBytes - node.size))
+        {
+            return fail("Could not write: " + image + ". Be sure there is enough space.");
+        }
+        result.files++;
+        done += node.size;
+        if (onProgress)
+        {
+            onProgress(done, result.dataBytes);
+        }
+    }
+    dataSpan.Finish();
+    if (std::fflush(out.get()) != 0)
+    {
+        return fail("Could not write: " + image + ". Be sure there is enough space.");
+    }
+    out.reset();
+    // The free clusters at the end are left as a hole, so a big card's image doesn't take its size on disk.
+    result.bytes = totalSectors * SECTOR;
+    std::error_code ec;
+    std::filesystem::resize_file(image, result.bytes, ec);
+    if (ec)
+    {
+        return fail("Could not write: " + image + " " + ec.message());
+    }
+    result.clusterBytes = clusterBytes;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    span.Arg("files", (int64_t)result.files);
+    return "";
+}
@@ -0,0 +1,55 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/fatimage.h
+// Purpose:     FAT32 card images of a profile's files, written front to back in one pass
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/profiles.h"
+#include "core/run.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*One file to put in an image.*/
+struct imageFile
+{
+    std::string path; //Inside the image, '/' separated, e.g. "roms/pacman.zip". Folders are made as needed.
+    std::string source; //Where its bytes come from.
+};
+
+/*What BuildFatImage wrote.*/
+struct imageResult
+{
+    uint64_t bytes = 0; //The image's size.
+    uint64_t dataBytes = 0; //Bytes of the files in it.
+    uint32_t clusterBytes = 0;
+    int files = 0; //Files put in.
+    int folders = 0;
+    std::vector<std::string> errors; //Files left out, one line each: unreadable, 4 GB or more, or too many in one folder.
+    double seconds = 0;
+};
+
+/*Microsoft's default FAT32 cluster size for a volume of this size: what formatting a card of that size gives, and what BuildFatImage uses.*/
+uint32_t FatClusterBytes(uint64_t volumeBytes);
+
+/*
+*Where a profile's run files go in a card image: their targets, relative to the folder holding both the rom and CHD targets.
+*E.g. /media/card/roms/pacman.zip and /media/card/chd/... become roms/pacman.zip and chd/...
+*/
+std::vector<imageFile> ImageFiles(const profile &p, const std::vector<runFile> &files);
+
+/*
+*Write a FAT32 filesystem image holding files, ready to be written to a card with dd or a flasher.
+*Everything is laid out before anything is written, so the image goes out front to back in one pass: the boot sectors, both FATs,
+*every folder, then each file in one contiguous run of clusters. The data area starts on a 1 MB boundary, as cards like.
+*The image is minimumBytes (e.g. the card's size, the rest left free) or as big as the files need, whichever is bigger. The free tail is sparse.
+*Cluster sizes follow the usual FAT32 table for the image's size. Names keep their case: short names when they fit 8.3, else long names.
+*onProgress, if given, is called with the file bytes written so far and in all. abort is checked between reads.
+*Returns "" on success, else the error that stopped it, with the image removed. Files that couldn't go in are in result.errors.
+*/
+std::string BuildFatImage(const std::string &image, const std::vector<imageFile> &files, uint64_t minimumBytes, const std::string &label, std::atomic<bool> &abort, imageResult &result,
+                          const std::function<void(uint64_t done, uint64_t total)> &onProgress = nullptr);
@@ -0,0 +1,149 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/history.cpp
+// Purpose:     Run history. Every run and its files are kept in profiles.romper.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/history.h"
+#include "core/trace.h"
+
+#include <chrono>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+int64_t EpochMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+int64_t RecordRun(SQLite::Database &profileDB, runRecord run, const std::vector<runFile> &files, const runResult &result)
+{
+    TraceSpan span("RecordRun", "profiledb");
+    run.files = (int)files.size();
+    run.ok = result.ok;
+    run.failed = result.failed;
+    run.skipped = result.skipped;
+    run.strategy = result.strategy;
+    run.retries = 0;
+    run.bytes = 0;
+    for (const fileStats &stats : result.files)
+    {
+        run.retries += stats.retries;
+        run.bytes += stats.bytes;
+    }
+
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement query(profileDB, "INSERT INTO runs (profile,started,finished,online,jobs,strategy,files,ok,failed,skipped,retries,bytes,aborted) VALUES (?,?,?,?,?,?,?,?,?,?,?,?,?);");
+    query.bind(1, run.profile);
+    query.bind(2, run.started);
+    query.bind(3, run.finished);
+    query.bind(4, run.online);
+    query.bind(5, run.jobs);
+    query.bind(6, run.strategy);
+    query.bind(7, run.files);
+    query.bind(8, run.ok);
+    query.bind(9, run.failed);
+    query.bind(10, run.skipped);
+    query.bind(11, run.retries);
+    query.bind(12, run.bytes);
+    query.bind(13, run.aborted);
+    query.exec();
+    int64_t id = profileDB.getLastInsertRowid();
+
+    SQLite::Statement fileQuery(profileDB, "INSERT INTO run_files (run,game,type,source,target,bytes,seconds,retries,skipped,error) VALUES (?,?,?,?,?,?,?,?,?,?);");
+    for (size_t i = 0; i < files.size() && i < result.files.size(); i++)
+    {
+        const fileStats &stats = result.files[i];
+        if (!stats.done)
+        {
+            continue;
+        }
+        fileQuery.bind(1, id);
+        fileQuery.bind(2, files[i].game);
+        fileQuery.bind(3, files[i].type);
+        fileQuery.bind(4, files[i].source);
+        fileQuery.bind(5, files[i].target);
+        fileQuery.bind(6, stats.bytes);
+        fileQuery.bind(7, stats.seconds);
+        fileQuery.bind(8, stats.retries);
+        fileQuery.bind(9, stats.skipped ? 1 : 0);
+        fileQuery.bind(10, stats.error);
+        fileQuery.exec();
+        fileQuery.reset();
+    }
+    transaction.commit();
+    return id;
+}
+
+std::vector<runRecord> LoadRuns(SQLite::Database &profileDB, const std::string &profileName, int limit)
+{
+    std::vector<runRecord> runs;
+    SQLite::Statement query(profileDB, "SELECT id,profile,started,finished,online,jobs,strategy,files,ok,failed,skipped,retries,bytes,aborted FROM runs WHERE ?='' OR profile=? ORDER BY started DESC, id DESC LIMIT ?;");
+    query.bind(1, profileName);
+    query.bind(2, profileName);
+    query.bind(3, limit);
+    while (query.executeStep())
+    {
+        runRecord run;
+        run.id = query.getColumn(0).getInt64();
+        run.profile = query.getColumn(1).getString();
+        run.started = query.getColumn(2).getInt64();
+        run.finished = query.getColumn(3).getInt64();
+        run.online = query.getColumn(4).getInt();
+        run.jobs = query.getColumn(5).getInt();
+        run.strategy = query.getColumn(6).getString();
+        run.files = query.getColumn(7).getInt();
+        run.ok = query.getColumn(8).getInt();
+        run.failed = query.getColumn(9).getInt();
+        run.skipped = query.getColumn(10).getInt();
+        run.retries = query.getColumn(11).getInt();
+        run.bytes = query.getColumn(12).getInt64();
+        run.aborted = query.getColumn(13).getInt();
+        runs.push_back(run);
+    }
+    return runs;
+}
+
+std::vector<runFileRecord> LoadRunFiles(SQLite::Database &profileDB, int64_t runId)
+{
+    std::vector<runFileRecord> files;
+    SQLite::Statement query(profileDB, "SELECT game,type,source,target,bytes,seconds,retries,skipped,error FROM run_files WHERE run=? ORDER BY rowid;");
+    query.bind(1, runId);
+    while (query.executeStep())
+    {
+        files.push_back(runFileRecord{query.getColumn(0).getString(), query.getColumn(1).getString(), query.getColumn(2).getString(), query.getColumn(3).getString(),
+                                      query.getColumn(4).getInt64(), query.getColumn(5).getDouble(), query.getColumn(6).getInt(), query.getColumn(7).getInt(), query.getColumn(8).getString()});
+    }
+    return files;
+}
+
+double RunMegabytesPerSecond(const runRecord &run)
+{
+    if (run.finished <= run.started)
+    {
+        return 0;
+    }
+    return run.bytes / 1048576.0 / ((run.finished - run.started) / 1000.0);
+}
+
+runThroughput PastThroughput(SQLite::Database &profileDB, int online, int runs)
+{
+    TraceSpan span("PastThroughput", "profiledb");
+    runThroughput throughput;
+    SQLite::Statement query(profileDB, "SELECT SUM(bytes), SUM(finished - started) FROM (SELECT bytes, started, finished FROM runs WHERE online=? AND aborted=0 AND bytes > 0 ORDER BY id DESC LIMIT ?);");
+    query.bind(1, online);
+    query.bind(2, runs);
+    if (query.executeStep() && query.getColumn(1).getInt64() > 0)
+    {
+        throughput.bytesPerSecond = query.getColumn(0).getInt64() / (query.getColumn(1).getInt64() / 1000.0);
+    }
+    SQLite::Statement files(profileDB, "SELECT type, AVG(bytes) FROM run_files WHERE run IN (SELECT id FROM runs WHERE online=? AND aborted=0 AND bytes > 0 ORDER BY id DESC LIMIT ?) "
+                                       "AND bytes > 0 AND skipped=0 GROUP BY type;");
+    files.bind(1, online);
+    files.bind(2, runs);
+    while (files.executeStep())
+    {
+        throughput.bytesPerFile[files.getColumn(0).getString()] = files.getColumn(1).getDouble();
+    }
+    return throughput;
+}
@@ -0,0 +1,77 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/history.h
+// Purpose:     Run history. Every run and its files are kept in profiles.romper.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/run.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace SQLite
+{
+    class Database;
+}
+
+struct runRecord //One row of the runs table.
+{
+    int64_t id = 0;
+    std::string profile;
+    int64_t started = 0; //Unix time in milliseconds.
+    int64_t finished = 0; //Unix time in milliseconds.
+    int online = 0;
+    int jobs = 1; //Files transferred at a time.
+    std::string strategy; //"copy", "download", ...
+    int files = 0; //Files planned.
+    int ok = 0;
+    int failed = 0;
+    int skipped = 0;
+    int retries = 0;
+    int64_t bytes = 0; //Bytes written.
+    int aborted = 0;
+};
+
+struct runFileRecord //One row of the run_files table.
+{
+    std::string game;
+    std::string type; //"rom" or "chd".
+    std::string source;
+    std::string target;
+    int64_t bytes = 0;
+    double seconds = 0;
+    int retries = 0;
+    int skipped = 0;
+    std::string error; //"" on success.
+};
+
+/*The current time as unix milliseconds, for runRecord.started and finished.*/
+int64_t EpochMs();
+
+/*
+*Save a finished run. run has the profile, times, online and jobs filled in, the rest is summed from result.
+*Files the run never got to are not saved. Returns the run's id.
+*/
+int64_t RecordRun(SQLite::Database &profileDB, runRecord run, const std::vector<runFile> &files, const runResult &result);
+
+/*The newest runs first. An empty profileName gives every profile's runs.*/
+std::vector<runRecord> LoadRuns(SQLite::Database &profileDB, const std::string &profileName, int limit);
+
+/*The files of one run, in the order they were planned.*/
+std::vector<runFileRecord> LoadRunFiles(SQLite::Database &profileDB, int64_t runId);
+
+/*Bytes per second over the run's wall time, in MB/s. 0 for an empty run.*/
+double RunMegabytesPerSecond(const runRecord &run);
+
+/*How fast past runs went, for estimating the next one.*/
+struct runThroughput
+{
+    double bytesPerSecond = 0; //Over the runs' wall time. 0 if there are none.
+    std::map<std::string, double> bytesPerFile; //Average size of a transferred file by type. A type never transferred isn't in it.
+};
+
+/*The throughput of the last runs finished (not aborted) that were online, or not, like the next one.*/
+runThroughput PastThroughput(SQLite::Database &profileDB, int online, int runs = 20);
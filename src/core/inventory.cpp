@@ -0,0 +1,533 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/inventory.cpp
+// Purpose:     Inventory of local source folders. Which ROMs and CHDs are really there.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/inventory.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+namespace
+{
+    struct fileEntry
+    {
+        std::string name;
+        int64_t size = 0;
+        int64_t mtime = 0; //Nanoseconds since the epoch where the platform has them.
+        int64_t inode = 0; //0 on Windows.
+    };
+
+    bool StatPath(const std::string &path, int64_t &size, int64_t &mtime, int64_t &inode)
+    {
+#ifdef _WIN32
+        std::error_code ec;
+        auto modified = std::filesystem::last_write_time(path, ec);
+        if (ec)
+        {
+            return false;
+        }
+        size = std::filesystem::is_regular_file(path, ec) ? (int64_t)std::filesystem::file_size(path, ec) : 0;
+        mtime = modified.time_since_epoch().count();
+        inode = 0;
+        return true;
+#else
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+        {
+            return false;
+        }
+        size = st.st_size;
+#ifdef __APPLE__
+        mtime = (int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        inode = st.st_ino;
+        return true;
+#endif
+    }
+
+    std::string JoinPath(const std::string &root, const std::string &dir, const std::string &name)
+    {
+        return root + (dir.empty() ? "" : "/" + dir) + "/" + name;
+    }
+
+    //A folder to list, or a chunk of a listed folder's files to stat.
+    struct scanTask
+    {
+        std::string dir;
+        std::vector<std::string> names; //Empty for a listing task.
+    };
+}
+
+scanStats ScanSource(SQLite::Database &profileDB, const std::string &root, int jobs, bool full, std::atomic<bool> &abort)
+{
+    TraceSpan span("ScanSource", "inventory");
+    span.Arg("root", root);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    scanStats stats;
+    std::error_code ec;
+    if (root.empty() || !std::filesystem::is_directory(root, ec))
+    {
+        stats.error = "Not a folder: " + root;
+        return stats;
+    }
+
+    // What the last scan saw: folder -> mtime, and each folder's subfolders.
+    std::map<std::string, int64_t> knownDirs;
+    std::map<std::string, std::vector<std::string>> knownChildren;
+    {
+        SQLite::Statement query(profileDB, "SELECT dir, mtime FROM inventory_dirs WHERE root=?;");
+        query.bind(1, root);
+        while (query.executeStep())
+        {
+            std::string dir = query.getColumn(0).getString();
+            knownDirs[dir] = query.getColumn(1).getInt64();
+            if (!dir.empty())
+            {
+                size_t slash = dir.rfind('/');
+                knownChildren[slash == std::string::npos ? "" : dir.substr(0, slash)].push_back(dir);
+            }
+        }
+    }
+
+    std::mutex mutex; //Guards everything the workers share.
+    std::condition_variable wake;
+    std::deque<scanTask> queue = {scanTask{"", {}}};
+    int pending = 1; //Tasks queued or running.
+    std::vector<std::string> visited;
+    std::map<std::string, int64_t> listedDirs; //Folders listed this scan -> their new mtime.
+    std::map<std::string, std::vector<fileEntry>> listedFiles;
+    const size_t statChunk = 512;
+
+    auto runTask = [&](scanTask &task)
+    {
+        if (!task.names.empty())
+        {
+            std::vector<fileEntry> entries;
+            entries.reserve(task.names.size());
+            for (const std::string &name : task.names)
+            {
+                fileEntry entry;
+                entry.name = name;
+                if (StatPath(JoinPath(root, task.dir, name), entry.size, entry.mtime, entry.inode))
+                {
+                    entries.push_back(entry);
+                }
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<fileEntry> &files = listedFiles[task.dir];
+            files.insert(files.end(), entries.begin(), entries.end());
+            stats.files += (int)entries.size();
+            return;
+        }
+
+        std::string path = task.dir.empty() ? root : root + "/" + task.dir;
+        int64_t size, mtime, inode;
+        if (!StatPath(path, size, mtime, inode))
+        {
+            return;
+        }
+        std::vector<scanTask> more;
+        auto known = knownDirs.find(task.dir);
+        bool listed = full || known == knownDirs.end() || known->second != mtime;
+        if (!listed)
+        {
+            // Unchanged, so its entries are too. Only its subfolders need checking.
+            auto children = knownChildren.find(task.dir);
+            if (children != knownChildren.end())
+            {
+                for (const std::string &child : children->second)
+                {
+                    more.push_back(scanTask{child, {}});
+                }
+            }
+        }
+        else
+        {
+            std::vector<std::string> names;
+            std::error_code ec;
+            for (std::filesystem::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+            {
+                std::string name = it->path().filename().string();
+                std::error_code entryEc;
+                if (it->is_directory(entryEc) && !it->is_symlink(entryEc))
+                {
+                    more.push_back(scanTask{task.dir.empty() ? name : task.dir + "/" + name, {}});
+                }
+                else if (it->is_regular_file(entryEc))
+                {
+                    names.push_back(name);
+                    if (names.size() == statChunk)
+                    {
+                        more.push_back(scanTask{task.dir, std::move(names)});
+                        names.clear();
+                    }
+                }
+            }
+            if (!names.empty())
+            {
+                more.push_back(scanTask{task.dir, std::move(names)});
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        visited.push_back(task.dir);
+        stats.dirs++;
+        if (listed)
+        {
+            listedDirs[task.dir] = mtime;
+            listedFiles[task.dir];
+            stats.dirsListed++;
+        }
+        for (scanTask &t : more)
+        {
+            queue.push_back(std::move(t));
+            pending++;
+        }
+        if (!more.empty())
+        {
+            wake.notify_all();
+        }
+    };
+
+    auto worker = [&]()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&]() { return !queue.empty() || pending == 0 || abort; });
+            if (queue.empty() || abort)
+            {
+                wake.notify_all();
+                return;
+            }
+            scanTask task = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            runTask(task);
+            lock.lock();
+            if (--pending == 0)
+            {
+                wake.notify_all();
+            }
+        }
+    };
+    jobs = std::max(1, jobs);
+    std::vector<std::thread> workers;
+    for (int j = 1; j < jobs; j++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+    if (abort)
+    {
+        stats.error = "Aborted";
+        return stats;
+    }
+
+    // Write only what changed, in one transaction.
+    TraceSpan writeSpan("write inventory", "profiledb");
+    SQLite::Transaction transaction(profileDB);
+    std::unordered_set<std::string> visitedSet(visited.begin(), visited.end());
+    SQLite::Statement deleteFiles(profileDB, "DELETE FROM inventory WHERE root=? AND dir=?;");
+    SQLite::Statement deleteDir(profileDB, "DELETE FROM inventory_dirs WHERE root=? AND dir=?;");
+    SQLite::Statement countFiles(profileDB, "SELECT COUNT(*) FROM inventory WHERE root=? AND dir=?;");
+    for (const auto &known : knownDirs)
+    {
+        if (visitedSet.count(known.first) == 0)
+        {
+            countFiles.bind(1, root);
+            countFiles.bind(2, known.first);
+            if (countFiles.executeStep())
+            {
+                stats.removed += countFiles.getColumn(0).getInt();
+            }
+            countFiles.reset();
+            for (SQLite::Statement *query : {&deleteFiles, &deleteDir})
+            {
+                query->bind(1, root);
+                query->bind(2, known.first);
+                query->exec();
+                query->reset();
+            }
+        }
+    }
+
+    SQLite::Statement oldFiles(profileDB, "SELECT name, size, mtime FROM inventory WHERE root=? AND dir=?;");
+    SQLite::Statement insertFile(profileDB, "INSERT INTO inventory (root,dir,name,size,mtime,inode) VALUES (?,?,?,?,?,?);");
+    SQLite::Statement insertDir(profileDB, "INSERT OR REPLACE INTO inventory_dirs (root,dir,mtime) VALUES (?,?,?);");
+    for (const auto &dir : listedDirs)
+    {
+        std::map<std::string, std::pair<int64_t, int64_t>> before;
+        oldFiles.bind(1, root);
+        oldFiles.bind(2, dir.first);
+        while (oldFiles.executeStep())
+        {
+            before[oldFiles.getColumn(0).getString()] = {oldFiles.getColumn(1).getInt64(), oldFiles.getColumn(2).getInt64()};
+        }
+        oldFiles.reset();
+        deleteFiles.bind(1, root);
+        deleteFiles.bind(2, dir.first);
+        deleteFiles.exec();
+        deleteFiles.reset();
+
+        const std::vector<fileEntry> &files = listedFiles[dir.first];
+        for (const fileEntry &file : files)
+        {
+            auto old = before.find(file.name);
+            if (old == before.end())
+            {
+                stats.added++;
+            }
+            else
+            {
+                if (old->second.first != file.size || old->second.second != file.mtime)
+                {
+                    stats.changed++;
+                }
+                before.erase(old);
+            }
+            insertFile.bind(1, root);
+            insertFile.bind(2, dir.first);
+            insertFile.bind(3, file.name);
+            insertFile.bind(4, file.size);
+            insertFile.bind(5, file.mtime);
+            insertFile.bind(6, file.inode);
+            insertFile.exec();
+            insertFile.reset();
+        }
+        stats.removed += (int)before.size();
+        insertDir.bind(1, root);
+        insertDir.bind(2, dir.first);
+        insertDir.bind(3, dir.second);
+        insertDir.exec();
+        insertDir.reset();
+    }
+    transaction.commit();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+std::vector<inventoryChange> UpdateInventoryFiles(SQLite::Database &profileDB, const std::string &root, const std::vector<std::string> &relativePaths)
+{
+    TraceSpan span("UpdateInventoryFiles", "inventory");
+    span.Arg("paths", (int64_t)relativePaths.size());
+    std::vector<inventoryChange> changes;
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement known(profileDB, "SELECT dir, name FROM inventory WHERE root=? AND (dir=? OR substr(dir,1,?)=? OR ?='');");
+    SQLite::Statement knownFile(profileDB, "SELECT 1 FROM inventory WHERE root=? AND dir=? AND name=?;");
+    SQLite::Statement upsert(profileDB, "INSERT OR REPLACE INTO inventory (root,dir,name,size,mtime,inode) VALUES (?,?,?,?,?,?);");
+    SQLite::Statement remove(profileDB, "DELETE FROM inventory WHERE root=? AND dir=? AND name=?;");
+    for (const std::string &relativePath : relativePaths)
+    {
+        // What the inventory had under this path, as dir/name pairs. Whatever is still there is taken back out.
+        std::map<std::pair<std::string, std::string>, bool> before;
+        size_t slash = relativePath.rfind('/');
+        std::string parent = slash == std::string::npos ? "" : relativePath.substr(0, slash);
+        std::string name = slash == std::string::npos ? relativePath : relativePath.substr(slash + 1);
+        if (!relativePath.empty())
+        {
+            knownFile.bind(1, root);
+            knownFile.bind(2, parent);
+            knownFile.bind(3, name);
+            if (knownFile.executeStep())
+            {
+                before[{parent, name}] = true;
+            }
+            knownFile.reset();
+        }
+        known.bind(1, root);
+        known.bind(2, relativePath);
+        known.bind(3, (int)relativePath.size() + 1);
+        known.bind(4, relativePath + "/");
+        known.bind(5, relativePath);
+        while (known.executeStep())
+        {
+            before[{known.getColumn(0).getString(), known.getColumn(1).getString()}] = true;
+        }
+        known.reset();
+
+        std::vector<std::pair<std::string, std::string>> found;
+        std::string path = relativePath.empty() ? root : root + "/" + relativePath;
+        std::error_code ec;
+        std::filesystem::file_status status = std::filesystem::symlink_status(path, ec);
+        if (std::filesystem::is_symlink(status))
+        {
+            status = std::filesystem::status(path, ec);
+            if (std::filesystem::is_directory(status))
+            {
+                status = std::filesystem::file_status(); //Scans don't follow linked folders either.
+            }
+        }
+        if (std::filesystem::is_regular_file(status))
+        {
+            found.push_back({parent, name});
+        }
+        else if (std::filesystem::is_directory(status))
+        {
+            for (std::filesystem::recursive_directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+            {
+                std::error_code entryEc;
+                if (it->is_regular_file(entryEc))
+                {
+                    std::string relative = it->path().lexically_relative(root).generic_string();
+                    size_t fileSlash = relative.rfind('/');
+                    found.push_back({fileSlash == std::string::npos ? "" : relative.substr(0, fileSlash), fileSlash == std::string::npos ? relative : relative.substr(fileSlash + 1)});
+                }
+            }
+        }
+
+        for (const auto &file : found)
+        {
+            int64_t size, mtime, inode;
+            if (!StatPath(JoinPath(root, file.first, file.second), size, mtime, inode))
+            {
+                continue;
+            }
+            upsert.bind(1, root);
+            upsert.bind(2, file.first);
+            upsert.bind(3, file.second);
+            upsert.bind(4, size);
+            upsert.bind(5, mtime);
+            upsert.bind(6, inode);
+            upsert.exec();
+            upsert.reset();
+            if (before.erase(file) == 0)
+            {
+                changes.push_back({file.first.empty() ? file.second : file.first + "/" + file.second, true});
+            }
+        }
+        for (const auto &gone : before)
+        {
+            remove.bind(1, root);
+            remove.bind(2, gone.first.first);
+            remove.bind(3, gone.first.second);
+            remove.exec();
+            remove.reset();
+            changes.push_back({gone.first.first.empty() ? gone.first.second : gone.first.first + "/" + gone.first.second, false});
+        }
+    }
+    transaction.commit();
+    return changes;
+}
+
+std::string GameOfPath(const profile &p, const std::string &root, const std::string &relativePath)
+{
+    size_t slash = relativePath.find('/');
+    const std::string zip = ".zip";
+    if (root == p.romSource && slash == std::string::npos && relativePath.size() > zip.size() && relativePath.compare(relativePath.size() - zip.size(), zip.size(), zip) == 0)
+    {
+        return relativePath.substr(0, relativePath.size() - zip.size());
+    }
+    if (root == p.chdSource && slash != std::string::npos)
+    {
+        return relativePath.substr(0, slash);
+    }
+    return "";
+}
+
+inventorySet LoadInventory(SQLite::Database &profileDB, const profile &p)
+{
+    TraceSpan span("LoadInventory", "inventory");
+    inventorySet inventory;
+    if (p.online == 1)
+    {
+        return inventory;
+    }
+    inventory.scanned = true;
+    for (const std::string &root : {p.romSource, p.chdSource})
+    {
+        if (root.empty())
+        {
+            continue;
+        }
+        SQLite::Statement scanned(profileDB, "SELECT 1 FROM inventory_dirs WHERE root=? AND dir='';");
+        scanned.bind(1, root);
+        if (!scanned.executeStep())
+        {
+            inventory.scanned = false;
+            inventory.files.clear();
+            return inventory;
+        }
+        SQLite::Statement query(profileDB, "SELECT dir, name FROM inventory WHERE root=?;");
+        query.bind(1, root);
+        while (query.executeStep())
+        {
+            inventory.files.insert(JoinPath(root, query.getColumn(0).getString(), query.getColumn(1).getString()));
+        }
+    }
+    return inventory;
+}
+
+gamePresence GamePresence(const inventorySet &inventory, const profile &p, const std::string &name, const std::string &disk)
+{
+    if (!inventory.scanned)
+    {
+        return PRESENCE_UNKNOWN;
+    }
+    bool rom = inventory.files.count(p.romSource + "/" + name + ".zip") > 0;
+    if (disk.empty())
+    {
+        return rom ? PRESENCE_PRESENT : PRESENCE_MISSING;
+    }
+    bool chd = inventory.files.count(p.chdSource + "/" + name + "/" + disk + ".chd") > 0;
+    if (rom && chd)
+    {
+        return PRESENCE_PRESENT;
+    }
+    return rom || chd ? PRESENCE_PARTIAL : PRESENCE_MISSING;
+}
+
+std::vector<std::string> GamesPresent(SQLite::Database &gameDB, const profile &p, const inventorySet &inventory)
+{
+    TraceSpan span("GamesPresent", "inventory");
+    std::vector<std::string> names;
+    if (!inventory.scanned)
+    {
+        return names;
+    }
+    SQLite::Statement query(gameDB, "SELECT Name, Disk FROM games;");
+    while (query.executeStep())
+    {
+        std::string name = query.getColumn(0).getString();
+        if (GamePresence(inventory, p, name, query.getColumn(1).getString()) == PRESENCE_PRESENT)
+        {
+            names.push_back(name);
+        }
+    }
+    return names;
+}
+
+std::vector<runFile> DropAbsentFiles(std::vector<runFile> &files, const inventorySet &inventory)
+{
+    std::vector<runFile> absent;
+    if (!inventory.scanned)
+    {
+        return absent;
+    }
+    // A zip of a split or merged set can be rebuilt as long as one of the zips it draws on is there.
+    auto firstAbsent = std::stable_partition(files.begin(), files.end(), [&](const runFile &file)
+                                             { return inventory.files.count(file.source) > 0 ||
+                                                      std::any_of(file.rebuildFrom.begin(), file.rebuildFrom.end(), [&](const std::string &zip)
+                                                                  { return inventory.files.count(zip) > 0; }); });
+    absent.assign(firstAbsent, files.end());
+    files.erase(firstAbsent, files.end());
+    return absent;
+}
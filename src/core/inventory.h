@@ -0,0 +1,82 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/inventory.h
+// Purpose:     Inventory of local source folders. Which ROMs and CHDs are really there.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/profiles.h"
+#include "core/run.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace SQLite
+{
+    class Database;
+}
+
+struct scanStats
+{
+    int dirs = 0; //Folders visited.
+    int dirsListed = 0; //Folders that changed since the last scan, so were listed and their files stat'd.
+    int files = 0; //Files stat'd.
+    int added = 0; //Files new since the last scan.
+    int removed = 0; //Files gone since the last scan.
+    int changed = 0; //Files with a new size or mtime.
+    double seconds = 0;
+    std::string error; //"" on success.
+};
+
+/*
+*Walk root on up to jobs threads and record each file's size, mtime and inode in the profile DB's inventory.
+*Folders whose mtime hasn't changed since the last scan are not listed again, unless full is set.
+*That catches added, removed and renamed files, but not files rewritten in place. Use full for those.
+*/
+scanStats ScanSource(SQLite::Database &profileDB, const std::string &root, int jobs, bool full, std::atomic<bool> &abort);
+
+/*A file that appeared in or left the inventory.*/
+struct inventoryChange
+{
+    std::string relativePath; //Relative to the root.
+    bool present = false; //False if it was removed.
+};
+
+/*
+*Bring single paths under root up to date, e.g. from a SourceWatcher, without a scan.
+*A path that is a folder is listed recursively, and anything under a path that no longer exists is removed. "" is all of root.
+*/
+std::vector<inventoryChange> UpdateInventoryFiles(SQLite::Database &profileDB, const std::string &root, const std::vector<std::string> &relativePaths);
+
+/*The game a file under one of p's source folders belongs to, or "" if it isn't a game's zip or CHD.*/
+std::string GameOfPath(const profile &p, const std::string &root, const std::string &relativePath);
+
+/*The files of a profile's source folders from the last scan.*/
+struct inventorySet
+{
+    bool scanned = false; //False if a source folder was never scanned. Then nothing is known to be absent.
+    std::unordered_set<std::string> files; //Full paths, built the way PlanRun builds sources.
+};
+
+/*Load the inventory of a local profile's source folders. Online profiles get an unscanned set.*/
+inventorySet LoadInventory(SQLite::Database &profileDB, const profile &p);
+
+enum gamePresence
+{
+    PRESENCE_UNKNOWN, //Online profile, or the sources were never scanned.
+    PRESENCE_MISSING, //None of the game's files are in the sources.
+    PRESENCE_PARTIAL, //The zip or the CHD is there, but not both.
+    PRESENCE_PRESENT, //Everything is there.
+};
+
+/*Whether a game's zip (and CHD if it has one) are in the inventory.*/
+gamePresence GamePresence(const inventorySet &inventory, const profile &p, const std::string &name, const std::string &disk);
+
+/*The names of every game in the game DB that is fully present. Used for the "have" filter.*/
+std::vector<std::string> GamesPresent(SQLite::Database &gameDB, const profile &p, const inventorySet &inventory);
+
+/*Remove the files known to be absent, and with nothing to rebuild them from, from files and return them. Does nothing if the inventory was never scanned.*/
+std::vector<runFile> DropAbsentFiles(std::vector<runFile> &files, const inventorySet &inventory);
@@ -0,0 +1,1168 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/pack.cpp
+// Purpose:     Packs rom zips into 7z sets, and reads 7z sets back
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/pack.h"
+#include "core/checksum.h"
+#include "core/trace.h"
+#include "core/util.h"
+#include "core/zipindex.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#include <lzma.h>
+
+// wxBase's zip stream does the inflating, as it does for deep verify.
+#include <wx/wfstream.h>
+#include <wx/zipstrm.h>
+
+namespace
+{
+    const unsigned char SIGNATURE[6] = {'7', 'z', 0xBC, 0xAF, 0x27, 0x1C};
+    const size_t START_HEADER_BYTES = 32;
+    const size_t IO_BYTES = 1 << 20;
+    const uint64_t MAX_HEADER_BYTES = 64 << 20; //A rom set's header is a few KB. Bigger is a corrupt size.
+
+    //Property IDs of the 7z header.
+    enum
+    {
+        ID_END = 0x00,
+        ID_HEADER = 0x01,
+        ID_ARCHIVE_PROPERTIES = 0x02,
+        ID_ADDITIONAL_STREAMS = 0x03,
+        ID_MAIN_STREAMS = 0x04,
+        ID_FILES = 0x05,
+        ID_PACK_INFO = 0x06,
+        ID_UNPACK_INFO = 0x07,
+        ID_SUBSTREAMS = 0x08,
+        ID_SIZE = 0x09,
+        ID_CRC = 0x0A,
+        ID_FOLDER = 0x0B,
+        ID_CODERS_UNPACK_SIZE = 0x0C,
+        ID_UNPACK_STREAMS = 0x0D,
+        ID_EMPTY_STREAM = 0x0E,
+        ID_EMPTY_FILE = 0x0F,
+        ID_NAME = 0x11,
+        ID_ENCODED_HEADER = 0x17,
+    };
+
+    const std::string METHOD_COPY("\x00", 1);
+    const std::string METHOD_LZMA("\x03\x01\x01", 3);
+    const std::string METHOD_LZMA2("\x21", 1);
+
+    using filePtr = std::unique_ptr<FILE, int (*)(FILE *)>;
+
+    /*An lzma_stream that is ended however the function using it returns.*/
+    struct lzmaStream
+    {
+        lzma_stream stream = LZMA_STREAM_INIT;
+        ~lzmaStream()
+        {
+            lzma_end(&stream);
+        }
+    };
+
+    void PutLittleEndian(unsigned char *at, uint64_t value, int bytes)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            at[i] = (unsigned char)(value >> (8 * i));
+        }
+    }
+
+    uint64_t GetLittleEndian(const unsigned char *at, int bytes)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++)
+        {
+            value |= (uint64_t)at[i] << (8 * i);
+        }
+        return value;
+    }
+
+    /*Builds a 7z header.*/
+    struct headerWriter
+    {
+        std::string bytes;
+
+        void Byte(uint8_t value)
+        {
+            bytes += (char)value;
+        }
+
+        /*7z's variable length number: the first byte's leading 1 bits count the little endian bytes after it, and its other bits are the top of the value.*/
+        void Number(uint64_t value)
+        {
+            uint8_t first = 0;
+            uint8_t mask = 0x80;
+            int extra = 0;
+            for (; extra < 8; extra++)
+            {
+                if (value < (1ull << (7 * (extra + 1))))
+                {
+                    first |= (uint8_t)(value >> (8 * extra));
+                    break;
+                }
+                first |= mask;
+                mask >>= 1;
+            }
+            Byte(first);
+            for (int i = 0; i < extra; i++)
+            {
+                Byte((uint8_t)(value >> (8 * i)));
+            }
+        }
+
+        void UInt32(uint32_t value)
+        {
+            for (int i = 0; i < 4; i++)
+            {
+                Byte((uint8_t)(value >> (8 * i)));
+            }
+        }
+
+        /*A bit per flag, the first in the top bit.*/
+        void Bits(const std::vector<bool> &bits)
+        {
+            for (size_t i = 0; i < bits.size(); i += 8)
+            {
+                uint8_t value = 0;
+                for (size_t k = 0; k < 8 && i + k < bits.size(); k++)
+                {
+                    value |= bits[i + k] ? 0x80 >> k : 0;
+                }
+                Byte(value);
+            }
+        }
+    };
+
+    /*Reads a 7z header. Reading past the end or a count bigger than the header can hold marks it bad and returns zeros, so callers check Ok once at the end.*/
+    class headerReader
+    {
+    public:
+        explicit headerReader(const std::string &bytes) : bytes(bytes) {}
+
+        bool Ok() const
+        {
+            return ok;
+        }
+
+        void Fail()
+        {
+            ok = false;
+        }
+
+        uint8_t Byte()
+        {
+            if (position >= bytes.size())
+            {
+                ok = false;
+                return 0;
+            }
+            return (uint8_t)bytes[position++];
+        }
+
+        uint64_t Number()
+        {
+            uint8_t first = Byte();
+            uint8_t mask = 0x80;
+            uint64_t value = 0;
+            for (int i = 0; i < 8; i++)
+            {
+                if ((first & mask) == 0)
+                {
+                    return value | ((uint64_t)(first & (mask - 1)) << (8 * i));
+                }
+                value |= (uint64_t)Byte() << (8 * i);
+                mask >>= 1;
+            }
+            return value;
+        }
+
+        /*A number of things that each take at least a bit of the header.*/
+        uint64_t Count()
+        {
+            uint64_t count = Number();
+            if (count > bytes.size() * 8)
+            {
+                ok = false;
+                return 0;
+            }
+            return count;
+        }
+
+        uint32_t UInt32()
+        {
+            uint32_t value = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                value |= (uint32_t)Byte() << (8 * i);
+            }
+            return value;
+        }
+
+        std::vector<bool> Bits(size_t count)
+        {
+            std::vector<bool> bits(count);
+            uint8_t value = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                if (i % 8 == 0)
+                {
+                    value = Byte();
+                }
+                bits[i] = (value & (0x80 >> (i % 8))) != 0;
+            }
+            return bits;
+        }
+
+        std::string Take(uint64_t count)
+        {
+            if (count > bytes.size() - position)
+            {
+                ok = false;
+                position = bytes.size();
+                return "";
+            }
+            position += count;
+            return bytes.substr(position - count, count);
+        }
+
+    private:
+        const std::string &bytes;
+        size_t position = 0;
+        bool ok = true;
+    };
+
+    struct coderInfo
+    {
+        std::string method; //See METHOD_LZMA and the rest.
+        std::string properties;
+        uint64_t inStreams = 1;
+        uint64_t outStreams = 1;
+    };
+
+    /*A run of files packed together by one chain of coders.*/
+    struct folderInfo
+    {
+        std::vector<coderInfo> coders;
+        std::vector<std::pair<uint64_t, uint64_t>> bindPairs; //A coder's in stream fed by another's out stream.
+        uint64_t packedStreams = 1;
+        std::vector<uint64_t> unpackSizes; //Per out stream of every coder.
+        uint64_t files = 1; //Non-empty files it holds, back to back.
+        bool hasCrc = false;
+        uint32_t crc = 0;
+
+        /*The out stream no coder reads is what the folder unpacks to.*/
+        uint64_t UnpackSize() const
+        {
+            for (uint64_t out = unpackSizes.size(); out-- > 0;)
+            {
+                if (std::none_of(bindPairs.begin(), bindPairs.end(), [&](const std::pair<uint64_t, uint64_t> &pair)
+                                 { return pair.second == out; }))
+                {
+                    return unpackSizes[out];
+                }
+            }
+            return 0;
+        }
+    };
+
+    struct streamsInfo
+    {
+        uint64_t packPosition = 0; //Of the first packed stream, from the end of the start header.
+        std::vector<uint64_t> packSizes;
+        std::vector<folderInfo> folders;
+        std::vector<uint64_t> sizes; //Of every non-empty file in the folders, in order.
+        std::vector<bool> hasCrc;
+        std::vector<uint32_t> crcs;
+    };
+
+    struct archiveInfo
+    {
+        streamsInfo streams;
+        std::vector<sevenZipEntry> entries;
+        std::vector<size_t> entryOfStream; //The entry each of streams.sizes is.
+    };
+
+    void ReadDigests(headerReader &r, size_t count, std::vector<bool> &defined, std::vector<uint32_t> &crcs)
+    {
+        defined = r.Byte() ? std::vector<bool>(count, true) : r.Bits(count);
+        crcs.assign(count, 0);
+        for (size_t i = 0; i < count && r.Ok(); i++)
+        {
+            crcs[i] = defined[i] ? r.UInt32() : 0;
+        }
+    }
+
+    void ReadFolder(headerReader &r, folderInfo &folder)
+    {
+        uint64_t coders = r.Count();
+        uint64_t inStreams = 0, outStreams = 0;
+        for (uint64_t c = 0; c < coders && r.Ok(); c++)
+        {
+            coderInfo coder;
+            uint8_t flags = r.Byte();
+            // 0x80 would be alternative methods, which 7-Zip has never written.
+            if (flags & 0x80)
+            {
+                r.Fail();
+            }
+            coder.method = r.Take(flags & 0x0F);
+            if (flags & 0x10)
+            {
+                coder.inStreams = r.Count();
+                coder.outStreams = r.Count();
+            }
+            if (flags & 0x20)
+            {
+                coder.properties = r.Take(r.Number());
+            }
+            inStreams += coder.inStreams;
+            outStreams += coder.outStreams;
+            folder.coders.push_back(coder);
+        }
+        if (outStreams == 0 || outStreams - 1 > inStreams)
+        {
+            r.Fail();
+            return;
+        }
+        for (uint64_t b = 0; b + 1 < outStreams && r.Ok(); b++)
+        {
+            uint64_t in = r.Number();
+            folder.bindPairs.push_back({in, r.Number()});
+        }
+        folder.packedStreams = inStreams - (outStreams - 1);
+        for (uint64_t p = 0; folder.packedStreams > 1 && p < folder.packedStreams && r.Ok(); p++)
+        {
+            r.Number();
+        }
+        folder.unpackSizes.resize(outStreams);
+    }
+
+    /*Pack info, folders and the files in them, up to and including their ID_END.*/
+    void ReadStreamsInfo(headerReader &r, streamsInfo &info)
+    {
+        uint64_t id = r.Number();
+        if (id == ID_PACK_INFO)
+        {
+            info.packPosition = r.Number();
+            uint64_t count = r.Count();
+            while (r.Ok() && (id = r.Number()) != ID_END)
+            {
+                if (id == ID_SIZE)
+                {
+                    for (uint64_t i = 0; i < count && r.Ok(); i++)
+                    {
+                        info.packSizes.push_back(r.Number());
+                    }
+                }
+                else if (id == ID_CRC)
+                {
+                    std::vector<bool> defined;
+                    std::vector<uint32_t> crcs;
+                    ReadDigests(r, count, defined, crcs);
+                }
+                else
+                {
+                    r.Fail();
+                }
+            }
+            id = r.Number();
+        }
+        if (id == ID_UNPACK_INFO)
+        {
+            if (r.Number() != ID_FOLDER)
+            {
+                r.Fail();
+            }
+            info.folders.resize(r.Count());
+            // The folders may be in another stream. 7-Zip never does that.
+            if (r.Byte() != 0)
+            {
+                r.Fail();
+            }
+            for (size_t f = 0; f < info.folders.size() && r.Ok(); f++)
+            {
+                ReadFolder(r, info.folders[f]);
+            }
+            if (r.Number() != ID_CODERS_UNPACK_SIZE)
+            {
+                r.Fail();
+            }
+            for (folderInfo &folder : info.folders)
+            {
+                for (uint64_t &size : folder.unpackSizes)
+                {
+                    size = r.Number();
+                }
+            }
+            while (r.Ok() && (id = r.Number()) != ID_END)
+            {
+                if (id != ID_CRC)
+                {
+                    r.Fail();
+                    break;
+                }
+                std::vector<bool> defined;
+                std::vector<uint32_t> crcs;
+                ReadDigests(r, info.folders.size(), defined, crcs);
+                for (size_t f = 0; f < info.folders.size(); f++)
+                {
+                    info.folders[f].hasCrc = defined[f];
+                    info.folders[f].crc = crcs[f];
+                }
+            }
+            id = r.Number();
+        }
+        bool sizesRead = false;
+        std::vector<bool> defined;
+        std::vector<uint32_t> crcs;
+        if (id == ID_SUBSTREAMS)
+        {
+            id = r.Number();
+            if (id == ID_UNPACK_STREAMS)
+            {
+                for (folderInfo &folder : info.folders)
+                {
+                    folder.files = r.Count();
+                }
+                id = r.Number();
+            }
+            if (id == ID_SIZE)
+            {
+                // Every file but each folder's last. That one has the rest.
+                for (const folderInfo &folder : info.folders)
+                {
+                    uint64_t sum = 0;
+                    for (uint64_t k = 0; k + 1 < folder.files && r.Ok(); k++)
+                    {
+                        info.sizes.push_back(r.Number());
+                        sum += info.sizes.back();
+                    }
+                    if (folder.files > 0)
+                    {
+                        if (sum > folder.UnpackSize())
+                        {
+                            r.Fail();
+                        }
+                        info.sizes.push_back(folder.UnpackSize() - sum);
+                    }
+                }
+                sizesRead = true;
+                id = r.Number();
+            }
+            if (id == ID_CRC)
+            {
+                // Only files whose folder doesn't already give their CRC are listed.
+                size_t unknown = 0;
+                for (const folderInfo &folder : info.folders)
+                {
+                    unknown += folder.files == 1 && folder.hasCrc ? 0 : folder.files;
+                }
+                ReadDigests(r, unknown, defined, crcs);
+                id = r.Number();
+            }
+            while (r.Ok() && id != ID_END)
+            {
+                r.Take(r.Number());
+                id = r.Number();
+            }
+            id = r.Number();
+        }
+        if (!sizesRead)
+        {
+            for (const folderInfo &folder : info.folders)
+            {
+                if (folder.files > 1)
+                {
+                    r.Fail();
+                }
+                if (folder.files == 1)
+                {
+                    info.sizes.push_back(folder.UnpackSize());
+                }
+            }
+        }
+        size_t digest = 0;
+        for (const folderInfo &folder : info.folders)
+        {
+            for (uint64_t k = 0; k < folder.files; k++)
+            {
+                bool known = folder.files == 1 && folder.hasCrc;
+                bool listed = !known && digest < defined.size();
+                info.hasCrc.push_back(known || (listed && defined[digest]));
+                info.crcs.push_back(known ? folder.crc : listed ? crcs[digest] : 0);
+                digest += listed ? 1 : 0;
+            }
+        }
+        if (id != ID_END)
+        {
+            r.Fail();
+        }
+    }
+
+    void ReadFilesInfo(headerReader &r, archiveInfo &archive)
+    {
+        size_t count = r.Count();
+        archive.entries.resize(count);
+        std::vector<bool> emptyStream(count, false);
+        std::vector<bool> emptyFile;
+        uint64_t type;
+        while (r.Ok() && (type = r.Number()) != ID_END)
+        {
+            std::string data = r.Take(r.Number());
+            headerReader property(data);
+            if (type == ID_EMPTY_STREAM)
+            {
+                emptyStream = property.Bits(count);
+            }
+            else if (type == ID_EMPTY_FILE)
+            {
+                emptyFile = property.Bits(std::count(emptyStream.begin(), emptyStream.end(), true));
+            }
+            else if (type == ID_NAME)
+            {
+                if (property.Byte() != 0)
+                {
+                    r.Fail();
+                }
+                for (sevenZipEntry &entry : archive.entries)
+                {
+                    std::u16string name;
+                    for (char16_t unit; property.Ok() && (unit = (char16_t)(property.Byte() | property.Byte() << 8)) != 0;)
+                    {
+                        name += unit;
+                    }
+                    entry.name = Utf8(name);
+                    std::replace(entry.name.begin(), entry.name.end(), '\\', '/');
+                }
+            }
+            if (!property.Ok())
+            {
+                r.Fail();
+            }
+        }
+        size_t empty = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (emptyStream[i])
+            {
+                archive.entries[i].folder = empty >= emptyFile.size() || !emptyFile[empty];
+                archive.entries[i].hasCrc = !archive.entries[i].folder;
+                empty++;
+            }
+            else
+            {
+                archive.entryOfStream.push_back(i);
+            }
+        }
+    }
+
+    /*
+    *Unpack one folder of one coder, passing what comes out to onData, which returns false to stop.
+    *The folder's packed stream is found from the pack position and the sizes of the streams before it.
+    */
+    std::string DecodeFolder(std::ifstream &in, const streamsInfo &streams, size_t folder, const std::function<bool(const char *data, size_t length)> &onData)
+    {
+        const folderInfo &f = streams.folders[folder];
+        if (f.coders.size() != 1 || f.packedStreams != 1)
+        {
+            return "Unsupported 7z method";
+        }
+        size_t packIndex = 0;
+        for (size_t k = 0; k < folder; k++)
+        {
+            packIndex += (size_t)streams.folders[k].packedStreams;
+        }
+        if (packIndex >= streams.packSizes.size())
+        {
+            return "Bad 7z header";
+        }
+        uint64_t offset = START_HEADER_BYTES + streams.packPosition;
+        for (size_t k = 0; k < packIndex; k++)
+        {
+            offset += streams.packSizes[k];
+        }
+        uint64_t packLeft = streams.packSizes[packIndex];
+        uint64_t unpackSize = f.UnpackSize();
+        const coderInfo &coder = f.coders.front();
+        in.clear();
+        in.seekg((std::streamoff)offset);
+        std::vector<char> input(IO_BYTES), output(IO_BYTES);
+        if (coder.method == METHOD_COPY)
+        {
+            while (packLeft > 0)
+            {
+                size_t want = (size_t)std::min<uint64_t>(packLeft, input.size());
+                if (!in.read(input.data(), want))
+                {
+                    return "Truncated 7z";
+                }
+                packLeft -= want;
+                if (!onData(input.data(), want))
+                {
+                    return "";
+                }
+            }
+            return "";
+        }
+        if (coder.method != METHOD_LZMA && coder.method != METHOD_LZMA2)
+        {
+            return "Unsupported 7z method";
+        }
+        lzma_filter filters[2] = {{coder.method == METHOD_LZMA ? LZMA_FILTER_LZMA1 : LZMA_FILTER_LZMA2, nullptr}, {LZMA_VLI_UNKNOWN, nullptr}};
+        if (lzma_properties_decode(&filters[0], nullptr, (const uint8_t *)coder.properties.data(), coder.properties.size()) != LZMA_OK)
+        {
+            return "Bad 7z coder properties";
+        }
+        lzmaStream decoder;
+        lzma_ret ret = lzma_raw_decoder(&decoder.stream, filters);
+        std::free(filters[0].options);
+        if (ret != LZMA_OK)
+        {
+            return "Could not start the LZMA decoder";
+        }
+        // LZMA1 streams may not say where they end, so this stops at the folder's size.
+        uint64_t produced = 0;
+        while (produced < unpackSize)
+        {
+            if (decoder.stream.avail_in == 0 && packLeft > 0)
+            {
+                size_t want = (size_t)std::min<uint64_t>(packLeft, input.size());
+                if (!in.read(input.data(), want))
+                {
+                    return "Truncated 7z";
+                }
+                packLeft -= want;
+                decoder.stream.next_in = (const uint8_t *)input.data();
+                decoder.stream.avail_in = want;
+            }
+            size_t room = (size_t)std::min<uint64_t>(output.size(), unpackSize - produced);
+            decoder.stream.next_out = (uint8_t *)output.data();
+            decoder.stream.avail_out = room;
+            ret = lzma_code(&decoder.stream, packLeft == 0 ? LZMA_FINISH : LZMA_RUN);
+            size_t got = room - decoder.stream.avail_out;
+            produced += got;
+            if (got > 0 && !onData(output.data(), got))
+            {
+                return "";
+            }
+            if (ret == LZMA_STREAM_END)
+            {
+                break;
+            }
+            if (ret != LZMA_OK)
+            {
+                return "Bad LZMA data";
+            }
+        }
+        return produced == unpackSize ? "" : "Truncated LZMA data";
+    }
+
+    std::string ReadArchive(std::ifstream &in, archiveInfo &archive)
+    {
+        unsigned char start[START_HEADER_BYTES];
+        if (!in.read((char *)start, sizeof(start)) || std::memcmp(start, SIGNATURE, sizeof(SIGNATURE)) != 0)
+        {
+            return "Not a 7z";
+        }
+        if (Crc32(0, start + 12, 20) != (uint32_t)GetLittleEndian(start + 8, 4))
+        {
+            return "Bad 7z start header";
+        }
+        uint64_t nextOffset = GetLittleEndian(start + 12, 8);
+        uint64_t nextSize = GetLittleEndian(start + 20, 8);
+        if (nextSize == 0)
+        {
+            return "";
+        }
+        if (nextSize > MAX_HEADER_BYTES)
+        {
+            return "Bad 7z header";
+        }
+        std::string header(nextSize, '\0');
+        in.seekg((std::streamoff)(START_HEADER_BYTES + nextOffset));
+        if (!in.read(&header[0], header.size()))
+        {
+            return "Truncated 7z";
+        }
+        if (Crc32(0, header.data(), header.size()) != (uint32_t)GetLittleEndian(start + 28, 4))
+        {
+            return "Bad 7z header CRC";
+        }
+        // 7-Zip packs its headers, so the header may only say where the real one is.
+        for (int round = 0; round < 4; round++)
+        {
+            headerReader r(header);
+            uint64_t id = r.Number();
+            if (id == ID_ENCODED_HEADER)
+            {
+                streamsInfo packed;
+                ReadStreamsInfo(r, packed);
+                if (!r.Ok() || packed.folders.empty())
+                {
+                    return "Bad 7z header";
+                }
+                std::string unpacked;
+                std::string error = DecodeFolder(in, packed, 0, [&](const char *data, size_t length)
+                                                 {
+                    unpacked.append(data, length);
+                    return unpacked.size() <= MAX_HEADER_BYTES; });
+                if (!error.empty())
+                {
+                    return error + " in the 7z header";
+                }
+                header.swap(unpacked);
+                continue;
+            }
+            if (id != ID_HEADER)
+            {
+                return "Bad 7z header";
+            }
+            id = r.Number();
+            if (id == ID_ARCHIVE_PROPERTIES)
+            {
+                while (r.Ok() && r.Number() != ID_END)
+                {
+                    r.Take(r.Number());
+                }
+                id = r.Number();
+            }
+            if (id == ID_ADDITIONAL_STREAMS)
+            {
+                streamsInfo additional;
+                ReadStreamsInfo(r, additional);
+                id = r.Number();
+            }
+            if (id == ID_MAIN_STREAMS)
+            {
+                ReadStreamsInfo(r, archive.streams);
+                id = r.Number();
+            }
+            if (id == ID_FILES)
+            {
+                ReadFilesInfo(r, archive);
+                id = r.Number();
+            }
+            if (!r.Ok() || id != ID_END || archive.entryOfStream.size() != archive.streams.sizes.size())
+            {
+                return "Bad 7z header";
+            }
+            for (size_t s = 0; s < archive.entryOfStream.size(); s++)
+            {
+                sevenZipEntry &entry = archive.entries[archive.entryOfStream[s]];
+                entry.size = archive.streams.sizes[s];
+                entry.hasCrc = archive.streams.hasCrc[s];
+                entry.crc = archive.streams.crcs[s];
+            }
+            return "";
+        }
+        return "Bad 7z header";
+    }
+
+    std::string MemberLine(const std::string &name, uint64_t size, uint32_t crc)
+    {
+        return name + " " + std::to_string(size) + " " + Crc32Hex(crc);
+    }
+
+    /*A zip's files as sorted MemberLines, from its directory. Empty if it can't be read.*/
+    std::vector<std::string> ZipLines(const std::string &zip)
+    {
+        std::vector<std::string> lines;
+        ZipIndex index(zip);
+        zipEntry entry;
+        while (index.Next(entry))
+        {
+            if (entry.name.empty() || entry.name.back() != '/')
+            {
+                lines.push_back(MemberLine(std::string(entry.name), entry.size, entry.crc));
+            }
+        }
+        if (!index.Error().empty())
+        {
+            lines.clear();
+        }
+        std::sort(lines.begin(), lines.end());
+        return lines;
+    }
+}
+
+void PackFiles(std::vector<runFile> &files)
+{
+    for (runFile &file : files)
+    {
+        if (file.type == "rom")
+        {
+            file.type = "7z";
+            file.target = std::filesystem::path(file.target).replace_extension(".7z").string();
+        }
+    }
+}
+
+std::string PackKey(const runFile &file, const gameChecksums &checksums)
+{
+    std::vector<std::string> lines;
+    auto roms = checksums.roms.find(file.game);
+    if (roms != checksums.roms.end())
+    {
+        for (const romChecksum &rom : roms->second)
+        {
+            lines.push_back(MemberLine(rom.name, rom.size, rom.crc));
+        }
+        std::sort(lines.begin(), lines.end());
+    }
+    else
+    {
+        lines = ZipLines(file.source);
+    }
+    if (lines.empty())
+    {
+        lines.push_back(file.source);
+    }
+    // A different preset packs differently, so it gets its own key.
+    std::string identity = "7z " + std::to_string(PACK_PRESET) + "\n";
+    for (const std::string &line : lines)
+    {
+        identity += line + "\n";
+    }
+    Sha1 sha1;
+    sha1.Update(identity.data(), identity.size());
+    return sha1.HexDigest();
+}
+
+std::string PackZip(const std::string &zip, const std::string &target)
+{
+    TraceSpan span("PackZip", "pack");
+    span.Arg("zip", zip);
+    // The directory gives the set's size up front, so a small set gets a small dictionary, and the count to check the stream against.
+    ZipIndex index(zip);
+    if (!index.Error().empty())
+    {
+        return index.Error();
+    }
+    uint64_t total = 0;
+    zipEntry member;
+    while (index.Next(member))
+    {
+        total += member.size;
+    }
+    wxFFileInputStream file(zip);
+    if (!file.IsOk())
+    {
+        return "Could not open " + zip;
+    }
+    wxZipInputStream in(file);
+    filePtr out(std::fopen(target.c_str(), "wb"), std::fclose);
+    if (!out)
+    {
+        return "Could not write: " + target + ". Be sure you have write permissions and that there is enough space.";
+    }
+    auto fail = [&](const std::string &error)
+    {
+        out.reset();
+        std::error_code ec;
+        std::filesystem::remove(target, ec);
+        return error;
+    };
+    unsigned char start[START_HEADER_BYTES] = {};
+    if (std::fwrite(start, 1, sizeof(start), out.get()) != sizeof(start))
+    {
+        return fail("Could not write: " + target);
+    }
+
+    lzma_options_lzma options;
+    lzma_lzma_preset(&options, PACK_PRESET);
+    options.dict_size = (uint32_t)std::max<uint64_t>(LZMA_DICT_SIZE_MIN, std::min<uint64_t>(options.dict_size, total));
+    lzma_filter filters[2] = {{LZMA_FILTER_LZMA2, &options}, {LZMA_VLI_UNKNOWN, nullptr}};
+    uint8_t properties = 0;
+    lzmaStream encoder;
+    if (lzma_properties_encode(&filters[0], &properties) != LZMA_OK || lzma_raw_encoder(&encoder.stream, filters) != LZMA_OK)
+    {
+        return fail("Could not start the LZMA2 encoder");
+    }
+    std::vector<char> input(IO_BYTES), output(IO_BYTES);
+    uint64_t packed = 0;
+    // Feed data to the encoder, writing out whatever it has ready. LZMA_FINISH flushes the rest.
+    auto compress = [&](const char *data, size_t length, lzma_action action)
+    {
+        encoder.stream.next_in = (const uint8_t *)data;
+        encoder.stream.avail_in = length;
+        while (true)
+        {
+            encoder.stream.next_out = (uint8_t *)output.data();
+            encoder.stream.avail_out = output.size();
+            lzma_ret ret = lzma_code(&encoder.stream, action);
+            size_t got = output.size() - encoder.stream.avail_out;
+            if (got > 0 && std::fwrite(output.data(), 1, got, out.get()) != got)
+            {
+                return false;
+            }
+            packed += got;
+            if (ret == LZMA_STREAM_END || (ret == LZMA_OK && action == LZMA_RUN && encoder.stream.avail_in == 0))
+            {
+                return true;
+            }
+            if (ret != LZMA_OK)
+            {
+                return false;
+            }
+        }
+    };
+
+    std::vector<std::u16string> names;
+    std::vector<uint64_t> sizes;
+    std::vector<uint32_t> crcs;
+    uint64_t seen = 0;
+    std::unique_ptr<wxZipEntry> entry;
+    while (entry.reset(in.GetNextEntry()), entry)
+    {
+        seen++;
+        if (entry->IsDir())
+        {
+            continue;
+        }
+        std::string name = entry->GetInternalName().ToStdString();
+        uint32_t crc = 0;
+        uint64_t size = 0;
+        while (in.Read(input.data(), input.size()).LastRead() > 0)
+        {
+            crc = Crc32(crc, input.data(), in.LastRead());
+            size += in.LastRead();
+            if (!compress(input.data(), in.LastRead(), LZMA_RUN))
+            {
+                return fail("Could not write: " + target + ". Be sure there is enough space.");
+            }
+        }
+        if (in.GetLastError() == wxSTREAM_READ_ERROR)
+        {
+            return fail("Could not decompress " + name + " in " + zip);
+        }
+        if (crc != entry->GetCrc())
+        {
+            return fail("Bad CRC for " + name + " in " + zip + ": " + Crc32Hex(crc) + ", expected " + Crc32Hex(entry->GetCrc()));
+        }
+        names.push_back(Utf16(name));
+        sizes.push_back(size);
+        crcs.push_back(crc);
+    }
+    if (seen != index.Count())
+    {
+        return fail("Could not read all of " + zip);
+    }
+    if (names.empty())
+    {
+        return fail("Nothing to pack in " + zip);
+    }
+    size_t streams = (size_t)std::count_if(sizes.begin(), sizes.end(), [](uint64_t size)
+                                           { return size > 0; });
+    if (streams > 0 && !compress(nullptr, 0, LZMA_FINISH))
+    {
+        return fail("Could not write: " + target + ". Be sure there is enough space.");
+    }
+
+    // One folder, LZMA2, holding every non-empty file back to back. Empty files are only named.
+    headerWriter header;
+    header.Byte(ID_HEADER);
+    if (streams > 0)
+    {
+        header.Byte(ID_MAIN_STREAMS);
+        header.Byte(ID_PACK_INFO);
+        header.Number(0);
+        header.Number(1);
+        header.Byte(ID_SIZE);
+        header.Number(packed);
+        header.Byte(ID_END);
+        header.Byte(ID_UNPACK_INFO);
+        header.Byte(ID_FOLDER);
+        header.Number(1);
+        header.Byte(0);
+        header.Number(1);
+        header.Byte(0x20 | (uint8_t)METHOD_LZMA2.size());
+        header.bytes += METHOD_LZMA2;
+        header.Number(1);
+        header.Byte(properties);
+        header.Byte(ID_CODERS_UNPACK_SIZE);
+        uint64_t unpacked = 0;
+        for (uint64_t size : sizes)
+        {
+            unpacked += size;
+        }
+        header.Number(unpacked);
+        header.Byte(ID_END);
+        header.Byte(ID_SUBSTREAMS);
+        header.Byte(ID_UNPACK_STREAMS);
+        header.Number(streams);
+        header.Byte(ID_SIZE);
+        size_t written = 0;
+        for (uint64_t size : sizes)
+        {
+            if (size > 0 && ++written < streams)
+            {
+                header.Number(size);
+            }
+        }
+        header.Byte(ID_CRC);
+        header.Byte(1);
+        for (size_t i = 0; i < sizes.size(); i++)
+        {
+            if (sizes[i] > 0)
+            {
+                header.UInt32(crcs[i]);
+            }
+        }
+        header.Byte(ID_END);
+        header.Byte(ID_END);
+    }
+    header.Byte(ID_FILES);
+    header.Number(names.size());
+    if (streams < names.size())
+    {
+        std::vector<bool> emptyStream;
+        for (uint64_t size : sizes)
+        {
+            emptyStream.push_back(size == 0);
+        }
+        headerWriter bits;
+        bits.Bits(emptyStream);
+        header.Byte(ID_EMPTY_STREAM);
+        header.Number(bits.bytes.size());
+        header.bytes += bits.bytes;
+        bits.bytes.clear();
+        bits.Bits(std::vector<bool>(names.size() - streams, true));
+        header.Byte(ID_EMPTY_FILE);
+        header.Number(bits.bytes.size());
+        header.bytes += bits.bytes;
+    }
+    headerWriter nameBytes;
+    nameBytes.Byte(0);
+    for (const std::u16string &name : names)
+    {
+        for (char16_t unit : name)
+        {
+            nameBytes.Byte((uint8_t)(unit & 0xFF));
+            nameBytes.Byte((uint8_t)(unit >> 8));
+        }
+        nameBytes.Byte(0);
+        nameBytes.Byte(0);
+    }
+    header.Byte(ID_NAME);
+    header.Number(nameBytes.bytes.size());
+    header.bytes += nameBytes.bytes;
+    header.Byte(ID_END);
+    header.Byte(ID_END);
+    if (std::fwrite(header.bytes.data(), 1, header.bytes.size(), out.get()) != header.bytes.size())
+    {
+        return fail("Could not write: " + target + ". Be sure there is enough space.");
+    }
+
+    // The start header says where the header is, now that it's written.
+    std::memcpy(start, SIGNATURE, sizeof(SIGNATURE));
+    start[7] = 4;
+    PutLittleEndian(start + 12, packed, 8);
+    PutLittleEndian(start + 20, header.bytes.size(), 8);
+    PutLittleEndian(start + 28, Crc32(0, header.bytes.data(), header.bytes.size()), 4);
+    PutLittleEndian(start + 8, Crc32(0, start + 12, 20), 4);
+    if (std::fseek(out.get(), 0, SEEK_SET) != 0 || std::fwrite(start, 1, sizeof(start), out.get()) != sizeof(start) || std::fclose(out.release()) != 0)
+    {
+        return fail("Could not write: " + target + ". Be sure there is enough space.");
+    }
+    span.Arg("ratio", total > 0 ? (int64_t)(packed * 100 / total) : 0);
+    return "";
+}
+
+std::string ListSevenZip(const std::string &path, std::vector<sevenZipEntry> &entries)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        return "Could not open " + path;
+    }
+    archiveInfo archive;
+    std::string error = ReadArchive(in, archive);
+    if (!error.empty())
+    {
+        return error + ": " + path;
+    }
+    entries = archive.entries;
+    return "";
+}
+
+std::string ReadSevenZip(const std::string &path, const std::function<void(size_t entry, const char *data, size_t length)> &onData)
+{
+    TraceSpan span("ReadSevenZip", "verify");
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        return "Could not open " + path;
+    }
+    archiveInfo archive;
+    std::string error = ReadArchive(in, archive);
+    if (!error.empty())
+    {
+        return error + ": " + path;
+    }
+    // The folders' files are back to back, so their data is split among them by size.
+    size_t next = 0;
+    for (size_t f = 0; f < archive.streams.folders.size(); f++)
+    {
+        size_t end = next + (size_t)archive.streams.folders[f].files;
+        size_t current = 0;
+        uint64_t left = 0;
+        bool overrun = false;
+        error = DecodeFolder(in, archive.streams, f, [&](const char *data, size_t length)
+                             {
+            while (length > 0)
+            {
+                while (left == 0 && next < end)
+                {
+                    current = next;
+                    left = archive.streams.sizes[next++];
+                }
+                if (left == 0)
+                {
+                    overrun = true;
+                    return false;
+                }
+                size_t take = (size_t)std::min<uint64_t>(left, length);
+                onData(archive.entryOfStream[current], data, take);
+                data += take;
+                length -= take;
+                left -= take;
+            }
+            return true; });
+        if (!error.empty() || overrun)
+        {
+            return (overrun ? "Bad 7z header" : error) + ": " + path;
+        }
+        next = end;
+    }
+    return "";
+}
+
+bool PackUpToDate(const runFile &file)
+{
+    std::vector<sevenZipEntry> entries;
+    if (!ListSevenZip(file.target, entries).empty())
+    {
+        return false;
+    }
+    std::vector<std::string> lines;
+    for (const sevenZipEntry &entry : entries)
+    {
+        if (!entry.folder)
+        {
+            lines.push_back(MemberLine(entry.name, entry.size, entry.crc));
+        }
+    }
+    std::sort(lines.begin(), lines.end());
+    return !lines.empty() && lines == ZipLines(file.source);
+}
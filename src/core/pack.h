@@ -0,0 +1,62 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/pack.h
+// Purpose:     Packs rom zips into 7z sets, and reads 7z sets back
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+#include "core/run.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+//The LZMA2 preset packs are written with: a 16 MB dictionary, or the set's size if smaller. A job packing a big set takes about 190 MB.
+const int PACK_PRESET = 7;
+
+/*One member of a 7z, as its header lists it.*/
+struct sevenZipEntry
+{
+    std::string name; //UTF-8, '/' separated.
+    uint64_t size = 0;
+    uint32_t crc = 0;
+    bool hasCrc = false;
+    bool folder = false;
+};
+
+/*
+*Make the rom zips of a local profile's run pack into 7z sets, which MAME loads like zips: their type becomes "7z" and their target NAME.7z.
+*Call it after PlanRun and before PlanTransfers, so planning and the run see the targets they will write.
+*/
+void PackFiles(std::vector<runFile> &files);
+
+/*
+*40 hex digits naming what a 7z packed from file's source holds: its ROMs' names, sizes and CRCs from the game DB,
+*else from the source zip's directory. The same ROMs give the same key however the zip was compressed, so the run's cache packs each set once.
+*/
+std::string PackKey(const runFile &file, const gameChecksums &checksums);
+
+/*
+*Write target as a solid 7z of every file in zip, LZMA2 packed at PACK_PRESET on the calling thread, so a run packs a set per job.
+*Members go in the zip's order, each checked against the zip's CRC as it is decompressed. The header isn't compressed, so it can be listed without unpacking.
+*Returns "" on success, else the error, in which case target is removed.
+*/
+std::string PackZip(const std::string &zip, const std::string &target);
+
+/*
+*List a 7z's members from its header. Headers that are LZMA or LZMA2 packed, as 7-Zip writes them, are unpacked, but no member data is read.
+*Returns "" on success, else why it can't be read.
+*/
+std::string ListSevenZip(const std::string &path, std::vector<sevenZipEntry> &entries);
+
+/*
+*Unpack every member of a 7z, passing its data to onData in order, a chunk at a time. entry indexes what ListSevenZip lists.
+*Only LZMA, LZMA2 and stored folders of one coder are understood, which covers PackZip and plain 7-Zip archives but not BCJ or PPMd ones.
+*Returns "" on success, else the error.
+*/
+std::string ReadSevenZip(const std::string &path, const std::function<void(size_t entry, const char *data, size_t length)> &onData);
+
+/*Whether a 7z target holds exactly its source zip's members, by name, size and CRC. For sets the game DB has no ROMs for.*/
+bool PackUpToDate(const runFile &file);
@@ -0,0 +1,326 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/plan.cpp
+// Purpose:     Dry run of a run. What it will write, whether it fits and how long it may take.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WIN32
+    #include <sys/stat.h>
+#endif
+
+#include "core/plan.h"
+#include "core/history.h"
+#include "core/pack.h"
+#include "core/rebuild.h"
+#include "core/trace.h"
+#include "core/verify.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <set>
+#include <thread>
+
+namespace
+{
+    /*What planning found out about one file.*/
+    struct filePlan
+    {
+        bool upToDate = false;
+        bool missing = false;
+        int64_t size = -1; //-1 if unknown.
+        int64_t replaced = 0; //Size of the target the run removes first.
+    };
+
+    int64_t FileSize(const std::string &path)
+    {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(path, ec);
+        return ec ? -1 : (int64_t)size;
+    }
+
+    filePlan PlanFile(const runFile &file, bool online, const gameChecksums &checksums, const downloadCache &cache)
+    {
+        filePlan plan;
+        std::error_code ec;
+        std::filesystem::file_time_type targetTime = std::filesystem::last_write_time(file.target, ec);
+        bool targetExists = !ec;
+        bool checked = false;
+        if (targetExists)
+        {
+            plan.replaced = std::max<int64_t>(0, FileSize(file.target));
+            plan.upToDate = VerifyFile(file, checksums, false, checked).empty() && checked;
+        }
+        if (online)
+        {
+            if (!cache.folder.empty())
+            {
+                plan.size = FileSize(CachePath(cache, CacheKey(file, checksums), file.type));
+            }
+            return plan;
+        }
+        ec.clear();
+        std::filesystem::file_time_type sourceTime = std::filesystem::last_write_time(file.source, ec);
+        bool sourceExists = !ec;
+        // A zip the run rebuilds is sized as rebuilt: a split clone's is bigger than its own zip, and a merged clone has none.
+        const std::vector<romChecksum> *rebuild = plan.upToDate ? nullptr : RebuildRoms(file, false, checksums);
+        if (rebuild)
+        {
+            std::vector<std::string> sources = {file.source};
+            sources.insert(sources.end(), file.rebuildFrom.begin(), file.rebuildFrom.end());
+            plan.size = RebuiltZipBytes(*rebuild, sources);
+        }
+        if (!sourceExists)
+        {
+            // A split clone's zip may be missing when its parent holds every ROM it has. The rebuild still needs checksums.
+            bool rebuildable = !file.rebuildFrom.empty() && checksums.roms.count(file.game) > 0 &&
+                               std::any_of(file.rebuildFrom.begin(), file.rebuildFrom.end(), [](const std::string &zip)
+                                           { std::error_code existsEc; return std::filesystem::exists(zip, existsEc); });
+            plan.missing = !plan.upToDate && !rebuildable;
+            return plan;
+        }
+        if (!rebuild)
+        {
+            plan.size = FileSize(file.source);
+        }
+        if (file.type == "7z")
+        {
+            // A 7z's size is known once it's packed, so from the cache if it's there. Else the zip's size stands in as a bound: LZMA2 packs ROMs smaller than deflate.
+            int64_t cached = cache.folder.empty() ? -1 : FileSize(CachePath(cache, PackKey(file, checksums), file.type));
+            plan.size = cached >= 0 ? cached : plan.size;
+            if (targetExists && !checked)
+            {
+                plan.upToDate = PackUpToDate(file);
+            }
+            return plan;
+        }
+        if (targetExists && !checked)
+        {
+            // Without checksums, a copy that is whole and no older than its source will do.
+            plan.upToDate = plan.size >= 0 && plan.size == plan.replaced && targetTime >= sourceTime;
+        }
+        return plan;
+    }
+
+    /*The filesystem a folder is on, from its nearest existing parent.*/
+    std::string FilesystemOf(std::filesystem::path folder, int64_t &available)
+    {
+        std::error_code ec;
+        while (!folder.empty() && !std::filesystem::exists(folder, ec) && folder.has_relative_path())
+        {
+            folder = folder.parent_path();
+        }
+        std::filesystem::space_info info = std::filesystem::space(folder, ec);
+        available = ec ? -1 : (int64_t)info.available;
+#ifdef _WIN32
+        return std::filesystem::absolute(folder, ec).root_name().string();
+#else
+        struct stat st;
+        if (stat(folder.string().c_str(), &st) != 0)
+        {
+            return folder.string();
+        }
+        return std::to_string((uint64_t)st.st_dev);
+#endif
+    }
+}
+
+bool runPlan::Fits() const
+{
+    for (const planSpace &fs : space)
+    {
+        if (fs.available >= 0 && fs.needed > fs.available)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+runPlan PlanTransfers(SQLite::Database &profileDB, const profile &p, std::vector<runFile> &files, const gameChecksums &checksums, int jobs,
+                      const downloadCache &cache)
+{
+    TraceSpan span("PlanTransfers", "run");
+    span.Arg("files", (int64_t)files.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    runPlan plan;
+    bool online = p.online == 1;
+    std::vector<filePlan> plans(files.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        size_t i;
+        while ((i = next++) < files.size())
+        {
+            plans[i] = PlanFile(files[i], online, checksums, cache);
+        }
+    };
+    jobs = std::max(1, std::min(jobs, (int)files.size()));
+    std::vector<std::thread> workers;
+    for (int j = 1; j < jobs; j++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+
+    runThroughput past = PastThroughput(profileDB, p.online);
+    plan.bytesPerSecond = past.bytesPerSecond;
+    // Targets on one filesystem share its space.
+    std::map<std::string, size_t> filesystems;
+    std::map<std::string, size_t> spaceOfType;
+    for (const std::string type : {"rom", "chd", "7z"})
+    {
+        const std::string &folder = type == "chd" ? p.chdTarget : p.romTarget;
+        int64_t available;
+        std::string filesystem = FilesystemOf(folder, available);
+        auto added = filesystems.emplace(filesystem, plan.space.size());
+        if (added.second)
+        {
+            plan.space.push_back(planSpace{folder, filesystem, 0, 0, available});
+        }
+        spaceOfType[type] = added.first->second;
+    }
+    plan.bytes.assign(files.size(), 0);
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        files[i].upToDate = plans[i].upToDate;
+        planGroup &group = plans[i].upToDate ? plan.unchanged[files[i].type] : plan.transfer[files[i].type];
+        group.files++;
+        if (plans[i].missing)
+        {
+            plan.missing.push_back(files[i].source);
+        }
+        if (plans[i].upToDate || plans[i].missing)
+        {
+            group.bytes += plans[i].upToDate ? plans[i].replaced : 0;
+            continue;
+        }
+        planSpace &fs = plan.space[spaceOfType[files[i].type]];
+        if (plans[i].size >= 0)
+        {
+            group.bytes += plans[i].size;
+            fs.needed += plans[i].size - plans[i].replaced;
+            plan.bytes[i] = plans[i].size;
+        }
+        else
+        {
+            group.unknownSize++;
+            auto average = past.bytesPerFile.find(files[i].type);
+            int64_t estimate = average == past.bytesPerFile.end() ? 0 : (int64_t)average->second;
+            fs.estimated += estimate;
+            plan.bytes[i] = estimate;
+        }
+        plan.estimatedBytes += plan.bytes[i];
+    }
+    for (planSpace &fs : plan.space)
+    {
+        fs.needed = std::max<int64_t>(0, fs.needed);
+    }
+    if (plan.bytesPerSecond > 0)
+    {
+        plan.estimatedSeconds = plan.estimatedBytes / plan.bytesPerSecond;
+    }
+    plan.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    span.Arg("missing", (int64_t)plan.missing.size());
+    return plan;
+}
+
+runPlan CombinePlans(const std::vector<runPlan> &plans, const fanOut &merged)
+{
+    runPlan combined;
+    std::set<std::string> missing;
+    std::map<std::string, size_t> filesystems;
+    for (const runPlan &plan : plans)
+    {
+        for (const auto &group : plan.transfer)
+        {
+            combined.transfer[group.first].files += group.second.files;
+            combined.transfer[group.first].bytes += group.second.bytes;
+            combined.transfer[group.first].unknownSize += group.second.unknownSize;
+        }
+        for (const auto &group : plan.unchanged)
+        {
+            combined.unchanged[group.first].files += group.second.files;
+            combined.unchanged[group.first].bytes += group.second.bytes;
+            combined.unchanged[group.first].unknownSize += group.second.unknownSize;
+        }
+        // Profiles with the same library are missing the same sources.
+        for (const std::string &source : plan.missing)
+        {
+            if (missing.insert(source).second)
+            {
+                combined.missing.push_back(source);
+            }
+        }
+        for (const planSpace &fs : plan.space)
+        {
+            auto added = filesystems.emplace(fs.filesystem, combined.space.size());
+            if (added.second)
+            {
+                combined.space.push_back(fs);
+                continue;
+            }
+            combined.space[added.first->second].needed += fs.needed;
+            combined.space[added.first->second].estimated += fs.estimated;
+        }
+        combined.bytesPerSecond = std::max(combined.bytesPerSecond, plan.bytesPerSecond);
+        combined.seconds += plan.seconds;
+    }
+    // A merged file is read and written once. Its other targets are filled from the first, mostly by linking.
+    combined.bytes.assign(merged.files.size(), 0);
+    for (size_t i = 0; i < merged.files.size(); i++)
+    {
+        const fanOutTarget &first = merged.targets[i].front();
+        if (first.profile < plans.size() && first.index < plans[first.profile].bytes.size())
+        {
+            combined.bytes[i] = plans[first.profile].bytes[first.index];
+        }
+        combined.estimatedBytes += combined.bytes[i];
+    }
+    if (combined.bytesPerSecond > 0)
+    {
+        combined.estimatedSeconds = combined.estimatedBytes / combined.bytesPerSecond;
+    }
+    return combined;
+}
+
+std::string FormatBytes(int64_t bytes)
+{
+    const char *units[] = {"bytes", "KB", "MB", "GB", "TB"};
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4)
+    {
+        value /= 1024;
+        unit++;
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return text;
+}
+
+std::string FormatSeconds(double seconds)
+{
+    long total = std::lround(seconds);
+    char text[32];
+    if (total >= 3600)
+    {
+        std::snprintf(text, sizeof(text), "%ldh %02ldm", total / 3600, total / 60 % 60);
+    }
+    else if (total >= 60)
+    {
+        std::snprintf(text, sizeof(text), "%ldm %02lds", total / 60, total % 60);
+    }
+    else
+    {
+        std::snprintf(text, sizeof(text), "%lds", total);
+    }
+    return text;
+}
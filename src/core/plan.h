@@ -0,0 +1,77 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/plan.h
+// Purpose:     Dry run of a run. What it will write, whether it fits and how long it may take.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+#include "core/downloadcache.h"
+#include "core/profiles.h"
+#include "core/run.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace SQLite
+{
+    class Database;
+}
+
+struct planGroup
+{
+    int files = 0;
+    int64_t bytes = 0; //Total of the sizes known.
+    int unknownSize = 0; //Files whose size can't be known before the run, e.g. downloads not in the cache.
+};
+
+/*Space on one filesystem that targets are written to.*/
+struct planSpace
+{
+    std::string folder; //The first target folder on it.
+    std::string filesystem; //Which filesystem it is, so the plans of several profiles can be combined.
+    int64_t needed = 0; //Known bytes the run adds, less the targets it replaces.
+    int64_t estimated = 0; //Bytes the files of unknown size will likely add, from past runs.
+    int64_t available = -1; //-1 if it couldn't be read.
+};
+
+struct runPlan
+{
+    std::map<std::string, planGroup> transfer; //Files the run will write, by type ("rom", "chd", "7z").
+    std::map<std::string, planGroup> unchanged; //Files already up to date, by type. The run skips them.
+    std::vector<std::string> missing; //Local sources that aren't there, so those files will fail.
+    std::vector<planSpace> space; //One per target filesystem.
+    std::vector<int64_t> bytes; //Per file, in the files' order: its size, or estimate. 0 for files the run skips.
+    int64_t estimatedBytes = 0; //Everything the run will write, known sizes plus estimates.
+    double bytesPerSecond = 0; //From past runs of the same kind. 0 if there are none.
+    double estimatedSeconds = -1; //-1 without past runs to go by.
+    double seconds = 0; //Time the planning took.
+
+    /*False if the known bytes don't fit on one of the target filesystems.*/
+    bool Fits() const;
+};
+
+/*
+*Look at every file of a run without writing anything.
+*Files whose target is already up to date get upToDate set, so RunFiles skips them:
+*with checksums, the target passes VerifyFile's quick check; without, a local file's target has the source's size and is no older, and a 7z set holds what its zip does (see PackUpToDate).
+*Local sizes come from the sources, a zip the run rebuilds from a split or merged set is sized as rebuilt (see RebuiltZipBytes), and a 7z set's from its packed copy in cache if there is one. Downloads use the cached copy's size if cache has one, else the average of past runs.
+*The files are looked at on up to jobs threads.
+*/
+runPlan PlanTransfers(SQLite::Database &profileDB, const profile &p, std::vector<runFile> &files, const gameChecksums &checksums, int jobs,
+                      const downloadCache &cache = downloadCache());
+
+/*
+*One plan for a fan-out run of several profiles (see FanOutFiles), from each profile's plan.
+*Space on a filesystem is added up over the profiles. That is an upper bound: targets filled by a hard link take none.
+*Bytes, and so the time estimate, count each merged file once, as it is only read and written once.
+*/
+runPlan CombinePlans(const std::vector<runPlan> &plans, const fanOut &merged);
+
+/*"1.2 GB" and the like.*/
+std::string FormatBytes(int64_t bytes);
+
+/*"1h 05m", "4m 10s" or "12s".*/
+std::string FormatSeconds(double seconds);
@@ -0,0 +1,188 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/profiles.cpp
+// Purpose:     Profile storage. Profiles and their selected games live in profiles.romper.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/profiles.h"
+#include "core/trace.h"
+
+#include <string>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+void CreateProfileSchema(SQLite::Database &profileDB)
+{
+    profileDB.exec("CREATE TABLE \"games\" (\"profile\" TEXT NOT NULL, \"game\" TEXT NOT NULL, CONSTRAINT \"unqProfileGame\" UNIQUE(\"game\",\"profile\"));");
+    profileDB.exec("CREATE TABLE \"profiles\" (\"name\" TEXT NOT NULL UNIQUE, \"online\" INTEGER NOT NULL, \"romSource\" TEXT, \"chdSource\" TEXT, \"romTarget\" TEXT, \"chdTarget\" TEXT, PRIMARY KEY(\"name\"));");
+    profileDB.exec("CREATE INDEX \"idxgames\" ON \"games\" (\"game\");");
+    profileDB.exec("CREATE INDEX \"idxprofile\" ON \"games\" (\"profile\");");
+    // These are the tables of the first release. Everything since is added by the upgrade steps.
+    UpgradeProfileSchema(profileDB);
+}
+
+void UpgradeProfileSchema(SQLite::Database &profileDB)
+{
+    TraceSpan span("UpgradeProfileSchema", "profiledb");
+    SQLite::Statement query(profileDB, "PRAGMA user_version;");
+    int version = query.executeStep() ? query.getColumn(0).getInt() : 0;
+    query.reset();
+    if (version >= PROFILE_SCHEMA_VERSION)
+    {
+        return;
+    }
+    SQLite::Transaction transaction(profileDB);
+    if (version < 1)
+    {
+        profileDB.exec("ALTER TABLE \"profiles\" ADD COLUMN \"baseUrl\" TEXT NOT NULL DEFAULT '';");
+    }
+    if (version < 2)
+    {
+        profileDB.exec("CREATE TABLE \"runs\" (\"id\" INTEGER PRIMARY KEY, \"profile\" TEXT NOT NULL, \"started\" INTEGER NOT NULL, \"finished\" INTEGER NOT NULL, \"online\" INTEGER NOT NULL, \"jobs\" INTEGER NOT NULL, \"strategy\" TEXT NOT NULL, "
+                       "\"files\" INTEGER NOT NULL, \"ok\" INTEGER NOT NULL, \"failed\" INTEGER NOT NULL, \"skipped\" INTEGER NOT NULL, \"retries\" INTEGER NOT NULL, \"bytes\" INTEGER NOT NULL, \"aborted\" INTEGER NOT NULL);");
+        profileDB.exec("CREATE TABLE \"run_files\" (\"run\" INTEGER NOT NULL, \"game\" TEXT NOT NULL, \"type\" TEXT NOT NULL, \"source\" TEXT NOT NULL, \"target\" TEXT NOT NULL, "
+                       "\"bytes\" INTEGER NOT NULL, \"seconds\" REAL NOT NULL, \"retries\" INTEGER NOT NULL, \"skipped\" INTEGER NOT NULL, \"error\" TEXT NOT NULL);");
+        profileDB.exec("CREATE INDEX \"idxrunsprofile\" ON \"runs\" (\"profile\");");
+        profileDB.exec("CREATE INDEX \"idxrunfilesrun\" ON \"run_files\" (\"run\");");
+    }
+    if (version < 3)
+    {
+        profileDB.exec("CREATE TABLE \"catalog_cache\" (\"key\" TEXT NOT NULL PRIMARY KEY, \"stamp\" TEXT NOT NULL, \"value\" TEXT NOT NULL);");
+    }
+    if (version < 4)
+    {
+        profileDB.exec("CREATE TABLE \"inventory\" (\"root\" TEXT NOT NULL, \"dir\" TEXT NOT NULL, \"name\" TEXT NOT NULL, \"size\" INTEGER NOT NULL, \"mtime\" INTEGER NOT NULL, \"inode\" INTEGER NOT NULL, PRIMARY KEY(\"root\",\"dir\",\"name\"));");
+        profileDB.exec("CREATE TABLE \"inventory_dirs\" (\"root\" TEXT NOT NULL, \"dir\" TEXT NOT NULL, \"mtime\" INTEGER NOT NULL, PRIMARY KEY(\"root\",\"dir\"));");
+    }
+    profileDB.exec("PRAGMA user_version = " + std::to_string(PROFILE_SCHEMA_VERSION) + ";");
+    transaction.commit();
+}
+
+std::map<std::string, profile> LoadProfiles(SQLite::Database &profileDB)
+{
+    std::map<std::string, profile> profiles;
+    SQLite::Statement query(profileDB, "SELECT name, online, romSource, chdSource, romTarget, chdTarget, baseUrl FROM profiles ORDER BY name;");
+    while (query.executeStep())
+    {
+        profiles[query.getColumn(0).getString()] = profile{query.getColumn(0).getString(), query.getColumn(1).getInt(), query.getColumn(2).getString(), query.getColumn(3).getString(), query.getColumn(4).getString(), query.getColumn(5).getString(), query.getColumn(6).getString()};
+    }
+    return profiles;
+}
+
+void CreateProfile(SQLite::Database &profileDB, const profile &p)
+{
+    TraceSpan span("CreateProfile", "profiledb");
+    SQLite::Statement query(profileDB, "INSERT INTO profiles (name,online,romSource,chdSource,romTarget,chdTarget,baseUrl) VALUES (?,?,?,?,?,?,?);");
+    query.bind(1, p.name);
+    query.bind(2, p.online);
+    query.bind(3, p.romSource);
+    query.bind(4, p.chdSource);
+    query.bind(5, p.romTarget);
+    query.bind(6, p.chdTarget);
+    query.bind(7, p.baseUrl);
+    query.exec();
+}
+
+void UpdateProfile(SQLite::Database &profileDB, const std::string &prevName, const profile &p)
+{
+    TraceSpan span("UpdateProfile", "profiledb");
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement query(profileDB, "UPDATE profiles SET name=?,online=?,romSource=?,chdSource=?,romTarget=?,chdTarget=?,baseUrl=? WHERE name=?;");
+    query.bind(1, p.name);
+    query.bind(2, p.online);
+    query.bind(3, p.romSource);
+    query.bind(4, p.chdSource);
+    query.bind(5, p.romTarget);
+    query.bind(6, p.chdTarget);
+    query.bind(7, p.baseUrl);
+    query.bind(8, prevName);
+    query.exec();
+    if (p.name != prevName)
+    {
+        SQLite::Statement query2(profileDB, "UPDATE games SET profile=? WHERE profile=?;");
+        query2.bind(1, p.name);
+        query2.bind(2, prevName);
+        query2.exec();
+        SQLite::Statement query3(profileDB, "UPDATE runs SET profile=? WHERE profile=?;");
+        query3.bind(1, p.name);
+        query3.bind(2, prevName);
+        query3.exec();
+    }
+    transaction.commit();
+}
+
+void DeleteProfile(SQLite::Database &profileDB, const std::string &name)
+{
+    TraceSpan span("DeleteProfile", "profiledb");
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement query(profileDB, "DELETE FROM profiles WHERE name=?;");
+    query.bind(1, name);
+    query.exec();
+    SQLite::Statement query2(profileDB, "DELETE FROM games WHERE profile=?;");
+    query2.bind(1, name);
+    query2.exec();
+    SQLite::Statement query3(profileDB, "DELETE FROM run_files WHERE run IN (SELECT id FROM runs WHERE profile=?);");
+    query3.bind(1, name);
+    query3.exec();
+    SQLite::Statement query4(profileDB, "DELETE FROM runs WHERE profile=?;");
+    query4.bind(1, name);
+    query4.exec();
+    transaction.commit();
+}
+
+std::vector<std::string> SelectedGames(SQLite::Database &profileDB, const std::string &profileName)
+{
+    TraceSpan span("SelectedGames", "profiledb");
+    std::vector<std::string> games;
+    SQLite::Statement query(profileDB, "SELECT game FROM games WHERE profile = ?;");
+    query.bind(1, profileName);
+    while (query.executeStep())
+    {
+        games.push_back(query.getColumn(0).getString());
+    }
+    return games;
+}
+
+void SetGamesSelected(SQLite::Database &profileDB, const std::string &profileName, const std::vector<std::string> &games, bool selected)
+{
+    TraceSpan span(selected ? "SetGamesSelected select" : "SetGamesSelected deselect", "profiledb");
+    span.Arg("games", (int64_t)games.size());
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement query(profileDB, selected ? "INSERT OR REPLACE INTO games (profile,game) VALUES (?,?);" : "DELETE FROM games WHERE profile=? AND game=?;");
+    for (const std::string &game : games)
+    {
+        query.bind(1, profileName);
+        query.bind(2, game);
+        query.exec();
+        query.reset();
+    }
+    transaction.commit();
+}
+
+void ReplaceProfileGames(SQLite::Database &profileDB, const profile &p, const std::vector<std::string> &games)
+{
+    TraceSpan span("ReplaceProfileGames", "profiledb");
+    span.Arg("games", (int64_t)games.size());
+    SQLite::Transaction transaction(profileDB);
+    SQLite::Statement create(profileDB, "INSERT OR IGNORE INTO profiles (name,online,romSource,chdSource,romTarget,chdTarget,baseUrl) VALUES (?,?,?,?,?,?,?);");
+    create.bind(1, p.name);
+    create.bind(2, p.online);
+    create.bind(3, p.romSource);
+    create.bind(4, p.chdSource);
+    create.bind(5, p.romTarget);
+    create.bind(6, p.chdTarget);
+    create.bind(7, p.baseUrl);
+    create.exec();
+    SQLite::Statement clear(profileDB, "DELETE FROM games WHERE profile=?;");
+    clear.bind(1, p.name);
+    clear.exec();
+    SQLite::Statement query(profileDB, "INSERT OR REPLACE INTO games (profile,game) VALUES (?,?);");
+    for (const std::string &game : games)
+    {
+        query.bind(1, p.name);
+        query.bind(2, game);
+        query.exec();
+        query.reset();
+    }
+    transaction.commit();
+}
@@ -0,0 +1,59 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/profiles.h
+// Purpose:     Profile storage. Profiles and their selected games live in profiles.romper.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace SQLite
+{
+    class Database;
+}
+
+struct profile //The profile data for each profile. LoadProfiles returns a map of these.
+{
+    std::string name; //Name of the profile
+    int online; //If 1, then download roms. Else, use local files.
+    std::string romSource; //If local files, this is the folder with all the .zip files
+    std::string chdSource; //If local files, this is the folder with all the chd folders.
+    std::string romTarget; //Where the rom zips are copied/downloaded.
+    std::string chdTarget; //Where the CHD folders are copied/downloaded.
+    std::string baseUrl; //If online, where to download from: one or more URLs separated by spaces, mirrors tried in turn. Blank is DOWNLOAD_URL.
+};
+
+//Bump this and add a step to UpgradeProfileSchema whenever the profile DB's tables change.
+const int PROFILE_SCHEMA_VERSION = 4;
+
+/*Create the tables of a brand new profile DB.*/
+void CreateProfileSchema(SQLite::Database &profileDB);
+
+/*Bring a profile DB written by an older Romper up to PROFILE_SCHEMA_VERSION.*/
+void UpgradeProfileSchema(SQLite::Database &profileDB);
+
+/*Every profile, keyed by name.*/
+std::map<std::string, profile> LoadProfiles(SQLite::Database &profileDB);
+
+/*Add a profile. Throws if the name is taken.*/
+void CreateProfile(SQLite::Database &profileDB, const profile &p);
+
+/*Update the profile named prevName. Its selected games and run history follow it if it's renamed.*/
+void UpdateProfile(SQLite::Database &profileDB, const std::string &prevName, const profile &p);
+
+/*Delete a profile, its selected games and its run history.*/
+void DeleteProfile(SQLite::Database &profileDB, const std::string &name);
+
+/*The names of the games selected in a profile.*/
+std::vector<std::string> SelectedGames(SQLite::Database &profileDB, const std::string &profileName);
+
+/*Select or deselect games in a profile, all in one transaction.*/
+void SetGamesSelected(SQLite::Database &profileDB, const std::string &profileName, const std::vector<std::string> &games, bool selected);
+
+/*
+*Make games the whole selection of the profile named p.name, all in one transaction.
+*If there is no such profile it is created from p first. An existing one keeps its folders.
+*/
+void ReplaceProfileGames(SQLite::Database &profileDB, const profile &p, const std::vector<std::string> &games);
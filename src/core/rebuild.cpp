@@ -0,0 +1,259 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/rebuild.cpp
+// Purpose:     Builds non-merged ROM zips out of split or merged sets
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/rebuild.h"
+#include "core/checksum.h"
+#include "core/trace.h"
+#include "core/zipindex.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace
+{
+    // TorrentZip's fixed time and date, so the same ROMs always rebuild to the same bytes.
+    const uint16_t DOS_TIME = 0xBC00;
+    const uint16_t DOS_DATE = 0x2198;
+
+    void Put16(std::string &out, uint16_t value)
+    {
+        out.push_back((char)(value & 0xFF));
+        out.push_back((char)(value >> 8));
+    }
+
+    void Put32(std::string &out, uint32_t value)
+    {
+        Put16(out, (uint16_t)(value & 0xFFFF));
+        Put16(out, (uint16_t)(value >> 16));
+    }
+
+    std::string Lower(std::string s)
+    {
+        std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+        return s;
+    }
+
+    /*Where one ROM's data comes from. zip is nullptr until a source has it.*/
+    struct romSource
+    {
+        ZipIndex *zip = nullptr;
+        zipEntry entry;
+    };
+
+    using filePtr = std::unique_ptr<FILE, int (*)(FILE *)>;
+    /*
+    *Find where each of roms is in sources, tried in order, keyed by size and CRC. zips keeps the sources found open.
+    *ROMs are matched by size and CRC, since a merged set may keep a clone's ROM under another name or in a clone folder.
+    *Nodump ROMs have no data to find, so they aren't looked for and rebuilt sets go without them, as MAME expects.
+    *Returns "" unless a source can't be read.
+    */
+    std::string FindRoms(const std::vector<romChecksum> &roms, const std::vector<std::string> &sources, std::map<std::pair<uint64_t, uint32_t>, romSource> &wanted,
+                         std::vector<std::unique_ptr<ZipIndex>> &zips)
+    {
+        for (const romChecksum &rom : roms)
+        {
+            if (!rom.nodump)
+            {
+                wanted[{rom.size, rom.crc}];
+            }
+        }
+        size_t missing = wanted.size();
+        for (const std::string &source : sources)
+        {
+            if (missing == 0)
+            {
+                break;
+            }
+            std::error_code ec;
+            if (!std::filesystem::exists(source, ec))
+            {
+                continue;
+            }
+            zips.push_back(std::make_unique<ZipIndex>(source));
+            ZipIndex &zip = *zips.back();
+            zipEntry entry;
+            while (zip.Next(entry))
+            {
+                // Only what MAME itself reads can be carried over as is.
+                if ((entry.flags & 1) || (entry.method != 0 && entry.method != 8))
+                {
+                    continue;
+                }
+                auto found = wanted.find({entry.size, entry.crc});
+                if (found != wanted.end() && !found->second.zip)
+                {
+                    found->second = romSource{&zip, entry};
+                    missing--;
+                }
+            }
+            if (!zip.Error().empty())
+            {
+                return "Rebuild error: " + zip.Error();
+            }
+        }
+        return "";
+    }
+}
+
+std::string RebuildZip(const std::string &target, const std::vector<romChecksum> &roms, const std::vector<std::string> &sources)
+{
+    TraceSpan span("rebuild", "run");
+    span.Arg("file", target);
+    if (roms.empty())
+    {
+        return "The game DB has no ROMs to rebuild " + std::filesystem::path(target).filename().string() + " from";
+    }
+
+    std::map<std::pair<uint64_t, uint32_t>, romSource> wanted;
+    std::vector<std::unique_ptr<ZipIndex>> zips;
+    std::string error = FindRoms(roms, sources, wanted, zips);
+    if (!error.empty())
+    {
+        return error;
+    }
+
+    // TorrentZip order: by name, ignoring case.
+    std::vector<const romChecksum *> members;
+    for (const romChecksum &rom : roms)
+    {
+        if (!rom.nodump)
+        {
+            members.push_back(&rom);
+        }
+    }
+    std::sort(members.begin(), members.end(), [](const romChecksum *a, const romChecksum *b)
+              { return Lower(a->name) < Lower(b->name); });
+    for (const romChecksum *rom : members)
+    {
+        // An empty ROM needs no source. It is written as an empty stored member.
+        if (!wanted[{rom->size, rom->crc}].zip && rom->size != 0)
+        {
+            return "Missing ROM " + rom->name + " (CRC " + Crc32Hex(rom->crc) + ") in the source set for " + std::filesystem::path(target).filename().string();
+        }
+    }
+
+    filePtr out(std::fopen(target.c_str(), "wb"), std::fclose);
+    if (!out)
+    {
+        return "Could not create " + target + ". Be sure you have write permissions.";
+    }
+    auto fail = [&](const std::string &error)
+    {
+        out.reset();
+        std::error_code ec;
+        std::filesystem::remove(target, ec);
+        return error;
+    };
+    std::string directory;
+    uint64_t offset = 0;
+    for (const romChecksum *rom : members)
+    {
+        const romSource &source = wanted[{rom->size, rom->crc}];
+        zipEntry entry = source.zip ? source.entry : zipEntry();
+        const unsigned char *data = source.zip ? source.zip->Data(entry) : nullptr;
+        if (source.zip && !data)
+        {
+            return fail("Rebuild error: " + source.zip->Error());
+        }
+        if (offset > 0xFFFFFFFF || entry.compressedSize > 0xFFFFFFFF || entry.size > 0xFFFFFFFF || members.size() > 0xFFFF)
+        {
+            return fail("Too big to rebuild without zip64: " + target);
+        }
+        // Keep the deflate level bits. Sizes are in the header, so there is no data descriptor.
+        uint16_t flags = entry.flags & 0x0006;
+        std::string header;
+        Put32(header, 0x04034b50);
+        Put16(header, 20);
+        Put16(header, flags);
+        Put16(header, entry.method);
+        Put16(header, DOS_TIME);
+        Put16(header, DOS_DATE);
+        Put32(header, entry.crc);
+        Put32(header, (uint32_t)entry.compressedSize);
+        Put32(header, (uint32_t)entry.size);
+        Put16(header, (uint16_t)rom->name.size());
+        Put16(header, 0);
+        header.append(rom->name);
+
+        Put32(directory, 0x02014b50);
+        Put16(directory, 0);
+        Put16(directory, 20);
+        Put16(directory, flags);
+        Put16(directory, entry.method);
+        Put16(directory, DOS_TIME);
+        Put16(directory, DOS_DATE);
+        Put32(directory, entry.crc);
+        Put32(directory, (uint32_t)entry.compressedSize);
+        Put32(directory, (uint32_t)entry.size);
+        Put16(directory, (uint16_t)rom->name.size());
+        Put16(directory, 0); // extra
+        Put16(directory, 0); // comment
+        Put16(directory, 0); // disk
+        Put16(directory, 0); // internal attributes
+        Put32(directory, 0); // external attributes
+        Put32(directory, (uint32_t)offset);
+        directory.append(rom->name);
+
+        if (std::fwrite(header.data(), 1, header.size(), out.get()) != header.size() ||
+            (entry.compressedSize > 0 && std::fwrite(data, 1, (size_t)entry.compressedSize, out.get()) != entry.compressedSize))
+        {
+            return fail("Could not write " + target + ". Be sure there is enough space.");
+        }
+        offset += header.size() + entry.compressedSize;
+    }
+    if (offset > 0xFFFFFFFF)
+    {
+        return fail("Too big to rebuild without zip64: " + target);
+    }
+    std::string end;
+    Put32(end, 0x06054b50);
+    Put16(end, 0);
+    Put16(end, 0);
+    Put16(end, (uint16_t)members.size());
+    Put16(end, (uint16_t)members.size());
+    Put32(end, (uint32_t)directory.size());
+    Put32(end, (uint32_t)offset);
+    Put16(end, 0);
+    directory.append(end);
+    if (std::fwrite(directory.data(), 1, directory.size(), out.get()) != directory.size() || std::fflush(out.get()) != 0)
+    {
+        return fail("Could not write " + target + ". Be sure there is enough space.");
+    }
+    span.Arg("bytes", (int64_t)(offset + directory.size()));
+    return "";
+}
+
+int64_t RebuiltZipBytes(const std::vector<romChecksum> &roms, const std::vector<std::string> &sources)
+{
+    TraceSpan span("RebuiltZipBytes", "plan");
+    std::map<std::pair<uint64_t, uint32_t>, romSource> wanted;
+    std::vector<std::unique_ptr<ZipIndex>> zips;
+    if (!FindRoms(roms, sources, wanted, zips).empty())
+    {
+        return -1;
+    }
+    // The same layout RebuildZip writes: a local header and a directory entry per ROM, then the end record.
+    int64_t bytes = 22;
+    for (const romChecksum &rom : roms)
+    {
+        if (rom.nodump)
+        {
+            continue;
+        }
+        const romSource &source = wanted[{rom.size, rom.crc}];
+        if (!source.zip && rom.size != 0)
+        {
+            return -1;
+        }
+        bytes += 30 + 46 + 2 * (int64_t)rom.name.size() + (source.zip ? (int64_t)source.entry.compressedSize : 0);
+    }
+    return bytes;
+}
@@ -0,0 +1,28 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/rebuild.h
+// Purpose:     Builds non-merged ROM zips out of split or merged sets
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+*Write target as a non-merged zip of exactly roms, finding each one by size and CRC in sources, which are tried in order.
+*In a split set a clone's zip only has the ROMs its parent doesn't, and in a merged set the clone's ROMs are in its parent's zip,
+*so sources is the game's own zip followed by its parent's and BIOS's. Missing sources are skipped.
+*Each ROM's compressed data is copied as is, deflate stream and all. Nothing is decompressed or recompressed.
+*Returns "" on success, else the error, in which case target is removed.
+*/
+std::string RebuildZip(const std::string &target, const std::vector<romChecksum> &roms, const std::vector<std::string> &sources);
+
+/*
+*The size of the zip RebuildZip would write for roms from sources, from the sources' zip directories alone.
+*Used to size split and merged sets before a run, as their rebuilt zips are bigger than a split clone's own zip, and a merged clone has none.
+*Returns -1 if a ROM isn't in sources or a source can't be read.
+*/
+int64_t RebuiltZipBytes(const std::vector<romChecksum> &roms, const std::vector<std::string> &sources);
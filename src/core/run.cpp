@@ -0,0 +1,881 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/run.cpp
+// Purpose:     The run pipeline. Plans and transfers a profile's files.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/run.h"
+#include "core/copy.h"
+#include "core/download.h"
+#include "core/pack.h"
+#include "core/rebuild.h"
+#include "core/storage.h"
+#include "core/trace.h"
+#include "core/verify.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+std::vector<gameMap> LoadProfileGames(SQLite::Database &profileDB, SQLite::Database &gameDB, const std::string &profileName)
+{
+    return LoadGames(gameDB, SelectedGames(profileDB, profileName));
+}
+
+std::vector<runFile> PlanRun(const profile &p, const std::vector<gameMap> &games, const dependencyGraph &dependencies)
+{
+    TraceSpan span("PlanRun", "run");
+    bool online = p.online == 1;
+    // The first base URL is the source, the rest are mirrors.
+    std::vector<std::string> baseUrls;
+    std::istringstream urls(p.baseUrl);
+    std::string url;
+    while (urls >> url)
+    {
+        baseUrls.push_back(url.back() == '/' ? url : url + "/");
+    }
+    if (baseUrls.empty())
+    {
+        baseUrls.push_back(DOWNLOAD_URL);
+    }
+    const std::string &baseUrl = baseUrls.front();
+    auto mirrors = [&](const std::string &path)
+    {
+        std::vector<std::string> others;
+        for (size_t m = 1; m < baseUrls.size(); m++)
+        {
+            others.push_back(baseUrls[m] + path);
+        }
+        return others;
+    };
+    std::vector<runFile> files;
+    files.reserve(games.size());
+    for (const gameMap &game : games)
+    {
+        std::string romSource = online ? baseUrl + game.name + ".zip" : p.romSource + "/" + game.name + ".zip";
+        files.push_back(runFile{game.name, "rom", romSource, p.romTarget + "/" + game.name + ".zip"});
+        if (online)
+        {
+            files.back().mirrors = mirrors(game.name + ".zip");
+        }
+        else
+        {
+            for (const gameMap &set : DependencyClosure(dependencies, {game}))
+            {
+                files.back().rebuildFrom.push_back(p.romSource + "/" + set.name + ".zip");
+            }
+        }
+        if (game.disk.size() > 0)
+        {
+            std::string chdSource = online ? baseUrl + game.name + "/" + game.disk + ".chd" : p.chdSource + "/" + game.name + "/" + game.disk + ".chd";
+            files.push_back(runFile{game.name, "chd", chdSource, p.chdTarget + "/" + game.name + "/" + game.disk + ".chd"});
+            if (online)
+            {
+                files.back().mirrors = mirrors(game.name + "/" + game.disk + ".chd");
+            }
+        }
+    }
+    return files;
+}
+
+const std::vector<romChecksum> *RebuildRoms(const runFile &file, bool online, const gameChecksums &checksums)
+{
+    if (online || (file.type != "rom" && file.type != "7z"))
+    {
+        return nullptr;
+    }
+    auto roms = checksums.roms.find(file.game);
+    if (roms == checksums.roms.end())
+    {
+        return nullptr;
+    }
+    // A missing source is audited as unreadable, and a merged parent as having extra files.
+    zipAuditStatus status = AuditZip(file.source, roms->second).status;
+    return status == AUDIT_GOOD ? nullptr : &roms->second;
+}
+
+namespace
+{
+    /*Clear the way for a file's target. Returns "" on success, else the error.*/
+    std::string PrepareTarget(const runFile &file)
+    {
+        std::error_code ec;
+        if (file.type != "chd")
+        {
+            // The target may be a hard link into the download cache. Writing through it would change the cached copy.
+            std::filesystem::remove(file.target, ec);
+            return "";
+        }
+        TraceSpan folderSpan("prepare folder", "run");
+        // Each game's CHDs live in a folder named after the game. Start it fresh.
+        std::filesystem::path folder = std::filesystem::path(file.target).parent_path();
+        std::filesystem::remove_all(folder, ec);
+        if (!std::filesystem::create_directory(folder, ec))
+        {
+            return "Could not create folder: " + folder.string() + ". Be sure you have write permissions and that there is enough space.";
+        }
+        return "";
+    }
+
+    /*
+    *Download a file from url into the cache unless it's already there, then link or copy it to its target.
+    *cached is set to the file's place in the cache, and hit to whether it was already there. Returns "" on success, else the error, with transient set as DownloadFile does.
+    */
+    std::string CachedDownload(const runFile &file, const std::string &url, const downloadCache &cache, const gameChecksums &checksums, std::string &cached, bool &hit, Throttle *throttle,
+                               const std::atomic<bool> &abort, bool &transient)
+    {
+        TraceSpan span("download", "run");
+        span.Arg("file", file.target);
+        cached = CachePath(cache, CacheKey(file, checksums), file.type);
+        std::error_code ec;
+        hit = std::filesystem::exists(cached, ec);
+        if (hit)
+        {
+            // Touch it so TrimDownloadCache keeps it over files nobody has asked for in a while.
+            std::filesystem::last_write_time(cached, std::filesystem::file_time_type::clock::now(), ec);
+        }
+        else
+        {
+            std::filesystem::create_directories(std::filesystem::path(cached).parent_path(), ec);
+            // Each download has its own .part, so two runs fetching the same file can't write into one.
+            std::string part = cached + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".part";
+            std::string error = DownloadFile(url, part, throttle, &abort, &transient);
+            if (!error.empty())
+            {
+                std::filesystem::remove(part, ec);
+                return error;
+            }
+            std::filesystem::rename(part, cached, ec);
+            if (ec)
+            {
+                std::filesystem::remove(part, ec);
+                return "Could not write: " + cached + " " + ec.message();
+            }
+        }
+        std::string error = PrepareTarget(file);
+        if (!error.empty())
+        {
+            return error;
+        }
+        std::string method;
+        error = FillFromCache(cached, file.target, method);
+        span.Arg("cache", hit ? "hit, " + method : "miss, " + method);
+        return error;
+    }
+}
+
+std::string TransferFile(const runFile &file, bool online, Throttle *throttle, const std::atomic<bool> *abort, bool *transient)
+{
+    TraceSpan span(online ? "download" : "copy", "run");
+    span.Arg("file", file.target);
+    std::string error = PrepareTarget(file);
+    if (!error.empty())
+    {
+        return error;
+    }
+    if (online)
+    {
+        return DownloadFile(file.source, file.target, throttle, abort, transient);
+    }
+    return CopyGameFile(file.source, file.target);
+}
+
+namespace
+{
+    // Plain local copies a worker takes at once when the copy backend batches them.
+    const size_t COPY_BATCH = 32;
+
+    // A download that fails for now goes around its URLs up to DOWNLOAD_ROUNDS times, waiting RETRY_DELAY_MS before the second and twice as long each time after, up to RETRY_DELAY_MAX_MS.
+    const int DOWNLOAD_ROUNDS = 4;
+    const int RETRY_DELAY_MS = 1000;
+    const int RETRY_DELAY_MAX_MS = 30000;
+
+    /*Fill a written and checked file's alsoTo targets from its target. Returns an error, or "", per target.*/
+    std::vector<std::string> FanOut(const runFile &file)
+    {
+        TraceSpan span("fan out", "run");
+        span.Arg("file", file.target);
+        std::vector<std::string> errors;
+        for (const std::string &target : file.alsoTo)
+        {
+            runFile other = file;
+            other.target = target;
+            std::error_code ec;
+            // Two profiles can share a target folder under different names. Clearing the way there would delete the file just written.
+            if (std::filesystem::equivalent(std::filesystem::path(target).parent_path(), std::filesystem::path(file.target).parent_path(), ec))
+            {
+                errors.push_back("");
+                continue;
+            }
+            std::string error = PrepareTarget(other);
+            std::string method;
+            if (error.empty())
+            {
+                error = FillFromCache(file.target, target, method);
+            }
+            errors.push_back(error);
+        }
+        return errors;
+    }
+
+    /*Wait before round (1 or more) of a download. False if abort was set meanwhile.*/
+    bool Backoff(int round, const std::atomic<bool> &abort)
+    {
+        TraceSpan span("backoff", "run");
+        static thread_local std::mt19937 random(std::random_device{}());
+        int delay = std::min(RETRY_DELAY_MAX_MS, RETRY_DELAY_MS << std::min(round - 1, 15));
+        // Somewhere in the upper half, so workers that failed together don't all ask again together.
+        std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::uniform_int_distribution<int>(delay / 2, delay)(random));
+        while (!abort && std::chrono::steady_clock::now() < until)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        return !abort;
+    }
+
+    /*Write a 7z of zip at packed, through a .part file so a pack cut short never looks done. Returns "" on success, else the error.*/
+    std::string PackTo(const runFile &file, const std::vector<romChecksum> *rebuild, const std::string &packed)
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(packed).parent_path(), ec);
+        std::string part = packed + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".part";
+        std::string zip = file.source;
+        std::string error;
+        if (rebuild)
+        {
+            // The set is rebuilt into a zip first, as it would be without packing, then packed from there.
+            zip = part + ".zip";
+            std::vector<std::string> sources{file.source};
+            sources.insert(sources.end(), file.rebuildFrom.begin(), file.rebuildFrom.end());
+            error = RebuildZip(zip, *rebuild, sources);
+        }
+        if (error.empty())
+        {
+            error = PackZip(zip, part);
+        }
+        if (rebuild)
+        {
+            std::filesystem::remove(zip, ec);
+        }
+        if (error.empty())
+        {
+            std::filesystem::rename(part, packed, ec);
+            error = ec ? "Could not write: " + packed + " " + ec.message() : "";
+        }
+        if (!error.empty())
+        {
+            std::filesystem::remove(part, ec);
+        }
+        return error;
+    }
+
+    /*
+    *Pack a local rom zip into its 7z target, rebuilding it first from rebuild if given (see RebuildRoms).
+    *With a cache folder, each set is packed there once under its PackKey and linked or copied to the target, as downloads are, so profiles and runs that share it don't pack it again.
+    *cached and hit are set as CachedDownload sets them. Returns "" on success, else the error.
+    */
+    std::string PackedCopy(const runFile &file, const std::vector<romChecksum> *rebuild, const downloadCache &cache, const gameChecksums &checksums, std::string &cached, bool &hit)
+    {
+        TraceSpan span("pack", "run");
+        span.Arg("file", file.target);
+        std::string error = PrepareTarget(file);
+        if (!error.empty() || cache.folder.empty())
+        {
+            return error.empty() ? PackTo(file, rebuild, file.target) : error;
+        }
+        cached = CachePath(cache, PackKey(file, checksums), file.type);
+        std::error_code ec;
+        hit = std::filesystem::exists(cached, ec);
+        if (hit)
+        {
+            std::filesystem::last_write_time(cached, std::filesystem::file_time_type::clock::now(), ec);
+        }
+        else
+        {
+            error = PackTo(file, rebuild, cached);
+            if (!error.empty())
+            {
+                return error;
+            }
+        }
+        std::string method;
+        error = FillFromCache(cached, file.target, method);
+        span.Arg("cache", hit ? "hit, " + method : "miss, " + method);
+        return error;
+    }
+
+    /*
+    *Hands out a run's files so no device has more of them in flight than it can take (see storageDevice::Concurrency).
+    *Local files are grouped by type, source device and the devices of every target they are written to, alsoTo's included.
+    *PlanRun puts each type's sources in one folder and its targets in another, so there are few groups, but profiles run together can each target another drive.
+    *A group on a spinning source is read in disk order. A group is only taken from while all its devices have room.
+    */
+    class FileQueue
+    {
+    public:
+        FileQueue(const std::vector<runFile> &files, bool online, int jobs)
+        {
+            TraceSpan span("schedule", "run");
+            std::map<std::string, size_t> groupOfKey;
+            std::map<std::string, size_t> deviceOfId;
+            std::map<std::string, size_t> deviceOfFolder;
+            std::vector<bool> rotational; //Of each device.
+            std::string kinds;
+            auto deviceIndex = [&](const std::string &path)
+            {
+                std::string folder = std::filesystem::path(path).parent_path().string();
+                auto known = deviceOfFolder.find(folder);
+                if (known != deviceOfFolder.end())
+                {
+                    return known->second;
+                }
+                storageDevice storage = StorageDeviceOf(folder);
+                auto found = deviceOfId.emplace(storage.id, devices.size());
+                if (found.second)
+                {
+                    devices.push_back(device{storage.Concurrency(jobs)});
+                    rotational.push_back(storage.rotational);
+                    kinds += (kinds.empty() ? "" : ", ") + (storage.name.empty() ? storage.id : storage.name) + (storage.rotational ? " rotational" : storage.card ? " card" : " fast");
+                }
+                deviceOfFolder[folder] = found.first->second;
+                return found.first->second;
+            };
+            for (size_t i = 0; i < files.size(); i++)
+            {
+                // Downloads are held up by the network, not the disks, so they are one group with no device limits. So are 7z packs, held up by the CPU.
+                std::string key = online ? "" : files[i].type;
+                std::vector<size_t> fileDevices;
+                if (!online && key != "7z")
+                {
+                    // The source first, then each target device once.
+                    fileDevices.push_back(deviceIndex(files[i].source));
+                    std::vector<size_t> targets{deviceIndex(files[i].target)};
+                    for (const std::string &target : files[i].alsoTo)
+                    {
+                        targets.push_back(deviceIndex(target));
+                    }
+                    std::sort(targets.begin(), targets.end());
+                    for (size_t target : targets)
+                    {
+                        if (std::find(fileDevices.begin(), fileDevices.end(), target) == fileDevices.end())
+                        {
+                            fileDevices.push_back(target);
+                        }
+                    }
+                    for (size_t d : fileDevices)
+                    {
+                        key += " " + std::to_string(d);
+                    }
+                }
+                auto found = groupOfKey.emplace(key, groups.size());
+                if (found.second)
+                {
+                    groups.emplace_back();
+                    groups.back().devices = fileDevices;
+                    groups.back().diskOrder = !fileDevices.empty() && rotational[fileDevices.front()];
+                }
+                groups[found.first->second].files.push_back(i);
+            }
+            span.Arg("devices", kinds);
+            for (group &g : groups)
+            {
+                if (g.diskOrder)
+                {
+                    std::vector<std::pair<uint64_t, size_t>> order;
+                    for (size_t i : g.files)
+                    {
+                        order.push_back({files[i].upToDate ? 0 : DiskOrder(files[i].source), i});
+                    }
+                    std::sort(order.begin(), order.end());
+                    for (size_t k = 0; k < order.size(); k++)
+                    {
+                        g.files[k] = order[k].second;
+                    }
+                }
+            }
+        }
+
+        /*Up to count files to do next, all of one group. Waits while every group left is held up by its devices. Empty when none are left or abort is set.*/
+        std::vector<size_t> Take(size_t count, std::atomic<bool> &abort)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!abort)
+            {
+                bool left = false;
+                for (group &g : groups)
+                {
+                    if (g.next >= g.files.size())
+                    {
+                        continue;
+                    }
+                    left = true;
+                    bool room = std::all_of(g.devices.begin(), g.devices.end(), [&](size_t d)
+                                            { return devices[d].busy < devices[d].limit; });
+                    if (!room)
+                    {
+                        continue;
+                    }
+                    for (size_t d : g.devices)
+                    {
+                        devices[d].busy++;
+                    }
+                    size_t end = std::min(g.files.size(), g.next + count);
+                    std::vector<size_t> taken(g.files.begin() + g.next, g.files.begin() + end);
+                    g.next = end;
+                    busyGroup[taken.front()] = &g;
+                    return taken;
+                }
+                if (!left)
+                {
+                    break;
+                }
+                // Done wakes this, and the timeout notices abort.
+                freed.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            return {};
+        }
+
+        /*The files from Take are done, so their devices have room again.*/
+        void Done(const std::vector<size_t> &taken)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto found = busyGroup.find(taken.front());
+                for (size_t d : found->second->devices)
+                {
+                    devices[d].busy--;
+                }
+                busyGroup.erase(found);
+            }
+            freed.notify_all();
+        }
+
+    private:
+        struct device
+        {
+            int limit; //Files it may have in flight.
+            int busy = 0; //Files it has in flight.
+        };
+        struct group
+        {
+            std::vector<size_t> files; //In the order they are handed out.
+            size_t next = 0;
+            std::vector<size_t> devices; //Indexes into devices.
+            bool diskOrder = false;
+        };
+        std::vector<device> devices;
+        std::vector<group> groups;
+        std::map<size_t, group *> busyGroup; //The group of each batch in flight, by its first file.
+        std::mutex mutex;
+        std::condition_variable freed;
+    };
+}
+
+runResult RunFiles(const std::vector<runFile> &files, bool online, int jobs, std::atomic<bool> &abort, const std::function<void(size_t index, const runFile &file, const std::string &error)> &onFile,
+                   const gameChecksums &checksums, const downloadCache &cache, Throttle *throttle)
+{
+    runResult result;
+    result.files.resize(files.size());
+    result.strategy = online ? "download" : "copy";
+    // Plain local copies are taken COPY_BATCH at a time so the io_uring backend can put them in one submission.
+    // A rate limit needs each file paid for before the next starts, so it takes them one at a time.
+    copyBackend backend = online ? COPY_PORTABLE : DefaultCopyBackend();
+    size_t batch = backend == COPY_URING && !(throttle && throttle->Limits()) ? COPY_BATCH : 1;
+    jobs = std::max(1, std::min(jobs, (int)files.size()));
+    FileQueue queue(files, online, jobs);
+    std::mutex resultMutex;
+    // Check a transferred file. Returns error, or why the check failed, with the bad file removed from its target and the cache.
+    auto check = [&](size_t i, const std::string &error, const std::string &cached)
+    {
+        if (!error.empty())
+        {
+            return error;
+        }
+        bool checked;
+        std::string bad = VerifyFile(files[i], checksums, false, checked);
+        if (bad.empty())
+        {
+            return bad;
+        }
+        std::error_code ec;
+        std::filesystem::remove(files[i].target, ec);
+        // Don't hand a bad download to the next profile that wants it.
+        if (!cached.empty())
+        {
+            std::filesystem::remove(cached, ec);
+        }
+        return "Verify failed: " + bad;
+    };
+    // Record how a checked file went, after filling its alsoTo targets. seconds is the time it took, checking included.
+    auto finish = [&](size_t i, const std::string &error, double seconds, bool rebuilt, bool hit, int attempts)
+    {
+        fileStats stats;
+        if (error.empty() && !files[i].alsoTo.empty())
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            stats.alsoErrors = FanOut(files[i]);
+            seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        stats.done = true;
+        stats.seconds = seconds;
+        stats.retries = std::max(0, attempts - 1);
+        stats.error = error;
+        stats.rebuilt = rebuilt && error.empty();
+        stats.cached = hit && error.empty();
+        if (error.empty())
+        {
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(files[i].target, ec);
+            stats.bytes = ec ? 0 : (int64_t)size;
+            // Downloads take from the throttle as their chunks come in. Copies and rebuilds do it here, and cache hits cost nothing.
+            if (throttle && !online)
+            {
+                throttle->Spend((uint64_t)stats.bytes);
+            }
+        }
+        std::lock_guard<std::mutex> lock(resultMutex);
+        result.files[i] = stats;
+        if (error.empty())
+        {
+            result.ok++;
+            result.rebuilt += stats.rebuilt ? 1 : 0;
+            result.cached += stats.cached ? 1 : 0;
+            result.packed += files[i].type == "7z" && !stats.cached ? 1 : 0;
+        }
+        else
+        {
+            result.failed++;
+            result.errors.push_back(error);
+        }
+        for (const std::string &alsoError : stats.alsoErrors)
+        {
+            alsoError.empty() ? result.ok++ : result.failed++;
+            if (!alsoError.empty())
+            {
+                result.errors.push_back(alsoError);
+            }
+        }
+        if (onFile)
+        {
+            onFile(i, files[i], error);
+        }
+    };
+    // Download and check an online file from its source, then each mirror, going around again after a backoff while a failure is transient.
+    // attempts counts every download tried. transient is left set if the last round still failed for now.
+    auto download = [&](size_t i, std::string &cached, bool &hit, int &attempts, bool &transient)
+    {
+        std::vector<std::string> urls{files[i].source};
+        urls.insert(urls.end(), files[i].mirrors.begin(), files[i].mirrors.end());
+        std::string error;
+        for (int round = 0; round < DOWNLOAD_ROUNDS; round++)
+        {
+            if (round > 0 && !Backoff(round, abort))
+            {
+                break;
+            }
+            transient = false;
+            for (const std::string &url : urls)
+            {
+                attempts++;
+                bool again = false;
+                if (!cache.folder.empty())
+                {
+                    error = CachedDownload(files[i], url, cache, checksums, cached, hit, throttle, abort, again);
+                }
+                else
+                {
+                    runFile from = files[i];
+                    from.source = url;
+                    error = TransferFile(from, true, throttle, &abort, &again);
+                }
+                // A file that downloads but doesn't check out is bad at that URL, so it moves on without going around again.
+                error = check(i, error, cached);
+                transient = !error.empty() && (transient || again);
+                if (error.empty() || abort)
+                {
+                    return error;
+                }
+            }
+            if (!transient)
+            {
+                break;
+            }
+        }
+        return error;
+    };
+    // Downloads still failing for now when their rounds ran out, tried again once the rest are done.
+    struct deferredFile
+    {
+        size_t index;
+        int attempts;
+        double seconds;
+    };
+    std::vector<deferredFile> deferred;
+    auto worker = [&]()
+    {
+        std::vector<size_t> copies;
+        std::vector<std::pair<std::string, std::string>> paths;
+        std::vector<size_t> taken;
+        while (!(taken = queue.Take(batch, abort)).empty())
+        {
+            copies.clear();
+            paths.clear();
+            for (size_t i : taken)
+            {
+                if (files[i].upToDate)
+                {
+                    fileStats stats;
+                    stats.done = true;
+                    stats.skipped = true;
+                    std::lock_guard<std::mutex> lock(resultMutex);
+                    result.files[i] = stats;
+                    result.skipped++;
+                    if (onFile)
+                    {
+                        onFile(i, files[i], "");
+                    }
+                    continue;
+                }
+                // Paused or over the rate: hold here. The rest of the batch is left undone if the run is stopped meanwhile.
+                if (throttle && !throttle->Wait(abort))
+                {
+                    break;
+                }
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                const std::vector<romChecksum> *rebuild = RebuildRoms(files[i], online, checksums);
+                std::string error;
+                bool hit = false;
+                int attempts = 1;
+                if (files[i].type == "7z")
+                {
+                    std::string cached;
+                    error = PackedCopy(files[i], rebuild, cache, checksums, cached, hit);
+                    error = check(i, error, cached);
+                }
+                else if (rebuild)
+                {
+                    error = PrepareTarget(files[i]);
+                    if (error.empty())
+                    {
+                        std::vector<std::string> sources{files[i].source};
+                        sources.insert(sources.end(), files[i].rebuildFrom.begin(), files[i].rebuildFrom.end());
+                        error = RebuildZip(files[i].target, *rebuild, sources);
+                    }
+                    error = check(i, error, "");
+                }
+                else if (online)
+                {
+                    std::string cached;
+                    bool transient = false;
+                    attempts = 0;
+                    error = download(i, cached, hit, attempts, transient);
+                    if (transient && !abort)
+                    {
+                        std::lock_guard<std::mutex> lock(resultMutex);
+                        deferred.push_back({i, attempts, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()});
+                        continue;
+                    }
+                }
+                else if (batch > 1)
+                {
+                    error = PrepareTarget(files[i]);
+                    if (error.empty())
+                    {
+                        copies.push_back(i);
+                        paths.push_back({files[i].source, files[i].target});
+                        continue;
+                    }
+                }
+                else
+                {
+                    error = check(i, TransferFile(files[i], online), "");
+                }
+                finish(i, error, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), rebuild != nullptr && !hit, hit, attempts);
+            }
+            if (!copies.empty())
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::vector<std::string> errors = CopyGameFiles(paths, backend);
+                for (size_t c = 0; c < copies.size(); c++)
+                {
+                    errors[c] = check(copies[c], errors[c], "");
+                }
+                // The batch's files were copied and checked together, so each is given an even share of the time.
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / copies.size();
+                for (size_t c = 0; c < copies.size(); c++)
+                {
+                    finish(copies[c], errors[c], seconds, false, false, 1);
+                }
+            }
+            queue.Done(taken);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int j = 1; j < jobs; j++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+    if (!deferred.empty())
+    {
+        // The server has had the rest of the run to recover. Each file gets its rounds again, and whatever still fails is final.
+        TraceSpan span("retry deferred", "run");
+        span.Arg("files", (int64_t)deferred.size());
+        std::atomic<size_t> next(0);
+        auto retry = [&]()
+        {
+            for (size_t d = next++; d < deferred.size() && !abort; d = next++)
+            {
+                if (throttle && !throttle->Wait(abort))
+                {
+                    break;
+                }
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                size_t i = deferred[d].index;
+                std::string cached;
+                bool hit = false;
+                bool transient = false;
+                std::string error = download(i, cached, hit, deferred[d].attempts, transient);
+                if (abort)
+                {
+                    break;
+                }
+                finish(i, error, deferred[d].seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), false, hit, deferred[d].attempts);
+            }
+        };
+        workers.clear();
+        for (int j = 1; j < std::min(jobs, (int)deferred.size()); j++)
+        {
+            workers.emplace_back(retry);
+        }
+        retry();
+        for (std::thread &t : workers)
+        {
+            t.join();
+        }
+    }
+    if (backend == COPY_URING)
+    {
+        result.strategy += "+uring";
+    }
+    if (result.rebuilt > 0)
+    {
+        result.strategy += "+rebuild";
+    }
+    bool packs = std::any_of(files.begin(), files.end(), [](const runFile &file)
+                             { return file.type == "7z"; });
+    if (packs)
+    {
+        result.strategy += "+7z";
+    }
+    if ((online || packs) && !cache.folder.empty())
+    {
+        result.strategy += "+cache";
+        result.trim = TrimDownloadCache(cache);
+    }
+    return result;
+}
+
+fanOut FanOutFiles(const std::vector<std::vector<runFile>> &profileFiles)
+{
+    TraceSpan span("FanOutFiles", "run");
+    fanOut merged;
+    // By type and source, the file that reads it.
+    std::map<std::pair<std::string, std::string>, size_t> reader;
+    for (size_t p = 0; p < profileFiles.size(); p++)
+    {
+        for (size_t f = 0; f < profileFiles[p].size(); f++)
+        {
+            const runFile &file = profileFiles[p][f];
+            if (!file.upToDate)
+            {
+                auto found = reader.find({file.type, file.source});
+                if (found != reader.end())
+                {
+                    runFile &first = merged.files[found->second];
+                    size_t slot = std::find(first.alsoTo.begin(), first.alsoTo.end(), file.target) - first.alsoTo.begin() + 1;
+                    if (file.target == first.target)
+                    {
+                        slot = 0;
+                    }
+                    else if (slot > first.alsoTo.size())
+                    {
+                        first.alsoTo.push_back(file.target);
+                    }
+                    merged.targets[found->second].push_back({p, f, slot});
+                    continue;
+                }
+                reader[{file.type, file.source}] = merged.files.size();
+            }
+            merged.files.push_back(file);
+            merged.targets.push_back({{p, f, 0}});
+        }
+    }
+    span.Arg("files", (int64_t)merged.files.size());
+    return merged;
+}
+
+std::vector<runResult> SplitFanOut(const fanOut &merged, const std::vector<std::vector<runFile>> &profileFiles, const runResult &result)
+{
+    std::vector<runResult> results(profileFiles.size());
+    for (size_t p = 0; p < profileFiles.size(); p++)
+    {
+        results[p].files.resize(profileFiles[p].size());
+        results[p].strategy = result.strategy + "+fanout";
+    }
+    if (!results.empty())
+    {
+        results[0].trim = result.trim;
+    }
+    for (size_t i = 0; i < merged.files.size() && i < result.files.size(); i++)
+    {
+        for (const fanOutTarget &target : merged.targets[i])
+        {
+            runResult &split = results[target.profile];
+            fileStats stats = result.files[i];
+            stats.alsoErrors.clear();
+            if (target.slot > 0 && stats.done && stats.error.empty())
+            {
+                stats.error = target.slot - 1 < result.files[i].alsoErrors.size() ? result.files[i].alsoErrors[target.slot - 1] : "Not filled from: " + merged.files[i].target;
+                // Nothing was read from the source for this target.
+                stats.rebuilt = false;
+            }
+            if (!stats.error.empty())
+            {
+                stats.bytes = 0;
+            }
+            split.files[target.index] = stats;
+            if (!stats.done)
+            {
+                continue;
+            }
+            if (stats.skipped)
+            {
+                split.skipped++;
+            }
+            else if (stats.error.empty())
+            {
+                split.ok++;
+                split.rebuilt += stats.rebuilt ? 1 : 0;
+                split.cached += stats.cached ? 1 : 0;
+                split.packed += target.slot == 0 && merged.files[i].type == "7z" && !stats.cached ? 1 : 0;
+            }
+            else
+            {
+                split.failed++;
+                split.errors.push_back(stats.error);
+            }
+        }
+    }
+    return results;
+}
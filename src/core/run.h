@@ -0,0 +1,120 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/run.h
+// Purpose:     The run pipeline. Plans and transfers a profile's files.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+#include "core/downloadcache.h"
+#include "core/profiles.h"
+#include "core/throttle.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*One file of a run. A run is a list of these, copied or downloaded in any order.*/
+struct runFile
+{
+    std::string game; //The game's name.
+    std::string type; //"rom" or "chd", or "7z" for a rom zip packed into a 7z set. See PackFiles.
+    std::string source; //Local path, or the URL when the profile is online.
+    std::string target; //Where the file is written.
+    std::vector<std::string> rebuildFrom; //Local rom zips only: the zips of the sets this game needs, which hold some of its ROMs in a split or merged set.
+    std::vector<std::string> mirrors; //Online files only: the same file at the profile's other base URLs, tried in turn when source fails.
+    std::vector<std::string> alsoTo; //Other profiles' targets for the same file, filled from target once it is written and checked. See FanOutFiles.
+    bool upToDate = false; //The target already matches, so the run leaves it alone. Set by PlanTransfers.
+};
+
+/*How one file of a run went.*/
+struct fileStats
+{
+    bool done = false; //False if the run was aborted before this file.
+    int64_t bytes = 0; //Size written. 0 if it failed or was skipped.
+    double seconds = 0; //Time spent on this file.
+    int retries = 0; //Attempts after the first.
+    bool skipped = false; //Left alone because the target was already up to date.
+    bool rebuilt = false; //A rom zip put together from a split or merged set instead of copied.
+    bool cached = false; //Filled from the download cache instead of downloaded.
+    std::string error; //"" on success.
+    std::vector<std::string> alsoErrors; //Per alsoTo target: "" if it was filled. Empty if target wasn't written.
+};
+
+struct runResult
+{
+    int ok = 0; //Files transferred. Each alsoTo target filled counts as one more.
+    int failed = 0; //Files that errored, alsoTo targets included.
+    int skipped = 0; //Files already up to date.
+    int rebuilt = 0; //Rom zips put together from a split or merged set. Also counted in ok.
+    int cached = 0; //Files filled from the download cache. Also counted in ok.
+    int packed = 0; //7z sets packed by this run, not filled from the cache. Also counted in ok.
+    cacheTrim trim; //What the download cache let go of after the run.
+    std::vector<std::string> errors; //One line per failed file.
+    std::vector<fileStats> files; //One per planned file, in the same order.
+    std::string strategy; //How the files were moved, e.g. "copy" or "download". Recorded with the run.
+};
+
+/*The selected games of a profile with their disks, from the game DB.*/
+std::vector<gameMap> LoadProfileGames(SQLite::Database &profileDB, SQLite::Database &gameDB, const std::string &profileName);
+
+/*
+*Turn a profile's games into the files to copy or download.
+*For local profiles, each rom zip's rebuildFrom lists the source zips of the sets dependencies says its game needs.
+*/
+std::vector<runFile> PlanRun(const profile &p, const std::vector<gameMap> &games, const dependencyGraph &dependencies = dependencyGraph());
+
+/*
+*The ROMs to rebuild a local rom zip (or the zip of a 7z set) from, or nullptr if it should just be copied: its source is already a good non-merged zip, or the game DB has no ROMs for it.
+*A missing source is audited as unreadable, so a merged clone is rebuilt too. See RebuildZip.
+*/
+const std::vector<romChecksum> *RebuildRoms(const runFile &file, bool online, const gameChecksums &checksums);
+
+/*Copy or download a single file from its source. Returns "" on success, else the error. A download goes through throttle, if given, and says whether its failure is transient. See DownloadFile.*/
+std::string TransferFile(const runFile &file, bool online, Throttle *throttle = nullptr, const std::atomic<bool> *abort = nullptr, bool *transient = nullptr);
+
+/*
+*Transfer every file on up to jobs threads until done or abort is set.
+*Local files are held to what their source and target drives can take: one at a time on spinning disks and cards, read in disk order from spinning disks.
+*onFile is called after each file, one call at a time, from whichever thread transferred it.
+*Files marked upToDate are skipped, and counted as such.
+*Plain local copies go through CopyGameFiles with DefaultCopyBackend, in batches when it is io_uring.
+*A rom zip or CHD with checksums is quickly checked against them once written. If it doesn't match, e.g. a truncated download, it is deleted and the file fails.
+*A local rom zip with checksums whose source isn't a good non-merged zip (missing, or with other games' ROMs too) is rebuilt from its source and rebuildFrom instead. See RebuildZip.
+*Online files go through cache, if it has a folder: each is downloaded there once, checked, and linked or copied to its target. The cache is trimmed at the end.
+*7z files are packed from their source zip, rebuilt first like a rom zip if need be, one per job. They go through cache the same way, under their PackKey, so a set is packed once.
+*With a throttle, every file waits on it before it starts and downloads wait again for each chunk, so its rate and pause hold for the whole run.
+*A download is tried at its source and then each mirror. While it fails for now (see DownloadFile), that is repeated with growing, jittered delays,
+*and if it still does, once more at the end of the run. A missing file or one that doesn't verify only moves on to the next mirror.
+*A file with alsoTo targets fills them from its target once that is written and checked, without reading the source again.
+*/
+runResult RunFiles(const std::vector<runFile> &files, bool online, int jobs, std::atomic<bool> &abort, const std::function<void(size_t index, const runFile &file, const std::string &error)> &onFile,
+                   const gameChecksums &checksums = gameChecksums(), const downloadCache &cache = downloadCache(), Throttle *throttle = nullptr);
+
+/*Where one profile's file went in a fan-out.*/
+struct fanOutTarget
+{
+    size_t profile; //Index into the profiles.
+    size_t index; //Index into that profile's files.
+    size_t slot; //0 if it is the merged file's target, else 1 + its place in alsoTo.
+};
+
+/*Several profiles' files merged so that each source is read once. See FanOutFiles.*/
+struct fanOut
+{
+    std::vector<runFile> files; //What to run: one file per source, its other targets in alsoTo.
+    std::vector<std::vector<fanOutTarget>> targets; //Per file: every profile file it stands for. Profiles sharing a target share its slot.
+};
+
+/*
+*Merge the planned files (after PlanTransfers) of several profiles of the same kind, local or online, so a run reads each source once.
+*Files with the same source that aren't up to date become one: written to the first profile's target, then linked (or reflinked, or copied)
+*from there to the others' (see FillFromCache). Up to date files are kept as they are, so the run skips them.
+*/
+fanOut FanOutFiles(const std::vector<std::vector<runFile>> &profileFiles);
+
+/*Split the result of running a fan-out's files back into one result per profile, in the profiles' own file order, for RecordRun.*/
+std::vector<runResult> SplitFanOut(const fanOut &merged, const std::vector<std::vector<runFile>> &profileFiles, const runResult &result);
+
@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/storage.cpp
+// Purpose:     What kind of storage a path is on, so runs don't thrash slow devices
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+    #include <fcntl.h>
+    #include <linux/fiemap.h>
+    #include <linux/fs.h>
+    #include <sys/ioctl.h>
+    #include <sys/stat.h>
+    #include <sys/sysmacros.h>
+    #include <unistd.h>
+#elif !defined(_WIN32)
+    #include <sys/stat.h>
+#endif
+
+#include "core/storage.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+
+namespace
+{
+    std::filesystem::path ExistingParent(std::filesystem::path path)
+    {
+        std::error_code ec;
+        while (!path.empty() && !std::filesystem::exists(path, ec) && path.has_relative_path())
+        {
+            path = path.parent_path();
+        }
+        return path;
+    }
+
+#ifdef __linux__
+    std::string ReadLine(const std::filesystem::path &file)
+    {
+        std::ifstream in(file);
+        std::string line;
+        std::getline(in, line);
+        return line;
+    }
+#endif
+}
+
+int storageDevice::Concurrency(int jobs) const
+{
+    // Some virtual disks claim to spin when they don't, so the guess can be overridden.
+    const char *setting = std::getenv("ROMPER_DEVICE_JOBS");
+    if (setting && std::atoi(setting) > 0)
+    {
+        return std::min(jobs, std::atoi(setting));
+    }
+    return rotational || card ? 1 : jobs;
+}
+
+storageDevice StorageDeviceOf(const std::string &path)
+{
+    storageDevice device;
+    std::filesystem::path existing = ExistingParent(path);
+#ifdef __linux__
+    struct stat st;
+    if (stat(existing.c_str(), &st) != 0)
+    {
+        device.id = existing.string();
+        return device;
+    }
+    device.id = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+    // /sys/dev/block/M:m is the disk, or a partition of it. Only the disk has the queue and removable flags.
+    std::error_code ec;
+    std::filesystem::path block = std::filesystem::canonical("/sys/dev/block/" + device.id, ec);
+    if (ec)
+    {
+        // Not a block device: tmpfs, NFS, FUSE and the like.
+        return device;
+    }
+    if (std::filesystem::exists(block / "partition", ec))
+    {
+        block = block.parent_path();
+    }
+    device.name = block.filename().string();
+    device.rotational = ReadLine(block / "queue" / "rotational") == "1";
+    device.card = device.name.rfind("mmcblk", 0) == 0 || ReadLine(block / "removable") == "1";
+#else
+    // Other systems only get told apart by their root, e.g. a drive letter, and are taken to be fast.
+    device.id = std::filesystem::absolute(existing).root_path().string();
+#endif
+    return device;
+}
+
+uint64_t DiskOrder(const std::string &path)
+{
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return UINT64_MAX;
+    }
+    // Room for the first extent only.
+    alignas(fiemap) char buffer[sizeof(fiemap) + sizeof(fiemap_extent)] = {};
+    fiemap *map = (fiemap *)buffer;
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    bool mapped = ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0;
+    struct stat st;
+    bool stated = fstat(fd, &st) == 0;
+    close(fd);
+    if (mapped)
+    {
+        return map->fm_extents[0].fe_physical;
+    }
+    return stated ? (uint64_t)st.st_ino : UINT64_MAX;
+#elif !defined(_WIN32)
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_ino : UINT64_MAX;
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,30 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/storage.h
+// Purpose:     What kind of storage a path is on, so runs don't thrash slow devices
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*The block device a path is on.*/
+struct storageDevice
+{
+    std::string id; //"major:minor" on Linux, else the path's root. Paths with the same id share the device.
+    std::string name; //The kernel's name for it, e.g. "sda", "nvme0n1" or "mmcblk0". "" if unknown.
+    bool rotational = false; //A spinning disk. Parallel I/O makes it seek.
+    bool card = false; //An SD card or USB stick. Parallel writes make it slower, not faster.
+
+    /*How many files may be read from or written to it at once: 1 for spinning disks and cards, else jobs. ROMPER_DEVICE_JOBS=N makes it N for every device.*/
+    int Concurrency(int jobs) const;
+};
+
+/*The device path is on. A path that doesn't exist yet is looked up by its nearest existing parent. Unknown devices are taken to be fast.*/
+storageDevice StorageDeviceOf(const std::string &path);
+
+/*
+*Where a file starts on its disk, for reading files in disk order: its first extent's physical offset from FIEMAP,
+*else its inode number, which most filesystems hand out roughly in disk order.
+*/
+uint64_t DiskOrder(const std::string &path);
@@ -0,0 +1,216 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/throttle.cpp
+// Purpose:     Bandwidth limit, time-of-day schedule and pause for runs
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/throttle.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <sstream>
+
+namespace
+{
+    /*"HH:MM" as minutes since midnight, or -1. "24:00" is the end of the day.*/
+    int ParseTime(const std::string &text)
+    {
+        int hours, minutes;
+        char colon;
+        std::istringstream in(text);
+        if (!(in >> hours >> colon >> minutes) || colon != ':' || hours < 0 || hours > 24 || minutes < 0 || minutes > 59 || (hours == 24 && minutes != 0) || !in.eof())
+        {
+            return -1;
+        }
+        return hours * 60 + minutes;
+    }
+
+    int MinutesSinceMidnight()
+    {
+        std::time_t now = std::time(nullptr);
+        std::tm local;
+#ifdef _WIN32
+        localtime_s(&local, &now);
+#else
+        localtime_r(&now, &local);
+#endif
+        return local.tm_hour * 60 + local.tm_min;
+    }
+}
+
+std::string ParseRateSchedule(const std::string &spec, std::vector<rateWindow> &schedule)
+{
+    schedule.clear();
+    std::istringstream in(spec);
+    std::string part;
+    while (std::getline(in, part, ','))
+    {
+        if (part.empty())
+        {
+            continue;
+        }
+        rateWindow window;
+        std::string rate = part;
+        size_t equals = part.find('=');
+        if (equals != std::string::npos)
+        {
+            size_t dash = part.find('-');
+            if (dash == std::string::npos || dash > equals)
+            {
+                return "Expected HH:MM-HH:MM=KB/s: " + part;
+            }
+            window.start = ParseTime(part.substr(0, dash));
+            window.end = ParseTime(part.substr(dash + 1, equals - dash - 1));
+            if (window.start < 0 || window.end < 0)
+            {
+                return "Bad time in: " + part;
+            }
+            rate = part.substr(equals + 1);
+        }
+        // strtoull takes "-5" as a huge number, which would mean no limit at all.
+        char *end = nullptr;
+        errno = 0;
+        unsigned long long kilobytes = std::strtoull(rate.c_str(), &end, 10);
+        if (rate.empty() || rate.find('-') != std::string::npos || *end != '\0')
+        {
+            return "Bad KB/s in: " + part;
+        }
+        if (errno == ERANGE || kilobytes > UINT64_MAX / 1024)
+        {
+            return "KB/s too large in: " + part;
+        }
+        window.bytesPerSecond = kilobytes * 1024;
+        schedule.push_back(window);
+    }
+    return "";
+}
+
+Throttle::Throttle(const std::vector<rateWindow> &schedule) : schedule(schedule), refilled(std::chrono::steady_clock::now())
+{
+}
+
+std::string Throttle::ScheduleFromEnvironment(std::vector<rateWindow> &schedule)
+{
+    schedule.clear();
+    const char *setting = std::getenv("ROMPER_RATE");
+    std::string error = setting ? ParseRateSchedule(setting, schedule) : "";
+    if (!error.empty())
+    {
+        schedule.clear();
+    }
+    return error;
+}
+
+void Throttle::Refill()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - refilled).count();
+    refilled = now;
+    uint64_t current = 0;
+    if (!schedule.empty())
+    {
+        int minute = MinutesSinceMidnight();
+        for (const rateWindow &window : schedule)
+        {
+            bool inside = window.start == window.end ||
+                          (window.start < window.end ? minute >= window.start && minute < window.end : minute >= window.start || minute < window.end);
+            if (inside)
+            {
+                current = window.bytesPerSecond;
+                break;
+            }
+        }
+    }
+    if (current != rate)
+    {
+        // A new window starts with a clean bucket, so debt from a tight window doesn't hold back a looser one.
+        rate = current;
+        tokens = 0;
+    }
+    // Up to a second of tokens may be saved up.
+    tokens = std::min((double)rate, tokens + rate * seconds);
+}
+
+bool Throttle::Wait(const std::atomic<bool> &abort)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!paused)
+    {
+        if (!schedule.empty())
+        {
+            Refill();
+        }
+        if (rate == 0 || tokens >= 0)
+        {
+            return true;
+        }
+    }
+    TraceSpan span(paused ? "paused" : "throttled", "run");
+    while (!abort)
+    {
+        if (paused)
+        {
+            resumed.wait_for(lock, std::chrono::milliseconds(200));
+            continue;
+        }
+        Refill();
+        if (rate == 0 || tokens >= 0)
+        {
+            return true;
+        }
+        // Sleep until the debt is paid, checking abort and the schedule now and then.
+        double seconds = std::min(0.2, -tokens / rate);
+        resumed.wait_for(lock, std::chrono::microseconds((int64_t)(seconds * 1e6) + 1));
+    }
+    return false;
+}
+
+void Throttle::Spend(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rate > 0)
+    {
+        tokens -= (double)bytes;
+    }
+}
+
+uint64_t Throttle::Rate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!schedule.empty())
+    {
+        Refill();
+    }
+    return rate;
+}
+
+bool Throttle::Limits() const
+{
+    return std::any_of(schedule.begin(), schedule.end(), [](const rateWindow &window)
+                       { return window.bytesPerSecond > 0; });
+}
+
+void Throttle::Pause()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    paused = true;
+}
+
+void Throttle::Resume()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        paused = false;
+    }
+    resumed.notify_all();
+}
+
+bool Throttle::Paused()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return paused;
+}
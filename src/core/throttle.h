@@ -0,0 +1,71 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/throttle.h
+// Purpose:     Bandwidth limit, time-of-day schedule and pause for runs
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*A rate for part of the day. start == end is all day. end < start runs past midnight.*/
+struct rateWindow
+{
+    int start = 0; //Minutes since local midnight.
+    int end = 0;
+    uint64_t bytesPerSecond = 0; //0 is no limit.
+};
+
+/*
+*Parse a schedule: comma separated KB/s rates, each for a time of day ("08:00-18:00=2048") or all day ("512").
+*The first that covers the time wins; with none, there is no limit. "" is no limit at all.
+*Returns "" on success, else what is wrong with spec.
+*/
+std::string ParseRateSchedule(const std::string &spec, std::vector<rateWindow> &schedule);
+
+/*
+*A token bucket shared by every transfer of a run, with pause. Thread safe.
+*Transfers call Wait before moving data and Spend after, so the run as a whole keeps to the rate of the moment.
+*/
+class Throttle
+{
+public:
+    explicit Throttle(const std::vector<rateWindow> &schedule = std::vector<rateWindow>());
+
+    /*Parse ROMPER_RATE into schedule, which stays empty if it isn't set. Returns "" on success, else what is wrong with it.*/
+    static std::string ScheduleFromEnvironment(std::vector<rateWindow> &schedule);
+
+    /*Block while paused or while the bucket is in debt. False if abort was set while waiting.*/
+    bool Wait(const std::atomic<bool> &abort);
+
+    /*Take bytes that were just moved out of the bucket. It may go into debt, which later Waits pay off.*/
+    void Spend(uint64_t bytes);
+
+    /*The rate the schedule allows right now, in bytes per second. 0 is no limit.*/
+    uint64_t Rate();
+
+    /*Whether the schedule limits the rate at any time of day.*/
+    bool Limits() const;
+
+    /*Hold every transfer at its next Wait. Transfers in flight finish their current chunk and keep what they have.*/
+    void Pause();
+    void Resume();
+    bool Paused();
+
+private:
+    /*Bring tokens up to now at the current rate. Call with mutex held.*/
+    void Refill();
+
+    std::vector<rateWindow> schedule;
+    std::mutex mutex;
+    std::condition_variable resumed;
+    bool paused = false;
+    double tokens = 0; //Bytes that may be moved now. Negative is debt.
+    uint64_t rate = 0; //The rate of the moment, updated by Refill.
+    std::chrono::steady_clock::time_point refilled;
+};
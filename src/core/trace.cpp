@@ -0,0 +1,125 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/trace.cpp
+// Purpose:     Span tracing, written as Chrome trace event JSON (opens in Perfetto or chrome://tracing)
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/trace.h"
+#include "core/util.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+std::atomic<bool> traceEnabled(false);
+
+namespace
+{
+    std::mutex traceMutex; //Guards everything below.
+    std::string traceFile;
+    std::vector<std::string> traceEvents; //One JSON object per span.
+    std::chrono::steady_clock::time_point traceStart;
+
+    int64_t TraceNow()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - traceStart).count();
+    }
+
+    //Small, stable ids read better in Perfetto than hashed std::thread::ids.
+    int TraceThreadId()
+    {
+        static std::atomic<int> nextId(1);
+        thread_local int id = nextId++;
+        return id;
+    }
+}
+
+void StartTrace(const std::string &file)
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (traceEnabled)
+    {
+        return;
+    }
+    static bool registered = false;
+    if (!registered)
+    {
+        std::atexit(StopTrace);
+        registered = true;
+    }
+    traceFile = file;
+    traceEvents.clear();
+    traceStart = std::chrono::steady_clock::now();
+    traceEnabled = true;
+}
+
+void StartTraceFromEnvironment()
+{
+    const char *file = std::getenv("ROMPER_TRACE");
+    if (file && *file)
+    {
+        StartTrace(file);
+    }
+}
+
+void StopTrace()
+{
+    std::lock_guard<std::mutex> lock(traceMutex);
+    if (!traceEnabled)
+    {
+        return;
+    }
+    traceEnabled = false;
+    std::ofstream out(traceFile, std::ios::trunc);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (size_t i = 0; i < traceEvents.size(); i++)
+    {
+        out << traceEvents[i] << (i + 1 < traceEvents.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+    if (!out)
+    {
+        std::cerr << "Could not write trace: " << traceFile << std::endl;
+    }
+    traceEvents.clear();
+}
+
+void TraceSpan::Begin(const char *name, const char *category)
+{
+    this->name = name;
+    this->category = category;
+    start = TraceNow();
+}
+
+void TraceSpan::AddArg(const char *key, const std::string &value)
+{
+    args += (args.empty() ? "" : ",") + JsonString(key) + ":" + JsonString(value);
+}
+
+void TraceSpan::End()
+{
+    int64_t end = TraceNow();
+    std::string event = "{\"name\":" + JsonString(name) + ",\"cat\":" + JsonString(category) + ",\"ph\":\"X\",\"ts\":" + std::to_string(start) +
+                        ",\"dur\":" + std::to_string(end - start) + ",\"pid\":" + std::to_string(getpid()) + ",\"tid\":" + std::to_string(TraceThreadId());
+    if (!args.empty())
+    {
+        event += ",\"args\":{" + args + "}";
+    }
+    event += "}";
+    std::lock_guard<std::mutex> lock(traceMutex);
+    //Tracing may have stopped while the span was open.
+    if (traceEnabled)
+    {
+        traceEvents.push_back(std::move(event));
+    }
+}
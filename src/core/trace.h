@@ -0,0 +1,83 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/trace.h
+// Purpose:     Span tracing, written as Chrome trace event JSON (opens in Perfetto or chrome://tracing)
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+//Set by StartTrace. Spans check this and do nothing else while tracing is off.
+extern std::atomic<bool> traceEnabled;
+
+/*Start recording spans. They are written to file by StopTrace, which also runs at exit.*/
+void StartTrace(const std::string &file);
+
+/*Start tracing if the ROMPER_TRACE environment variable names a file.*/
+void StartTraceFromEnvironment();
+
+/*Write the recorded spans and stop tracing. Safe to call when tracing is off.*/
+void StopTrace();
+
+/*
+*Records the time from construction to destruction as one span on the calling thread.
+*name and category must be string literals. They are stored as pointers.
+*/
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, const char *category)
+    {
+        if (traceEnabled.load(std::memory_order_relaxed))
+        {
+            Begin(name, category);
+        }
+    }
+    ~TraceSpan()
+    {
+        if (name)
+        {
+            End();
+        }
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    /*End the span before the end of its scope.*/
+    void Finish()
+    {
+        if (name)
+        {
+            End();
+            name = nullptr;
+        }
+    }
+
+    /*Attach a value shown in the span's details. Ignored when tracing is off.*/
+    void Arg(const char *key, const std::string &value)
+    {
+        if (name)
+        {
+            AddArg(key, value);
+        }
+    }
+    void Arg(const char *key, int64_t value)
+    {
+        if (name)
+        {
+            AddArg(key, std::to_string(value));
+        }
+    }
+
+private:
+    void Begin(const char *name, const char *category);
+    void End();
+    void AddArg(const char *key, const std::string &value);
+
+    const char *name = nullptr; //Null when tracing was off at construction.
+    const char *category = nullptr;
+    int64_t start = 0; //Microseconds since StartTrace.
+    std::string args; //Already JSON: "key":"value",...
+};
@@ -0,0 +1,253 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/util.cpp
+// Purpose:     Small helpers shared by the GUI, the CLI and romper_core
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+    #include <Windows.h>
+#endif
+#ifdef __APPLE__
+    #include <mach-o/dyld.h>
+#endif
+
+#include "core/util.h"
+#include "core/profiles.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <filesystem>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+std::string getProfileDatabasePath(std::string &error)
+{
+    std::string databasePath;
+    std::string configDir;
+    try {
+        // Determine the correct configuration directory
+        #ifdef _WIN32
+            configDir = getenv("APPDATA");
+            configDir += "\\Romper\\";
+        #elif defined(__APPLE__)
+            // macOS: ~/Library/Application Support/Romper/
+            const char* homeEnv = std::getenv("HOME");
+            if (homeEnv && *homeEnv)
+            {
+                configDir = std::string(homeEnv) + "/Library/Application Support/Romper/";
+            }
+            else
+            {
+                // Fallback if HOME is not set (rare in normal user sessions)
+                configDir = "./Romper/";
+            }
+        #else
+            configDir = getenv("HOME");
+            configDir += "/.Romper/";
+        #endif
+
+        // Create the configuration directory if it does not exist
+        std::filesystem::create_directories(configDir);
+
+        // Build the full database path
+        databasePath = configDir + "profiles.romper";
+
+        // Check if the file exists, and create it if it does not
+        if (!std::filesystem::exists(databasePath)) {
+            SQLite::Database db(databasePath, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+            CreateProfileSchema(db);
+        }
+        else
+        {
+            SQLite::Database db(databasePath, SQLite::OPEN_READWRITE);
+            UpgradeProfileSchema(db);
+        }
+    } catch (const std::exception& e) {
+        error = e.what();
+        return "";
+    }
+
+    return databasePath;
+}
+
+std::string getGameDatabasePath()
+{
+#ifdef __APPLE__
+    // We'll compute our actual executable path via _NSGetExecutablePath().
+    // The typical layout is: /MyApp.app/Contents/MacOS/romper
+    uint32_t bufSize = 0;
+    _NSGetExecutablePath(nullptr, &bufSize);
+    std::vector<char> pathBuf(bufSize + 1, '\0');
+    _NSGetExecutablePath(pathBuf.data(), &bufSize);
+    std::filesystem::path exeDir = std::filesystem::canonical(pathBuf.data());
+    std::filesystem::path resourcesPath = exeDir.parent_path().parent_path() / "Resources";
+    return (resourcesPath / "romper.romper").string();
+#else
+    return GetExeDirectory() + "/romper_data/romper.romper";
+#endif
+}
+
+std::string ltrim(const std::string &s)
+{
+    size_t start = s.find_first_not_of(WHITESPACE);
+    return (start == std::string::npos) ? "" : s.substr(start);
+}
+std::string rtrim(const std::string &s)
+{
+    size_t end = s.find_last_not_of(WHITESPACE);
+    return (end == std::string::npos) ? "" : s.substr(0, end + 1);
+}
+
+std::string trim(const std::string &s)
+{
+    return rtrim(ltrim(s));
+}
+
+bool in_array(const std::string &needle, const std::vector<std::string> &haystack)
+{
+    int max = haystack.size();
+
+    if (max == 0)
+        return false;
+
+    for (int i = 0; i < max; i++)
+        if (haystack[i] == needle)
+            return true;
+    return false;
+}
+// https://en.cppreference.com/w/cpp/filesystem/exists
+bool dir_exists(std::string dir)
+{
+    std::filesystem::path filepath = dir;
+    return std::filesystem::is_directory(filepath.parent_path());
+}
+
+std::string GetExeDirectory()
+{
+#ifdef _WIN32
+    // Windows specific
+    wchar_t szPath[MAX_PATH];
+    GetModuleFileNameW(NULL, szPath, MAX_PATH);
+#else
+    // Linux specific
+    char szPath[PATH_MAX];
+    ssize_t count = readlink("/proc/self/exe", szPath, PATH_MAX);
+    if (count < 0 || count >= PATH_MAX)
+        return {}; // some error
+    szPath[count] = '\0';
+#endif
+    return std::filesystem::path{szPath}.parent_path().generic_string(); // to finish the folder path with (back)slash
+}
+
+std::string JsonString(const std::string &s)
+{
+    std::string out = "\"";
+    for (unsigned char c : s)
+    {
+        switch (c)
+        {
+        case '"':
+            out.append("\\\"");
+            break;
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        case '\r':
+            out.append("\\r");
+            break;
+        case '\t':
+            out.append("\\t");
+            break;
+        default:
+            if (c < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out.append(buf);
+            }
+            else
+            {
+                out.push_back((char)c);
+            }
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+std::u16string Utf16(const std::string &text)
+{
+    std::u16string out;
+    for (size_t i = 0; i < text.size();)
+    {
+        unsigned char c = text[i];
+        uint32_t code = c;
+        size_t length = c < 0x80 ? 1 : (c >> 5) == 6 ? 2 : (c >> 4) == 14 ? 3 : (c >> 3) == 30 ? 4 : 0;
+        if (length > 1 && i + length <= text.size())
+        {
+            code = c & (0xFF >> (length + 1));
+            for (size_t k = 1; k < length; k++)
+            {
+                code = (code << 6) | (text[i + k] & 0x3F);
+            }
+        }
+        else
+        {
+            length = 1;
+        }
+        i += length;
+        if (code >= 0x10000)
+        {
+            code -= 0x10000;
+            out.push_back((char16_t)(0xD800 + (code >> 10)));
+            out.push_back((char16_t)(0xDC00 + (code & 0x3FF)));
+        }
+        else
+        {
+            out.push_back((char16_t)code);
+        }
+    }
+    return out;
+}
+
+std::string Utf8(const std::u16string &text)
+{
+    std::string out;
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        uint32_t code = text[i];
+        if (code >= 0xD800 && code < 0xDC00 && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] < 0xE000)
+        {
+            code = 0x10000 + ((code - 0xD800) << 10) + (text[++i] - 0xDC00);
+        }
+        if (code < 0x80)
+        {
+            out += (char)code;
+        }
+        else if (code < 0x800)
+        {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += (char)(0xF0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3F));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+    }
+    return out;
+}
@@ -0,0 +1,47 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/util.h
+// Purpose:     Small helpers shared by the GUI, the CLI and romper_core
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <string>
+#include <vector>
+
+//Set default new line char for each OS.
+#ifdef _WIN32
+#define NEWLINE "\r\n"
+#else
+#define NEWLINE "\n"
+#endif
+
+//Set version
+const std::string VERSION = "2025-2-23";
+
+//Required for trim
+const std::string WHITESPACE = " \n\r\t\f\v";
+std::string rtrim(const std::string &s);
+std::string ltrim(const std::string &s);
+std::string trim(const std::string &s);
+std::string GetExeDirectory();
+
+/*The Profile DB should be in the user's folder. What should it's filename be? Create it if it doesn't exist. Returns "" and sets error on failure.*/
+std::string getProfileDatabasePath(std::string &error);
+
+/*Where the game DB ships. Next to the exe, or in the app bundle's Resources on macOS.*/
+std::string getGameDatabasePath();
+
+/*Check if a string is in an vector*/
+bool in_array(const std::string &needle, const std::vector<std::string> &haystack);
+
+/*Check if a folder exists*/
+bool dir_exists(std::string dir);
+
+/*Quote and escape a string for JSON output.*/
+std::string JsonString(const std::string &s);
+
+/*UTF-8 to UTF-16, e.g. for names in FAT and 7z. Bytes that aren't UTF-8 are taken as Latin-1.*/
+std::u16string Utf16(const std::string &text);
+
+/*UTF-16 back to UTF-8.*/
+std::string Utf8(const std::u16string &text);
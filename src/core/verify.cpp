@@ -0,0 +1,481 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/verify.cpp
+// Purpose:     Checks ROM zips and CHDs against the checksums in the game DB
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/verify.h"
+#include "core/checksum.h"
+#include "core/chd.h"
+#include "core/pack.h"
+#include "core/trace.h"
+#include "core/zipindex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+// wxBase's zip stream does the inflating for deep checks.
+#include <wx/wfstream.h>
+#include <wx/zipstrm.h>
+
+namespace
+{
+    std::string DeepVerify(const std::string &path, const std::vector<romChecksum> &roms)
+    {
+        TraceSpan span("deep verify", "verify");
+        std::unordered_map<std::string, const romChecksum *> byName;
+        for (const romChecksum &rom : roms)
+        {
+            if (!rom.nodump)
+            {
+                byName[rom.name] = &rom;
+            }
+        }
+        wxFFileInputStream file(path);
+        if (!file.IsOk())
+        {
+            return "Could not open " + path;
+        }
+        wxZipInputStream zip(file);
+        std::vector<char> buffer(1 << 20);
+        std::unique_ptr<wxZipEntry> entry;
+        while (entry.reset(zip.GetNextEntry()), entry)
+        {
+            auto rom = byName.find(entry->GetInternalName().ToStdString());
+            if (rom == byName.end())
+            {
+                continue;
+            }
+            bool wantSha1 = !rom->second->sha1.empty();
+            uint32_t crc = 0;
+            Sha1 sha1;
+            while (zip.Read(buffer.data(), buffer.size()).LastRead() > 0)
+            {
+                crc = Crc32(crc, buffer.data(), zip.LastRead());
+                if (wantSha1)
+                {
+                    sha1.Update(buffer.data(), zip.LastRead());
+                }
+            }
+            if (zip.GetLastError() == wxSTREAM_READ_ERROR)
+            {
+                return "Could not decompress " + rom->first;
+            }
+            if (crc != rom->second->crc)
+            {
+                return "Bad data in " + rom->first + ": CRC " + Crc32Hex(crc) + ", expected " + Crc32Hex(rom->second->crc);
+            }
+            if (wantSha1 && sha1.HexDigest() != rom->second->sha1)
+            {
+                return "Bad data in " + rom->first + ": SHA1 doesn't match";
+            }
+            byName.erase(rom);
+        }
+        if (!byName.empty())
+        {
+            return "Could not read " + byName.begin()->first;
+        }
+        return "";
+    }
+
+    /*
+    *Compare a set's members to a game's ROMs, for AuditZip and VerifySevenZip.
+    *next gives the name, size and CRC of each member in turn, and returns false after the last. Names ending in '/' are folders.
+    */
+    zipAudit AuditMembers(const std::string &path, const std::vector<romChecksum> &roms, const std::function<bool(std::string_view &name, uint64_t &size, uint32_t &crc)> &next)
+    {
+        zipAudit audit;
+        // Keyed by views of the ROM names, so the members' names are looked up without copying them.
+        std::unordered_map<std::string_view, const romChecksum *> expected;
+        for (const romChecksum &rom : roms)
+        {
+            expected[rom.name] = &rom;
+        }
+        audit.status = AUDIT_GOOD;
+        auto problem = [&](zipAuditStatus status, const std::string &detail)
+        {
+            if (status > audit.status)
+            {
+                audit.status = status;
+                audit.detail = detail;
+            }
+        };
+        std::string_view name;
+        uint64_t size;
+        uint32_t crc;
+        while (next(name, size, crc))
+        {
+            auto rom = expected.find(name);
+            if (rom == expected.end())
+            {
+                // Folder entries aren't files.
+                if (name.empty() || name.back() != '/')
+                {
+                    problem(AUDIT_EXTRA_FILES, "Extra file " + std::string(name) + " in " + path);
+                }
+                continue;
+            }
+            // A nodump ROM has nothing to compare against, but a member of that name isn't extra either.
+            if (rom->second->nodump)
+            {
+                expected.erase(rom);
+                continue;
+            }
+            if (size != rom->second->size)
+            {
+                problem(AUDIT_BAD_CRC, "Wrong size for " + rom->second->name + " in " + path + ": " + std::to_string(size) + ", expected " + std::to_string(rom->second->size));
+            }
+            else if (crc != rom->second->crc)
+            {
+                problem(AUDIT_BAD_CRC, "Bad CRC for " + rom->second->name + " in " + path + ": " + Crc32Hex(crc) + ", expected " + Crc32Hex(rom->second->crc));
+            }
+            expected.erase(rom);
+        }
+        for (const auto &rom : expected)
+        {
+            if (!rom.second->nodump)
+            {
+                problem(AUDIT_MISSING_ROM, "Missing " + std::string(rom.first) + " in " + path);
+                break;
+            }
+        }
+        return audit;
+    }
+
+    /*DeepVerify for a 7z: every ROM in it unpacked and its CRC32, and SHA1 if known, computed from the data.*/
+    std::string DeepVerifySevenZip(const std::string &path, const std::vector<sevenZipEntry> &entries, const std::vector<romChecksum> &roms)
+    {
+        TraceSpan span("deep verify 7z", "verify");
+        std::unordered_map<std::string, const romChecksum *> byName;
+        for (const romChecksum &rom : roms)
+        {
+            if (!rom.nodump)
+            {
+                byName[rom.name] = &rom;
+            }
+        }
+        std::vector<const romChecksum *> romOf(entries.size(), nullptr);
+        std::vector<uint32_t> crcs(entries.size(), 0);
+        std::vector<Sha1> sha1s(entries.size());
+        for (size_t e = 0; e < entries.size(); e++)
+        {
+            auto rom = byName.find(entries[e].name);
+            romOf[e] = entries[e].folder || rom == byName.end() ? nullptr : rom->second;
+        }
+        std::string error = ReadSevenZip(path, [&](size_t entry, const char *data, size_t length)
+                                         {
+            if (!romOf[entry])
+            {
+                return;
+            }
+            crcs[entry] = Crc32(crcs[entry], data, length);
+            if (!romOf[entry]->sha1.empty())
+            {
+                sha1s[entry].Update(data, length);
+            }
+        });
+        if (!error.empty())
+        {
+            return error;
+        }
+        for (size_t e = 0; e < entries.size(); e++)
+        {
+            const romChecksum *rom = romOf[e];
+            if (!rom)
+            {
+                continue;
+            }
+            if (crcs[e] != rom->crc)
+            {
+                return "Bad data in " + rom->name + ": CRC " + Crc32Hex(crcs[e]) + ", expected " + Crc32Hex(rom->crc) + " in " + path;
+            }
+            if (!rom->sha1.empty() && sha1s[e].HexDigest() != rom->sha1)
+            {
+                return "Bad data in " + rom->name + ": SHA1 doesn't match in " + path;
+            }
+        }
+        return "";
+    }
+}
+
+const char *AuditLabel(zipAuditStatus status)
+{
+    switch (status)
+    {
+    case AUDIT_GOOD:
+        return "Good";
+    case AUDIT_EXTRA_FILES:
+        return "Extra files";
+    case AUDIT_BAD_CRC:
+        return "Bad CRC";
+    case AUDIT_MISSING_ROM:
+        return "Missing ROM";
+    case AUDIT_UNREADABLE:
+        return "Unreadable";
+    default:
+        return "Unknown";
+    }
+}
+
+zipAudit AuditZip(const std::string &path, const std::vector<romChecksum> &roms)
+{
+    zipAudit audit;
+    ZipIndex index(path);
+    if (!index.Error().empty())
+    {
+        audit.status = AUDIT_UNREADABLE;
+        audit.detail = index.Error();
+        return audit;
+    }
+    if (roms.empty())
+    {
+        return audit;
+    }
+    zipEntry entry;
+    audit = AuditMembers(path, roms, [&](std::string_view &name, uint64_t &size, uint32_t &crc)
+                         {
+        if (!index.Next(entry))
+        {
+            return false;
+        }
+        name = entry.name;
+        size = entry.size;
+        crc = entry.crc;
+        return true; });
+    if (!index.Error().empty())
+    {
+        audit.status = AUDIT_UNREADABLE;
+        audit.detail = index.Error();
+    }
+    return audit;
+}
+
+std::string VerifyZip(const std::string &path, const std::vector<romChecksum> &roms, bool deep)
+{
+    TraceSpan span("VerifyZip", "verify");
+    zipAudit audit = AuditZip(path, roms);
+    if (audit.status > AUDIT_EXTRA_FILES)
+    {
+        return audit.detail;
+    }
+    if (deep)
+    {
+        std::string error = DeepVerify(path, roms);
+        if (!error.empty())
+        {
+            return error + " in " + path;
+        }
+    }
+    return "";
+}
+
+folderAudit AuditFolder(SQLite::Database &gameDB, const std::string &folder, int jobs, std::atomic<bool> &abort, const std::function<void(size_t done, size_t total)> &onProgress)
+{
+    TraceSpan span("AuditFolder", "verify");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    folderAudit result;
+    std::vector<std::string> games;
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(folder, ec), end; !ec && it != end; it.increment(ec))
+    {
+        const std::filesystem::path &path = it->path();
+        if (path.extension() == ".zip" && it->is_regular_file(ec))
+        {
+            games.push_back(path.stem().string());
+        }
+    }
+    std::sort(games.begin(), games.end());
+    span.Arg("zips", (int64_t)games.size());
+
+    // The same chunk size LoadGames uses, so each chunk is one query.
+    const size_t chunk = 500;
+    jobs = std::max(1, jobs);
+    for (size_t first = 0; first < games.size() && !abort; first += chunk)
+    {
+        std::vector<std::string> names(games.begin() + first, games.begin() + std::min(first + chunk, games.size()));
+        romChecksums checksums = LoadRomChecksums(gameDB, names);
+        std::vector<zipAudit> audits(names.size());
+        std::atomic<size_t> next(0);
+        auto worker = [&]()
+        {
+            size_t i;
+            while (!abort && (i = next++) < names.size())
+            {
+                auto roms = checksums.find(names[i]);
+                audits[i] = AuditZip(folder + "/" + names[i] + ".zip", roms == checksums.end() ? std::vector<romChecksum>() : roms->second);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int j = 1; j < std::min(jobs, (int)names.size()); j++)
+        {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (std::thread &t : workers)
+        {
+            t.join();
+        }
+        if (abort)
+        {
+            break;
+        }
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            result.counts[audits[i].status]++;
+            result.games[names[i]] = std::move(audits[i]);
+        }
+        if (onProgress)
+        {
+            onProgress(first + names.size(), games.size());
+        }
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+std::string VerifySevenZip(const std::string &path, const std::vector<romChecksum> &roms, bool deep)
+{
+    TraceSpan span("VerifySevenZip", "verify");
+    std::vector<sevenZipEntry> entries;
+    std::string error = ListSevenZip(path, entries);
+    if (!error.empty())
+    {
+        return error;
+    }
+    size_t e = 0;
+    zipAudit audit = AuditMembers(path, roms, [&](std::string_view &name, uint64_t &size, uint32_t &crc)
+                                  {
+        // Folders have no data to check.
+        while (e < entries.size() && entries[e].folder)
+        {
+            e++;
+        }
+        if (e == entries.size())
+        {
+            return false;
+        }
+        name = entries[e].name;
+        size = entries[e].size;
+        crc = entries[e].crc;
+        e++;
+        return true; });
+    if (audit.status > AUDIT_EXTRA_FILES)
+    {
+        return audit.detail;
+    }
+    return deep ? DeepVerifySevenZip(path, entries, roms) : "";
+}
+
+std::string VerifyFile(const runFile &file, const gameChecksums &checksums, bool deep, bool &checked, bool *hashed)
+{
+    checked = false;
+    if (hashed)
+    {
+        *hashed = true;
+    }
+    if (file.type == "chd")
+    {
+        auto disks = checksums.disks.find(file.game);
+        if (disks == checksums.disks.end())
+        {
+            return "";
+        }
+        std::string name = std::filesystem::path(file.target).stem().string();
+        for (const diskChecksum &disk : disks->second)
+        {
+            if (disk.name == name)
+            {
+                checked = true;
+                return VerifyChd(file.target, disk.sha1, deep, hashed);
+            }
+        }
+        return "";
+    }
+    auto roms = checksums.roms.find(file.game);
+    if (roms == checksums.roms.end())
+    {
+        return "";
+    }
+    checked = true;
+    if (file.type == "7z")
+    {
+        return VerifySevenZip(file.target, roms->second, deep);
+    }
+    return VerifyZip(file.target, roms->second, deep);
+}
+
+verifyResult VerifyFiles(const std::vector<runFile> &files, const gameChecksums &checksums, bool deep, int jobs, std::atomic<bool> &abort,
+                         const std::function<void(size_t index, const runFile &file, const std::string &error)> &onFile)
+{
+    TraceSpan span("VerifyFiles", "verify");
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    verifyResult result;
+    std::atomic<size_t> next(0);
+    std::mutex resultMutex;
+    auto worker = [&]()
+    {
+        size_t i;
+        while (!abort && (i = next++) < files.size())
+        {
+            const runFile &file = files[i];
+            std::string error;
+            bool checked = false;
+            bool hashed = true;
+            std::error_code ec;
+            uintmax_t size = std::filesystem::file_size(file.target, ec);
+            if (ec)
+            {
+                error = "Missing " + file.target;
+            }
+            else
+            {
+                error = VerifyFile(file, checksums, deep, checked, &hashed);
+            }
+            std::lock_guard<std::mutex> lock(resultMutex);
+            if (!ec)
+            {
+                result.bytes += (int64_t)size;
+            }
+            if (!error.empty())
+            {
+                result.bad++;
+                result.errors.push_back(error);
+            }
+            else if (!checked)
+            {
+                result.unchecked++;
+            }
+            else if (deep && !hashed)
+            {
+                result.readable++;
+            }
+            else
+            {
+                result.good++;
+            }
+            if (onFile)
+            {
+                onFile(i, file, error);
+            }
+        }
+    };
+    jobs = std::max(1, std::min(jobs, (int)files.size()));
+    std::vector<std::thread> workers;
+    for (int j = 1; j < jobs; j++)
+    {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (std::thread &t : workers)
+    {
+        t.join();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
@@ -0,0 +1,94 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/verify.h
+// Purpose:     Checks ROM zips and CHDs against the checksums in the game DB
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include "core/catalog.h"
+#include "core/run.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*How a game's zip compares to its ROMs in the game DB. Worse problems have higher values.*/
+enum zipAuditStatus
+{
+    AUDIT_NO_CHECKSUMS, //The game DB has no ROMs for this game, so there is nothing to compare.
+    AUDIT_GOOD,
+    AUDIT_EXTRA_FILES, //Every ROM is right, but the zip also has files the game doesn't use.
+    AUDIT_BAD_CRC, //A ROM has the wrong size or CRC.
+    AUDIT_MISSING_ROM, //A ROM isn't in the zip.
+    AUDIT_UNREADABLE, //Not a zip, or truncated.
+    AUDIT_STATUSES
+};
+
+struct zipAudit
+{
+    zipAuditStatus status = AUDIT_NO_CHECKSUMS;
+    std::string detail; //The first problem of that status. "" if good.
+};
+
+/*What the grid's Audit column shows for a status.*/
+const char *AuditLabel(zipAuditStatus status);
+
+/*Compare a zip's directory to a game's ROMs. Only the directory is read, through a ZipIndex.*/
+zipAudit AuditZip(const std::string &path, const std::vector<romChecksum> &roms);
+
+struct folderAudit
+{
+    std::unordered_map<std::string, zipAudit> games; //Game name (the zip's name without .zip) -> its audit.
+    int counts[AUDIT_STATUSES] = {}; //Games per status.
+    double seconds = 0;
+};
+
+/*
+*Audit every zip directly in folder against the game DB, on up to jobs threads until done or abort is set.
+*Checksums are loaded a chunk of zips at a time, so memory stays flat however big the library is.
+*onProgress is called from this thread after each chunk.
+*/
+folderAudit AuditFolder(SQLite::Database &gameDB, const std::string &folder, int jobs, std::atomic<bool> &abort, const std::function<void(size_t done, size_t total)> &onProgress);
+
+/*
+*Check a game's zip against its ROMs: each one must be in the zip with the right size and CRC. Extra files are fine.
+*The sizes and CRCs come from the zip's directory, so this reads a few KB per zip.
+*If deep, every ROM is also decompressed and its CRC32, and SHA1 when the game DB has one, computed from the data.
+*Returns "" if the zip is good, else what is wrong with it.
+*/
+std::string VerifyZip(const std::string &path, const std::vector<romChecksum> &roms, bool deep);
+
+/*
+*VerifyZip for a 7z set, from its header. A deep check unpacks it. See ReadSevenZip.
+*Returns "" if the 7z is good, else what is wrong with it.
+*/
+std::string VerifySevenZip(const std::string &path, const std::vector<romChecksum> &roms, bool deep);
+
+/*
+*Check a run file's target against the game DB: VerifyZip for roms, VerifySevenZip for 7z sets, VerifyChd for disks. deep is their deep/full check.
+*checked is set false if the game DB has nothing for the file, in which case only its presence is checked.
+*hashed (if given) is set false if deep only read the file through without hashing its data: a compressed CHD.
+*Returns "" if the file is good, else what is wrong with it.
+*/
+std::string VerifyFile(const runFile &file, const gameChecksums &checksums, bool deep, bool &checked, bool *hashed = nullptr);
+
+struct verifyResult
+{
+    int good = 0; //Files that matched.
+    int readable = 0; //Deep only: compressed CHDs whose header and metadata matched and which read through, but whose data couldn't be hashed. Not in good.
+    int bad = 0; //Files that are missing, unreadable or don't match.
+    int unchecked = 0; //Files the game DB has no checksums for.
+    int64_t bytes = 0; //Size of the files checked.
+    double seconds = 0;
+    std::vector<std::string> errors; //One line per bad file.
+};
+
+/*
+*Verify the targets of a run's files on up to jobs threads until done or abort is set.
+*onFile is called after each file, one call at a time, with "" or the problem.
+*/
+verifyResult VerifyFiles(const std::vector<runFile> &files, const gameChecksums &checksums, bool deep, int jobs, std::atomic<bool> &abort,
+                         const std::function<void(size_t index, const runFile &file, const std::string &error)> &onFile);
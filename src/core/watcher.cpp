@@ -0,0 +1,383 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/watcher.cpp
+// Purpose:     Watches source folders so the inventory stays current between scans.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#include "core/watcher.h"
+#include "core/trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::string JoinRelative(const std::string &dir, const std::string &name)
+    {
+        return dir.empty() ? name : dir + "/" + name;
+    }
+
+    std::string FullPath(const std::string &root, const std::string &relative)
+    {
+        return relative.empty() ? root : root + "/" + relative;
+    }
+
+    bool IsUnder(const std::string &path, const std::string &dir)
+    {
+        return dir.empty() || path == dir || (path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 && path[dir.size()] == '/');
+    }
+
+#ifdef __linux__
+    const uint32_t WATCH_MASK = IN_CREATE | IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+#endif
+}
+
+SourceWatcher::SourceWatcher(const std::vector<std::string> &roots, changeCallback onChange, int pollMs, int debounceMs)
+    : roots(roots), onChange(onChange), pollMs(std::max(100, pollMs)), debounceMs(std::max(0, debounceMs))
+{
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0 && pipe2(stopPipe, O_CLOEXEC) != 0)
+    {
+        close(inotifyFd);
+        inotifyFd = -1;
+    }
+#endif
+    thread = std::thread(&SourceWatcher::Run, this);
+}
+
+SourceWatcher::~SourceWatcher()
+{
+    Stop();
+#ifdef __linux__
+    for (int fd : {inotifyFd, stopPipe[0], stopPipe[1]})
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+    }
+#endif
+}
+
+void SourceWatcher::Stop()
+{
+    if (stopping.exchange(true))
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        wake.notify_all();
+    }
+#ifdef __linux__
+    if (stopPipe[1] >= 0)
+    {
+        char c = 0;
+        (void)!write(stopPipe[1], &c, 1);
+    }
+#endif
+    if (thread.joinable())
+    {
+        thread.join();
+    }
+}
+
+std::vector<std::string> SourceWatcher::PolledRoots()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string> result;
+    for (const auto &root : polled)
+    {
+        result.push_back(root.first);
+    }
+    return result;
+}
+
+void SourceWatcher::Run()
+{
+    TraceSpan setupSpan("SourceWatcher setup", "inventory");
+    for (const std::string &root : roots)
+    {
+        if (stopping)
+        {
+            return;
+        }
+#ifdef __linux__
+        if (inotifyFd >= 0 && AddWatches(root, ""))
+        {
+            continue;
+        }
+        RemoveWatches(root, "");
+#endif
+        // No inotify, or the tree has more folders than the watch limit allows.
+        pollState state;
+        std::set<std::string> ignored;
+        Poll(root, state, "", true, ignored);
+        std::lock_guard<std::mutex> lock(mutex);
+        polled[root] = std::move(state);
+    }
+    setupSpan.Finish();
+
+    using clock = std::chrono::steady_clock;
+    std::map<std::string, std::set<std::string>> pending; //Root -> changed relative paths not yet reported.
+    clock::time_point lastEvent = clock::now();
+    clock::time_point nextPoll = clock::now() + std::chrono::milliseconds(pollMs);
+    while (!stopping)
+    {
+        clock::time_point now = clock::now();
+        clock::time_point until = pending.empty() ? now + std::chrono::milliseconds(pollMs) : lastEvent + std::chrono::milliseconds(debounceMs);
+        bool polling;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            polling = !polled.empty();
+        }
+        if (polling)
+        {
+            until = std::min(until, nextPoll);
+        }
+        int timeout = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(until - now).count());
+
+        size_t before = 0;
+        for (const auto &root : pending)
+        {
+            before += root.second.size();
+        }
+#ifdef __linux__
+        if (inotifyFd >= 0)
+        {
+            struct pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+            if (poll(fds, 2, timeout) > 0 && (fds[0].revents & POLLIN))
+            {
+                ReadEvents(pending);
+            }
+        }
+        else
+#endif
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_for(lock, std::chrono::milliseconds(timeout), [&]() { return stopping.load(); });
+        }
+        if (stopping)
+        {
+            return;
+        }
+
+        now = clock::now();
+        if (polling && now >= nextPoll)
+        {
+            TraceSpan pollSpan("SourceWatcher poll", "inventory");
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &root : polled)
+            {
+                Poll(root.first, root.second, "", false, pending[root.first]);
+            }
+            nextPoll = now + std::chrono::milliseconds(pollMs);
+        }
+
+        size_t after = 0;
+        for (auto it = pending.begin(); it != pending.end();)
+        {
+            it = it->second.empty() ? pending.erase(it) : std::next(it);
+        }
+        for (const auto &root : pending)
+        {
+            after += root.second.size();
+        }
+        if (after != before)
+        {
+            lastEvent = now;
+        }
+        if (!pending.empty() && now - lastEvent >= std::chrono::milliseconds(debounceMs))
+        {
+            for (const auto &root : pending)
+            {
+                std::vector<std::string> paths;
+                // "" covers everything, and a folder covers what is under it.
+                for (const std::string &path : root.second)
+                {
+                    if (paths.empty() || !IsUnder(path, paths.back()))
+                    {
+                        paths.push_back(path);
+                    }
+                }
+                onChange(root.first, paths);
+            }
+            pending.clear();
+        }
+    }
+}
+
+void SourceWatcher::Poll(const std::string &root, pollState &state, const std::string &dir, bool first, std::set<std::string> &changed)
+{
+    std::error_code ec;
+    std::string path = FullPath(root, dir);
+    auto modified = std::filesystem::last_write_time(path, ec);
+    if (ec)
+    {
+        return;
+    }
+    int64_t mtime = modified.time_since_epoch().count();
+    auto known = state.find(dir);
+    if (known == state.end() || known->second.mtime != mtime)
+    {
+        pollEntry entry;
+        entry.mtime = mtime;
+        for (std::filesystem::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec))
+        {
+            std::error_code entryEc;
+            entry.entries[it->path().filename().string()] = it->is_directory(entryEc) && !it->is_symlink(entryEc);
+        }
+        if (known != state.end())
+        {
+            for (const auto &name : known->second.entries)
+            {
+                auto now = entry.entries.find(name.first);
+                if (now == entry.entries.end() || now->second != name.second)
+                {
+                    std::string gone = JoinRelative(dir, name.first);
+                    changed.insert(gone);
+                    if (name.second)
+                    {
+                        for (auto it = state.begin(); it != state.end();)
+                        {
+                            it = IsUnder(it->first, gone) ? state.erase(it) : std::next(it);
+                        }
+                    }
+                }
+            }
+            for (const auto &name : entry.entries)
+            {
+                if (known->second.entries.count(name.first) == 0)
+                {
+                    changed.insert(JoinRelative(dir, name.first));
+                }
+            }
+        }
+        else if (!first && !dir.empty())
+        {
+            changed.insert(dir);
+        }
+        known = state.insert_or_assign(dir, std::move(entry)).first;
+    }
+    std::vector<std::string> children;
+    for (const auto &name : known->second.entries)
+    {
+        if (name.second)
+        {
+            children.push_back(JoinRelative(dir, name.first));
+        }
+    }
+    for (const std::string &child : children)
+    {
+        Poll(root, state, child, first, changed);
+    }
+}
+
+#ifdef __linux__
+bool SourceWatcher::AddWatches(const std::string &root, const std::string &dir)
+{
+    int wd = inotify_add_watch(inotifyFd, FullPath(root, dir).c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+        return false;
+    }
+    watches[wd] = {root, dir};
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it(FullPath(root, dir), ec), end; !ec && it != end; it.increment(ec))
+    {
+        std::error_code entryEc;
+        if (it->is_directory(entryEc) && !it->is_symlink(entryEc) && !AddWatches(root, JoinRelative(dir, it->path().filename().string())))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SourceWatcher::RemoveWatches(const std::string &root, const std::string &dir)
+{
+    for (auto it = watches.begin(); it != watches.end();)
+    {
+        if (it->second.first == root && IsUnder(it->second.second, dir))
+        {
+            inotify_rm_watch(inotifyFd, it->first);
+            it = watches.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void SourceWatcher::ReadEvents(std::map<std::string, std::set<std::string>> &pending)
+{
+    alignas(struct inotify_event) char buffer[16384];
+    ssize_t length;
+    while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0)
+    {
+        for (char *p = buffer; p < buffer + length; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len)
+        {
+            const struct inotify_event *event = (const struct inotify_event *)p;
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // Events were lost, so anything may have changed.
+                for (const auto &watch : watches)
+                {
+                    pending[watch.second.first].insert("");
+                }
+                continue;
+            }
+            auto watch = watches.find(event->wd);
+            if (watch == watches.end())
+            {
+                continue;
+            }
+            if (event->mask & IN_IGNORED)
+            {
+                watches.erase(watch);
+                continue;
+            }
+            if (event->len == 0)
+            {
+                continue;
+            }
+            std::string root = watch->second.first;
+            std::string path = JoinRelative(watch->second.second, event->name);
+            if (event->mask & IN_ISDIR)
+            {
+                if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+                {
+                    RemoveWatches(root, path);
+                }
+                else if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !AddWatches(root, path))
+                {
+                    // Out of watches. Poll this tree from now on.
+                    RemoveWatches(root, "");
+                    pollState state;
+                    std::set<std::string> ignored;
+                    Poll(root, state, "", true, ignored);
+                    std::lock_guard<std::mutex> lock(mutex);
+                    polled[root] = std::move(state);
+                    pending[root].insert("");
+                    continue;
+                }
+            }
+            pending[root].insert(path);
+        }
+    }
+}
+#endif
@@ -0,0 +1,73 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/watcher.h
+// Purpose:     Watches source folders so the inventory stays current between scans.
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+*Watches folders on a background thread and reports which paths under them changed.
+*On Linux this uses inotify. If inotify can't watch a whole folder tree (e.g. it hit max_user_watches),
+*or on other platforms, that tree is polled instead: folder mtimes every pollMs, listing only folders that changed.
+*/
+class SourceWatcher
+{
+public:
+    /*
+    *Called on the watcher thread with paths relative to root. A path may be a file or a folder, and may no longer exist.
+    *"" means anything under root may have changed. Events are batched until debounceMs pass without a new one.
+    */
+    using changeCallback = std::function<void(const std::string &root, const std::vector<std::string> &relativePaths)>;
+
+    SourceWatcher(const std::vector<std::string> &roots, changeCallback onChange, int pollMs = 5000, int debounceMs = 500);
+    ~SourceWatcher();
+    SourceWatcher(const SourceWatcher &) = delete;
+    SourceWatcher &operator=(const SourceWatcher &) = delete;
+
+    /*Stop watching and join the thread. Called by the destructor. The callback is not called after this returns.*/
+    void Stop();
+
+    /*The roots that are polled rather than watched.*/
+    std::vector<std::string> PolledRoots();
+
+private:
+    struct pollEntry //A listed folder while polling.
+    {
+        int64_t mtime = 0;
+        std::map<std::string, bool> entries; //Name -> is a folder.
+    };
+    using pollState = std::map<std::string, pollEntry>; //Relative folder -> what it held when last listed.
+
+    void Run();
+    void Poll(const std::string &root, pollState &state, const std::string &dir, bool first, std::set<std::string> &changed);
+#ifdef __linux__
+    bool AddWatches(const std::string &root, const std::string &dir);
+    void RemoveWatches(const std::string &root, const std::string &dir);
+    void ReadEvents(std::map<std::string, std::set<std::string>> &pending);
+
+    int inotifyFd = -1;
+    int stopPipe[2] = {-1, -1};
+    std::map<int, std::pair<std::string, std::string>> watches; //Watch descriptor -> root and relative folder.
+#endif
+
+    std::vector<std::string> roots;
+    changeCallback onChange;
+    int pollMs;
+    int debounceMs;
+    std::mutex mutex; //Guards polled and wakes Stop.
+    std::condition_variable wake;
+    std::map<std::string, pollState> polled; //Roots that fell back to polling.
+    std::atomic<bool> stopping{false};
+    std::thread thread;
+};
@@ -0,0 +1,231 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/zipindex.cpp
+// Purpose:     Reads a zip's central directory in place from a memory map
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+
+#ifdef _WIN32
+    #include <Windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include "core/zipindex.h"
+#include "core/trace.h"
+
+#include <algorithm>
+
+namespace
+{
+    uint16_t Get16(const unsigned char *p)
+    {
+        return (uint16_t)(p[0] | p[1] << 8);
+    }
+
+    uint32_t Get32(const unsigned char *p)
+    {
+        return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    uint64_t Get64(const unsigned char *p)
+    {
+        return (uint64_t)Get32(p) | (uint64_t)Get32(p + 4) << 32;
+    }
+}
+
+ZipIndex::ZipIndex(const std::string &path) : path(path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        error = "Could not open " + path;
+        return;
+    }
+    LARGE_INTEGER size;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        length = (uint64_t)size.QuadPart;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            data = (const unsigned char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        error = "Could not open " + path;
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        length = (uint64_t)st.st_size;
+        void *map = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            // Only the end of the file is read. Read-ahead would pull in compressed data nobody looks at.
+            madvise(map, length, MADV_RANDOM);
+            data = (const unsigned char *)map;
+        }
+    }
+    close(fd);
+#endif
+    if (!data)
+    {
+        error = length == 0 ? "Not a zip file: " + path : "Could not map " + path;
+        return;
+    }
+    Parse();
+}
+
+ZipIndex::~ZipIndex()
+{
+#ifdef _WIN32
+    if (data)
+    {
+        UnmapViewOfFile(data);
+    }
+    if (mapping)
+    {
+        CloseHandle(mapping);
+    }
+#else
+    if (data)
+    {
+        munmap((void *)data, length);
+    }
+#endif
+}
+
+void ZipIndex::Parse()
+{
+    TraceSpan span("ZipIndex", "verify");
+    if (length < 22)
+    {
+        error = "Not a zip file: " + path;
+        return;
+    }
+    // The end of central directory record is in the last 22 bytes, plus up to 64KB of comment.
+    uint64_t earliest = length - std::min<uint64_t>(length, 22 + 65535);
+    uint64_t eocd = length - 22;
+    while (Get32(data + eocd) != 0x06054b50)
+    {
+        if (eocd == earliest)
+        {
+            error = "No zip directory (truncated?): " + path;
+            return;
+        }
+        eocd--;
+    }
+    entries = Get16(data + eocd + 10);
+    uint64_t directorySize = Get32(data + eocd + 12);
+    directoryOffset = Get32(data + eocd + 16);
+    if ((entries == 0xFFFF || directorySize == 0xFFFFFFFF || directoryOffset == 0xFFFFFFFF) && eocd >= 20 && Get32(data + eocd - 20) == 0x07064b50)
+    {
+        uint64_t record = Get64(data + eocd - 20 + 8);
+        if (record + 56 <= eocd && Get32(data + record) == 0x06064b50)
+        {
+            entries = Get64(data + record + 32);
+            directorySize = Get64(data + record + 40);
+            directoryOffset = Get64(data + record + 48);
+        }
+    }
+    if (directoryOffset > eocd || directorySize > eocd - directoryOffset)
+    {
+        error = "Zip directory is past the end of the file (truncated?): " + path;
+        return;
+    }
+    directoryEnd = directoryOffset + directorySize;
+    position = directoryOffset;
+}
+
+bool ZipIndex::Next(zipEntry &entry)
+{
+    if (!error.empty() || read >= entries)
+    {
+        return false;
+    }
+    if (position + 46 > directoryEnd || Get32(data + position) != 0x02014b50)
+    {
+        error = "Corrupt zip directory: " + path;
+        return false;
+    }
+    const unsigned char *record = data + position;
+    size_t nameLength = Get16(record + 28);
+    size_t extraLength = Get16(record + 30);
+    size_t commentLength = Get16(record + 32);
+    if (position + 46 + nameLength + extraLength + commentLength > directoryEnd)
+    {
+        error = "Corrupt zip directory: " + path;
+        return false;
+    }
+    entry.flags = Get16(record + 8);
+    entry.method = Get16(record + 10);
+    entry.crc = Get32(record + 16);
+    entry.compressedSize = Get32(record + 20);
+    entry.size = Get32(record + 24);
+    entry.offset = Get32(record + 42);
+    entry.name = std::string_view((const char *)record + 46, nameLength);
+    // Zip64 sizes and offset live in extra field 1, in this order, for each value that is 0xFFFFFFFF.
+    const unsigned char *extra = record + 46 + nameLength;
+    for (size_t e = 0; e + 4 <= extraLength;)
+    {
+        uint16_t id = Get16(extra + e);
+        size_t fieldEnd = std::min(e + 4 + Get16(extra + e + 2), extraLength);
+        if (id == 1)
+        {
+            size_t field = e + 4;
+            for (uint64_t *value : {&entry.size, &entry.compressedSize, &entry.offset})
+            {
+                if (*value == 0xFFFFFFFF && field + 8 <= fieldEnd)
+                {
+                    *value = Get64(extra + field);
+                    field += 8;
+                }
+            }
+        }
+        e = fieldEnd;
+    }
+    if (entry.offset > directoryOffset || entry.compressedSize > directoryOffset - entry.offset)
+    {
+        error = "Zip member past the end of the data (truncated?): " + std::string(entry.name);
+        return false;
+    }
+    position += 46 + nameLength + extraLength + commentLength;
+    read++;
+    return true;
+}
+
+const unsigned char *ZipIndex::Data(const zipEntry &entry)
+{
+    if (!error.empty())
+    {
+        return nullptr;
+    }
+    if (entry.offset + 30 > directoryOffset || Get32(data + entry.offset) != 0x04034b50)
+    {
+        error = "Corrupt zip member: " + std::string(entry.name);
+        return nullptr;
+    }
+    // The local header's name and extra field can differ from the directory's, so its own lengths are used.
+    uint64_t start = entry.offset + 30 + Get16(data + entry.offset + 26) + Get16(data + entry.offset + 28);
+    if (start > directoryOffset || entry.compressedSize > directoryOffset - start)
+    {
+        error = "Zip member past the end of the data (truncated?): " + std::string(entry.name);
+        return nullptr;
+    }
+#ifndef _WIN32
+    // The map was opened for random access. This member is about to be read through, so ask for it ahead.
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t first = start / page * page;
+    madvise((void *)(data + first), start + entry.compressedSize - first, MADV_WILLNEED);
+#endif
+    return data + start;
+}
@@ -0,0 +1,67 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:        core/zipindex.h
+// Purpose:     Reads a zip's central directory in place from a memory map
+// Licence:     LGPL
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*One member of a zip, as its central directory lists it. name points into the ZipIndex's map and lives as long as it does.*/
+struct zipEntry
+{
+    std::string_view name;
+    uint64_t size = 0; //Uncompressed.
+    uint64_t compressedSize = 0;
+    uint32_t crc = 0;
+    uint16_t method = 0; //0 is stored, 8 is deflate.
+    uint16_t flags = 0; //General purpose bits. Bit 0 is encryption.
+    uint64_t offset = 0; //Where the member's local header starts.
+};
+
+/*
+*A zip's central directory, read straight out of a read-only memory map of the file. Zip64 is understood.
+*Only the pages holding the end records and the directory are touched, and nothing is decompressed or copied,
+*so listing thousands of zips costs a few KB of page cache each.
+*/
+class ZipIndex
+{
+public:
+    explicit ZipIndex(const std::string &path);
+    ~ZipIndex();
+    ZipIndex(const ZipIndex &) = delete;
+    ZipIndex &operator=(const ZipIndex &) = delete;
+
+    /*"" if the zip's directory was found, else why not. A truncated file fails here, since the directory is the last thing written.*/
+    const std::string &Error() const { return error; }
+
+    /*Members the directory claims to have.*/
+    uint64_t Count() const { return entries; }
+
+    /*The next member, in directory order. False at the end, or if the entry is corrupt, in which case Error says so.*/
+    bool Next(zipEntry &entry);
+
+    /*
+    *Where an entry's compressed data starts in the map, found through its local header. compressedSize bytes of it are valid.
+    *nullptr if the local header is corrupt, in which case Error says so.
+    */
+    const unsigned char *Data(const zipEntry &entry);
+
+private:
+    void Parse();
+
+    std::string path;
+    std::string error;
+    const unsigned char *data = nullptr; //The whole file, mapped read-only.
+    uint64_t length = 0;
+#ifdef _WIN32
+    void *mapping = nullptr;
+#endif
+    uint64_t entries = 0;
+    uint64_t directoryOffset = 0;
+    uint64_t directoryEnd = 0;
+    uint64_t position = 0; //Of the next directory entry.
+    uint64_t read = 0; //Entries returned by Next.
+};
@@ -6,24 +6,19 @@
 // Licence:     LGPL
 /////////////////////////////////////////////////////////////////////////////
 
-#ifdef _WIN32
-    #include <Windows.h>
-#endif
-#ifdef __APPLE__
-    #include <mach-o/dyld.h>
-    #include <stdexcept>
-#endif
-
 #include <iostream>
-#include <sys/stat.h>
 #include <string>
 //#include <regex>
 #include <algorithm>
 #include <chrono>
-#include <unistd.h>
+#include <cstdlib>
 #include <map>
+#include <memory>
+#include <unordered_set>
 #include <vector>
-#include <filesystem>
+#include <atomic>
+#include <thread>
+#include <mutex>
 
 // Precompiled header support for wxWidgets
 #ifdef WX_PRECOMP
@@ -37,6 +32,8 @@
 #include <wx/stattext.h>
 #include <wx/button.h>
 #include <wx/choice.h>
+#include <wx/choicdlg.h>
+#include <wx/numdlg.h>
 #include <wx/menu.h>
 #include <wx/menuitem.h>
 #include <wx/filefn.h>
@@ -46,21 +43,31 @@
 #include <wx/aui/aui.h>
 #include <wx/event.h>
 #include <wx/progdlg.h>
+#include <wx/listctrl.h>
+#include <wx/datetime.h>
 #include <wx/webrequest.h>
 #include <wx/wfstream.h>
 
 #include <SQLiteCpp/SQLiteCpp.h>
 
-//Set version
-const std::string VERSION = "2025-2-23";
-
-//Set default new line char for each OS.
-#ifdef _WIN32
-#define NEWLINE "\r\n"
-#else
-#define NEWLINE "\n"
-#endif
-namespace fs = std::filesystem;
+#include "cli.h"
+#include "core/budget.h"
+#include "core/cache.h"
+#include "core/catalog.h"
+#include "core/checksum.h"
+#include "core/download.h"
+#include "core/fatimage.h"
+#include "core/history.h"
+#include "core/inventory.h"
+#include "core/pack.h"
+#include "core/plan.h"
+#include "core/profiles.h"
+#include "core/run.h"
+#include "core/throttle.h"
+#include "core/trace.h"
+#include "core/util.h"
+#include "core/verify.h"
+#include "core/watcher.h"
 
 #ifdef SQLITECPP_ENABLE_ASSERT_HANDLER // Do we need all this? Just copied from SQLiteCPP example...
 namespace SQLite
@@ -83,21 +90,19 @@ namespace SQLite
 #define romperNewProfile 3
 #define romperSearchOptions 4
 
-//Required for trim
-const std::string WHITESPACE = " \n\r\t\f\v";
-std::string rtrim(const std::string &s);
-std::string ltrim(const std::string &s);
-std::string trim(const std::string &s);
-std::string GetExeDirectory();
+//Set during static initialization, so startup times include wx's own startup.
+const std::chrono::steady_clock::time_point processStart = std::chrono::steady_clock::now();
 
-/*The Profile DB should be in the user's folder. What should it's filename be? Create it if it doesn't exist.*/
-std::string getProfileDatabasePath();
-
-/*Check if a string is in an vector*/
-bool in_array(const std::string &needle, const std::vector<std::string> &haystack);
+long long MsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
 
-/*Check if a folder exists*/
-bool dir_exists(std::string dir);
+//What the grid's Have column shows.
+const char *PresenceLabel(gamePresence presence)
+{
+    return presence == PRESENCE_PRESENT ? "Yes" : presence == PRESENCE_PARTIAL ? "Partial" : "No";
+}
 
 class MyApp : public wxApp
 {
@@ -116,6 +121,8 @@ public:
     *This also orders, and filters the grid.
     */
     void BuildGrid(const std::string &orderDirection, const std::string &orderBy, const std::string &searchField, const std::string &searchValue, int page, const std::string limit);
+    /*The search and the Select menu's choices, as BuildGrid and OnBuildBudgetProfile use them.*/
+    searchFilter CurrentFilter(const std::string &searchField, const std::string &searchValue);
     
     /*A simple way to display string messages.*/
     void DisplayMessage(std::string Message);
@@ -123,17 +130,10 @@ public:
     /*Change the book to a different page. Use the constants define above.*/
     void ChangeMainBookPage(int page);
 
-private:
-    struct profile //The profile data for each profile. profile_map is a map of these.
-    {
-        std::string name; //Name of the profile
-        int online; //If 1, then download roms. Else, use local files.
-        std::string romSource; //If local files, this is the folder with all the .zip files
-        std::string chdSource; //If local files, this is the folder with all the chd folders.
-        std::string romTarget; //Where the rom zips are copied/downloaded.
-        std::string chdTarget; //Where the CHD folders are copied/downloaded.
-    };
+    /*Add the phases timed outside the frame: before goes ahead of the frame's own, after behind them. Returns every phase, in order.*/
+    const std::vector<std::pair<std::string, long long>> &AddStartupTimes(const std::vector<std::pair<std::string, long long>> &before, const std::vector<std::pair<std::string, long long>> &after);
 
+private:
     std::map<std::string, profile> profile_map; //Populated everytime profiles are loaded. Updated when profiles are changed.
     
     struct romperBook //Sometimes we need to know the previous book page. So we use this struct for the simplebook.
@@ -158,20 +158,6 @@ private:
         wxGrid *Grid; //the actual grid
     };
 
-    struct gameMap
-    {
-        std::string name; //name of the game
-        std::string disk; //name of the game's disk. If blank, no disk
-    };
-
-    enum //required for downloading roms.
-    {
-        DOWNLOAD_STATE_IDLE = 0,
-        DOWNLOAD_STATE_BUSY,
-        DOWNLOAD_STATE_DONE_OK,
-        DOWNLOAD_STATE_DONE_ERROR,
-    };
-
     //std::string exePath; //DELETE!
     wxPanel *panel;     //The main panel/window
     wxPanel *gamePanel; //The Game Grid panel on the grid book page.
@@ -183,8 +169,8 @@ private:
     controlChoice *profileChoice; //The choice box to select which profile. On change, the profile loads and populates the grid.
     wxChoice *searchBy; //The choice box to select which field to search by. Name, Description, Date, etc.
     wxChoice *perPage; //How many results per page? 50, 100(default), 500, 1000(not recommended)
-    wxBoxSizer *vSizerEditProfile; //Edit Profile panel's sizer.
-    wxBoxSizer *vSizerNewProfile; //New Profile panel's sizer.
+    wxBoxSizer *vSizerEditProfile = nullptr; //Edit Profile panel's sizer. Null until BuildEditProfilePanel.
+    wxBoxSizer *vSizerNewProfile = nullptr; //New Profile panel's sizer. Null until BuildNewProfilePanel.
     wxBoxSizer *hSizerRunButtons; //Sizer to hold the run button. There used to be more buttons there. Is hidden when run shouldn't be available.
     wxBoxSizer *mainSizer; //Panel's main sizer. 
     wxBoxSizer *vSizer; //The main vertical sizer.
@@ -195,6 +181,12 @@ private:
     wxBoxSizer *hSizerSearch;  //In vSizerGameGrid
     wxFlexGridSizer *gridSizerEditProfile; //Sizer for edit profile labels, text input, buttons
     wxMenuItem *menuScreenless; //Menu checkbox for deselect screenless games. Search must be clicked after it changes for the grid to update.
+    wxMenuItem *menuOnlyHave; //Menu checkbox to only show games whose files were all found by the last scan. Local profiles only.
+    wxMenuItem *menuPackSevenZip; //Menu checkbox to write rom zips as 7z sets on runs and verify them as such. Local profiles only. See PackFiles.
+    std::string rateSchedule; //File > Transfer Rate: the cap runs keep to, as ParseRateSchedule takes it. Starts as ROMPER_RATE.
+    inventorySet inventory; //The selected profile's source folders as of the last scan. Unscanned for online profiles.
+    std::unique_ptr<SourceWatcher> watcher; //Keeps inventory current while a scanned local profile is selected.
+    std::unordered_map<std::string, zipAudit> audits; //The selected profile's rom zips as of the last audit. Empty until File > Audit ROM Zips.
     wxStaticText *totalGamesLabel; //How many games were found in the search. updated each search
     wxButton *nextResults; //Click to go to update the grid with the next page results
     wxButton *prevResults; //Click to go to update the grid with the prev page results
@@ -203,13 +195,14 @@ private:
     wxButton *newProfileButton; //Click to change to the new profile page.
     wxButton *searchButton; //Click to search and populate the grid.
     wxButton *resetSearch; //Reset the search to its default params.
-    wxStatusBar *statusBar; //Status bar. Used to show how long each search took. I should add that back.
+    wxStatusBar *statusBar; //Status bar. Shows the result count and how long each search took.
     //wxToolBar *toolbar; //Can be deleted?
     wxMenuBar *menubar; //Menu bar for file, select, about etc.
     wxMenu *menuFile; //File menu drop down
     wxMenu *menuSelect; //Select menu drop down
     wxTextCtrl *searchInput; //Text box for search.
     wxCheckBox *newProfileOnline; //Create new profile: Download Roms checkbox. If checked, download roms. If not, local files.
+    wxTextCtrl *newProfileBaseUrl; //Create new profile: Where to download from, then any mirrors. Blank is archive.org.
     wxStaticText *newProfileROMSourceFolder;  //Create new profile: Folders for local .zips
     wxStaticText *newProfileCHDSourceFolder; //Create new profile: Folders for CHD folders
     wxStaticText *newProfileROMTargetFolder; //Create new profile:  Where to download/copy .zips
@@ -218,6 +211,7 @@ private:
     wxButton *newProfileCHDSourceFolderButton; //Create new profile:  Select the local CHD folder
     wxTextCtrl *newProfileName; //Create new profile: name of the new profile
     wxCheckBox *editProfileOnline; //Edit profile: download or local files?
+    wxTextCtrl *editProfileBaseUrl; //Edit profile: Where to download from, then any mirrors. Blank is archive.org.
     wxStaticText *editProfileROMSourceFolder; //Edit profile: Folders for local .zips
     wxStaticText *editProfileCHDSourceFolder; //Edit profile: Folder for local CHD folders
     wxStaticText *editProfileROMTargetFolder; //Edit profile: Where to download/copy zips
@@ -242,6 +236,24 @@ private:
     void OnEditProfile(wxCommandEvent &event);
     void OnExit(wxCommandEvent &event);
     void OnAbout(wxCommandEvent &event);
+    void OnUpdateGameDB(wxCommandEvent &event);
+    void OnRunHistory(wxCommandEvent &event);
+    void OnScanSources(wxCommandEvent &event);
+    void OnVerifyTarget(wxCommandEvent &event);
+    void OnAuditZips(wxCommandEvent &event);
+    void OnBuildCardImage(wxCommandEvent &event);
+    /*Fill a profile with the best ranked games matching the search that fit in a card. See SelectWithinBudget.*/
+    void OnBuildBudgetProfile(wxCommandEvent &event);
+    /*Ask for the rate schedule runs keep to, until it parses or is cancelled.*/
+    void OnTransferRate(wxCommandEvent &event);
+    /*Load the selected profile's inventory and the game DB's temp.have table from the last scan.*/
+    void ReloadInventory();
+    /*Apply a SourceWatcher batch to the inventory, temp.have and the Have column of the rows shown.*/
+    void OnSourcesChanged(const std::string &root, const std::vector<std::string> &relativePaths);
+    /*The profile's selected games plus the parents, BIOSes and devices they need to run.*/
+    std::vector<gameMap> LoadRunGames(const std::string &profileName);
+    /*Show what a run will do, and whether it fits, before it starts. True if the user goes ahead.*/
+    bool ConfirmRun(const runPlan &plan, bool online);
     void OnGridClick(wxGridEvent &event);
     void OnGridLabelClick(wxGridEvent &event);
     void OnNewProfileROMSourceFolderButton(wxCommandEvent &event);
@@ -260,12 +272,25 @@ private:
     void OnEditProfileDeleteButton(wxCommandEvent &event);
     void OnEditProfileSaveButton(wxCommandEvent &event);
     void PopulateProfileChoice(int selection = 0);
+    /*The profile panels are only built when first shown, which keeps them out of startup.*/
+    void BuildNewProfilePanel();
+    void BuildEditProfilePanel();
+    void OnStartupTiming(wxCommandEvent &event);
+    std::vector<std::pair<std::string, long long>> startupTimes; //Startup phase and its milliseconds. Shown by Help > Startup Timing.
+    bool firstGridTimed = false; //Set once the first grid's time is in startupTimes.
     void OnRunButton(wxCommandEvent &event);
-    bool DownloadGame(gameMap, const char *type, const std::string url, wxString &runErrors, wxProgressDialog &progress);
+    void OnRunSeveralProfiles(wxCommandEvent &event);
+    /*Plan, confirm and run the profiles' files. Several profiles run as one fan-out run (see FanOutFiles), each recorded as its own run.*/
+    void RunProfiles(const std::vector<std::string> &names);
 
     wxDECLARE_EVENT_TABLE();
+    std::string gameDBPath; //Where the game DB lives. Only written to by OnUpdateGameDB.
+    std::string catalogStamp; //CatalogStamp of the game DB. Keys the startup cache.
+    dependencyGraph dependencies; //Parents, BIOSes and devices of every game. Loaded by the first run or verify after the game DB changes.
     SQLite::Database gameDB; //The SQLite DB of games. Not written to by this app.
     SQLite::Database profileDB; //Where profile data is saved. Written to by this app. Should probably be written by this app.
+    downloadCache cache; //Where online profiles download to, shared by all of them. See DefaultDownloadCache.
+    std::string cacheError; //What is wrong with ROMPER_CACHE_MB, or "". Runs won't start while it's set.
 };
 
 //The event table. There are also events created within the frame construct.
@@ -273,96 +298,55 @@ wxBEGIN_EVENT_TABLE(MyFrame, wxFrame)
     EVT_MENU(wxID_EXIT, MyFrame::OnExit)
         EVT_MENU(wxID_ABOUT, MyFrame::OnAbout)
             wxEND_EVENT_TABLE()
-                wxIMPLEMENT_APP(MyApp);
 
+#ifdef _WIN32
+//Windows builds are GUI subsystem apps without a console, so there is no headless mode there.
+wxIMPLEMENT_APP(MyApp);
+#else
+wxIMPLEMENT_APP_NO_MAIN(MyApp);
 
-std::string getProfileDatabasePath()
+//Headless options never touch the GUI, so they work without a display.
+int main(int argc, char **argv)
 {
-    std::string databasePath;
-    std::string configDir;
-    try {
-        // Determine the correct configuration directory
-        #ifdef _WIN32
-            configDir = getenv("APPDATA");
-            configDir += "\\Romper\\";
-        #elif defined(__APPLE__)
-            // macOS: ~/Library/Application Support/Romper/
-            const char* homeEnv = std::getenv("HOME");
-            if (homeEnv && *homeEnv)
-            {
-                configDir = std::string(homeEnv) + "/Library/Application Support/Romper/";
-            }
-            else
-            {
-                // Fallback if HOME is not set (rare in normal user sessions)
-                configDir = "./Romper/";
-            }
-        #else
-            configDir = getenv("HOME");
-            configDir += "/.Romper/";
-        #endif
-
-        // Create the configuration directory if it does not exist
-        std::filesystem::create_directories(configDir);
-
-        // Build the full database path
-        databasePath = configDir + "profiles.romper";
-
-        // Check if the file exists, and create it if it does not
-        if (!std::filesystem::exists(databasePath)) {
-            std::filesystem::create_directories(configDir);
-
-            SQLite::Database db(databasePath, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
-            db.exec("CREATE TABLE \"games\" (\"profile\" TEXT NOT NULL, \"game\" TEXT NOT NULL, CONSTRAINT \"unqProfileGame\" UNIQUE(\"game\",\"profile\"));");
-            db.exec("CREATE TABLE \"profiles\" (\"name\" TEXT NOT NULL UNIQUE, \"online\" INTEGER NOT NULL, \"romSource\" TEXT, \"chdSource\" TEXT, \"romTarget\" TEXT, \"chdTarget\" TEXT, PRIMARY KEY(\"name\"));");
-            db.exec("CREATE INDEX \"idxgames\" ON \"games\" (\"game\");");
-            db.exec("CREATE INDEX \"idxprofile\" ON \"games\" (\"profile\");");
-        }
-    } catch (const std::exception& e) {
-        wxMessageBox(e.what(), "Create Profile DB Error", wxOK | wxICON_INFORMATION);
-        return "";
+    if (IsCliInvocation(argc, argv))
+    {
+        return RunCli(argc, argv);
     }
-
-    return databasePath;
+    return wxEntry(argc, argv);
 }
-
-
+#endif
 
 //This acts at main(). Calls the class to create the Window
 bool MyApp::OnInit()
 {
+    StartTraceFromEnvironment();
+    TraceSpan span("OnInit", "startup");
     try
     {
-        auto romperFolder = GetExeDirectory();
-        std::string profileDBFile = getProfileDatabasePath();
+        std::chrono::steady_clock::time_point phaseStart = std::chrono::steady_clock::now();
+        long long beforeInit = MsSince(processStart);
+        std::string profileDBError;
+        std::string profileDBFile = getProfileDatabasePath(profileDBError);
+        long long profileDBTime = MsSince(phaseStart);
         if (profileDBFile == "") {
+            wxMessageBox(profileDBError, "Create Profile DB Error", wxOK | wxICON_INFORMATION);
             return false;
         }
-        //std::string gameDBFile = romperFolder + "/romper_data/romper.romper";
-                // Game database:
-        std::string gameDBFile;
-        #ifdef __APPLE__
-        
-            // We'll compute our actual executable path via _NSGetExecutablePath().
-            // The typical layout is: /MyApp.app/Contents/MacOS/romper
-            {
-                uint32_t bufSize = 0;
-                _NSGetExecutablePath(nullptr, &bufSize);
-                std::vector<char> pathBuf(bufSize + 1, '\0');
-                _NSGetExecutablePath(pathBuf.data(), &bufSize);
-                std::filesystem::path exeDir = std::filesystem::canonical(pathBuf.data());
-                std::filesystem::path resourcesPath = exeDir.parent_path().parent_path() / "Resources";
-                gameDBFile = (resourcesPath / "romper.romper").string();
-            }
-        #else
-            // On other platforms, fallback to your existing approach:
-            std::string gameDBFile = romperFolder + "/romper_data/romper.romper";
-        #endif
+        std::string gameDBFile = getGameDatabasePath();
         std::cout << "Profile DB: " << profileDBFile << std::endl;
         std::cout << "Game DB: " << gameDBFile << std::endl;
+        phaseStart = std::chrono::steady_clock::now();
         MyFrame *frame = new MyFrame("Romper", wxPoint(50, 50), wxSize(800, 600), profileDBFile, gameDBFile);
         frame->Refresh();
         frame->Show(true);
+        long long windowTime = MsSince(phaseStart);
+        const auto &startupTimes = frame->AddStartupTimes({{"wx startup", beforeInit}, {"profile DB", profileDBTime}}, {{"window", windowTime}, {"time to interactive", MsSince(processStart)}});
+        std::cout << "Startup:";
+        for (const auto &t : startupTimes)
+        {
+            std::cout << " " << t.first << " " << t.second << " ms,";
+        }
+        std::cout << std::endl;
     }
     catch (std::exception &e)
     {
@@ -375,8 +359,39 @@ bool MyApp::OnInit()
     return true;
 }
 
+searchFilter MyFrame::CurrentFilter(const std::string &searchField, const std::string &searchValue)
+{
+    searchFilter filter;
+    filter.field = searchField;
+    filter.value = searchValue;
+    filter.screenless = menuScreenless->IsChecked();
+    filter.onlyHave = menuOnlyHave->IsChecked() && inventory.scanned;
+    wxMenuItemList mr = menuRank->GetMenuItems();
+    for (wxMenuItemList::iterator i = mr.begin(); i != mr.end(); ++i)
+    {
+        if (!(*i)->IsChecked())
+        {
+            std::string rank = (*i)->GetItemLabelText().ToStdString();
+            filter.excludedRanks.push_back(rank == "Blank" ? "" : rank);
+        }
+    }
+    wxMenuItemList mg = menuGenre->GetMenuItems();
+    for (wxMenuItemList::iterator i = mg.begin(); i != mg.end(); ++i)
+    {
+        if (!(*i)->IsChecked())
+        {
+            std::string genre = (*i)->GetItemLabelText().ToStdString();
+            filter.excludedGenres.push_back(genre == "Blank" ? "" : genre);
+        }
+    }
+    return filter;
+}
+
 void MyFrame::BuildGrid(const std::string &orderDirection, const std::string &orderBy, const std::string &searchField, const std::string &searchValue, int page = 1, const std::string limit = "100")
 { // reset the grid
+    TraceSpan span("BuildGrid", "grid");
+    span.Arg("page", page);
+    std::chrono::steady_clock::time_point searchStart = std::chrono::steady_clock::now();
     SetStatusText("Searching");
     ChangeMainBookPage(romperBlankPage);
     gameGrid->Grid->BeginBatch();
@@ -389,15 +404,11 @@ void MyFrame::BuildGrid(const std::string &orderDirection, const std::string &or
         gameGrid->Grid->DeleteCols(0, gameGrid->Grid->GetNumberCols());
     }
 
-    std::vector<std::string> checkedGames{};
+    std::unordered_set<std::string> checkedGames{};
     try
     {
-        SQLite::Statement pq(profileDB, "SELECT game FROM games WHERE profile = ?;");
-        pq.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-        while (pq.executeStep())
-        {
-            checkedGames.push_back(pq.getColumn(0));
-        }
+        std::vector<std::string> selected = SelectedGames(profileDB, profileChoice->choice->GetStringSelection().ToStdString());
+        checkedGames.insert(selected.begin(), selected.end());
     }
     catch (std::exception &e)
     {
@@ -411,252 +422,75 @@ void MyFrame::BuildGrid(const std::string &orderDirection, const std::string &or
 
     try
     {
-        std::string querystr;
         // build the query
-
-        bool needBind = false;
-        std::string where = "";
-        bool whereBool = false; // determine if the WHERE needs to be WHERE or AND. If TRUE, then AND. There's got to be a better way for this.
-        // If the search value is not empty, set the WHERE var and we'll need to bind it.
-        if (trim(searchValue) != "")
-        {
-            needBind = true; // We only bind on the searchValue because it's the only WHERE that's not programically assigned.
-            whereBool = true;
-            where = " WHERE games." + searchField + " LIKE ? ";
-        }
-
-        // Screenless: if NOT screenless, then don't show screenless. Else, show all.
-        // Who cares about only screenless games?
-        if (!menuScreenless->IsChecked())
-        {
-            if (whereBool)
-            {
-                where += " AND games.Screenless=0 ";
-            }
-            else
-            {
-                whereBool = true;
-                where = " WHERE games.Screenless=0 ";
-            }
-        }
-
-        // RANK
-        bool notInRank = false;
-        std::string rankTempSQL = "";
-        if (!whereBool)
-        {
-            whereBool = true;
-            rankTempSQL = " WHERE games.rank NOT IN (";
-        }
-        else
-        {
-            rankTempSQL = " AND games.rank NOT IN (";
-        }
-        wxMenuItemList mr = menuRank->GetMenuItems();
-        for (wxMenuItemList::iterator i = mr.begin(); i != mr.end(); ++i)
-        {
-            if (!(*i)->IsChecked())
-            {
-                notInRank = true;
-                if ((*i)->GetItemLabelText().ToStdString() == "Blank")
-                {
-                    rankTempSQL.append("\"\",");
-                }
-                else
-                {
-                    rankTempSQL.append("\"" + (*i)->GetItemLabelText().ToStdString() + "\",");
-                }
-            }
-        }
-        if (notInRank)
-        {
-            rankTempSQL.pop_back(); // remove last comma.
-            where.append(rankTempSQL.append(") "));
-        }
-        // Genre
-        bool notInGenre = false;
-        std::string genreTempSQL = "";
-        if (!whereBool)
-        {
-            whereBool = true;
-            genreTempSQL = " WHERE games.genre NOT IN (";
-        }
-        else
-        {
-            genreTempSQL = " AND games.genre NOT IN (";
-        }
-        wxMenuItemList mg = menuGenre->GetMenuItems();
-        for (wxMenuItemList::iterator i = mg.begin(); i != mg.end(); ++i)
-        {
-            if (!(*i)->IsChecked())
-            {
-                notInGenre = true;
-                if ((*i)->GetItemLabelText().ToStdString() == "Blank")
-                {
-                    genreTempSQL.append("\"\",");
-                }
-                else
-                {
-                    genreTempSQL.append("\"" + (*i)->GetItemLabelText().ToStdString() + "\",");
-                }
-            }
-        }
-        if (notInGenre)
-        {
-            genreTempSQL.pop_back(); // remove last comma.
-            where.append(genreTempSQL.append(") "));
-        }
-
-        //std::string queryStr = "WITH All_Games AS (SELECT * FROM games {WHERE}), Count_Games AS (SELECT COUNT(*) AS TotalGames FROM All_Games) SELECT c.TotalGames, g.Name, g.Genre, g.Cat, g.Developer, g.Publisher, g.Year, g.Series, g.Description, g.ROMof, g.Disk, g.Rank, g.Screenless FROM All_Games g CROSS JOIN Count_Games c ";
-        std::string queryStr = "WITH All_Games AS (SELECT * FROM games "+where+"), Count_Games AS (SELECT COUNT(*) AS TotalGames FROM All_Games) SELECT c.TotalGames, g.Name, g.Genre, g.Cat, g.Developer, g.Publisher, g.Year, g.Series, g.Description, g.ROMof, g.Disk, g.Rank, g.Screenless FROM All_Games g CROSS JOIN Count_Games c ";
-        //queryStr = std::regex_replace(queryStr, std::regex("\\{WHERE\\}"), where);
-
-        std::string sqlOrderBy;
-        if (orderBy == "")
-        {
-            sqlOrderBy = "g.Description";
-        }
-        else
-        {
-            sqlOrderBy = "g." + orderBy;
-        }
-
-        std::string sqlOrderDirection;
-        if (orderDirection != "ASC" && orderDirection != "DESC")
-        {
-            sqlOrderDirection = "ASC";
-        }
-        else
-        {
-            sqlOrderDirection = orderDirection;
-        }
+        searchFilter filter = CurrentFilter(searchField, searchValue);
         int limitInt = stoi(limit);
-        int start = (limitInt * page) - limitInt;
-        std::string temp = queryStr + " ORDER BY " + sqlOrderBy + " " + sqlOrderDirection + " LIMIT " + std::to_string(limitInt) + " OFFSET " + std::to_string(start) + ";";
-
-        SQLite::Statement query(gameDB, temp);
-        if (needBind)
-        {
-            query.bind(1, trim(searchValue + "%"));
-        }
-        // Get the total games;
-        int totalGames;
-        while (query.executeStep())
-        {
-            totalGames = query.getColumn(0);
-            if (totalGames < 1)
-            {
-                DisplayMessage("No games in the result");
-                SetStatusText("No games in search results");
-                return;
-            }
-
-            break;
-        }
-        gameGrid->Grid->AppendRows(limitInt, false); // we'll fix this later if it's too big.
-        int totalPages;
-        if (totalGames >= limitInt)
-        {
-            totalPages = totalGames / limitInt;
-        }
-        else
+        int totalGames = 0;
+        std::vector<gameRow> rows = CachedSearchGames(gameDB, profileDB, catalogStamp, filter, orderBy, orderDirection, limitInt, page, totalGames);
+        if (totalGames < 1)
         {
-            totalPages = 1;
+            gameGrid->Grid->EndBatch();
+            DisplayMessage("No games in the result");
+            SetStatusText("No games in search results");
+            return;
         }
+        TraceSpan fillSpan("grid fill", "grid");
+        gameGrid->Grid->AppendRows((int)rows.size(), false);
+        int totalPages = (totalGames + limitInt - 1) / limitInt;
         gameGrid->lastPage = totalPages;
         gameGrid->curPage = page;
         std::string tgl = std::to_string(page).append(" of ").append(std::to_string(totalPages));
         totalGamesLabel->SetLabelText(tgl);
         hSizerSearch->Layout();
-        const char *headers[8] = {"X", "Name", "Description", "Developer", "Series", "Cat", "Genre", "Rank"};
-        gameGrid->Grid->AppendCols(8);
-        for (int i = 0; i < 8; i++)
+        std::vector<std::string> headers = {"X", "Name", "Description", "Developer", "Series", "Cat", "Genre", "Rank"};
+        if (inventory.scanned)
+        {
+            headers.push_back("Have");
+        }
+        int auditCol = (int)headers.size();
+        if (!audits.empty())
+        {
+            headers.push_back("Audit");
+        }
+        int cols = (int)headers.size();
+        gameGrid->Grid->AppendCols(cols);
+        for (int i = 0; i < cols; i++)
         {
             gameGrid->Grid->SetColLabelValue(i, headers[i]);
         }
+        const profile &p = profile_map[profileChoice->choice->GetStringSelection().ToStdString()];
 
-        query.reset();
         int row = 0;
-        // wxGridCellBoolEditor *editor = new wxGridCellBoolEditor();
-        // wxGridCellBoolRenderer *renderer = new wxGridCellBoolRenderer();
-        while (query.executeStep())
+        for (const gameRow &game : rows)
         {
-            int col = 0;
             // Bool col
-            gameGrid->Grid->SetReadOnly(row, col);
-            // editor->IncRef();
-            gameGrid->Grid->SetCellEditor(row, col, new wxGridCellBoolEditor());
-            // renderer->IncRef();
-            gameGrid->Grid->SetCellRenderer(row, col, new wxGridCellBoolRenderer());
-            // Name
-            const char *gName = query.getColumn(1);
-            std::string gNameString = query.getColumn(1).getString();
-            if (in_array(gNameString, checkedGames))
+            gameGrid->Grid->SetCellEditor(row, 0, new wxGridCellBoolEditor());
+            gameGrid->Grid->SetCellRenderer(row, 0, new wxGridCellBoolRenderer());
+            gameGrid->Grid->SetCellValue(row, 0, checkedGames.count(game.name) ? "1" : "");
+            gameGrid->Grid->SetCellValue(row, 1, game.name);
+            gameGrid->Grid->SetCellValue(row, 2, game.description);
+            gameGrid->Grid->SetCellValue(row, 3, game.developer);
+            gameGrid->Grid->SetCellValue(row, 4, game.series);
+            gameGrid->Grid->SetCellValue(row, 5, game.cat);
+            gameGrid->Grid->SetCellValue(row, 6, game.genre);
+            gameGrid->Grid->SetCellValue(row, 7, game.rank);
+            if (inventory.scanned)
             {
-                gameGrid->Grid->SetCellValue(row, col, "1");
+                gamePresence presence = GamePresence(inventory, p, game.name, game.disk);
+                gameGrid->Grid->SetCellValue(row, 8, PresenceLabel(presence));
             }
-            else
+            if (!audits.empty())
             {
-                gameGrid->Grid->SetCellValue(row, col, "");
+                auto audit = audits.find(game.name);
+                gameGrid->Grid->SetCellValue(row, auditCol, audit == audits.end() ? "" : AuditLabel(audit->second.status));
+            }
+            for (int col = 0; col < cols; col++)
+            {
+                gameGrid->Grid->SetReadOnly(row, col);
             }
-            col++;
-
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gName);
-
-            // Description
-            col++;
-
-            const char *gDescription = query.getColumn(8);
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gDescription);
-
-            // Developer
-            col++;
-            const char *gDev = query.getColumn(4);
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gDev);
-
-            // Series
-            col++;
-            const char *gSeries = query.getColumn(7);
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gSeries);
-
-            // Cat
-            col++;
-            const char *gCat = query.getColumn(3);
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gCat);
-
-            // Genre
-            col++;
-            const char *gGenre = query.getColumn(2);
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gGenre);
-
-            // const int gYear = query.getColumn(5);
-
-            // const char *gDescription = query.getColumn(7);
-            // const char *gRomOf = query.getColumn(8);
-            // const char *gDisk = query.getColumn(9);
-
-            // Rank
-            col++;
-            const char *gRank = query.getColumn(11);
-            gameGrid->Grid->SetReadOnly(row, col);
-            gameGrid->Grid->SetCellValue(row, col, gRank);
-            // const int gScreenless = query.getColumn(11);
             row++;
         }
-        query.clearBindings();
-        query.reset();
-        // editor.Destroy();
 
-        if (row < limitInt)
-        {
-            gameGrid->Grid->DeleteRows(row, limitInt - row);
-        }
         gameGrid->Grid->AutoSizeColumns(false);
         gameGrid->prevChangeAll = "";
         vSizer->Show(hSizerRunButtons);
@@ -670,7 +504,14 @@ void MyFrame::BuildGrid(const std::string &orderDirection, const std::string &or
         hSizerLoad->Layout();
         vSizerGameGrid->Layout();
         Refresh();
-        SetStatusText("Total Games Found: " + std::to_string(totalGames));
+        fillSpan.Finish();
+        long long searchMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - searchStart).count();
+        SetStatusText("Total Games Found: " + std::to_string(totalGames) + " (" + std::to_string(searchMs) + " ms)");
+        if (!firstGridTimed)
+        {
+            firstGridTimed = true;
+            startupTimes.push_back({"first grid", searchMs});
+        }
     }
     catch (std::exception &e)
     {
@@ -685,24 +526,58 @@ void MyFrame::BuildGrid(const std::string &orderDirection, const std::string &or
 
 MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size, std::string profileDBFile, std::string gameDBFile)
     : wxFrame(NULL, wxID_ANY, title, pos, size),
-      gameDB(gameDBFile), profileDB(profileDBFile, SQLite::OPEN_READWRITE)
+      gameDBPath(gameDBFile), gameDB(gameDBFile), profileDB(profileDBFile, SQLite::OPEN_READWRITE)
 {
+    cacheError = DefaultDownloadCache(profileDBFile, cache);
+    TraceSpan span("MyFrame", "startup");
+    std::chrono::steady_clock::time_point menusStart = std::chrono::steady_clock::now();
+    catalogStamp = CatalogStamp(gameDBFile);
+    try
+    {
+        // Map the game DB instead of read()ing it page by page. Helps most on slow SD cards.
+        gameDB.exec("PRAGMA mmap_size=268435456;");
+    }
+    catch (std::exception &)
+    {
+    }
 
     menuFile = new wxMenu;
+    wxMenuItem *menuUpdateGameDB = menuFile->Append(wxID_ANY, "Update Game DB...", "Apply a newer romper.romper on top of the installed one.");
+    Bind(wxEVT_MENU, &MyFrame::OnUpdateGameDB, this, menuUpdateGameDB->GetId());
+    wxMenuItem *menuRunSeveral = menuFile->Append(wxID_ANY, "Run Several Profiles...", "Run profiles built from the same library together, reading each source file once.");
+    Bind(wxEVT_MENU, &MyFrame::OnRunSeveralProfiles, this, menuRunSeveral->GetId());
+    wxMenuItem *menuRunHistory = menuFile->Append(wxID_ANY, "Run History...", "Past runs with their speed and errors.");
+    Bind(wxEVT_MENU, &MyFrame::OnRunHistory, this, menuRunHistory->GetId());
+    wxMenuItem *menuScanSources = menuFile->Append(wxID_ANY, "Scan Source Folders", "Find which ROMs and CHDs are in this profile's source folders.");
+    Bind(wxEVT_MENU, &MyFrame::OnScanSources, this, menuScanSources->GetId());
+    wxMenuItem *menuVerifyTarget = menuFile->Append(wxID_ANY, "Verify Target Folder", "Check this profile's copied ROM zips and CHDs against the game DB's checksums.");
+    Bind(wxEVT_MENU, &MyFrame::OnVerifyTarget, this, menuVerifyTarget->GetId());
+    wxMenuItem *menuAuditZips = menuFile->Append(wxID_ANY, "Audit ROM Zips", "Compare every zip in this profile's rom folder to the game DB, and show the result in the grid.");
+    Bind(wxEVT_MENU, &MyFrame::OnAuditZips, this, menuAuditZips->GetId());
+    wxMenuItem *menuBuildCardImage = menuFile->Append(wxID_ANY, "Build SD Card Image...", "Write this profile's ROM zips and CHDs straight into a FAT32 image to flash to a card.");
+    Bind(wxEVT_MENU, &MyFrame::OnBuildCardImage, this, menuBuildCardImage->GetId());
+    wxMenuItem *menuBuildBudgetProfile = menuFile->Append(wxID_ANY, "Build Profile to Fit...", "Select the best ranked games matching the search that fit on a card of a given size, into a new or existing profile.");
+    Bind(wxEVT_MENU, &MyFrame::OnBuildBudgetProfile, this, menuBuildBudgetProfile->GetId());
+    menuFile->AppendSeparator();
+    menuPackSevenZip = menuFile->AppendCheckItem(wxID_ANY, "Pack ROM Zips as 7z", "Write local profiles' ROM zips as 7z sets, which take less room. Each set is packed once and kept in the cache.");
+    wxMenuItem *menuTransferRate = menuFile->Append(wxID_ANY, "Transfer Rate...", "Cap how fast runs copy and download, by time of day if you like.");
+    Bind(wxEVT_MENU, &MyFrame::OnTransferRate, this, menuTransferRate->GetId());
+    const char *rate = std::getenv("ROMPER_RATE");
+    rateSchedule = rate ? rate : "";
     menuFile->AppendSeparator();
     menuFile->Append(wxID_EXIT);
     menuSelect = new wxMenu;
     menuScreenless = new wxMenuItem(menuSelect, wxID_ANY, "Screenless", "Select to include Screenless", wxITEM_CHECK);
     menuSelect->Append(menuScreenless);
     menuScreenless->Check(false);
+    menuOnlyHave = menuSelect->AppendCheckItem(wxID_ANY, "Only Games I Have", "Only include games found by the last scan of the source folders.");
+    Bind(wxEVT_MENU, &MyFrame::OnSearch, this, menuOnlyHave->GetId());
     menuRank = new wxMenu;
     menuSelect->AppendSubMenu(menuRank, "Select Rank", "Choose which ranks are included.");
     try
     {
-        SQLite::Statement query(gameDB, "SELECT rank FROM games GROUP BY rank ORDER BY rank;");
-        while (query.executeStep())
+        for (std::string s : CachedCatalogValues(gameDB, profileDB, catalogStamp, "rank"))
         {
-            std::string s = query.getColumn(0).getString();
             if (s == "")
             {
                 s = "Blank";
@@ -734,10 +609,8 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     menuSelect->AppendSubMenu(menuGenre, "Select Genre", "Select genre to include in search.");
     try
     {
-        SQLite::Statement query(gameDB, "SELECT genre FROM games GROUP BY genre ORDER BY genre;");
-        while (query.executeStep())
+        for (std::string s : CachedCatalogValues(gameDB, profileDB, catalogStamp, "genre"))
         {
-            std::string s = query.getColumn(0).getString();
             if (s == "")
             {
                 s = "Blank";
@@ -763,7 +636,11 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
         return;
     }
 
+    startupTimes.push_back({"menus", MsSince(menusStart)});
+
     wxMenu *menuHelp = new wxMenu;
+    wxMenuItem *menuStartupTiming = menuHelp->Append(wxID_ANY, "Startup Timing", "How long each part of startup took.");
+    Bind(wxEVT_MENU, &MyFrame::OnStartupTiming, this, menuStartupTiming->GetId());
     menuHelp->Append(wxID_ABOUT);
     menubar = new wxMenuBar;
     menubar->Append(menuFile, "&File");
@@ -880,7 +757,19 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     gameGrid->Grid->Bind(wxEVT_GRID_CELL_LEFT_DCLICK, &MyFrame::OnGridClick, this);
     gameGrid->Grid->Bind(wxEVT_GRID_LABEL_LEFT_DCLICK, &MyFrame::OnGridLabelClick, this);
 
-    /*New profile panel*/
+    PopulateProfileChoice();
+    SetInitialSize();
+    SetSize(wxSize(1100, 700));
+    Layout();
+}
+
+void MyFrame::BuildNewProfilePanel()
+{
+    if (vSizerNewProfile)
+    {
+        return;
+    }
+    TraceSpan span("BuildNewProfilePanel", "startup");
     vSizerNewProfile = new wxBoxSizer(wxVERTICAL);
     wxFlexGridSizer *gridSizerNewProfile = new wxFlexGridSizer(3, 3, 7);
     wxStaticText *newProfileNameLabel = new wxStaticText(newProfilePanel, wxID_ANY, "Profile Name:");
@@ -890,6 +779,10 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     newProfileName->SetInsertionPoint(0);
     newProfileOnline = new wxCheckBox(newProfilePanel, wxID_ANY, "Download files automatically");
     newProfileOnline->Bind(wxEVT_CHECKBOX, &MyFrame::OnNewProfileOnline, this);
+    wxStaticText *newProfileBaseUrlLabel = new wxStaticText(newProfilePanel, wxID_ANY, "Download URL:");
+    newProfileBaseUrl = new wxTextCtrl(newProfilePanel, wxID_ANY, "", wxDefaultPosition, wxSize(350, wxDefaultSize.GetHeight()));
+    newProfileBaseUrl->SetHint(DOWNLOAD_URL);
+    newProfileBaseUrl->SetToolTip("Mirrors can follow, separated by spaces. Each is tried in turn when a download fails.");
     wxStaticText *newProfileROMSourceLabel = new wxStaticText(newProfilePanel, wxID_ANY, "Rom Source Dir:");
     newProfileROMSourceFolder = new wxStaticText(newProfilePanel, wxID_ANY, "");
     newProfileROMSourceFolderButton = new wxButton(newProfilePanel, wxID_ANY, "Select");
@@ -915,6 +808,9 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     gridSizerNewProfile->Add(newProfileOnline);
     gridSizerNewProfile->AddSpacer(1);
     gridSizerNewProfile->AddSpacer(1);
+    gridSizerNewProfile->Add(newProfileBaseUrlLabel);
+    gridSizerNewProfile->AddSpacer(1);
+    gridSizerNewProfile->Add(newProfileBaseUrl);
     gridSizerNewProfile->Add(newProfileROMSourceLabel);
     gridSizerNewProfile->Add(newProfileROMSourceFolderButton);
     gridSizerNewProfile->Add(newProfileROMSourceFolder);
@@ -940,8 +836,16 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     newProfileROMTargetFolderButton->Bind(wxEVT_BUTTON, &MyFrame::OnNewProfileROMTargetFolderButton, this);
     newProfileCHDTargetFolderButton->Bind(wxEVT_BUTTON, &MyFrame::OnNewProfileCHDTargetFolderButton, this);
     newProfileCancelButton->Bind(wxEVT_BUTTON, &MyFrame::OnNewProfileCancelButton, this);
+    newProfilePanel->Layout();
+}
 
-/*EDIT PROFILE*/
+void MyFrame::BuildEditProfilePanel()
+{
+    if (vSizerEditProfile)
+    {
+        return;
+    }
+    TraceSpan span("BuildEditProfilePanel", "startup");
     vSizerEditProfile = new wxBoxSizer(wxVERTICAL);
     gridSizerEditProfile = new wxFlexGridSizer(3, 3, 7);
     wxStaticText *editProfileNameLabel = new wxStaticText(editProfilePanel, wxID_ANY, "Profile Name:");
@@ -949,6 +853,10 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     editProfileName->SetInsertionPoint(0);
     editProfileOnline = new wxCheckBox(editProfilePanel, wxID_ANY, "Download files automatically");
     editProfileOnline->Bind(wxEVT_CHECKBOX, &MyFrame::OnEditProfileOnline, this);
+    wxStaticText *editProfileBaseUrlLabel = new wxStaticText(editProfilePanel, wxID_ANY, "Download URL:");
+    editProfileBaseUrl = new wxTextCtrl(editProfilePanel, wxID_ANY, "", wxDefaultPosition, wxSize(350, wxDefaultSize.GetHeight()));
+    editProfileBaseUrl->SetHint(DOWNLOAD_URL);
+    editProfileBaseUrl->SetToolTip("Mirrors can follow, separated by spaces. Each is tried in turn when a download fails.");
     wxStaticText *editProfileROMSourceLabel = new wxStaticText(editProfilePanel, wxID_ANY, "Rom Source Dir:");
     editProfileROMSourceFolder = new wxStaticText(editProfilePanel, wxID_ANY, "");
     editProfileROMSourceFolderButton = new wxButton(editProfilePanel, wxID_ANY, "Select");
@@ -981,6 +889,9 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     gridSizerEditProfile->Add(editProfileOnline);
     gridSizerEditProfile->AddSpacer(1);
     gridSizerEditProfile->AddSpacer(1);
+    gridSizerEditProfile->Add(editProfileBaseUrlLabel);
+    gridSizerEditProfile->Add(editProfileBaseUrl);
+    gridSizerEditProfile->AddSpacer(1);
     gridSizerEditProfile->Add(editProfileROMSourceLabel);
     gridSizerEditProfile->Add(editProfileROMSourceFolderButton);
     gridSizerEditProfile->Add(editProfileROMSourceFolder);
@@ -1002,10 +913,7 @@ MyFrame::MyFrame(const wxString &title, const wxPoint &pos, const wxSize &size,
     gridSizerEditProfile->Add(editProfileDeleteButton);
     editProfilePanel->SetSizer(vSizerEditProfile);
     vSizerEditProfile->Add(gridSizerEditProfile);
-    PopulateProfileChoice();
-    SetInitialSize();
-    SetSize(wxSize(1100, 700));
-    Layout();
+    editProfilePanel->Layout();
 }
 
 /*Events & Methods*/
@@ -1022,12 +930,168 @@ void MyFrame::OnExit(wxCommandEvent &event)
     Close(true);
 }
 
+void MyFrame::OnStartupTiming(wxCommandEvent &event)
+{
+    std::string m;
+    for (const auto &t : startupTimes)
+    {
+        m += t.first + ": " + std::to_string(t.second) + " ms" + NEWLINE;
+    }
+    DisplayMessage(m);
+}
+
 void MyFrame::OnAbout(wxCommandEvent &event)
 {
     wxMessageBox("Romper is a tool to help sift through your MAME ROMs. More info on Github.",
                  "Romper Version: " + VERSION, wxOK | wxICON_INFORMATION);
 }
 
+void MyFrame::OnRunHistory(wxCommandEvent &event)
+{
+    std::vector<runRecord> runs;
+    try
+    {
+        runs = LoadRuns(profileDB, "", 500);
+    }
+    catch (std::exception &e)
+    {
+        std::string m("Run history error: ");
+        m.append(e.what());
+        DisplayMessage(m);
+        return;
+    }
+    if (runs.empty())
+    {
+        DisplayMessage("No runs yet.");
+        return;
+    }
+
+    wxDialog dialog(this, wxID_ANY, "Run History", wxDefaultPosition, wxSize(1100, 650), wxDEFAULT_DIALOG_STYLE | wxRESIZE_BORDER);
+    wxBoxSizer *sizer = new wxBoxSizer(wxVERTICAL);
+    wxListCtrl *runList = new wxListCtrl(&dialog, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+    const char *runHeaders[13] = {"Started", "Profile", "Strategy", "Jobs", "Files", "OK", "Failed", "Skipped", "Retries", "MB", "Seconds", "MB/s", "Aborted"};
+    for (int i = 0; i < 13; i++)
+    {
+        runList->AppendColumn(runHeaders[i]);
+    }
+    long row = 0;
+    for (const runRecord &run : runs)
+    {
+        runList->InsertItem(row, wxDateTime(wxLongLong(run.started)).Format("%Y-%m-%d %H:%M:%S"));
+        runList->SetItem(row, 1, run.profile);
+        runList->SetItem(row, 2, run.strategy);
+        runList->SetItem(row, 3, std::to_string(run.jobs));
+        runList->SetItem(row, 4, std::to_string(run.files));
+        runList->SetItem(row, 5, std::to_string(run.ok));
+        runList->SetItem(row, 6, std::to_string(run.failed));
+        runList->SetItem(row, 7, std::to_string(run.skipped));
+        runList->SetItem(row, 8, std::to_string(run.retries));
+        runList->SetItem(row, 9, wxString::Format("%.1f", run.bytes / 1048576.0));
+        runList->SetItem(row, 10, wxString::Format("%.1f", (run.finished - run.started) / 1000.0));
+        runList->SetItem(row, 11, wxString::Format("%.2f", RunMegabytesPerSecond(run)));
+        runList->SetItem(row, 12, run.aborted ? "Yes" : "");
+        row++;
+    }
+
+    //The files of the selected run.
+    wxListCtrl *fileList = new wxListCtrl(&dialog, wxID_ANY, wxDefaultPosition, wxDefaultSize, wxLC_REPORT | wxLC_SINGLE_SEL);
+    const char *fileHeaders[8] = {"Game", "Type", "Target", "MB", "Seconds", "MB/s", "Retries", "Error"};
+    for (int i = 0; i < 8; i++)
+    {
+        fileList->AppendColumn(fileHeaders[i]);
+    }
+    runList->Bind(wxEVT_LIST_ITEM_SELECTED, [&](wxListEvent &e)
+                  {
+        fileList->Freeze();
+        fileList->DeleteAllItems();
+        try
+        {
+            long fileRow = 0;
+            for (const runFileRecord &file : LoadRunFiles(profileDB, runs[e.GetIndex()].id))
+            {
+                fileList->InsertItem(fileRow, file.game);
+                fileList->SetItem(fileRow, 1, file.type);
+                fileList->SetItem(fileRow, 2, file.target);
+                fileList->SetItem(fileRow, 3, wxString::Format("%.2f", file.bytes / 1048576.0));
+                fileList->SetItem(fileRow, 4, wxString::Format("%.2f", file.seconds));
+                fileList->SetItem(fileRow, 5, wxString::Format("%.2f", file.seconds > 0 ? file.bytes / 1048576.0 / file.seconds : 0));
+                fileList->SetItem(fileRow, 6, std::to_string(file.retries));
+                fileList->SetItem(fileRow, 7, file.skipped ? "Skipped" : file.error);
+                fileRow++;
+            }
+        }
+        catch (std::exception &ex)
+        {
+            std::string m("Run history error: ");
+            m.append(ex.what());
+            DisplayMessage(m);
+        }
+        fileList->Thaw(); });
+
+    sizer->Add(runList, 1, wxEXPAND | wxALL, 5);
+    sizer->Add(fileList, 1, wxEXPAND | wxALL, 5);
+    sizer->Add(dialog.CreateButtonSizer(wxOK), 0, wxEXPAND | wxALL, 5);
+    dialog.SetSizer(sizer);
+    dialog.ShowModal();
+}
+
+void MyFrame::OnUpdateGameDB(wxCommandEvent &event)
+{
+    wxFileDialog fd(this, "Choose the new game DB", "", "romper.romper", "Romper game DB (*.romper)|*.romper|All files|*", wxFD_OPEN | wxFD_FILE_MUST_EXIST);
+    if (fd.ShowModal() != wxID_OK)
+    {
+        return;
+    }
+    int remap = wxMessageBox("Move profile games that were renamed in the new game DB to their new names?", "Update Game DB", wxYES_NO | wxICON_QUESTION);
+    catalogDelta delta;
+    try
+    {
+        SetStatusText("Updating game DB");
+        delta = ApplyCatalogDelta(gameDBPath, fd.GetPath().ToStdString(), profileDB, remap == wxYES);
+        catalogStamp = CatalogStamp(gameDBPath);
+        dependencies = dependencyGraph();
+    }
+    catch (std::exception &e)
+    {
+        SetStatusText("Game DB update failed");
+        std::string m("Update game DB error: ");
+        m.append(e.what());
+        DisplayMessage(m);
+        return;
+    }
+
+    wxString report = wxString::Format("Inserted: %d%sUpdated: %d%sRemoved: %d%sRenamed: %d%sProfile entries remapped: %d%sGames with changed checksums: %d%sGames with changed devices: %d%s",
+                                       delta.inserted, NEWLINE, delta.updated, NEWLINE, delta.removed, NEWLINE, (int)delta.renamed.size(), NEWLINE, delta.remapped, NEWLINE, delta.checksumsChanged, NEWLINE,
+                                       delta.devicesChanged, NEWLINE);
+    SetStatusText("Game DB updated");
+    //Reload the grid so removed games disappear.
+    wxCommandEvent evt(wxEVT_CHOICE, profileChoice->choice->GetId());
+    evt.SetEventObject(this);
+    wxPostEvent(profileChoice->choice, evt);
+    if (delta.affectedEntries.empty())
+    {
+        DisplayMessage(report.ToStdString() + "No profile games were affected.");
+        return;
+    }
+    int r = wxMessageBox(report + wxString::Format("%d profile games were affected. Would you like to save the report to a file?", (int)delta.affectedEntries.size()),
+                         "Update Game DB", wxYES_NO | wxNO_DEFAULT | wxICON_QUESTION);
+    if (r == wxYES)
+    {
+        wxDirDialog dd = wxDirDialog(panel, "Choose location to save report", "", wxDD_DEFAULT_STYLE | wxDD_DIR_MUST_EXIST);
+        dd.ShowModal();
+        wxTextFile file(dd.GetPath().Append("/romper_update_report.txt"));
+        file.Create();
+        file.Open();
+        file.AddLine(report);
+        for (const std::string &entry : delta.affectedEntries)
+        {
+            file.AddLine(entry);
+        }
+        file.Write();
+        file.Close();
+    }
+}
+
 void MyFrame::PopulateProfileChoice(int selection /*=0*/)
 {
     profileChoice->choice->Clear();
@@ -1036,12 +1100,10 @@ void MyFrame::PopulateProfileChoice(int selection /*=0*/)
     profile_map.clear();
     try
     {
-        SQLite::Statement query(profileDB, "SELECT name, online, romSource, chdSource, romTarget, chdTarget FROM profiles ORDER BY name;");
-        while (query.executeStep())
+        profile_map = LoadProfiles(profileDB);
+        for (const auto &p : profile_map)
         {
-            profile_map[query.getColumn(0).getString()] = profile{query.getColumn(0).getString(), query.getColumn(1), query.getColumn(2).getString(), query.getColumn(3).getString(), query.getColumn(4).getString(), query.getColumn(5).getString()};
-            std::string str = query.getColumn(0);
-            profileChoice->choice->Append(str);
+            profileChoice->choice->Append(p.first);
         }
     }
     catch (std::exception &e)
@@ -1068,6 +1130,7 @@ void MyFrame::OnProfileChange(wxCommandEvent &event)
 {
 
     if (profile_map.empty()) {
+        BuildNewProfilePanel();
         vSizer->Hide(hSizerLoad);
         vSizer->Hide(hSizerRunButtons);
         mainBook->book->ChangeSelection(romperNewProfile);
@@ -1080,6 +1143,7 @@ void MyFrame::OnProfileChange(wxCommandEvent &event)
     }
     if (profileChoice->choice->GetSelection() == 0)
     {
+        watcher.reset();
         mainBook->book->ChangeSelection(romperBlankPage);
         profileEditButton->Hide();
         vSizer->Hide(hSizerRunButtons);
@@ -1096,30 +1160,643 @@ void MyFrame::OnProfileChange(wxCommandEvent &event)
         {
             (*i)->Check(true);
         }
+        audits.clear();
+        ReloadInventory();
         BuildGrid("asc", "Description", searchBy->GetStringSelection().ToStdString(), "", 1, perPage->GetStringSelection().ToStdString());
     }
 }
 
-void MyFrame::OnNewProfile(wxCommandEvent &event)
+void MyFrame::ReloadInventory()
 {
-    vSizer->Hide(hSizerLoad);
-    ChangeMainBookPage(romperNewProfile);
+    TraceSpan span("ReloadInventory", "inventory");
+    watcher.reset();
+    try
+    {
+        const profile &p = profile_map[profileChoice->choice->GetStringSelection().ToStdString()];
+        inventory = LoadInventory(profileDB, p);
+        SetHaveTable(gameDB, GamesPresent(gameDB, p, inventory));
+        if (inventory.scanned)
+        {
+            std::vector<std::string> roots;
+            for (const std::string &root : {p.romSource, p.chdSource})
+            {
+                if (!root.empty())
+                {
+                    roots.push_back(root);
+                }
+            }
+            // Batches arrive on the watcher thread. The DBs and the grid are only touched on this one.
+            watcher = std::make_unique<SourceWatcher>(roots, [this](const std::string &root, const std::vector<std::string> &relativePaths)
+                                                      { CallAfter([this, root, relativePaths]()
+                                                                  { OnSourcesChanged(root, relativePaths); }); });
+        }
+    }
+    catch (std::exception &e)
+    {
+        inventory = inventorySet();
+        std::string m("Inventory error: ");
+        m.append(e.what());
+        DisplayMessage(m);
+    }
 }
 
-void MyFrame::OnEditProfile(wxCommandEvent &event)
+void MyFrame::OnSourcesChanged(const std::string &root, const std::vector<std::string> &relativePaths)
 {
-    vSizer->Hide(hSizerLoad);
-    vSizer->Hide(hSizerRunButtons);
-    std::string name = profileChoice->choice->GetStringSelection().ToStdString();
-    editProfileName->SetValue(name);
-    if (profile_map[name].online == 1)
+    TraceSpan span("OnSourcesChanged", "inventory");
+    std::vector<inventoryChange> changes;
+    try
     {
-        editProfileOnline->SetValue(true);
+        // The inventory is kept per folder, so this is right even if another profile was picked since.
+        changes = UpdateInventoryFiles(profileDB, root, relativePaths);
     }
-    else
+    catch (std::exception &e)
+    {
+        SetStatusText("Inventory update error: " + std::string(e.what()));
+        return;
+    }
+    if (profileChoice->choice->GetSelection() < 1 || !inventory.scanned)
+    {
+        return;
+    }
+    const profile &p = profile_map[profileChoice->choice->GetStringSelection().ToStdString()];
+    if (root != p.romSource && root != p.chdSource)
+    {
+        return;
+    }
+    std::unordered_set<std::string> affected;
+    for (const inventoryChange &change : changes)
+    {
+        std::string path = root + "/" + change.relativePath;
+        if (change.present)
+        {
+            inventory.files.insert(path);
+        }
+        else
+        {
+            inventory.files.erase(path);
+        }
+        std::string game = GameOfPath(p, root, change.relativePath);
+        if (!game.empty())
+        {
+            affected.insert(game);
+        }
+    }
+    if (affected.empty())
+    {
+        return;
+    }
+
+    try
+    {
+        std::map<std::string, gamePresence> presence;
+        std::vector<std::string> have, notHave;
+        for (const gameMap &game : LoadGames(gameDB, std::vector<std::string>(affected.begin(), affected.end())))
+        {
+            presence[game.name] = GamePresence(inventory, p, game.name, game.disk);
+            (presence[game.name] == PRESENCE_PRESENT ? have : notHave).push_back(game.name);
+        }
+        UpdateHaveTable(gameDB, have, notHave);
+        // A changed zip's audit is stale. It shows blank until the next audit.
+        bool audited = !audits.empty();
+        for (const auto &game : presence)
+        {
+            audits.erase(game.first);
+        }
+        // Only the rows of affected games are touched. The rest of the page stays as it is.
+        if (gameGrid->Grid->GetNumberCols() > 8)
+        {
+            gameGrid->Grid->BeginBatch();
+            for (int row = 0; row < gameGrid->Grid->GetNumberRows(); row++)
+            {
+                auto game = presence.find(gameGrid->Grid->GetCellValue(row, 1).ToStdString());
+                if (game != presence.end())
+                {
+                    gameGrid->Grid->SetCellValue(row, 8, PresenceLabel(game->second));
+                    if (audited && gameGrid->Grid->GetNumberCols() > 9)
+                    {
+                        gameGrid->Grid->SetCellValue(row, 9, "");
+                    }
+                }
+            }
+            gameGrid->Grid->EndBatch();
+        }
+        SetStatusText(wxString::Format("%d games changed in the source folders", (int)presence.size()));
+    }
+    catch (std::exception &e)
+    {
+        SetStatusText("Inventory update error: " + std::string(e.what()));
+    }
+}
+
+void MyFrame::OnScanSources(wxCommandEvent &event)
+{
+    if (profileChoice->choice->GetSelection() < 1)
+    {
+        DisplayMessage("Choose a profile first.");
+        return;
+    }
+    const profile &p = profile_map[profileChoice->choice->GetStringSelection().ToStdString()];
+    if (p.online == 1)
+    {
+        DisplayMessage("This profile downloads its files. There are no source folders to scan.");
+        return;
+    }
+
+    // Scanning a big library over a network share takes a while, so it runs on a worker thread like a run does.
+    // The watcher would write the same rows, so it stops until ReloadInventory starts it again.
+    watcher.reset();
+    std::atomic<bool> abort(false);
+    std::atomic<bool> finished(false);
+    std::vector<scanStats> stats;
+    int jobs = std::max(1, (int)std::thread::hardware_concurrency());
+    std::thread worker([&]()
+                       {
+        for (const std::string &root : {p.romSource, p.chdSource})
+        {
+            if (root.empty() || abort)
+            {
+                continue;
+            }
+            try
+            {
+                stats.push_back(ScanSource(profileDB, root, jobs, false, abort));
+            }
+            catch (std::exception &e)
+            {
+                scanStats failed;
+                failed.error = root + ": " + e.what();
+                stats.push_back(failed);
+            }
+        }
+        finished = true; });
+
+    wxProgressDialog progress("SCAN SOURCE FOLDERS", "Scanning source folders", 100, this, wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_APP_MODAL);
+    progress.Show();
+    while (!finished)
+    {
+        if (!progress.Pulse())
+        {
+            abort = true;
+        }
+        ::wxMilliSleep(100);
+    }
+    worker.join();
+    progress.Hide();
+
+    std::string report;
+    for (const scanStats &s : stats)
+    {
+        if (!s.error.empty())
+        {
+            report += "Error: " + s.error + NEWLINE;
+            continue;
+        }
+        report += wxString::Format("%d files in %d folders (%d changed folders). Added: %d, Removed: %d, Changed: %d. %.1f s%s",
+                                   s.files, s.dirs, s.dirsListed, s.added, s.removed, s.changed, s.seconds, NEWLINE)
+                      .ToStdString();
+    }
+    ReloadInventory();
+    BuildGrid(gameGrid->orderDirection, gameGrid->orderBy, searchBy->GetStringSelection().ToStdString(), searchInput->GetValue().ToStdString(), 1, perPage->GetStringSelection().ToStdString());
+    DisplayMessage(report);
+}
+
+std::vector<gameMap> MyFrame::LoadRunGames(const std::string &profileName)
+{
+    if (!dependencies.loaded)
+    {
+        dependencies = LoadDependencyGraph(gameDB);
+    }
+    std::vector<gameMap> games = LoadProfileGames(profileDB, gameDB, profileName);
+    std::vector<gameMap> required = DependencyClosure(dependencies, games);
+    games.insert(games.end(), required.begin(), required.end());
+    return games;
+}
+
+bool MyFrame::ConfirmRun(const runPlan &plan, bool online)
+{
+    std::string message;
+    const char *types[3][2] = {{"rom", "ROM zips"}, {"7z", "7z sets"}, {"chd", "CHDs"}};
+    for (const auto &type : types)
+    {
+        auto transfer = plan.transfer.find(type[0]);
+        auto unchanged = plan.unchanged.find(type[0]);
+        planGroup toWrite = transfer == plan.transfer.end() ? planGroup() : transfer->second;
+        planGroup upToDate = unchanged == plan.unchanged.end() ? planGroup() : unchanged->second;
+        if (toWrite.files == 0 && upToDate.files == 0)
+        {
+            continue;
+        }
+        message += wxString::Format("%s: %d to %s (%s", type[1], toWrite.files, std::string(type[0]) == "7z" ? "pack" : online ? "download" : "copy", FormatBytes(toWrite.bytes)).ToStdString();
+        if (toWrite.unknownSize > 0)
+        {
+            message += wxString::Format(" + %d of unknown size", toWrite.unknownSize).ToStdString();
+        }
+        message += wxString::Format("), %d already up to date.%s", upToDate.files, NEWLINE).ToStdString();
+    }
+    if (!plan.missing.empty())
+    {
+        message += wxString::Format("%d source files are missing and will fail, e.g. %s%s", (int)plan.missing.size(), plan.missing.front(), NEWLINE).ToStdString();
+    }
+    for (const planSpace &fs : plan.space)
+    {
+        message += wxString::Format("%s needs %s", fs.folder, FormatBytes(fs.needed)).ToStdString();
+        if (fs.estimated > 0)
+        {
+            message += " (about " + FormatBytes(fs.needed + fs.estimated) + " with estimates)";
+        }
+        message += fs.available < 0 ? std::string(", free space unknown.") : ", " + FormatBytes(fs.available) + " free.";
+        message += NEWLINE;
+    }
+    if (plan.estimatedSeconds >= 0)
+    {
+        message += "Estimated time: " + FormatSeconds(plan.estimatedSeconds) + ", going by past runs." + NEWLINE;
+    }
+    if (!plan.Fits())
+    {
+        message += std::string(NEWLINE) + "There isn't enough free space for this run. Start anyway?";
+        return wxMessageBox(message, "Not enough space", wxYES_NO | wxNO_DEFAULT | wxICON_WARNING) == wxYES;
+    }
+    message += std::string(NEWLINE) + "Start the run?";
+    return wxMessageBox(message, online ? "DOWNLOAD GAMES" : "COPY FILES", wxYES_NO | wxICON_QUESTION) == wxYES;
+}
+
+void MyFrame::OnVerifyTarget(wxCommandEvent &event)
+{
+    if (profileChoice->choice->GetSelection() < 1)
+    {
+        DisplayMessage("Choose a profile first.");
+        return;
+    }
+    std::string profileName = profileChoice->choice->GetStringSelection().ToStdString();
+    const profile &p = profile_map[profileName];
+    std::vector<runFile> files;
+    gameChecksums checksums;
+    try
+    {
+        std::vector<gameMap> games = LoadRunGames(profileName);
+        files = PlanRun(p, games);
+        if (menuPackSevenZip->IsChecked() && p.online != 1)
+        {
+            PackFiles(files);
+        }
+        checksums = LoadChecksums(gameDB, games);
+    }
+    catch (std::exception &e)
+    {
+        std::string m("Verify error: ");
+        m.append(e.what());
+        DisplayMessage(m);
+        return;
+    }
+    if (files.empty())
+    {
+        DisplayMessage("No games are selected in this profile.");
+        return;
+    }
+    if (checksums.roms.empty() && checksums.disks.empty())
+    {
+        DisplayMessage("This game DB has no checksums. Update the game DB to verify.");
+        return;
+    }
+
+    // The quick check only reads zip directories and CHD headers. The full one reads every byte, which takes as long as a copy.
+    bool deep = wxMessageBox("Also decompress every ROM and read every CHD through? This takes much longer.", "Verify Target Folder", wxYES_NO | wxNO_DEFAULT | wxICON_QUESTION) == wxYES;
+    std::atomic<bool> abort(false);
+    std::atomic<bool> finished(false);
+    std::atomic<size_t> completed(0);
+    verifyResult result;
+    int jobs = std::max(1, (int)std::thread::hardware_concurrency());
+    std::thread worker([&]()
+                       {
+        result = VerifyFiles(files, checksums, deep, jobs, abort, [&](size_t index, const runFile &file, const std::string &error)
+                             { completed++; });
+        finished = true; });
+
+    wxProgressDialog progress("VERIFY TARGET FOLDER", "Verifying ROM zips and CHDs", (int)files.size(), this, wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_APP_MODAL);
+    progress.Show();
+    while (!finished)
+    {
+        if (!progress.Update((int)std::min(completed.load(), files.size())))
+        {
+            abort = true;
+        }
+        ::wxMilliSleep(100);
+    }
+    worker.join();
+    progress.Hide();
+
+    std::string report = wxString::Format("Good: %d%sBad or missing: %d%sNo checksums: %d%s%.1f s (%s)%s",
+                                          result.good, NEWLINE, result.bad, NEWLINE, result.unchecked, NEWLINE, result.seconds, ChecksumKernels(), NEWLINE)
+                             .ToStdString();
+    if (result.readable > 0)
+    {
+        report += wxString::Format("Compressed CHDs read through but not hashed: %d%s", result.readable, NEWLINE).ToStdString();
+    }
+    const size_t shown = 20;
+    for (size_t i = 0; i < result.errors.size() && i < shown; i++)
+    {
+        report += result.errors[i] + NEWLINE;
+    }
+    if (result.errors.size() > shown)
+    {
+        report += wxString::Format("...and %d more. Run the profile again to replace them.", (int)(result.errors.size() - shown)).ToStdString();
+    }
+    else if (!result.errors.empty())
+    {
+        report += "Run the profile again to replace them.";
+    }
+    DisplayMessage(abort ? "Aborted" : report);
+}
+
+void MyFrame::OnBuildCardImage(wxCommandEvent &event)
+{
+    if (profileChoice->choice->GetSelection() < 1)
+    {
+        DisplayMessage("Choose a profile first.");
+        return;
+    }
+    std::string profileName = profileChoice->choice->GetStringSelection().ToStdString();
+    const profile &p = profile_map[profileName];
+    if (p.online == 1)
+    {
+        DisplayMessage("Images are built from local source folders. Run this profile, then image a local profile whose sources are its targets.");
+        return;
+    }
+    if (!dir_exists(p.romSource))
+    {
+        DisplayMessage("The source rom folder is invalid. Edit the profile and try again.");
+        return;
+    }
+    std::vector<runFile> files;
+    std::vector<runFile> absent;
+    try
+    {
+        std::vector<gameMap> games = LoadRunGames(profileName);
+        files = PlanRun(p, games, dependencies);
+        absent = DropAbsentFiles(files, inventory);
+    }
+    catch (std::exception &e)
+    {
+        std::string m("Image error: ");
+        m.append(e.what());
+        DisplayMessage(m);
+        return;
+    }
+    if (files.empty())
+    {
+        DisplayMessage("No games are selected in this profile.");
+        return;
+    }
+    wxFileDialog fd(this, "Save the card image", "", profileName + ".img", "Disk images (*.img)|*.img|All files|*", wxFD_SAVE | wxFD_OVERWRITE_PROMPT);
+    if (fd.ShowModal() == wxID_CANCEL)
+    {
+        return;
+    }
+    // The card's size, so the image fills it. 0 makes it just big enough.
+    long cardMB = wxGetNumberFromUser("Card size in MB, so the image fills the card. 0 makes it just big enough for the files.", "MB:", "Build SD Card Image", 0, 0, 2097151, this);
+    if (cardMB < 0)
+    {
+        return;
+    }
+    std::string image = fd.GetPath().ToStdString();
+    std::atomic<bool> abort(false);
+    std::atomic<bool> finished(false);
+    std::atomic<int> percent(0);
+    imageResult result;
+    std::string error;
+    std::thread worker([&]()
+                       {
+        error = BuildFatImage(image, ImageFiles(p, files), (uint64_t)cardMB << 20, profileName, abort, result, [&](uint64_t done, uint64_t total)
+                              { percent = total > 0 ? (int)(done * 100 / total) : 100; });
+        finished = true; });
+
+    wxProgressDialog progress("BUILD SD CARD IMAGE", "Writing " + image, 100, this, wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_APP_MODAL);
+    progress.Show();
+    while (!finished)
+    {
+        if (!progress.Update(std::min(100, percent.load())))
+        {
+            abort = true;
+        }
+        ::wxMilliSleep(100);
+    }
+    worker.join();
+    progress.Hide();
+
+    if (!error.empty())
+    {
+        DisplayMessage(abort ? "Aborted" : error);
+        return;
+    }
+    std::string report = wxString::Format("Files: %d%sImage: %s, %s clusters%s%.1f s%s", result.files, NEWLINE, FormatBytes(result.bytes), FormatBytes(result.clusterBytes), NEWLINE,
+                                          result.seconds, NEWLINE)
+                             .ToStdString();
+    std::vector<std::string> leftOut = result.errors;
+    for (const runFile &file : absent)
+    {
+        leftOut.push_back("Not found by the last scan: " + file.source);
+    }
+    const size_t shown = 20;
+    for (size_t i = 0; i < leftOut.size() && i < shown; i++)
+    {
+        report += leftOut[i] + NEWLINE;
+    }
+    if (leftOut.size() > shown)
+    {
+        report += wxString::Format("...and %d more were left out.", (int)(leftOut.size() - shown)).ToStdString();
+    }
+    DisplayMessage(report);
+}
+
+void MyFrame::OnBuildBudgetProfile(wxCommandEvent &event)
+{
+    if (profileChoice->choice->GetSelection() < 1)
+    {
+        DisplayMessage("Choose a profile first.");
+        return;
+    }
+    std::string profileName = profileChoice->choice->GetStringSelection().ToStdString();
+    // A copy, as PopulateProfileChoice reloads profile_map.
+    profile p = profile_map[profileName];
+    if (p.online == 1)
+    {
+        DisplayMessage("Games are fitted by the sizes of their local source files. Choose a local profile.");
+        return;
+    }
+    long cardMB = wxGetNumberFromUser("Card size in MB. The best ranked games matching the search and the Select menu are fitted into it, with the parent, BIOS and device sets they need.",
+                                      "MB:", "Build Profile to Fit", 32768, 1, 2097151, this);
+    if (cardMB < 1)
+    {
+        return;
+    }
+    wxArrayString rules;
+    rules.Add("Best rank first");
+    rules.Add("Most rank points per MB");
+    int rule = wxGetSingleChoiceIndex("Which games go in first?", "Build Profile to Fit", rules, this);
+    if (rule < 0)
+    {
+        return;
+    }
+    std::string into = trim(wxGetTextFromUser("Profile to select the games in. A new profile gets this profile's folders.", "Build Profile to Fit", profileName + " " + std::to_string(cardMB) + " MB", this).ToStdString());
+    if (into.empty())
+    {
+        return;
+    }
+    if (profile_map.count(into) && wxMessageBox("Replace the games selected in " + into + "?", "Build Profile to Fit", wxYES_NO | wxNO_DEFAULT | wxICON_QUESTION) != wxYES)
+    {
+        return;
+    }
+    try
+    {
+        if (!dependencies.loaded)
+        {
+            dependencies = LoadDependencyGraph(gameDB);
+        }
+        int64_t budget = (int64_t)cardMB << 20;
+        std::vector<budgetGame> candidates = BudgetCandidates(gameDB, CurrentFilter(searchBy->GetStringSelection().ToStdString(), searchInput->GetValue().ToStdString()));
+        budgetSelection selection = SelectWithinBudget(candidates, LoadSetSizes(profileDB, gameDB, p, candidates, dependencies), dependencies, budget, rule == 1 ? BUDGET_MOST_POINTS : BUDGET_BEST_FIRST, FatClusterBytes(budget));
+        profile target = profile_map.count(into) ? profile_map[into] : p;
+        target.name = into;
+        ReplaceProfileGames(profileDB, target, selection.games);
+        PopulateProfileChoice();
+        PopulateProfileChoice(profileChoice->choice->GetStrings().Index(into));
+        std::string report = wxString::Format("Games: %d of %d matching%sSets they need: %d, %s%sOn the card: %s of %s%sRank points: %lld%s",
+                                              (int)selection.games.size(), selection.candidates, NEWLINE, selection.dependencies, FormatBytes(selection.dependencyBytes), NEWLINE,
+                                              FormatBytes(selection.bytes), FormatBytes(budget), NEWLINE, (long long)selection.points, NEWLINE)
+                                 .ToStdString();
+        if (selection.unsized > 0)
+        {
+            report += wxString::Format("Left out because their files aren't in the source folders or can't be rebuilt from them: %d", selection.unsized).ToStdString();
+        }
+        DisplayMessage(report);
+    }
+    catch (std::exception &e)
+    {
+        std::string m("Build profile error: ");
+        m.append(e.what());
+        DisplayMessage(m);
+    }
+}
+
+void MyFrame::OnTransferRate(wxCommandEvent &event)
+{
+    std::string spec = rateSchedule;
+    while (true)
+    {
+        wxTextEntryDialog dialog(this, "KB/s for runs to keep to, shared by all their files. Comma separated, each for a time of day or all day; the first that matches wins and a time with none is unlimited.\n"
+                                       "For example 08:00-18:00=2048,512 is 2 MB/s during office hours and 512 KB/s otherwise. Blank is no limit.",
+                                 "Transfer Rate", spec);
+        if (dialog.ShowModal() != wxID_OK)
+        {
+            return;
+        }
+        spec = trim(dialog.GetValue().ToStdString());
+        std::vector<rateWindow> schedule;
+        std::string error = ParseRateSchedule(spec, schedule);
+        if (error.empty())
+        {
+            rateSchedule = spec;
+            return;
+        }
+        wxMessageBox(error, "Transfer Rate", wxOK | wxICON_ERROR);
+    }
+}
+
+void MyFrame::OnAuditZips(wxCommandEvent &event)
+{
+    if (profileChoice->choice->GetSelection() < 1)
+    {
+        DisplayMessage("Choose a profile first.");
+        return;
+    }
+    const profile &p = profile_map[profileChoice->choice->GetStringSelection().ToStdString()];
+    // A local profile's library is its source folder. A downloading profile only has what it downloaded.
+    std::string folder = p.online == 1 ? p.romTarget : p.romSource;
+    if (!dir_exists(folder))
+    {
+        DisplayMessage("The profile's rom folder is invalid. Edit your profile and try again.");
+        return;
+    }
+
+    std::atomic<bool> abort(false);
+    std::atomic<bool> finished(false);
+    std::atomic<size_t> done(0);
+    std::atomic<size_t> total(0);
+    folderAudit result;
+    std::string error;
+    int jobs = std::max(1, (int)std::thread::hardware_concurrency());
+    std::thread worker([&]()
+                       {
+        try
+        {
+            result = AuditFolder(gameDB, folder, jobs, abort, [&](size_t d, size_t t)
+                                 {
+                done = d;
+                total = t; });
+        }
+        catch (std::exception &e)
+        {
+            error = e.what();
+        }
+        finished = true; });
+
+    wxProgressDialog progress("AUDIT ROM ZIPS", "Reading zip directories", 100, this, wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_APP_MODAL);
+    progress.Show();
+    while (!finished)
+    {
+        bool keepGoing = total > 0 ? progress.Update((int)(done * 100 / total), wxString::Format("Reading zip directories (%d/%d)", (int)done.load(), (int)total.load())) : progress.Pulse();
+        if (!keepGoing)
+        {
+            abort = true;
+        }
+        ::wxMilliSleep(100);
+    }
+    worker.join();
+    progress.Hide();
+    if (!error.empty())
+    {
+        DisplayMessage("Audit error: " + error);
+        return;
+    }
+    if (abort)
+    {
+        DisplayMessage("Aborted");
+        return;
+    }
+
+    audits = std::move(result.games);
+    BuildGrid(gameGrid->orderDirection, gameGrid->orderBy, searchBy->GetStringSelection().ToStdString(), searchInput->GetValue().ToStdString(), gameGrid->curPage, perPage->GetStringSelection().ToStdString());
+    std::string report = wxString::Format("%d zips in %.1f s%s", (int)audits.size(), result.seconds, NEWLINE).ToStdString();
+    for (int status = AUDIT_NO_CHECKSUMS; status < AUDIT_STATUSES; status++)
+    {
+        report += wxString::Format("%s: %d%s", AuditLabel((zipAuditStatus)status), result.counts[status], NEWLINE).ToStdString();
+    }
+    DisplayMessage(report);
+}
+
+void MyFrame::OnNewProfile(wxCommandEvent &event)
+{
+    BuildNewProfilePanel();
+    vSizer->Hide(hSizerLoad);
+    ChangeMainBookPage(romperNewProfile);
+}
+
+void MyFrame::OnEditProfile(wxCommandEvent &event)
+{
+    BuildEditProfilePanel();
+    vSizer->Hide(hSizerLoad);
+    vSizer->Hide(hSizerRunButtons);
+    std::string name = profileChoice->choice->GetStringSelection().ToStdString();
+    editProfileName->SetValue(name);
+    if (profile_map[name].online == 1)
+    {
+        editProfileOnline->SetValue(true);
+    }
+    else
     {
         editProfileOnline->SetValue(false);
     }
+    editProfileBaseUrl->SetValue(profile_map[name].baseUrl);
     editProfileROMSourceFolder->SetLabelText(profile_map[name].romSource);
     editProfileROMTargetFolder->SetLabelText(profile_map[name].romTarget);
     editProfileCHDSourceFolder->SetLabelText(profile_map[name].chdSource);
@@ -1169,6 +1846,13 @@ void MyFrame::ChangeMainBookPage(int page)
     mainBook->book->SetSelection(page);
 }
 
+const std::vector<std::pair<std::string, long long>> &MyFrame::AddStartupTimes(const std::vector<std::pair<std::string, long long>> &before, const std::vector<std::pair<std::string, long long>> &after)
+{
+    startupTimes.insert(startupTimes.begin(), before.begin(), before.end());
+    startupTimes.insert(startupTimes.end(), after.begin(), after.end());
+    return startupTimes;
+}
+
 void MyFrame::OnGridLabelClick(wxGridEvent &event)
 {
     // if the check box, the select all.
@@ -1182,55 +1866,22 @@ void MyFrame::OnGridLabelClick(wxGridEvent &event)
         {
             gameGrid->prevChangeAll = "";
         }
-        std::string gameNames[gameGrid->Grid->GetNumberRows()];
-        std::string qmarks = "";
-        for (int i = 0; i <= gameGrid->Grid->GetNumberRows()-1; i++)
+        std::vector<std::string> gameNames;
+        for (int i = 0; i < gameGrid->Grid->GetNumberRows(); i++)
         {
-            
-            wxGridCellCoords coords = wxGridCellCoords();
-            coords.Set(i, 1);
-            gameNames[i] = gameGrid->Grid->GetCellValue(coords).ToStdString();
-            qmarks.append("?,");
+            gameNames.push_back(gameGrid->Grid->GetCellValue(i, 1).ToStdString());
         }
-        qmarks.pop_back(); // remove last comma.
         try
         {
-            if (gameGrid->prevChangeAll == "")
-            {
-                
-                std::string qstr = "DELETE FROM games WHERE profile=? AND game IN(" + qmarks + ");";
-                SQLite::Statement query(profileDB, qstr);
-                query.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-                for (int i = 1; i <= gameGrid->Grid->GetNumberRows(); i++)
-                {
-                    query.bind(i + 1, gameNames[i - 1]);
-                }
-                query.exec();
-                //Set X after exec so we know it ran fine.
-                
-                gameGrid->Grid->BeginBatch();
-                for (int i = 0; i < gameGrid->Grid->GetNumberRows(); i++)
-                {
-                    gameGrid->Grid->SetCellValue(i, 0, "");
-                }
-                gameGrid->Grid->EndBatch();
-                
-            }
-            else
+            // One transaction for the whole page. Set X after it commits so we know it ran fine.
+            bool selected = gameGrid->prevChangeAll != "";
+            SetGamesSelected(profileDB, profileChoice->choice->GetStringSelection().ToStdString(), gameNames, selected);
+            gameGrid->Grid->BeginBatch();
+            for (int i = 0; i < gameGrid->Grid->GetNumberRows(); i++)
             {
-                
-                for (int i = 0; i < gameGrid->Grid->GetNumberRows(); i++)
-                {
-                    SQLite::Statement query(profileDB, "INSERT OR REPLACE INTO games (profile,game) VALUES (?,?);");
-                    query.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-                    query.bind(2, gameNames[i]);
-                    //DisplayMessage(query.getExpandedSQL());
-                    query.exec();
-                    wxGridCellCoords coords = wxGridCellCoords();
-                    coords.Set(i, 0);
-                    gameGrid->Grid->SetCellValue(i, 0, "1");
-                }
+                gameGrid->Grid->SetCellValue(i, 0, selected ? "1" : "");
             }
+            gameGrid->Grid->EndBatch();
         }
         catch (std::exception &e)
         {
@@ -1241,6 +1892,12 @@ void MyFrame::OnGridLabelClick(wxGridEvent &event)
         return;
     }
 
+    // The have and audit columns aren't games columns, so they can't be ordered by.
+    if (gameGrid->Grid->GetColLabelValue(event.GetCol()).ToStdString() == "Have" || gameGrid->Grid->GetColLabelValue(event.GetCol()).ToStdString() == "Audit")
+    {
+        return;
+    }
+
     // else, do order.
     //  Swap order direction
     if (gameGrid->orderDirection == "ASC")
@@ -1262,22 +1919,8 @@ void MyFrame::OnGridClick(wxGridEvent &event)
     std::string g = gameGrid->Grid->GetCellValue(event.GetRow(), 1).ToStdString(); // the game's name.
     try
     {
-        if (v == "1")
-        {
-            SQLite::Statement query(profileDB, "DELETE FROM games WHERE profile=? AND game=?;");
-            query.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-            query.bind(2, g);
-            query.exec();
-            gameGrid->Grid->SetCellValue(event.GetRow(), 0, "");
-        }
-        else
-        {
-            SQLite::Statement query(profileDB, "INSERT OR REPLACE INTO games (profile,game) VALUES (?,?);");
-            query.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-            query.bind(2, g);
-            query.exec();
-            gameGrid->Grid->SetCellValue(event.GetRow(), 0, "1");
-        }
+        SetGamesSelected(profileDB, profileChoice->choice->GetStringSelection().ToStdString(), {g}, v != "1");
+        gameGrid->Grid->SetCellValue(event.GetRow(), 0, v == "1" ? "" : "1");
     }
     catch (std::exception &e)
     {
@@ -1308,20 +1951,14 @@ void MyFrame::OnNewProfileSaveButton(wxCommandEvent &event)
     }
     try
     {
-        SQLite::Statement query(profileDB, "INSERT INTO profiles (name,online,romSource,chdSource,romTarget,chdTarget) VALUES (?,?,?,?,?,?);");
         int isOnline = 0;
         if (newProfileOnline->IsChecked())
         {
             isOnline = 1;
         }
         std::string name = trim(newProfileName->GetValue().ToStdString());
-        query.bind(1, name);
-        query.bind(2, isOnline);
-        query.bind(3, newProfileROMSourceFolder->GetLabelText().ToStdString());
-        query.bind(4, newProfileCHDSourceFolder->GetLabelText().ToStdString());
-        query.bind(5, newProfileROMTargetFolder->GetLabelText().ToStdString());
-        query.bind(6, newProfileCHDTargetFolder->GetLabelText().ToStdString());
-        query.exec();
+        CreateProfile(profileDB, profile{name, isOnline, newProfileROMSourceFolder->GetLabelText().ToStdString(), newProfileCHDSourceFolder->GetLabelText().ToStdString(),
+                                         newProfileROMTargetFolder->GetLabelText().ToStdString(), newProfileCHDTargetFolder->GetLabelText().ToStdString(), trim(newProfileBaseUrl->GetValue().ToStdString())});
         PopulateProfileChoice();
         PopulateProfileChoice(profileChoice->choice->GetStrings().Index(name));
         vSizer->Show(hSizerLoad);
@@ -1360,21 +1997,13 @@ void MyFrame::OnEditProfileSaveButton(wxCommandEvent &event)
     }
     try
     {
-        SQLite::Statement query(profileDB, "UPDATE profiles SET name=?,online=?,romSource=?,chdSource=?,romTarget=?,chdTarget=? WHERE name=?;");
         int isOnline = 0;
         if (editProfileOnline->IsChecked())
         {
             isOnline = 1;
         }
-
-        query.bind(1, trim(editProfileName->GetValue().ToStdString()));
-        query.bind(2, isOnline);
-        query.bind(3, editProfileROMSourceFolder->GetLabelText().ToStdString());
-        query.bind(4, editProfileCHDSourceFolder->GetLabelText().ToStdString());
-        query.bind(5, editProfileROMTargetFolder->GetLabelText().ToStdString());
-        query.bind(6, editProfileCHDTargetFolder->GetLabelText().ToStdString());
-        query.bind(7, prevName);
-        query.exec();
+        UpdateProfile(profileDB, prevName, profile{trim(editProfileName->GetValue().ToStdString()), isOnline, editProfileROMSourceFolder->GetLabelText().ToStdString(), editProfileCHDSourceFolder->GetLabelText().ToStdString(),
+                                                   editProfileROMTargetFolder->GetLabelText().ToStdString(), editProfileCHDTargetFolder->GetLabelText().ToStdString(), trim(editProfileBaseUrl->GetValue().ToStdString())});
         PopulateProfileChoice(profileChoice->choice->GetStrings().Index(prevName));
         vSizer->Show(hSizerLoad);
         vSizer->Layout();
@@ -1402,12 +2031,7 @@ void MyFrame::OnEditProfileDeleteButton(wxCommandEvent &event)
     case wxYES:
         try
         {
-            SQLite::Statement query(profileDB, "DELETE FROM profiles WHERE name=?;");
-            query.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-            query.exec();
-            SQLite::Statement query2(profileDB, "DELETE FROM games WHERE profile=?;");
-            query2.bind(1, profileChoice->choice->GetStringSelection().ToStdString());
-            query2.exec();
+            DeleteProfile(profileDB, profileChoice->choice->GetStringSelection().ToStdString());
             PopulateProfileChoice();
             vSizer->Show(hSizerLoad);
             vSizer->Layout();
@@ -1495,6 +2119,7 @@ void MyFrame::OnNewProfileCancelButton(wxCommandEvent &event)
     newProfileCHDTargetFolder->SetLabel("");
     newProfileName->SetValue("");
     newProfileOnline->SetValue(false);
+    newProfileBaseUrl->SetValue("");
 
     profileChoice->choice->SetSelection(0);
     wxCommandEvent evt(wxEVT_CHOICE, profileChoice->choice->GetId());
@@ -1511,6 +2136,7 @@ void MyFrame::OnEditProfileCancelButton(wxCommandEvent &event)
     editProfileCHDTargetFolder->SetLabel("");
     editProfileName->SetValue("");
     editProfileOnline->SetValue(false);
+    editProfileBaseUrl->SetValue("");
 
     // profileChoice->choice->SetSelection(0);
     wxCommandEvent evt(wxEVT_CHOICE, profileChoice->choice->GetId());
@@ -1563,151 +2189,126 @@ void MyFrame::OnEditProfileOnline(wxCommandEvent &event)
 
 void MyFrame::OnRunButton(wxCommandEvent &event)
 {
-    std::string profileName = profileChoice->choice->GetStringSelection().ToStdString();
-    // make sure the target folders are real.
-    struct stat sb;
+    RunProfiles({profileChoice->choice->GetStringSelection().ToStdString()});
+}
 
-    if (!dir_exists(profile_map[profileName].romTarget))
+void MyFrame::OnRunSeveralProfiles(wxCommandEvent &event)
+{
+    wxArrayString names;
+    for (const auto &p : profile_map)
     {
-        DisplayMessage("Your Rom Target path is invalid. Edit your profile and try again.");
-        return;
+        names.Add(p.first);
     }
-    std::string romTargetFolder = profile_map[profileName].romTarget;
-    if (!dir_exists(profile_map[profileName].chdTarget))
+    wxMultiChoiceDialog dialog(this, "Profiles built from the same library share one read of each source file.", "Run Several Profiles", names);
+    if (dialog.ShowModal() != wxID_OK)
     {
-        DisplayMessage("Your CHD Target path is invalid. Edit your profile and try again.");
         return;
     }
-    std::string chdTargetFolder = profile_map[profileName].chdTarget;
-    // get current profile's selected games.
-    try
+    std::vector<std::string> chosen;
+    for (int index : dialog.GetSelections())
     {
-        SQLite::Statement query(profileDB, "SELECT game FROM games WHERE profile = ?;");
-        query.bind(1, profileName);
-        std::string whereIn = "(";
-
-        std::vector<gameMap> checkedGames{};
+        chosen.push_back(names[index].ToStdString());
+    }
+    if (chosen.empty())
+    {
+        DisplayMessage("No profiles were chosen.");
+        return;
+    }
+    RunProfiles(chosen);
+}
 
-        while (query.executeStep())
+void MyFrame::RunProfiles(const std::vector<std::string> &names)
+{
+    bool several = names.size() > 1;
+    bool online = profile_map[names.front()].online == 1;
+    std::string selected = profileChoice->choice->GetStringSelection().ToStdString();
+    std::vector<std::vector<runFile>> profileFiles;
+    std::vector<std::vector<runFile>> profileAbsent;
+    std::vector<gameMap> allGames;
+    gameChecksums checksums;
+    std::vector<rateWindow> schedule;
+    std::string rateError = ParseRateSchedule(rateSchedule, schedule);
+    if (!rateError.empty())
+    {
+        // Only ROMPER_RATE can get here unchecked.
+        DisplayMessage("The transfer rate is invalid: " + rateError + " Fix it in File > Transfer Rate and try again.");
+        return;
+    }
+    if (!cacheError.empty())
+    {
+        DisplayMessage("ROMPER_CACHE_MB is invalid: " + cacheError + ". Fix it and restart Romper.");
+        return;
+    }
+    for (const std::string &profileName : names)
+    {
+        const profile &p = profile_map[profileName];
+        std::string which = several ? profileName + ": " : "";
+        // make sure the target folders are real.
+        if (!dir_exists(p.romTarget))
         {
-            whereIn.append("\"" + query.getColumn(0).getString() + "\",");
+            DisplayMessage(which + "Your Rom Target path is invalid. Edit your profile and try again.");
+            return;
         }
-        whereIn.pop_back();
-        whereIn.append(");");
-        std::string strTmp = "SELECT name,disk FROM games WHERE name IN " + whereIn;
-        SQLite::Statement query2(gameDB, strTmp);
-        while (query2.executeStep())
+        if (!dir_exists(p.chdTarget))
         {
-            checkedGames.push_back(gameMap{query2.getColumn(0).getString(), query2.getColumn(1).getString()});
+            DisplayMessage(which + "Your CHD Target path is invalid. Edit your profile and try again.");
+            return;
         }
-        int totalGames = std::size(checkedGames);
-
-        std::string totalGamesString = std::to_string(totalGames); // So we don't have to keep calling to_string
-        wxString runErrors = "";
-        if (profile_map[profileName].online == 1)
+        if (p.online != 1 && !dir_exists(p.romSource))
         {
-            int current_file = 0;
-            bool downloading = false;
-            bool abort = false;
-            bool done = false;
-            wxProgressDialog progress("DOWNLOAD GAMES", "Downloading Games", 100, this, wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_APP_MODAL);
-            progress.Show();
-            std::string url = "https://archive.org/download/mame-chds-roms-extras-complete/";
-            wxString runErrors;
-
-            while (!abort && current_file < totalGames)
-            {
-                abort |= DownloadGame(checkedGames[current_file], "rom", url, runErrors, progress);
-                if (checkedGames[current_file].disk.size() > 0)
-                {
-                    abort |= DownloadGame(checkedGames[current_file], "chd", url, runErrors, progress);
-                }
-                current_file++;
-            }
-            if (abort)
-            {
-                progress.Hide();
-                DisplayMessage("Aborted");
-                return; // If we aborted, don't download CHDs.
-            }
-            if (runErrors.size() < 1)
-            {
-                DisplayMessage("Finished with no errors!");
-            }
-            else
-            {
-                DisplayMessage("Finished with errors");
-            }
+            DisplayMessage(which + "Your Rom Source path is invalid. Edit your profile or select to 'download' instead and try again.");
+            return;
         }
-        else
+        if ((p.online == 1) != online)
         {
-            // COPY instead of download
-            if (!dir_exists(profile_map[profileName].romSource))
-            {
-                wxLogMessage("Your Rom Source path is invalid. Edit your profile or select to 'download' instead and try again.");
-                return;
-            }
-            wxProgressDialog progress("COPY FILES", "Copying Files", 100, this, wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_APP_MODAL);
-            progress.Show();
-            int current_file = 0;
-            bool abort = false;
-            while (current_file < totalGames && !abort)
+            DisplayMessage("Profiles run together must all download, or all copy.");
+            return;
+        }
+        std::vector<runFile> files;
+        try
+        {
+            std::vector<gameMap> games = LoadRunGames(profileName);
+            files = PlanRun(p, games, dependencies);
+            if (menuPackSevenZip->IsChecked() && !online)
             {
-                // Copy the ROM
-                abort |= !progress.Pulse(wxString::Format("Copying (%d/%d): %s", current_file + 1, totalGames, checkedGames[current_file].name));
-                if (!std::filesystem::copy_file(profile_map[profileName].romSource + "/" + checkedGames[current_file].name + ".zip", profile_map[profileName].romTarget + "/" + checkedGames[current_file].name + ".zip",
-                                                std::filesystem::copy_options::overwrite_existing))
-                {
-                    runErrors.Append(wxString::Format("Error copying file: %s%s", checkedGames[current_file].name + ".zip", NEWLINE));
-                }
-
-                if (checkedGames[current_file].disk.size() > 0)
-                {
-                    std::filesystem::remove_all(profile_map[profileName].chdTarget + "/" + checkedGames[current_file].name);
-                    if (!std::filesystem::create_directory(profile_map[profileName].chdTarget + "/" + checkedGames[current_file].name))
-                    {
-                        wxLogMessage("error creating CHD folder. Be sure you have write permissions and that there is enough space. Aborting.");
-                        return;
-                    }
-                    abort |= !progress.Pulse(wxString::Format("Copying (%d/%d): DISK %s", current_file + 1, totalGames, checkedGames[current_file].disk));
-                    if (!std::filesystem::copy_file(profile_map[profileName].chdSource + "/" + checkedGames[current_file].name + "/" + checkedGames[current_file].disk + ".chd",
-                                                    profile_map[profileName].chdTarget + "/" + checkedGames[current_file].name + "/" + checkedGames[current_file].disk + ".chd",
-                                                    std::filesystem::copy_options::overwrite_existing))
-                    {
-                        runErrors.Append(wxString::Format("Error copying file: %s%s", checkedGames[current_file].disk + ".chd", NEWLINE));
-                    }
-                }
-
-                current_file++;
-                if (abort)
-                {
-                    return; // If we aborted, don't download CHDs.
-                }
+                PackFiles(files);
             }
-            progress.Hide();
+            allGames.insert(allGames.end(), games.begin(), games.end());
+        }
+        catch (std::exception &e)
+        {
+            std::string m("RUN Error: ");
+            m.append(e.what());
+            DisplayMessage(m);
+            return;
+        }
+        // Files the last scan didn't find would only fail, so they are reported without being tried.
+        std::vector<runFile> absent = DropAbsentFiles(files, profileName == selected ? inventory : LoadInventory(profileDB, p));
+        if (files.empty() && absent.empty())
+        {
+            DisplayMessage(which + "No games are selected in this profile.");
+            return;
+        }
+        if (files.empty())
+        {
+            DisplayMessage(which + "None of this profile's files were found by the last scan. Scan the source folders again or edit the profile.");
+            return;
+        }
+        profileFiles.push_back(files);
+        profileAbsent.push_back(absent);
+    }
 
-            if (runErrors.size() > 0)
-            {
-                int dialog_return_value = wxNO;
-                wxMessageDialog *saveLog = new wxMessageDialog(this, "This finished with errors. Would you like to save the errors to a file?", "This finished with errors. Would you like to save the errors to a file?", wxYES_NO | wxNO_DEFAULT | wxICON_QUESTION);
-                dialog_return_value = saveLog->ShowModal();
-                if (dialog_return_value == wxYES)
-                {
-                    wxDirDialog dd = wxDirDialog(panel, "Choose location to save log", "", wxDD_DEFAULT_STYLE | wxDD_DIR_MUST_EXIST);
-                    dd.ShowModal();
-                    dd.GetPath();
-                    wxTextFile file(dd.GetPath().Append("/romper_log.txt"));
-                    file.Create();
-                    file.Open();
-                    file.AddLine(runErrors);
-                    file.Write();
-                    file.Close();
-                }
-            }
-            else
-            {
-                DisplayMessage("Completed with no errors");
-            }
+    // Look before writing anything: what is already there, whether the rest fits and how long it should take.
+    std::vector<runPlan> plans;
+    runPlan plan;
+    fanOut merged;
+    std::vector<runFile> files;
+    try
+    {
+        checksums = LoadChecksums(gameDB, allGames);
+        for (size_t k = 0; k < names.size(); k++)
+        {
+            plans.push_back(PlanTransfers(profileDB, profile_map[names[k]], profileFiles[k], checksums, std::max(1, (int)std::thread::hardware_concurrency()), cache));
         }
     }
     catch (std::exception &e)
@@ -1717,175 +2318,147 @@ void MyFrame::OnRunButton(wxCommandEvent &event)
         DisplayMessage(m);
         return;
     }
-}
-bool MyFrame::DownloadGame(gameMap game, const char *type, const std::string url, wxString &runErrors, wxProgressDialog &progress)
-{
-    bool abort = false;
-    bool done = false;
-    bool downloading = false;
+    if (several)
+    {
+        // One run for them all: each source read once and fanned out to every target that needs it.
+        merged = FanOutFiles(profileFiles);
+        plan = CombinePlans(plans, merged);
+        files = merged.files;
+    }
+    else
+    {
+        plan = plans.front();
+        files = profileFiles.front();
+    }
+    if (!ConfirmRun(plan, online))
+    {
+        return;
+    }
 
-    while (!done && !abort)
+    // The transfers block, so they run on a worker thread while this one keeps the progress dialog alive.
+    std::atomic<bool> abort(false);
+    std::atomic<bool> finished(false);
+    std::mutex currentMutex;
+    size_t completed = 0;
+    int64_t bytesDone = 0;
+    std::string current = "";
+    runResult result;
+    runRecord run;
+    run.started = EpochMs();
+    run.online = online ? 1 : 0;
+    // As many files at a time as there are cores. RunFiles holds each drive to what it can take, so a card or spinning disk still gets one.
+    run.jobs = std::max(1, (int)std::thread::hardware_concurrency());
+    Throttle throttle(schedule);
+    std::thread worker([&]()
+                       {
+        result = RunFiles(files, online, run.jobs, abort, [&](size_t index, const runFile &file, const std::string &error)
+                          {
+            std::lock_guard<std::mutex> lock(currentMutex);
+            completed++;
+            bytesDone += plan.bytes[index];
+            current = file.type + " " + file.game; }, checksums, cache, &throttle);
+        finished = true; });
+    // The bar moves by planned kilobytes rather than files, so a CHD weighs what it should and the time left means something.
+    // With no size known or estimated (a first download), it falls back to files.
+    bool byBytes = plan.estimatedBytes >= 1024;
+    int range = byBytes ? (int)(plan.estimatedBytes / 1024) : (int)files.size();
+    wxProgressDialog progress(online ? "DOWNLOAD GAMES" : "COPY FILES", online ? "Downloading Games" : "Copying Files", range, this,
+                              wxPD_SMOOTH | wxPD_CAN_ABORT | wxPD_ELAPSED_TIME | wxPD_REMAINING_TIME | wxPD_APP_MODAL);
+    progress.Show();
+    while (!finished)
     {
-        if (!downloading)
+        size_t done;
+        int64_t kilobytes;
+        std::string message;
         {
-            wxWebRequest request;
-            if (std::string(type) == "rom")
+            std::lock_guard<std::mutex> lock(currentMutex);
+            done = completed;
+            kilobytes = byBytes ? bytesDone / 1024 : (int64_t)completed;
+            message = current;
+        }
+        if (!progress.Update((int)std::min<int64_t>(kilobytes, range - 1), wxString::Format("%s (%d/%d): %s", online ? "Downloading" : "Copying", (int)done, (int)files.size(), message)))
+        {
+            // Cancel offers a pause first. The worker holds at its next file or chunk while the box is up.
+            throttle.Pause();
+            if (wxMessageBox("Pause the run instead of stopping it? Files in flight keep what they have.", "Pause", wxYES_NO | wxICON_QUESTION) == wxYES)
             {
-                request = wxWebSession::GetDefault().CreateRequest(this, url + game.name + ".zip");
+                wxMessageBox("Paused. Click OK to resume.", "Paused", wxOK | wxICON_INFORMATION);
+                progress.Resume();
             }
             else
             {
-                request = wxWebSession::GetDefault().CreateRequest(this, url + game.name + "/" + game.disk + ".chd");
-                // std::cout << url + game.name + "/" + game.disk + ".chd" << std::endl;
+                abort = true;
             }
-            Bind(wxEVT_WEBREQUEST_STATE, [&](wxWebRequestEvent &evt)
-                 {
-                        switch (evt.GetState())
-                        {
-                            //Done! mark download as false.
-                            case wxWebRequest::State_Completed:
-                            {   
-                                downloading = false;
-                                done = true;
-                                wxInputStream *istream = evt.GetResponse().GetStream();
-                                if( istream->IsOk() ) {
-                                    if (std::string(type) == "rom") {
-                                        wxFileOutputStream ostream( profile_map[profileChoice->choice->GetStringSelection().ToStdString()].romTarget + "/" + game.name+".zip" );
-                                        if( ostream.IsOk() ) {
-                                        ostream.Write( *istream );
-                                        ostream.Close();
-                                        }
-                                    } else {
-                                        if( istream->IsOk() ) {
-                                            std::filesystem::remove_all(profile_map[profileChoice->choice->GetStringSelection().ToStdString()].romTarget + "/" + game.name);
-                                            if (!std::filesystem::create_directory(profile_map[profileChoice->choice->GetStringSelection().ToStdString()].romTarget + "/" + game.name)){
-                                                runErrors.Append(wxString::Format("Could not create folder: %s%s", profile_map[profileChoice->choice->GetStringSelection().ToStdString()].romTarget + "/" + game.name,NEWLINE));
-                                            }
-                                            wxFileOutputStream ostream( profile_map[profileChoice->choice->GetStringSelection().ToStdString()].romTarget + "/" + game.name+"/"+ game.disk+".chd");
-                                            if( ostream.IsOk() ) {
-                                                ostream.Write( *istream );
-                                                ostream.Close();
-                                            }
-                                }
-                                    }
-                                    
-                                } else {
-                                    switch (istream->GetLastError()) {
-                                        case wxStreamError::wxSTREAM_NO_ERROR:
-                                        {
-                                            std::cout << "STREAM NO ERROR";
-                                            break;
-                                        }
-                                        case wxStreamError::wxSTREAM_EOF:
-                                        {
-                                            std::cout << "STREAM EOF ERROR";
-                                            break;
-                                        }
-                                        case wxStreamError::wxSTREAM_WRITE_ERROR:
-                                        {
-                                            std::cout << "STREAM WRITE ERROR";
-                                            break;
-                                        }
-                                        case wxStreamError::wxSTREAM_READ_ERROR:
-                                        {
-                                            std::cout << "STREAM READ ERROR";
-                                            break;
-                                        }
-                                        default:
-                                        {
-                                            break;
-                                        }
-                                    }
-                                }
-                        
-                                done = true;
-                                downloading = false;
-                            }
-                                break;
-                                case wxWebRequest::State_Failed:
-                                {
-                                    std::cout << "State_Failed " << type << " " << game.name << std::endl;
-                                    //wxLogError("Could not download: %s", checkedGames[current_file].name);
-                                    //abort = true;
-                                    done = true;
-                                    downloading = false;
-                                     break;
-                                }
-                                case wxWebRequest::State_Unauthorized:
-                                {
-                                    std::cout << "State_Unauthorized " << type << " " << game.name << std::endl;
-                                    done = true;
-                                    downloading = false;
-                                    break;
-                                }
-                                default:
-                                //std::cout << evt.GetState() << "Unknown " << type << " " << game.name << std::endl;
-                                break;
-                        } });
-            done = false;
-            downloading = true;
-            request.Start();
-        }
-        abort |= !progress.Pulse(wxString::Format("Downloading %s %s", type, game.name));
-        ::wxYield();
-        ::wxMilliSleep(250);
+            throttle.Resume();
+        }
+        ::wxMilliSleep(100);
     }
-    if (abort)
+    worker.join();
+    progress.Hide();
+    run.finished = EpochMs();
+    run.aborted = abort ? 1 : 0;
+    // Each profile gets its own run in the history, as if it had been run alone.
+    std::vector<runResult> results = several ? SplitFanOut(merged, profileFiles, result) : std::vector<runResult>{result};
+    try
     {
-        return abort; // If we aborted, don't download CHDs.
+        for (size_t k = 0; k < names.size(); k++)
+        {
+            run.profile = names[k];
+            RecordRun(profileDB, run, profileFiles[k], results[k]);
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::string m("Could not save the run history: ");
+        m.append(e.what());
+        DisplayMessage(m);
     }
-    return abort;
-}
-
-// Non-MyFrame helpers
-std::string ltrim(const std::string &s)
-{
-    size_t start = s.find_first_not_of(WHITESPACE);
-    return (start == std::string::npos) ? "" : s.substr(start);
-}
-std::string rtrim(const std::string &s)
-{
-    size_t end = s.find_last_not_of(WHITESPACE);
-    return (end == std::string::npos) ? "" : s.substr(0, end + 1);
-}
-
-std::string trim(const std::string &s)
-{
-    return rtrim(ltrim(s));
-}
-
-bool in_array(const std::string &needle, const std::vector<std::string> &haystack)
-{
-    int max = haystack.size();
-
-    if (max == 0)
-        return false;
-
-    for (int i = 0; i < max; i++)
-        if (haystack[i] == needle)
-            return true;
-    return false;
-}
-// https://en.cppreference.com/w/cpp/filesystem/exists
-bool dir_exists(std::string dir)
-{
-    std::filesystem::path filepath = dir;
-    return std::filesystem::is_directory(filepath.parent_path());
-}
 
-std::string GetExeDirectory()
-{
-#ifdef _WIN32
-    // Windows specific
-    wchar_t szPath[MAX_PATH];
-    GetModuleFileNameW(NULL, szPath, MAX_PATH);
-#else
-    // Linux specific
-    char szPath[PATH_MAX];
-    ssize_t count = readlink("/proc/self/exe", szPath, PATH_MAX);
-    if (count < 0 || count >= PATH_MAX)
-        return {}; // some error
-    szPath[count] = '\0';
-#endif
-    return std::filesystem::path{szPath}.parent_path().generic_string(); // to finish the folder path with (back)slash
+    if (abort)
+    {
+        DisplayMessage("Aborted");
+        return;
+    }
+    for (const std::vector<runFile> &absent : profileAbsent)
+    {
+        for (const runFile &file : absent)
+        {
+            result.errors.push_back("Not found in the last scan: " + file.source);
+        }
+    }
+    if (result.errors.empty())
+    {
+        std::string message = "Completed with no errors.";
+        if (result.cached > 0)
+        {
+            message += wxString::Format(" %d of %d files came from the download cache.", result.cached, (int)files.size()).ToStdString();
+        }
+        if (result.packed > 0)
+        {
+            message += wxString::Format(" %d sets were packed as 7z.", result.packed).ToStdString();
+        }
+        if (result.skipped > 0)
+        {
+            message += wxString::Format(" %d were already up to date.", result.skipped).ToStdString();
+        }
+        DisplayMessage(message);
+        return;
+    }
+    int dialog_return_value = wxNO;
+    wxMessageDialog *saveLog = new wxMessageDialog(this, "This finished with errors. Would you like to save the errors to a file?", "This finished with errors. Would you like to save the errors to a file?", wxYES_NO | wxNO_DEFAULT | wxICON_QUESTION);
+    dialog_return_value = saveLog->ShowModal();
+    if (dialog_return_value == wxYES)
+    {
+        wxDirDialog dd = wxDirDialog(panel, "Choose location to save log", "", wxDD_DEFAULT_STYLE | wxDD_DIR_MUST_EXIST);
+        dd.ShowModal();
+        wxTextFile file(dd.GetPath().Append("/romper_log.txt"));
+        file.Create();
+        file.Open();
+        for (const std::string &error : result.errors)
+        {
+            file.AddLine(error);
+        }
+        file.Write();
+        file.Close();
+    }
 }